@@ -5,8 +5,10 @@
 #include "platform/concurrency.h"
 #include "platform/uefi.h"
 #include "platform/file_io.h"
+#include "platform/file_compression.h"
 #include "platform/time_stamp_counter.h"
 #include "platform/memory_util.h"
+#include "platform/parallel_job.h"
 
 #include "network_messages/assets.h"
 
@@ -17,6 +19,7 @@
 #include "kangaroo_twelve.h"
 #include "four_q.h"
 #include "common_buffers.h"
+#include "sparse_state_file.h"
 
 
 // CAUTION: Currently, there is no locking of universeLock if contracts use the QPI asset iteration classes directly.
@@ -105,24 +108,30 @@ public: // TODO: make protected
             setMem(nextIdx, sizeof(nextIdx), 0xff);
         }
 
+        // Add record assets[index] to the list matching its type (does nothing for empty records)
+        void add(unsigned int index)
+        {
+            switch (assets[index].varStruct.issuance.type)
+            {
+            case ISSUANCE:
+                addIssuance(index);
+                break;
+            case OWNERSHIP:
+                addOwnership(assets[index].varStruct.ownership.issuanceIndex, index);
+                break;
+            case POSSESSION:
+                addPossession(assets[index].varStruct.possession.ownershipIndex, index);
+                break;
+            }
+        }
+
         // Rebuild lists from assets array (includes reset)
         void rebuild()
         {
             reset();
             for (int index = 0; index < ASSETS_CAPACITY; index++)
             {
-                switch (assets[index].varStruct.issuance.type)
-                {
-                case ISSUANCE:
-                    addIssuance(index);
-                    break;
-                case OWNERSHIP:
-                    addOwnership(assets[index].varStruct.ownership.issuanceIndex, index);
-                    break;
-                case POSSESSION:
-                    addPossession(assets[index].varStruct.possession.ownershipIndex, index);
-                    break;
-                }
+                add(index);
             }
         }
     };
@@ -667,6 +676,10 @@ static void getUniverseDigest(m256i& digest)
     digest = assetDigests[(ASSETS_CAPACITY * 2 - 1) - 1];
 }
 
+static void universeLeafDigest(const void* record, m256i& digest)
+{
+    KangarooTwelve(record, sizeof(AssetRecord), &digest, 32);
+}
 
 static bool saveUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, const CHAR16* directory = NULL)
 {
@@ -674,42 +687,108 @@ static bool saveUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, const CHAR
 
     const unsigned long long beginningTick = __rdtsc();
 
+    unsigned long long storedSize = 0;
     ACQUIRE(universeLock);
-    long long savedSize = save(fileName, ASSETS_CAPACITY * sizeof(AssetRecord), (unsigned char*)assets, directory);
+    long long savedSize = saveSparseStateFile(fileName, (unsigned char*)assets, sizeof(AssetRecord), ASSETS_CAPACITY, universeLeafDigest, directory, &storedSize);
     RELEASE(universeLock);
 
     if (savedSize == ASSETS_CAPACITY * sizeof(AssetRecord))
     {
         setNumber(message, savedSize, TRUE);
-        appendText(message, L" bytes of the universe data are saved (");
-        appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
-        appendText(message, L" microseconds).");
+        appendText(message, L" bytes of the universe data are saved");
+        appendCompressionStats(message, savedSize, storedSize, (__rdtsc() - beginningTick) * 1000000 / frequency);
+        appendText(message, L".");
         logToConsole(message);
         return true;
     }
     return false;
 }
 
+// Load universe and compute all assetDigests, so the next call of getUniverseDigest() does not need to rehash the
+// whole universe. Sparse files are checked against the stored digest.
 static bool loadUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, CHAR16* directory = NULL)
 {
-    long long loadedSize = load(fileName, ASSETS_CAPACITY * sizeof(AssetRecord), (unsigned char*)assets, directory);
+    const unsigned long long beginningTick = __rdtsc();
+    unsigned long long storedSize = 0;
+    long long loadedSize = loadSparseStateFile(fileName, (unsigned char*)assets, sizeof(AssetRecord), ASSETS_CAPACITY, universeLeafDigest, assetDigests, directory, &storedSize);
     if (loadedSize != ASSETS_CAPACITY * sizeof(AssetRecord))
     {
         logStatusToConsole(L"EFI_FILE_PROTOCOL.Read() reads invalid number of bytes", loadedSize, __LINE__);
 
         return false;
     }
+    setNumber(message, loadedSize, TRUE);
+    appendText(message, L" bytes of the universe data are loaded and hashed");
+    appendCompressionStats(message, loadedSize, storedSize, (__rdtsc() - beginningTick) * 1000000 / frequency);
+    appendText(message, L".");
+    logToConsole(message);
+    setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0);
     as.indexLists.rebuild();
     return true;
 }
 
+// Number of parts that the universe is split into for processing in parallel in assetsEndEpoch()
+static constexpr unsigned int assetsReorgParts = 256;
+static_assert((assetsReorgParts & (assetsReorgParts - 1)) == 0 && ASSETS_CAPACITY % (assetsReorgParts * 64) == 0);
+
+static void clearAssetsReorgBufferPart(void*, unsigned int partIndex)
+{
+    constexpr unsigned int partSize = ASSETS_CAPACITY / assetsReorgParts;
+    setMem((AssetRecord*)reorgBuffer + partIndex * partSize, partSize * sizeof(AssetRecord), 0);
+}
+
+// Copy part of the rebuilt hash map from reorgBuffer to assets, reset the index lists entries of the part, compute
+// the digests of the leaves and of the subtree of the part, and mark non-empty records in assetChangeFlags (which are
+// used for linking the index lists afterwards).
+static void finishAssetsReorgPart(void*, unsigned int partIndex)
+{
+    constexpr unsigned int partSize = ASSETS_CAPACITY / assetsReorgParts;
+    unsigned int first = partIndex * partSize;
+    copyMem(&assets[first], (AssetRecord*)reorgBuffer + first, partSize * sizeof(AssetRecord));
+    static_assert(NO_ASSET_INDEX == 0xffffffff, "Following setMem() expects NO_ASSET_INDEX == 0xffffffff");
+    setMem(&as.indexLists.ownershipsPossessionsFirstIdx[first], partSize * sizeof(unsigned int), 0xff);
+    setMem(&as.indexLists.nextIdx[first], partSize * sizeof(unsigned int), 0xff);
+
+    for (unsigned int i = first; i < first + partSize; i += 64)
+    {
+        unsigned long long nonEmptyFlags = 0;
+        for (unsigned int j = 0; j < 64; j++)
+        {
+            KangarooTwelve(&assets[i + j], sizeof(AssetRecord), &assetDigests[i + j], 32);
+            if (assets[i + j].varStruct.issuance.type != EMPTY)
+            {
+                nonEmptyFlags |= (1ULL << j);
+            }
+        }
+        assetChangeFlags[i >> 6] = nonEmptyFlags;
+    }
+
+    unsigned long long levelBeginning = 0;
+    unsigned int numberOfNodes = ASSETS_CAPACITY;
+    for (unsigned int count = partSize; count > 1; count >>= 1)
+    {
+        const unsigned long long nextLevelBeginning = levelBeginning + numberOfNodes;
+        for (unsigned int i = first; i < first + count; i += 2)
+        {
+            KangarooTwelve64To32(&assetDigests[levelBeginning + i], &assetDigests[nextLevelBeginning + (i >> 1)]);
+        }
+        levelBeginning = nextLevelBeginning;
+        numberOfNodes >>= 1;
+        first >>= 1;
+    }
+}
+
+// Rebuild asset hash map, getting rid of all elements with zero shares. Also rebuilds the index lists and all
+// assetDigests, so the next call of getUniverseDigest() does not need to rehash the whole universe.
+// Clearing the buffer, copying back, hashing, and resetting the index lists are done in parallel by all processors
+// that call tryHelpWithParallelJob(); only the reinsertion and the linking of the lists is sequential.
 static void assetsEndEpoch()
 {
     ACQUIRE(universeLock);
 
     // rebuild asset hash map, getting rid of all elements with zero shares
     AssetRecord* reorgAssets = (AssetRecord*)reorgBuffer;
-    setMem(reorgAssets, ASSETS_CAPACITY * sizeof(AssetRecord), 0);
+    runParallelJob(clearAssetsReorgBufferPart, nullptr, assetsReorgParts);
     for (unsigned int i = 0; i < ASSETS_CAPACITY; i++)
     {
         if (assets[i].varStruct.possession.type == POSSESSION
@@ -788,11 +867,42 @@ static void assetsEndEpoch()
             }
         }
     }
-    copyMem(assets, reorgAssets, ASSETS_CAPACITY * sizeof(AssetRecord));
 
-    setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
+    // Copy back, hash leaves and subtrees of parts, and reset index lists in parallel
+    runParallelJob(finishAssetsReorgPart, nullptr, assetsReorgParts);
 
-    as.indexLists.rebuild();
+    // Compute the top levels of the digest tree above the subtrees of the parts
+    unsigned long long levelBeginning = 0;
+    unsigned int numberOfNodes = ASSETS_CAPACITY;
+    while (numberOfNodes > assetsReorgParts)
+    {
+        levelBeginning += numberOfNodes;
+        numberOfNodes >>= 1;
+    }
+    while (numberOfNodes > 1)
+    {
+        const unsigned long long nextLevelBeginning = levelBeginning + numberOfNodes;
+        for (unsigned int i = 0; i < numberOfNodes; i += 2)
+        {
+            KangarooTwelve64To32(&assetDigests[levelBeginning + i], &assetDigests[nextLevelBeginning + (i >> 1)]);
+        }
+        levelBeginning = nextLevelBeginning;
+        numberOfNodes >>= 1;
+    }
+
+    // Link index lists in order of index (same result as rebuild()), only visiting non-empty records. All digests
+    // are up to date, so the change flags are cleared.
+    as.indexLists.issuancesFirstIdx = NO_ASSET_INDEX;
+    for (unsigned int flagsIndex = 0; flagsIndex < ASSETS_CAPACITY / 64; flagsIndex++)
+    {
+        unsigned long long nonEmptyFlags = assetChangeFlags[flagsIndex];
+        assetChangeFlags[flagsIndex] = 0;
+        while (nonEmptyFlags)
+        {
+            as.indexLists.add(flagsIndex * 64 + (unsigned int)_tzcnt_u64(nonEmptyFlags));
+            nonEmptyFlags &= nonEmptyFlags - 1;
+        }
+    }
 
     RELEASE(universeLock);
 }
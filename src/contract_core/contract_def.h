@@ -208,6 +208,7 @@ constexpr unsigned short TESTEXB_CONTRACT_INDEX = (CONTRACT_INDEX + 1);
 #endif
 
 #define MAX_CONTRACT_ITERATION_DURATION 0 // In milliseconds, must be above 0; for now set to 0 to disable timeout, because a rollback mechanism needs to be implemented to properly handle timeout
+#define CONTRACT_CALL_WARNING_DURATION 1000 // In milliseconds, contract processor calls running longer are reported by the watchdog in the main loop
 
 #undef INITIALIZE
 #undef BEGIN_EPOCH
@@ -318,6 +319,13 @@ enum OtherEntryPointIDs
 GLOBAL_VAR_DECL SYSTEM_PROCEDURE contractSystemProcedures[contractCount][contractSystemProcedureCount];
 GLOBAL_VAR_DECL unsigned short contractSystemProcedureLocalsSizes[contractCount][contractSystemProcedureCount];
 
+// Dense per-procedure lists of the contracts that implement the system procedure and are constructed and not yet
+// destructed in contractSystemProcedureListsEpoch, in ascending order of contract index. They let the contract
+// processor run BEGIN_EPOCH, END_EPOCH, BEGIN_TICK, and END_TICK without visiting the other contracts.
+GLOBAL_VAR_DECL unsigned int contractSystemProcedureLists[contractSystemProcedureCount][contractCount];
+GLOBAL_VAR_DECL unsigned int contractSystemProcedureListSizes[contractSystemProcedureCount];
+GLOBAL_VAR_DECL unsigned int contractSystemProcedureListsEpoch; // 0xffffffff if lists have to be built
+
 
 #define REGISTER_CONTRACT_FUNCTIONS_AND_PROCEDURES(contractName) { \
 constexpr unsigned int contractIndex = contractName##_CONTRACT_INDEX; \
@@ -367,3 +375,52 @@ static void initializeContracts()
     REGISTER_CONTRACT_FUNCTIONS_AND_PROCEDURES(TESTEXB);
 #endif
 }
+
+// Build contractSystemProcedureLists for epoch, after contracts have been registered
+static void buildContractSystemProcedureLists(unsigned int epoch)
+{
+    for (unsigned int systemProcId = 0; systemProcId < contractSystemProcedureCount; systemProcId++)
+    {
+        unsigned int listSize = 0;
+        for (unsigned int contractIndex = 1; contractIndex < contractCount; contractIndex++)
+        {
+            if (contractSystemProcedures[contractIndex][systemProcId]
+                && epoch >= contractDescriptions[contractIndex].constructionEpoch
+                && epoch < contractDescriptions[contractIndex].destructionEpoch)
+            {
+                contractSystemProcedureLists[systemProcId][listSize++] = contractIndex;
+            }
+        }
+        contractSystemProcedureListSizes[systemProcId] = listSize;
+    }
+    contractSystemProcedureListsEpoch = epoch;
+}
+
+// Version of the format of contract states, stored in the contract files (see saveCompressed()). Versions:
+// - 0: files saved before the version was stored, Collections with former element layout
+// - 1: Collections with separate arrays of BST nodes, element infos, and values
+constexpr unsigned int CONTRACT_STATE_FORMAT_VERSION = 1;
+
+// Convert state of contract that has been loaded from a file saved with format version formatVersion to the current
+// format. Currently, this converts the Collections of QX from the former element layout (version 0). The conversion
+// of version 0 isn't needed anymore as soon as all nodes run a version saving contract files with version 1.
+static bool migrateContractStateFormat(unsigned int contractIndex, void* state, unsigned int formatVersion)
+{
+    if (formatVersion >= CONTRACT_STATE_FORMAT_VERSION)
+    {
+        return true;
+    }
+    if (contractIndex == QX_CONTRACT_INDEX)
+    {
+        struct QxStateAccess : public QX
+        {
+            static bool migrateCollections(QX& qx)
+            {
+                return QPI::migrateCollectionFromElementArrayLayout(qx.*(&QxStateAccess::_assetOrders))
+                    && QPI::migrateCollectionFromElementArrayLayout(qx.*(&QxStateAccess::_entityOrders));
+            }
+        };
+        return QxStateAccess::migrateCollections(*(QX*)state);
+    }
+    return true;
+}
@@ -12,6 +12,10 @@
 #include "contract_core/contract_def.h"
 #include "contract_core/stack_buffer.h"
 #include "contract_core/contract_action_tracker.h"
+#include "contract_core/contract_locals_stack_pool.h"
+#include "contract_core/contract_exec_profiler.h"
+#include "contract_core/contract_state_snapshots.h"
+#include "contract_core/contract_function_cache.h"
 
 #include "logging/logging.h"
 #include "common_buffers.h"
@@ -35,9 +39,26 @@ enum ContractError
 // Used to store: locals and for first invocation level also input and output
 typedef StackBuffer<unsigned int, 32 * 1024 * 1024> ContractLocalsStack;
 GLOBAL_VAR_DECL ContractLocalsStack contractLocalsStack[NUMBER_OF_CONTRACT_EXECUTION_BUFFERS];
-GLOBAL_VAR_DECL volatile char contractLocalsStackLock[NUMBER_OF_CONTRACT_EXECUTION_BUFFERS];
-GLOBAL_VAR_DECL volatile long contractLocalsStackLockWaitingCount;
-GLOBAL_VAR_DECL long contractLocalsStackLockWaitingCountMax;
+
+// Manages which stacks are in use. Affinity slots are the processors and MAX_NUMBER_OF_PROCESSORS for calls without
+// processor number (procedures run by the contract processor, functions called internally).
+typedef ContractLocalsStackPool<NUMBER_OF_CONTRACT_EXECUTION_BUFFERS, MAX_NUMBER_OF_PROCESSORS + 1> ContractLocalsStackPoolType;
+GLOBAL_VAR_DECL ContractLocalsStackPoolType contractLocalsStackPool;
+constexpr unsigned int contractLocalsStackDefaultAffinitySlot = MAX_NUMBER_OF_PROCESSORS;
+constexpr unsigned int contractLocalsStacksInitiallyActive = (NUMBER_OF_CONTRACT_EXECUTION_BUFFERS >= 8) ? NUMBER_OF_CONTRACT_EXECUTION_BUFFERS / 2 : NUMBER_OF_CONTRACT_EXECUTION_BUFFERS;
+
+// Statistics about zeroing input, output, and locals of contracts. Allocations only zero the part of the stack that
+// may be non-zero (see StackBuffer::allocateZeroed()). The rest of the unused memory of free stacks is zeroed in the
+// background by idle request processors (see cleanUpContractLocalsStack()).
+struct ContractLocalsZeroingStats
+{
+    volatile long long allocatedBytes;
+    volatile long long zeroedBytes;     // zeroed on allocation
+    volatile long long cleanedBytes;    // zeroed in background
+    volatile long long cleanUpCycles;
+    CycleHistogram zeroingCycles;       // per allocation
+};
+GLOBAL_VAR_DECL ContractLocalsZeroingStats contractLocalsZeroingStats;
 
 
 GLOBAL_VAR_DECL ReadWriteLock contractStateLock[contractCount];
@@ -45,6 +66,12 @@ GLOBAL_VAR_DECL unsigned char* contractStates[contractCount];
 GLOBAL_VAR_DECL volatile long long contractTotalExecutionTicks[contractCount];
 GLOBAL_VAR_DECL unsigned int contractError[contractCount];
 
+// Snapshots of contract states read by user functions (only contracts registered with registerContract())
+GLOBAL_VAR_DECL ContractStateSnapshots<contractCount> contractStateSnapshots;
+
+// Cache of responses to contract function requests (only used if initialized with init())
+GLOBAL_VAR_DECL ContractFunctionCache<contractCount> contractFunctionCache;
+
 // TODO: If we ever have parallel procedure calls (of different contracts), we need to make
 // access to contractStateChangeFlags thread-safe
 GLOBAL_VAR_DECL unsigned long long* contractStateChangeFlags GLOBAL_VAR_INIT(nullptr);
@@ -74,11 +101,13 @@ struct ContractRollbackInfo
         ContractStateReuseLock = 0,
         ContractStateWriteLock = 1,
         ContractStateReadLock = 2,
+        ContractStateSnapshot = 3,
     };
     unsigned int type : 2;
-    unsigned int contractIndex : 30;
-    static constexpr int i = (1 << 30) - 1;
-    static_assert(contractCount < (1 << 30) - 1, "Implementation assumes fewer contracts and must be changed!");
+    unsigned int snapshotBuffer : 1;
+    unsigned int contractIndex : 29;
+    static constexpr int i = (1 << 29) - 1;
+    static_assert(contractCount < (1 << 29) - 1, "Implementation assumes fewer contracts and must be changed!");
 };
 
 static inline ContractRollbackInfo* contractStackUnwindRollbackInfo(int stackIndex)
@@ -99,8 +128,8 @@ static bool rollbackContractFunctionCall(int stackIndex)
 {
     ASSERT(stackIndex >= 0);
     ASSERT(stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
-    ASSERT(contractLocalsStackLock[stackIndex]);
-    if (stackIndex < 0 || stackIndex >= NUMBER_OF_CONTRACT_EXECUTION_BUFFERS || !contractLocalsStackLock[stackIndex])
+    ASSERT(contractLocalsStackPool.isAcquired(stackIndex));
+    if (stackIndex < 0 || stackIndex >= NUMBER_OF_CONTRACT_EXECUTION_BUFFERS || !contractLocalsStackPool.isAcquired(stackIndex))
         return false;
 
     char* ptr;
@@ -111,8 +140,14 @@ static bool rollbackContractFunctionCall(int stackIndex)
         if (specialBlock && size == sizeof(ContractRollbackInfo))
         {
             auto cri = reinterpret_cast<ContractRollbackInfo*>(ptr);
-            ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock);
+            ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock || cri->type == ContractRollbackInfo::ContractStateSnapshot);
             ASSERT(cri->contractIndex < contractCount);
+            if (cri->type == ContractRollbackInfo::ContractStateSnapshot
+                && cri->contractIndex < contractCount)
+            {
+                contractStateSnapshots.release(cri->contractIndex, cri->snapshotBuffer);
+                continue;
+            }
             ASSERT(contractStateLock[cri->contractIndex].getCurrentReaderLockCount() > 0);
             if (cri->type == ContractRollbackInfo::ContractStateReadLock
                 && cri->contractIndex < contractCount
@@ -134,6 +169,8 @@ static bool initContractExec()
     }
     setMem(contractSystemProcedures, sizeof(contractSystemProcedures), 0);
     setMem(contractSystemProcedureLocalsSizes, sizeof(contractSystemProcedureLocalsSizes), 0);
+    setMem(contractSystemProcedureListSizes, sizeof(contractSystemProcedureListSizes), 0);
+    contractSystemProcedureListsEpoch = 0xffffffff; // build lists before first use
     setMem(contractUserFunctions, sizeof(contractUserFunctions), 0);
     setMem(contractUserProcedures, sizeof(contractUserProcedures), 0);
     setMem(contractUserFunctionInputSizes, sizeof(contractUserFunctionInputSizes), 0);
@@ -145,12 +182,12 @@ static bool initContractExec()
 
     for (ContractLocalsStack::SizeType i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; ++i)
         contractLocalsStack[i].init();
-    setMem((void*)contractLocalsStackLock, sizeof(contractLocalsStackLock), 0);
-    contractLocalsStackLockWaitingCount = 0;
-    contractLocalsStackLockWaitingCountMax = 0;
+    contractLocalsStackPool.init(contractLocalsStacksInitiallyActive);
+    setMem((void*)&contractLocalsZeroingStats, sizeof(contractLocalsZeroingStats), 0);
 
     setMem((void*)contractTotalExecutionTicks, sizeof(contractTotalExecutionTicks), 0);
     setMem((void*)contractError, sizeof(contractError), 0);
+    contractStateSnapshots.reset();
     for (int i = 0; i < contractCount; ++i)
     {
         contractStateLock[i].reset();
@@ -167,6 +204,9 @@ static bool initContractExec()
     if (!contractActionTracker.allocBuffer())
         return false;
 
+    if (!contractExecProfiler.init())
+        return false;
+
     return true;
 }
 
@@ -178,32 +218,20 @@ static void deinitContractExec()
     }
 
     contractActionTracker.freeBuffer();
+    contractExecProfiler.deinit();
+    contractStateSnapshots.deinit();
+    contractFunctionCache.deinit();
 }
 
-// Acquire lock of an currently unused stack (may block if all in use)
+// Acquire a currently unused stack (may block if all in use), preferring the stack used last by the affinity slot
 // stacksToIgnore > 0 can be passed by low priority tasks to keep some stacks reserved for high prio purposes.
-static void acquireContractLocalsStack(int& stackIdx, unsigned int stacksToIgnore = 0)
+static void acquireContractLocalsStack(int& stackIdx, unsigned int stacksToIgnore = 0, unsigned int affinitySlot = contractLocalsStackDefaultAffinitySlot)
 {
     static_assert(NUMBER_OF_CONTRACT_EXECUTION_BUFFERS >= 2, "NUMBER_OF_CONTRACT_EXECUTION_BUFFERS should be at least 2.");
     ASSERT(stackIdx < 0);
     ASSERT(stacksToIgnore < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
 
-    long waitingCount = _InterlockedIncrement(&contractLocalsStackLockWaitingCount);
-    if (contractLocalsStackLockWaitingCountMax < waitingCount)
-        contractLocalsStackLockWaitingCountMax = waitingCount;
-
-    int i = stacksToIgnore;
-    while (TRY_ACQUIRE(contractLocalsStackLock[i]) == false)
-    {
-        _mm_pause();
-        ++i;
-        if (i == NUMBER_OF_CONTRACT_EXECUTION_BUFFERS)
-            i = stacksToIgnore;
-    }
-
-    _InterlockedDecrement(&contractLocalsStackLockWaitingCount);
-
-    stackIdx = i;
+    stackIdx = contractLocalsStackPool.acquire(stacksToIgnore, affinitySlot);
     ASSERT(stackIdx >= 0);
 
     ASSERT(contractLocalsStack[stackIdx].size() == 0);
@@ -216,11 +244,47 @@ static void releaseContractLocalsStack(int& stackIdx)
 {
     ASSERT(stackIdx >= 0);
     ASSERT(stackIdx < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
-    ASSERT(contractLocalsStackLock[stackIdx]);
-    RELEASE(contractLocalsStackLock[stackIdx]);
+    contractLocalsStackPool.release(stackIdx);
     stackIdx = -1;
 }
 
+// Allocate zeroed storage on locals stack and record zeroing cost
+static char* allocateZeroedContractLocals(int stackIdx, unsigned int size)
+{
+    ASSERT(contractLocalsStackPool.isAcquired(stackIdx));
+    const unsigned long long startTick = __rdtsc();
+    unsigned int zeroedSize;
+    char* buffer = contractLocalsStack[stackIdx].allocateZeroed(size, zeroedSize);
+    if (buffer)
+    {
+        contractLocalsZeroingStats.zeroingCycles.recordConcurrent(__rdtsc() - startTick);
+        _interlockedadd64(&contractLocalsZeroingStats.allocatedBytes, size);
+        _interlockedadd64(&contractLocalsZeroingStats.zeroedBytes, zeroedSize);
+    }
+    return buffer;
+}
+
+// Zero part of the unused memory of a free locals stack, so later allocations need less zeroing. Called by idle
+// request processors. Keeps one stack free for procedures. Returns false if there was nothing to do.
+static bool cleanUpContractLocalsStack()
+{
+    constexpr unsigned int maxCleanUpSize = 1024 * 1024;
+    for (int i = 0; i < contractLocalsStackPool.activeStacks; ++i)
+    {
+        if (contractLocalsStack[i].dirtySize() && contractLocalsStackPool.tryAcquireIndex(i, 1))
+        {
+            const unsigned long long startTick = __rdtsc();
+            const unsigned int cleanedSize = contractLocalsStack[i].cleanUp(maxCleanUpSize);
+            _interlockedadd64(&contractLocalsZeroingStats.cleanUpCycles, __rdtsc() - startTick);
+            _interlockedadd64(&contractLocalsZeroingStats.cleanedBytes, cleanedSize);
+            contractLocalsStackPool.release(i);
+            if (cleanedSize)
+                return true;
+        }
+    }
+    return false;
+}
+
 // Allocate storage on ContractLocalsStack of QPI execution context
 void* QPI::QpiContextFunctionCall::__qpiAllocLocals(unsigned int sizeOfLocals) const
 {
@@ -238,7 +302,7 @@ void* QPI::QpiContextFunctionCall::__qpiAllocLocals(unsigned int sizeOfLocals) c
         // abort execution of contract here
         __qpiAbort(ContractErrorAllocLocalsFailed);
     }
-    void* p = contractLocalsStack[_stackIndex].allocate(sizeOfLocals);
+    void* p = allocateZeroedContractLocals(_stackIndex, sizeOfLocals);
     if (!p)
     {
 #ifndef NDEBUG
@@ -257,7 +321,8 @@ void* QPI::QpiContextFunctionCall::__qpiAllocLocals(unsigned int sizeOfLocals) c
         // abort execution of contract here
         __qpiAbort(ContractErrorAllocLocalsFailed);
     }
-    setMem(p, sizeOfLocals, 0);
+    if (_entryPoint != USER_FUNCTION_CALL)
+        trackContractExecLocalsStackBytes(contractLocalsStack[_stackIndex].size());
     return p;
 }
 
@@ -348,6 +413,22 @@ void* QPI::QpiContextFunctionCall::__qpiAcquireStateForReading(unsigned int cont
     // Add rollback info for this lock to the stack
     auto rollbackInfo = reinterpret_cast<ContractRollbackInfo*>(contractLocalsStack[_stackIndex].allocateSpecial(sizeof(ContractRollbackInfo)));
     rollbackInfo->contractIndex = contractIndex;
+    rollbackInfo->snapshotBuffer = 0;
+
+    if (_entryPoint == USER_FUNCTION_CALL)
+    {
+        // Entry point is user function (running in request processor)
+        // -> Read snapshot of state if available, which neither waits for nor delays the contract processor
+        //    (and thus cannot cause a deadlock with a callback)
+        int snapshotBuffer;
+        const unsigned char* snapshot = contractStateSnapshots.acquire(contractIndex, snapshotBuffer);
+        if (snapshot)
+        {
+            rollbackInfo->type = ContractRollbackInfo::ContractStateSnapshot;
+            rollbackInfo->snapshotBuffer = snapshotBuffer;
+            return (void*)snapshot;
+        }
+    }
 
     if (contractCallbacksRunning == NoContractCallback)
     {
@@ -415,9 +496,9 @@ void QPI::QpiContextFunctionCall::__qpiReleaseStateForReading(unsigned int contr
     ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
     ASSERT(contractIndex < contractCount);
     ASSERT(contractIndex < _currentContractIndex);
-    if (contractCallbacksRunning == NoContractCallback)
+    if (contractCallbacksRunning == NoContractCallback && _entryPoint != USER_FUNCTION_CALL)
     {
-        // Default case: no callback is running
+        // Default case: no callback is running and entry point is procedure (no snapshots)
         // - release read lock
         contractStateLock[contractIndex].releaseRead();
 #if !defined(NO_UEFI) && defined(NDEBUG)
@@ -432,14 +513,19 @@ void QPI::QpiContextFunctionCall::__qpiReleaseStateForReading(unsigned int contr
     }
     else
     {
-        // Special case: callback is running (locks may be reused)
+        // Special case: callback is running (locks may be reused) or user function may have read snapshot
         ContractRollbackInfo* cri = contractStackUnwindRollbackInfo(_stackIndex);
-        ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock || cri->type == ContractRollbackInfo::ContractStateReuseLock);
+        ASSERT(cri->type == ContractRollbackInfo::ContractStateReadLock || cri->type == ContractRollbackInfo::ContractStateReuseLock
+            || cri->type == ContractRollbackInfo::ContractStateSnapshot);
         ASSERT(cri->contractIndex == contractIndex);
         if (cri->type == ContractRollbackInfo::ContractStateReadLock)
         {
             contractStateLock[contractIndex].releaseRead();
         }
+        else if (cri->type == ContractRollbackInfo::ContractStateSnapshot)
+        {
+            contractStateSnapshots.release(contractIndex, cri->snapshotBuffer);
+        }
     }
 }
 
@@ -576,10 +662,10 @@ void QPI::QpiContextProcedureCall::__qpiCallSystemProcOfOtherContract(unsigned i
 
     // Alloc locals
     unsigned short localsSize = contractSystemProcedureLocalsSizes[otherContractIndex][sysProcId];
-    char* localsBuffer = contractLocalsStack[_stackIndex].allocate(localsSize);
+    char* localsBuffer = allocateZeroedContractLocals(_stackIndex, localsSize);
     if (!localsBuffer)
         __qpiAbort(ContractErrorAllocLocalsFailed);
-    setMem(localsBuffer, localsSize, 0);
+    trackContractExecLocalsStackBytes(contractLocalsStack[_stackIndex].size());
 
     // Run procedure
     contractSystemProcedures[otherContractIndex][sysProcId](otherContractContext, otherContractState, &input, &output, localsBuffer);
@@ -629,13 +715,15 @@ void QPI::QpiContextFunctionCall::__qpiAbort(unsigned int errorCode) const
 // Prologue of contract functions / procedures
 static void __beginFunctionOrProcedure(const unsigned int functionOrProcedureId)
 {
-    // TODO
     // called by all non-empty system procedures, user procedures, and user functions
     // purpose:
+    // - count nested calls of procedures for the contract execution profiler (execution time is measured by
+    //   the caller of the entry point, which knows the inputType)
+    // TODO:
     // - make sure the limit of nested calls is not violated
-    // - measure execution time
     // - construction of execution graph
     // - debugging
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_NESTED_CALLS);
 }
 
 // Epilogue of contract functions / procedures
@@ -700,6 +788,8 @@ struct QpiContextSystemProcedureCall : public QPI::QpiContextProcedureCall
         // reserve resources for this processor (may block)
         contractStateLock[_currentContractIndex].acquireWrite();
 
+        contractExecProfiler.beginProcedure();
+        unsigned int localsStackBytes = 0;
         const unsigned long long startTick = __rdtsc();
         unsigned short localsSize = contractSystemProcedureLocalsSizes[_currentContractIndex][systemProcId];
         if (localsSize == sizeof(QPI::NoData))
@@ -711,10 +801,10 @@ struct QpiContextSystemProcedureCall : public QPI::QpiContextProcedureCall
         {
             // locals required: reserve stack and use stack (should not block because stack 0 is reserved for procedures)
             acquireContractLocalsStack(_stackIndex);
-            char* localsBuffer = contractLocalsStack[_stackIndex].allocate(localsSize);
+            char* localsBuffer = allocateZeroedContractLocals(_stackIndex, localsSize);
             if (!localsBuffer)
                 __qpiAbort(ContractErrorAllocLocalsFailed);
-            setMem(localsBuffer, localsSize, 0);
+            localsStackBytes = contractLocalsStack[_stackIndex].size();
 
             // call system proc
             contractSystemProcedures[_currentContractIndex][systemProcId](*this, contractStates[_currentContractIndex], &noInOutData, &noInOutData, localsBuffer);
@@ -724,7 +814,9 @@ struct QpiContextSystemProcedureCall : public QPI::QpiContextProcedureCall
             ASSERT(contractLocalsStack[_stackIndex].size() == 0);
             releaseContractLocalsStack(_stackIndex);
         }
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        contractExecProfiler.endProcedure(system.epoch, _currentContractIndex, CONTRACT_EXEC_PROFILE_KIND_SYSTEM_PROCEDURE, systemProcId, executionTicks, localsStackBytes);
 
         // release lock of contract state and set state to changed
         contractStateLock[_currentContractIndex].releaseWrite();
@@ -776,7 +868,7 @@ struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
         unsigned short fullInputSize = contractUserProcedureInputSizes[_currentContractIndex][inputType];
         outputSize = contractUserProcedureOutputSizes[_currentContractIndex][inputType];
         unsigned int localsSize = contractUserProcedureLocalsSizes[_currentContractIndex][inputType];
-        char* inputBuffer = contractLocalsStack[_stackIndex].allocate(fullInputSize + outputSize + localsSize);
+        char* inputBuffer = allocateZeroedContractLocals(_stackIndex, fullInputSize + outputSize + localsSize);
         if (!inputBuffer)
         {
 #ifndef NDEBUG
@@ -804,26 +896,25 @@ struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
 
         outputBuffer = inputBuffer + fullInputSize;
         char* localsBuffer = outputBuffer + outputSize;
-        if (inputSize < fullInputSize)
-        {
-            // less input data than expected by contract -> fill with 0
-            setMem(inputBuffer + inputSize, fullInputSize - inputSize, 0);
-        }
-        else if (inputSize > fullInputSize)
+        if (inputSize > fullInputSize)
         {
             // more input data than expected by contract -> discard additional bytes
             inputSize = fullInputSize;
         }
+        // if there is less input data than expected by contract, the rest is 0 (buffers are zeroed on allocation)
         copyMem(inputBuffer, inputPtr, inputSize);
-        setMem(outputBuffer, outputSize + localsSize, 0);
 
         // acquire lock of contract state for writing (shouldn't block because 1 stack is not used by functions and thus kept free for procedures)
         contractStateLock[_currentContractIndex].acquireWrite();
 
         // run procedure
+        const unsigned int localsStackBytes = contractLocalsStack[_stackIndex].size();
+        contractExecProfiler.beginProcedure();
         const unsigned long long startTick = __rdtsc();
         contractUserProcedures[_currentContractIndex][inputType](*this, contractStates[_currentContractIndex], inputBuffer, outputBuffer, localsBuffer);
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        contractExecProfiler.endProcedure(system.epoch, _currentContractIndex, CONTRACT_EXEC_PROFILE_KIND_USER_PROCEDURE, inputType, executionTicks, localsStackBytes);
 
         // release lock of contract state and set state to changed
         contractStateLock[_currentContractIndex].releaseWrite();
@@ -850,11 +941,14 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
 {
     char* outputBuffer;
     unsigned short outputSize;
+    unsigned int affinitySlot;
 
-    QpiContextUserFunctionCall(unsigned int contractIndex) : QPI::QpiContextFunctionCall(contractIndex, NULL_ID, 0, USER_FUNCTION_CALL)
+    // Pass processor number as affinitySlot if known, so the processor reuses its last contract locals stack
+    QpiContextUserFunctionCall(unsigned int contractIndex, unsigned int affinitySlot = contractLocalsStackDefaultAffinitySlot) : QPI::QpiContextFunctionCall(contractIndex, NULL_ID, 0, USER_FUNCTION_CALL)
     {
         outputBuffer = nullptr;
         outputSize = 0;
+        this->affinitySlot = affinitySlot;
     }
 
     ~QpiContextUserFunctionCall()
@@ -883,13 +977,13 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
 
         // reserve stack for this processor (may block)
         constexpr unsigned int stacksNotUsedToReserveThemForStateWriter = 1;
-        acquireContractLocalsStack(_stackIndex, stacksNotUsedToReserveThemForStateWriter);
+        acquireContractLocalsStack(_stackIndex, stacksNotUsedToReserveThemForStateWriter, affinitySlot);
 
         // allocate input, output, and locals buffer from stack and init them
         unsigned short fullInputSize = contractUserFunctionInputSizes[_currentContractIndex][inputType];
         outputSize = contractUserFunctionOutputSizes[_currentContractIndex][inputType];
         unsigned int localsSize = contractUserFunctionLocalsSizes[_currentContractIndex][inputType];
-        char* inputBuffer = contractLocalsStack[_stackIndex].allocate(fullInputSize + outputSize + localsSize);
+        char* inputBuffer = allocateZeroedContractLocals(_stackIndex, fullInputSize + outputSize + localsSize);
         if (!inputBuffer)
         {
 #ifndef NDEBUG
@@ -916,29 +1010,36 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
         }
         outputBuffer = inputBuffer + fullInputSize;
         char* localsBuffer = outputBuffer + outputSize;
-        if (inputSize < fullInputSize)
-        {
-            // less input data than expected by contract -> fill with 0
-            setMem(inputBuffer + inputSize, fullInputSize - inputSize, 0);
-        }
-        else if (inputSize > fullInputSize)
+        if (inputSize > fullInputSize)
         {
             // more input data than expected by contract -> discard additional bytes
             inputSize = fullInputSize;
         }
+        // if there is less input data than expected by contract, the rest is 0 (buffers are zeroed on allocation)
         copyMem(inputBuffer, inputPtr, inputSize);
-        setMem(outputBuffer, outputSize + localsSize, 0);
 
-        // acquire lock of contract state for reading (may block)
-        contractStateLock[_currentContractIndex].acquireRead();
+        // read snapshot of contract state if available (never blocks), otherwise acquire lock of contract state for
+        // reading (may block)
+        int snapshotBuffer;
+        void* state = (void*)contractStateSnapshots.acquire(_currentContractIndex, snapshotBuffer);
+        if (!state)
+        {
+            contractStateLock[_currentContractIndex].acquireRead();
+            state = contractStates[_currentContractIndex];
+        }
 
         // run function
         const unsigned long long startTick = __rdtsc();
-        contractUserFunctions[_currentContractIndex][inputType](*this, contractStates[_currentContractIndex], inputBuffer, outputBuffer, localsBuffer);
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
-
-        // release lock of contract state
-        contractStateLock[_currentContractIndex].releaseRead();
+        contractUserFunctions[_currentContractIndex][inputType](*this, state, inputBuffer, outputBuffer, localsBuffer);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        contractExecProfiler.recordFunction(system.epoch, _currentContractIndex, inputType, executionTicks, contractLocalsStack[_stackIndex].size());
+
+        // release snapshot or lock of contract state
+        if (state == contractStates[_currentContractIndex])
+            contractStateLock[_currentContractIndex].releaseRead();
+        else
+            contractStateSnapshots.release(_currentContractIndex, snapshotBuffer);
     }
 
     // free buffer after output has been copied
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/global_var.h"
+#include "platform/memory_util.h"
+
+#include "network_messages/special_command.h"
+#include "ticking/tick_profiler.h"
+
+
+// Profile of contract execution per entry point (contract, kind of entry point, inputType), collected for the current
+// and the previous epoch. Cycles and locals stack usage are recorded for all calls. Operation counts (nested calls,
+// Collection/HashMap modifications, spectrum/universe access) are only collected for procedures, which are run by
+// the single contract processor. Operations are only counted on the contract processor, which is identified by its
+// function call stack, so user functions running concurrently on request processors don't affect the counts. The
+// counters are shared by nested calls, so a procedure's counts include the operations of the contracts it calls.
+// Functions are run by several request processors concurrently, so entries are updated with atomic operations.
+struct ContractExecProfiler
+{
+    static constexpr unsigned int capacity = 512; // must be power of 2
+
+    struct OpCounters
+    {
+        unsigned long long ops[CONTRACT_EXEC_PROFILE_OP_COUNT];
+        unsigned int maxLocalsStackBytes;
+    };
+
+    struct Entry
+    {
+        volatile long key; // 0 if unused, see makeKey()
+        volatile long maxLocalsStackBytes;
+        volatile long long totalCycles;
+        volatile long long ops[CONTRACT_EXEC_PROFILE_OP_COUNT];
+        CycleHistogram cycles;
+    };
+
+    struct EpochProfile
+    {
+        unsigned short epoch;
+        volatile long droppedCalls; // calls not recorded because table was full
+        Entry* entries;
+    };
+
+    EpochProfile epochs[2];
+
+    // Counters of the procedure that is currently run by the contract processor (nullptr if none is running)
+    OpCounters* volatile activeOps;
+    OpCounters procedureOps;
+
+    // Memory range of function call stack of contract processor (nullptr if not set, which disables the check)
+    const char* contractProcessorStackBottom;
+    const char* contractProcessorStackTop;
+
+    bool init()
+    {
+        setMem(this, sizeof(*this), 0);
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            if (!allocPoolWithErrorLog(L"contractExecProfiler", capacity * sizeof(Entry), (void**)&epochs[i].entries, __LINE__))
+            {
+                return false;
+            }
+            setMem(epochs[i].entries, capacity * sizeof(Entry), 0);
+        }
+        return true;
+    }
+
+    void deinit()
+    {
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            if (epochs[i].entries)
+            {
+                freePool(epochs[i].entries);
+                epochs[i].entries = nullptr;
+            }
+        }
+    }
+
+    static long makeKey(unsigned int contractIndex, unsigned int kind, unsigned short inputType)
+    {
+        return (long)(((contractIndex + 1) << 18) | (kind << 16) | inputType);
+    }
+
+    // Prepare profile of epoch (called by tick processor, resets data of epoch before previous one)
+    void beginEpoch(unsigned short epoch)
+    {
+        EpochProfile& profile = epochs[epoch & 1];
+        if (profile.epoch != epoch && profile.entries)
+        {
+            setMem(profile.entries, capacity * sizeof(Entry), 0);
+            profile.droppedCalls = 0;
+            profile.epoch = epoch;
+        }
+    }
+
+    // Find or insert entry, returns nullptr if epoch isn't prepared or table is full
+    Entry* getEntry(unsigned short epoch, long key)
+    {
+        EpochProfile& profile = epochs[epoch & 1];
+        if (profile.epoch != epoch || !profile.entries)
+        {
+            return nullptr;
+        }
+        unsigned int index = (unsigned int)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+        for (unsigned int i = 0; i < capacity; i++)
+        {
+            Entry& entry = profile.entries[index];
+            const long entryKey = entry.key;
+            if (entryKey == key)
+            {
+                return &entry;
+            }
+            if (!entryKey)
+            {
+                const long previousKey = _InterlockedCompareExchange(&entry.key, key, 0);
+                if (previousKey == 0 || previousKey == key)
+                {
+                    return &entry;
+                }
+            }
+            index = (index + 1) & (capacity - 1);
+        }
+        _InterlockedIncrement(&profile.droppedCalls);
+        return nullptr;
+    }
+
+    static void updateMaxLocalsStackBytes(Entry& entry, unsigned int localsStackBytes)
+    {
+        long currentMax = entry.maxLocalsStackBytes;
+        while ((unsigned long)currentMax < localsStackBytes)
+        {
+            const long previousMax = _InterlockedCompareExchange(&entry.maxLocalsStackBytes, (long)localsStackBytes, currentMax);
+            if (previousMax == currentMax)
+                break;
+            currentMax = previousMax;
+        }
+    }
+
+    // Set function call stack of contract processor (call after init())
+    void setContractProcessorStack(const char* stackBottom, const char* stackTop)
+    {
+        contractProcessorStackBottom = stackBottom;
+        contractProcessorStackTop = stackTop;
+    }
+
+    // Return if caller runs on the contract processor (always true if stack of contract processor isn't set)
+    bool isContractProcessor() const
+    {
+        const char* stackPointer = (const char*)&stackPointer;
+        return !contractProcessorStackTop || (stackPointer >= contractProcessorStackBottom && stackPointer < contractProcessorStackTop);
+    }
+
+    // Start counting operations of procedure (called by contract processor before running a procedure from the core)
+    void beginProcedure()
+    {
+        setMem(&procedureOps, sizeof(procedureOps), 0);
+        activeOps = &procedureOps;
+    }
+
+    // Stop counting operations and record procedure call
+    void endProcedure(unsigned short epoch, unsigned int contractIndex, unsigned int kind, unsigned short inputType, unsigned long long cycles, unsigned int localsStackBytes)
+    {
+        activeOps = nullptr;
+        Entry* entry = getEntry(epoch, makeKey(contractIndex, kind, inputType));
+        if (!entry)
+        {
+            return;
+        }
+        entry->cycles.recordConcurrent(cycles);
+        _interlockedadd64(&entry->totalCycles, cycles);
+        for (unsigned int i = 0; i < CONTRACT_EXEC_PROFILE_OP_COUNT; i++)
+        {
+            _interlockedadd64(&entry->ops[i], procedureOps.ops[i]);
+        }
+        updateMaxLocalsStackBytes(*entry, (localsStackBytes > procedureOps.maxLocalsStackBytes) ? localsStackBytes : procedureOps.maxLocalsStackBytes);
+    }
+
+    // Record user function call (may be called by several processors concurrently)
+    void recordFunction(unsigned short epoch, unsigned int contractIndex, unsigned short inputType, unsigned long long cycles, unsigned int localsStackBytes)
+    {
+        Entry* entry = getEntry(epoch, makeKey(contractIndex, CONTRACT_EXEC_PROFILE_KIND_USER_FUNCTION, inputType));
+        if (!entry)
+        {
+            return;
+        }
+        entry->cycles.recordConcurrent(cycles);
+        _interlockedadd64(&entry->totalCycles, cycles);
+        updateMaxLocalsStackBytes(*entry, localsStackBytes);
+    }
+
+    // Fill response entries for requested epoch in the order of the hash table. Sets response.epoch = 0 if epoch is
+    // not available. Returns number of entries.
+    template <unsigned int maxNumberOfEntries>
+    unsigned int getStats(unsigned short epoch, SpecialCommandGetContractExecProfileResponse<maxNumberOfEntries>& response) const
+    {
+        const EpochProfile& profile = epochs[epoch & 1];
+        response.epoch = (epoch && profile.epoch == epoch && profile.entries) ? epoch : 0;
+        response.numberOfEntries = 0;
+        if (!response.epoch)
+        {
+            return 0;
+        }
+        for (unsigned int i = 0; i < capacity && response.numberOfEntries < maxNumberOfEntries; i++)
+        {
+            const Entry& entry = profile.entries[i];
+            const unsigned long key = entry.key;
+            if (!key || !entry.cycles.count)
+            {
+                continue;
+            }
+            ContractExecProfileEntry& out = response.entries[response.numberOfEntries++];
+            setMem(&out, sizeof(out), 0);
+            out.contractIndex = (unsigned short)((key >> 18) - 1);
+            out.kind = (unsigned char)((key >> 16) & 3);
+            out.inputType = (unsigned short)key;
+            out.maxLocalsStackBytes = entry.maxLocalsStackBytes;
+            out.count = entry.cycles.count;
+            out.totalCycles = entry.totalCycles;
+            out.p50 = entry.cycles.percentile(500);
+            out.p99 = entry.cycles.percentile(990);
+            out.max = entry.cycles.max;
+            for (unsigned int j = 0; j < CONTRACT_EXEC_PROFILE_OP_COUNT; j++)
+            {
+                out.ops[j] = entry.ops[j];
+            }
+        }
+        return response.numberOfEntries;
+    }
+};
+
+GLOBAL_VAR_DECL ContractExecProfiler contractExecProfiler;
+
+// Count operation of the procedure currently run by the contract processor (no-op if no procedure is running or
+// if called by another processor, for example by a user function running on a request processor)
+static inline void countContractExecOp(unsigned int op)
+{
+    ContractExecProfiler::OpCounters* ops = contractExecProfiler.activeOps;
+    if (ops && contractExecProfiler.isContractProcessor())
+    {
+        ops->ops[op]++;
+    }
+}
+
+// Track size of locals stack used by procedure currently run by the contract processor (no-op if none is running or
+// if called by another processor)
+static inline void trackContractExecLocalsStackBytes(unsigned int localsStackBytes)
+{
+    ContractExecProfiler::OpCounters* ops = contractExecProfiler.activeOps;
+    if (ops && ops->maxLocalsStackBytes < localsStackBytes && contractExecProfiler.isContractProcessor())
+    {
+        ops->maxLocalsStackBytes = localsStackBytes;
+    }
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/concurrency.h"
+#include "platform/memory_util.h"
+#include "platform/debugging.h"
+
+#include "kangaroo_twelve.h"
+
+
+// Cache of responses to contract function requests (RequestContractFunction), keyed by contract index, inputType, and
+// input data. User functions may read the spectrum, the universe, tick data, and the states of other contracts, so the
+// version of the state used for validating entries is a global generation counter. The tick processor increments it
+// before and after each phase that changes the state (processing a tick, switching to the next tick / epoch), so the
+// generation is odd while the state is changing. Nothing is looked up or added during these phases. Data that functions
+// may read and that is changed outside of the tick processor (such as the computor list broadcasted at the beginning of
+// the epoch) is followed by invalidate(), which skips a generation. Entries of older generations are treated as empty.
+// Thus, identical requests between two ticks only run the function once.
+// Each set has its own lock and several ways, which are replaced round-robin. Inputs and outputs larger than the
+// limits below bypass the cache.
+template <unsigned int numberOfContracts>
+struct ContractFunctionCache
+{
+    static constexpr unsigned int numberOfSets = 1024; // must be power of 2
+    static constexpr unsigned int numberOfWays = 4;
+    static constexpr unsigned int maxInputSize = 256;
+    static constexpr unsigned int maxOutputSize = 2048;
+
+    struct Entry
+    {
+        unsigned long long generation; // 0 if unused
+        unsigned long long hash;
+        unsigned int contractIndex;
+        unsigned short inputType;
+        unsigned short inputSize;
+        unsigned short outputSize;
+        unsigned char input[maxInputSize];
+        unsigned char output[maxOutputSize];
+    };
+
+    struct Set
+    {
+        volatile char lock;
+        unsigned char nextWayToReplace;
+        Entry entries[numberOfWays];
+    };
+
+    struct Stats
+    {
+        volatile long long lookups;
+        volatile long long hits;
+    };
+
+    Set* sets;
+    volatile long long generation; // odd while state is changed by the tick processor
+    Stats stats[numberOfContracts];
+
+    bool init()
+    {
+        if (!allocPoolWithErrorLog(L"contractFunctionCache", sizeof(Set) * numberOfSets, (void**)&sets, __LINE__))
+        {
+            return false;
+        }
+        setMem(sets, sizeof(Set) * numberOfSets, 0);
+        setMem(stats, sizeof(stats), 0);
+        generation = 2;
+        return true;
+    }
+
+    void deinit()
+    {
+        if (sets)
+        {
+            freePool(sets);
+            sets = nullptr;
+        }
+    }
+
+    // Called by tick processor before changing the state. Invalidates all entries and disables the cache.
+    void beginStateChange()
+    {
+        ASSERT((generation & 1) == 0);
+        _InterlockedIncrement64(&generation);
+    }
+
+    // Called by tick processor after changing the state. Enables the cache again.
+    void endStateChange()
+    {
+        ASSERT((generation & 1) == 1);
+        _InterlockedIncrement64(&generation);
+    }
+
+    // Invalidate all entries after changing data read by functions outside of beginStateChange() / endStateChange().
+    // May be called by any processor at any time, because it keeps the parity of the generation.
+    void invalidate()
+    {
+        _InterlockedExchangeAdd64(&generation, 2);
+    }
+
+    static unsigned long long getHash(unsigned int contractIndex, unsigned short inputType, const void* input, unsigned short inputSize)
+    {
+        unsigned long long hash;
+        KangarooTwelve(input, inputSize, &hash, sizeof(hash));
+        return hash ^ ((unsigned long long)contractIndex << 16) ^ inputType;
+    }
+
+    // Try to get output of function from cache. Returns true on hit, after copying the output to the buffer of size
+    // maxOutputSize. On miss, callGeneration is set to the generation to pass to add() after running the function.
+    // It is 0 if the result must not be added to the cache.
+    bool tryFetching(unsigned int contractIndex, unsigned short inputType, const void* input, unsigned short inputSize,
+        void* output, unsigned short& outputSize, unsigned long long& callGeneration)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        callGeneration = 0;
+        const unsigned long long currentGeneration = generation;
+        if (!sets || (currentGeneration & 1) || inputSize > maxInputSize)
+        {
+            return false;
+        }
+
+        _InterlockedIncrement64(&stats[contractIndex].lookups);
+        const unsigned long long hash = getHash(contractIndex, inputType, input, inputSize);
+        Set& set = sets[hash & (numberOfSets - 1)];
+        bool hit = false;
+        ACQUIRE(set.lock);
+        for (unsigned int i = 0; i < numberOfWays; ++i)
+        {
+            const Entry& entry = set.entries[i];
+            if (entry.generation == currentGeneration && entry.hash == hash && entry.contractIndex == contractIndex
+                && entry.inputType == inputType && entry.inputSize == inputSize && isEqual(entry.input, input, inputSize))
+            {
+                copyMem(output, entry.output, entry.outputSize);
+                outputSize = entry.outputSize;
+                hit = true;
+                break;
+            }
+        }
+        RELEASE(set.lock);
+
+        if (hit)
+        {
+            _InterlockedIncrement64(&stats[contractIndex].hits);
+        }
+        else
+        {
+            callGeneration = currentGeneration;
+        }
+        return hit;
+    }
+
+    // Add output of function to cache, unless the state may have changed since tryFetching() returned callGeneration
+    void add(unsigned long long callGeneration, unsigned int contractIndex, unsigned short inputType, const void* input, unsigned short inputSize,
+        const void* output, unsigned short outputSize)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        if (!callGeneration || callGeneration != generation || inputSize > maxInputSize || outputSize > maxOutputSize)
+        {
+            return;
+        }
+
+        const unsigned long long hash = getHash(contractIndex, inputType, input, inputSize);
+        Set& set = sets[hash & (numberOfSets - 1)];
+        ACQUIRE(set.lock);
+        // skip if entry has been added by other processor, otherwise prefer entry of old generation or replace round-robin
+        unsigned int way = numberOfWays;
+        for (unsigned int i = 0; i < numberOfWays; ++i)
+        {
+            const Entry& entry = set.entries[i];
+            if (entry.generation != callGeneration)
+            {
+                if (way == numberOfWays)
+                    way = i;
+            }
+            else if (entry.hash == hash && entry.contractIndex == contractIndex && entry.inputType == inputType
+                && entry.inputSize == inputSize && isEqual(entry.input, input, inputSize))
+            {
+                RELEASE(set.lock);
+                return;
+            }
+        }
+        if (way == numberOfWays)
+        {
+            way = set.nextWayToReplace;
+            set.nextWayToReplace = (set.nextWayToReplace + 1) % numberOfWays;
+        }
+        Entry& entry = set.entries[way];
+        entry.generation = callGeneration;
+        entry.hash = hash;
+        entry.contractIndex = contractIndex;
+        entry.inputType = inputType;
+        entry.inputSize = inputSize;
+        entry.outputSize = outputSize;
+        copyMem(entry.input, input, inputSize);
+        copyMem(entry.output, output, outputSize);
+        RELEASE(set.lock);
+    }
+
+    static bool isEqual(const unsigned char* a, const void* b, unsigned short size)
+    {
+        const unsigned char* bb = (const unsigned char*)b;
+        for (unsigned short i = 0; i < size; ++i)
+        {
+            if (a[i] != bb[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
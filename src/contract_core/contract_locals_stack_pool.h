@@ -0,0 +1,127 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/memory_util.h"
+#include "platform/debugging.h"
+
+#include "ticking/tick_profiler.h"
+
+
+// Pool managing which of the contract locals stacks are in use (the stacks are identified by index).
+// Free stacks are tracked in a bit mask that is updated lock-free with compare-and-swap, so acquiring a free stack
+// doesn't require scanning and retrying locks. Each affinity slot (usually a processor) prefers the stack it used last,
+// whose memory is likely still in its caches. Only the first stacks are active initially. The others are reserved and
+// only activated if no free stack is available, so the set of stacks touched stays small under low load.
+// Acquiring with stacksToIgnore > 0 only succeeds if more than stacksToIgnore stacks are free (or can be activated),
+// which keeps stacks available for high priority tasks.
+// The cycles spent for acquiring a stack are recorded in histograms for high priority (stacksToIgnore == 0) and low
+// priority acquisitions.
+template <unsigned int numberOfStacks, unsigned int numberOfAffinitySlots>
+struct ContractLocalsStackPool
+{
+    static_assert(numberOfStacks >= 2 && numberOfStacks <= 64, "ContractLocalsStackPool supports 2 to 64 stacks.");
+
+    volatile long long freeStackFlags;  // bit i is set if stack i is active and not acquired
+    volatile long activeStacks;         // stacks with index < activeStacks are active, the others are reserved
+    unsigned char lastStack[numberOfAffinitySlots]; // stack used last by affinity slot, 0xff if none
+    CycleHistogram acquireCycles[2];    // index 0: high priority, 1: low priority (stacksToIgnore > 0)
+
+    void init(unsigned int initialStacks)
+    {
+        ASSERT(initialStacks >= 2 && initialStacks <= numberOfStacks);
+        activeStacks = initialStacks;
+        freeStackFlags = (initialStacks == 64) ? -1LL : (long long)((1ULL << initialStacks) - 1);
+        setMem(lastStack, sizeof(lastStack), 0xff);
+        acquireCycles[0].reset();
+        acquireCycles[1].reset();
+    }
+
+    // Try to acquire a stack without waiting. Returns stack index or -1 if no stack is available.
+    int tryAcquire(unsigned int stacksToIgnore, unsigned int affinitySlot)
+    {
+        ASSERT(stacksToIgnore < numberOfStacks);
+        ASSERT(affinitySlot < numberOfAffinitySlots);
+        while (true)
+        {
+            const unsigned long long flags = freeStackFlags;
+            unsigned long stackIndex;
+            if (__popcnt64(flags) <= stacksToIgnore)
+            {
+                // no free stack that may be used -> activate reserved stack if any
+                const long active = activeStacks;
+                if (active >= (long)numberOfStacks)
+                {
+                    return -1;
+                }
+                if (_InterlockedCompareExchange(&activeStacks, active + 1, active) != active)
+                {
+                    continue;
+                }
+                stackIndex = active;
+            }
+            else
+            {
+                const unsigned char last = lastStack[affinitySlot];
+                if (last < numberOfStacks && ((flags >> last) & 1))
+                {
+                    stackIndex = last;
+                }
+                else
+                {
+                    _BitScanForward64(&stackIndex, flags);
+                }
+                if (_InterlockedCompareExchange64(&freeStackFlags, flags & ~(1ULL << stackIndex), flags) != (long long)flags)
+                {
+                    continue;
+                }
+            }
+            lastStack[affinitySlot] = (unsigned char)stackIndex;
+            return (int)stackIndex;
+        }
+    }
+
+    // Acquire a stack (may block if all are in use)
+    int acquire(unsigned int stacksToIgnore, unsigned int affinitySlot)
+    {
+        const unsigned long long startTick = __rdtsc();
+        int stackIndex = tryAcquire(stacksToIgnore, affinitySlot);
+        while (stackIndex < 0)
+        {
+            _mm_pause();
+            stackIndex = tryAcquire(stacksToIgnore, affinitySlot);
+        }
+        acquireCycles[stacksToIgnore ? 1 : 0].recordConcurrent(__rdtsc() - startTick);
+        return stackIndex;
+    }
+
+    // Try to acquire a specific stack if it is free and more than stacksToIgnore stacks are free. Doesn't record
+    // statistics or change the affinity (used for maintenance such as zeroing unused memory of the stack).
+    bool tryAcquireIndex(int stackIndex, unsigned int stacksToIgnore)
+    {
+        ASSERT(stackIndex >= 0 && stackIndex < (int)numberOfStacks);
+        while (true)
+        {
+            const unsigned long long flags = freeStackFlags;
+            if (!((flags >> stackIndex) & 1) || __popcnt64(flags) <= stacksToIgnore)
+            {
+                return false;
+            }
+            if (_InterlockedCompareExchange64(&freeStackFlags, flags & ~(1ULL << stackIndex), flags) == (long long)flags)
+            {
+                return true;
+            }
+        }
+    }
+
+    void release(int stackIndex)
+    {
+        ASSERT(isAcquired(stackIndex));
+        _InterlockedOr64(&freeStackFlags, 1LL << stackIndex);
+    }
+
+    bool isAcquired(int stackIndex) const
+    {
+        return stackIndex >= 0 && stackIndex < activeStacks && !((freeStackFlags >> stackIndex) & 1);
+    }
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/assert.h"
+
+// Mailbox for handing calls from the tick processor to the contract processor. There is at most one call in
+// flight: the tick processor posts a call and waits until the contract processor has finished it. The contract
+// processor either polls the mailbox in a resident loop (no dispatch through the main loop and StartupThisAP()) or
+// is started for each call by the main loop, taking the posted call right away. Calls are counted, so the state of
+// the current call can be derived from the counters without locking.
+struct ContractProcessorMailbox
+{
+    volatile long long postedCalls;
+    volatile long long startedCalls;
+    volatile long long finishedCalls;
+    volatile unsigned long long postTime; // __rdtsc() when last call was posted
+    volatile unsigned long long startTime; // __rdtsc() when last call was started
+
+    // Stats written by the contract processor, read and reset by the main loop (see resetStats())
+    unsigned long long numberOfCalls;
+    unsigned long long dispatchLatencySum; // time from posting to start of execution
+    unsigned long long maxDispatchLatency;
+    unsigned long long executionTimeSum;
+    unsigned long long maxExecutionTime;
+    unsigned long long numberOfAbortedCalls; // calls not finished because processor has been stopped by timeout
+    long long lastWatchdogReportedCall;
+
+    void init()
+    {
+        postedCalls = 0;
+        startedCalls = 0;
+        finishedCalls = 0;
+        postTime = 0;
+        startTime = 0;
+        lastWatchdogReportedCall = 0;
+        numberOfAbortedCalls = 0;
+        resetStats();
+    }
+
+    void resetStats()
+    {
+        numberOfCalls = 0;
+        dispatchLatencySum = 0;
+        maxDispatchLatency = 0;
+        executionTimeSum = 0;
+        maxExecutionTime = 0;
+    }
+
+    // Post call (tick processor). Parameters of the call must be set before.
+    void post()
+    {
+        ASSERT(finishedCalls == postedCalls);
+        postTime = __rdtsc();
+        _InterlockedIncrement64(&postedCalls);
+    }
+
+    bool isFinished() const
+    {
+        return finishedCalls == postedCalls;
+    }
+
+    // Post call and wait until it has been finished by the resident contract processor (tick processor)
+    void call()
+    {
+        post();
+        while (!isFinished())
+        {
+            _mm_pause();
+        }
+    }
+
+    // Take posted call if there is one (contract processor). Returns true if call has to be executed and finished
+    // with finishCall().
+    bool tryStartCall()
+    {
+        if (startedCalls == postedCalls)
+        {
+            return false;
+        }
+        const unsigned long long now = __rdtsc();
+        const unsigned long long dispatchLatency = now - postTime;
+        startTime = now;
+        ++numberOfCalls;
+        dispatchLatencySum += dispatchLatency;
+        if (dispatchLatency > maxDispatchLatency)
+        {
+            maxDispatchLatency = dispatchLatency;
+        }
+        _InterlockedIncrement64(&startedCalls);
+        return true;
+    }
+
+    // Mark call as finished (contract processor), so the waiting tick processor continues
+    void finishCall()
+    {
+        const unsigned long long executionTime = __rdtsc() - startTime;
+        executionTimeSum += executionTime;
+        if (executionTime > maxExecutionTime)
+        {
+            maxExecutionTime = executionTime;
+        }
+        _InterlockedIncrement64(&finishedCalls);
+    }
+
+    // Discard call that has not been finished, because the contract processor has been stopped (tick processor)
+    void abortUnfinishedCall()
+    {
+        if (!isFinished())
+        {
+            startedCalls = postedCalls;
+            finishedCalls = postedCalls;
+            ++numberOfAbortedCalls;
+        }
+    }
+
+    // Return time since start of the running call in __rdtsc() ticks, or 0 if no call is being executed
+    unsigned long long runningCallDuration() const
+    {
+        const long long started = startedCalls;
+        if (started == finishedCalls)
+        {
+            return 0;
+        }
+        return __rdtsc() - startTime;
+    }
+
+    // Return true once per call that runs for longer than maxDuration (watchdog in main loop)
+    bool checkWatchdog(unsigned long long maxDuration)
+    {
+        const long long started = startedCalls;
+        if (started == lastWatchdogReportedCall || runningCallDuration() <= maxDuration)
+        {
+            return false;
+        }
+        lastWatchdogReportedCall = started;
+        return true;
+    }
+};
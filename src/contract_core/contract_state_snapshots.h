@@ -0,0 +1,177 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/memory_util.h"
+#include "platform/debugging.h"
+
+
+// Double-buffered snapshots of contract states, which let user functions read a consistent state without acquiring
+// contractStateLock (multi-version concurrency control).
+// The tick processor copies the state of each changed contract to the buffer that is not used by new readers and then
+// publishes it, while no procedure is running. Readers pin the published buffer with a reader count. If the other
+// buffer is still pinned by a long-running function, the update of this contract is deferred to the next call of
+// update(), so neither side ever waits for the other. Thus, functions see the state after the last update (usually
+// the end of the last tick) and snapshots of different contracts may occasionally be from different ticks.
+template <unsigned int numberOfContracts>
+struct ContractStateSnapshots
+{
+    static constexpr unsigned long long pageSize = 4096;
+
+    struct Snapshot
+    {
+        const unsigned char* state;     // live state, only changed by the contract processor
+        unsigned long long size;
+        unsigned char* buffers[2];
+        unsigned int bufferTicks[2];    // tick of the state that has been copied to buffer
+        volatile long readers[2];
+        volatile long published;        // index of buffer acquired by new readers, -1 if no snapshot is available
+        bool pending;                   // live state has changed but hasn't been copied yet
+    };
+
+    Snapshot snapshots[numberOfContracts];
+
+    void reset()
+    {
+        setMem(snapshots, sizeof(snapshots), 0);
+        for (unsigned int i = 0; i < numberOfContracts; i++)
+        {
+            snapshots[i].published = -1;
+        }
+    }
+
+    // Allocate snapshot buffers of contract. Contracts that are not registered are read with contractStateLock.
+    bool registerContract(unsigned int contractIndex, const void* state, unsigned long long size)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        Snapshot& snapshot = snapshots[contractIndex];
+        ASSERT(!snapshot.buffers[0] && !snapshot.buffers[1]);
+        if (!size)
+        {
+            return true;
+        }
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            if (!allocPoolWithErrorLog(L"contractStateSnapshot", size, (void**)&snapshot.buffers[i], __LINE__))
+            {
+                return false;
+            }
+            setMem(snapshot.buffers[i], size, 0);
+        }
+        snapshot.state = (const unsigned char*)state;
+        snapshot.size = size;
+        snapshot.published = -1;
+        snapshot.pending = true;
+        return true;
+    }
+
+    void deinit()
+    {
+        for (unsigned int i = 0; i < numberOfContracts; i++)
+        {
+            for (unsigned int j = 0; j < 2; j++)
+            {
+                if (snapshots[i].buffers[j])
+                {
+                    freePool(snapshots[i].buffers[j]);
+                }
+            }
+        }
+        reset();
+    }
+
+    // Mark live state of contract as changed (called if contractStateChangeFlags is set for contract)
+    void markChanged(unsigned int contractIndex)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        snapshots[contractIndex].pending = true;
+    }
+
+    // Copy the changed states to snapshots and publish them. Must only be called by the tick processor while no
+    // contract procedure is running.
+    void update(unsigned int tick)
+    {
+        for (unsigned int i = 0; i < numberOfContracts; i++)
+        {
+            Snapshot& snapshot = snapshots[i];
+            if (!snapshot.pending || !snapshot.size)
+            {
+                continue;
+            }
+
+            // Readers that acquired the target buffer before the last publication may still be running -> try again later
+            const long target = (snapshot.published == 0) ? 1 : 0;
+            if (snapshot.readers[target])
+            {
+                continue;
+            }
+
+            copyChangedPages(snapshot.buffers[target], snapshot.state, snapshot.size);
+            snapshot.bufferTicks[target] = tick;
+            _InterlockedExchange(&snapshot.published, target);
+            snapshot.pending = false;
+        }
+    }
+
+    // Copy pages of state that differ from the (older) content of buffer
+    static void copyChangedPages(unsigned char* buffer, const unsigned char* state, unsigned long long size)
+    {
+        for (unsigned long long offset = 0; offset < size; offset += pageSize)
+        {
+            const unsigned long long length = (size - offset < pageSize) ? size - offset : pageSize;
+            const unsigned long long* src = (const unsigned long long*)(state + offset);
+            const unsigned long long* dst = (const unsigned long long*)(buffer + offset);
+            bool changed = false;
+            for (unsigned long long i = 0; i < length / 8 && !changed; i++)
+            {
+                changed = (src[i] != dst[i]);
+            }
+            for (unsigned long long i = length & ~7ULL; i < length && !changed; i++)
+            {
+                changed = (state[offset + i] != buffer[offset + i]);
+            }
+            if (changed)
+            {
+                copyMem(buffer + offset, state + offset, length);
+            }
+        }
+    }
+
+    // Pin the published snapshot of contract for reading. Returns nullptr if no snapshot is available. Never waits.
+    const unsigned char* acquire(unsigned int contractIndex, int& buffer)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        Snapshot& snapshot = snapshots[contractIndex];
+        while (true)
+        {
+            const long published = snapshot.published;
+            if (published < 0)
+            {
+                return nullptr;
+            }
+            _InterlockedIncrement(&snapshot.readers[published]);
+            if (snapshot.published == published)
+            {
+                buffer = published;
+                return snapshot.buffers[published];
+            }
+            // Buffer has been replaced in the meantime and may be overwritten -> retry with new one
+            _InterlockedDecrement(&snapshot.readers[published]);
+        }
+    }
+
+    void release(unsigned int contractIndex, int buffer)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        ASSERT(buffer == 0 || buffer == 1);
+        ASSERT(snapshots[contractIndex].readers[buffer] > 0);
+        _InterlockedDecrement(&snapshots[contractIndex].readers[buffer]);
+    }
+
+    // Return tick of state in snapshot buffer
+    unsigned int getTick(unsigned int contractIndex, int buffer) const
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        return snapshots[contractIndex].bufferTicks[buffer];
+    }
+};
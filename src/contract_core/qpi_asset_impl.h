@@ -379,6 +379,8 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
     uint16 sourceOwnershipManagingContractIndex, uint16 sourcePossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -462,6 +464,8 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
 
 bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     if (amountPerShare < 0 || amountPerShare * NUMBER_OF_COMPUTORS > MAX_AMOUNT)
     {
         return false;
@@ -535,6 +539,8 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
 
 long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, const QPI::id& issuer, signed char numberOfDecimalPlaces, long long numberOfShares, unsigned long long unitOfMeasurement) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     if (((unsigned char)name) < 'A' || ((unsigned char)name) > 'Z'
         || name > 0xFFFFFFFFFFFFFF)
     {
@@ -597,11 +603,17 @@ long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, cons
 // TODO: remove after testing period, because numberOfShares() can do this and more
 long long QPI::QpiContextFunctionCall::numberOfPossessedShares(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, unsigned short ownershipManagingContractIndex, unsigned short possessionManagingContractIndex) const
 {
+    if (_entryPoint != USER_FUNCTION_CALL)
+        countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     return ::numberOfPossessedShares(assetName, issuer, owner, possessor, ownershipManagingContractIndex, possessionManagingContractIndex);
 }
 
 sint64 QPI::QpiContextFunctionCall::numberOfShares(const QPI::Asset& asset, const QPI::AssetOwnershipSelect& ownership, const QPI::AssetPossessionSelect& possession) const
 {
+    if (_entryPoint != USER_FUNCTION_CALL)
+        countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     return ::numberOfShares(asset, ownership, possession);
 }
 
@@ -610,6 +622,8 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
     uint16 destinationOwnershipManagingContractIndex, uint16 destinationPossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -690,6 +704,8 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
 
 long long QPI::QpiContextProcedureCall::transferShareOwnershipAndPossession(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, long long numberOfShares, const m256i& newOwnerAndPossessor) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+
     if (numberOfShares <= 0 || numberOfShares > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
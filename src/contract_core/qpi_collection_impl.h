@@ -7,6 +7,7 @@
 
 #include "../contracts/qpi.h"
 #include "../platform/memory.h"
+#include "contract_exec_profiler.h"
 
 namespace QPI
 {
@@ -52,11 +53,11 @@ namespace QPI
 		const auto& pov = _povs[povIndex];
 
 		// quick check head/tail
-		if (_elements[pov.headIndex].priority <= maxPriority)
+		if (_elementNodes[pov.headIndex].priority <= maxPriority)
 		{
 			return pov.headIndex;
 		}
-		if (_elements[pov.tailIndex].priority > maxPriority)
+		if (_elementNodes[pov.tailIndex].priority > maxPriority)
 		{
 			return NULL_INDEX;
 		}
@@ -67,13 +68,13 @@ namespace QPI
 		// search index of parent element
 		// - always found parent element because pov is not empty
 		sint64 idx = _searchElement(pov.bstRootIndex, maxPriority);
-		if (_elements[idx].priority > maxPriority)
+		if (_elementNodes[idx].priority > maxPriority)
 		{
 			// forward iterating until meet element having priority <= maxPriority
 			while (true)
 			{
 				idx = _nextElementIndex(idx);
-				if (_elements[idx].priority <= maxPriority)
+				if (_elementNodes[idx].priority <= maxPriority)
 				{
 					break;
 				}
@@ -85,7 +86,7 @@ namespace QPI
 		while (true)
 		{
 			sint64 prevIdx = _previousElementIndex(idx);
-			if (prevIdx == NULL_INDEX || _elements[prevIdx].priority > maxPriority)
+			if (prevIdx == NULL_INDEX || _elementNodes[prevIdx].priority > maxPriority)
 			{
 				break;
 			}
@@ -101,11 +102,11 @@ namespace QPI
 		const auto& pov = _povs[povIndex];
 
 		// quick check head/tail
-		if (_elements[pov.headIndex].priority < minPriority)
+		if (_elementNodes[pov.headIndex].priority < minPriority)
 		{
 			return NULL_INDEX;
 		}
-		if (_elements[pov.tailIndex].priority >= minPriority)
+		if (_elementNodes[pov.tailIndex].priority >= minPriority)
 		{
 			return pov.tailIndex;
 		}
@@ -117,13 +118,13 @@ namespace QPI
 		// - always found parent element because pov is not empty
 		sint64 idx = _searchElement(pov.bstRootIndex, minPriority);
 
-		if (_elements[idx].priority >= minPriority)
+		if (_elementNodes[idx].priority >= minPriority)
 		{
 			// forward iterating until meet element having priority < minPriority
 			while (true)
 			{
 				sint64 nextIdx = _nextElementIndex(idx);
-				if (nextIdx == NULL_INDEX || _elements[nextIdx].priority < minPriority)
+				if (nextIdx == NULL_INDEX || _elementNodes[nextIdx].priority < minPriority)
 				{
 					break;
 				}
@@ -136,7 +137,7 @@ namespace QPI
 		while (true)
 		{
 			idx = _previousElementIndex(idx);
-			if (_elements[idx].priority >= minPriority)
+			if (_elementNodes[idx].priority >= minPriority)
 			{
 				break;
 			}
@@ -145,17 +146,12 @@ namespace QPI
 	}
 
 	template <typename T, uint64 L>
-	sint64 Collection<T, L>::_searchElement(const sint64 bstRootIndex,
-		const sint64 priority, int* pIterationsCount) const
+	sint64 Collection<T, L>::_searchElement(const sint64 bstRootIndex, const sint64 priority) const
 	{
 		sint64 idx = bstRootIndex;
 		while (idx != NULL_INDEX)
 		{
-			if (pIterationsCount)
-			{
-				*pIterationsCount += 1;
-			}
-			auto& curElement = _elements[idx];
+			auto& curElement = _elementNodes[idx];
 			if (curElement.priority >= priority)
 			{
 				if (curElement.bstRightIndex != NULL_INDEX)
@@ -186,7 +182,10 @@ namespace QPI
 	sint64 Collection<T, L>::_addPovElement(const sint64 povIndex, const T value, const sint64 priority)
 	{
 		const sint64 newElementIdx = _population++;
-		auto& newElement = _elements[newElementIdx].init(value, priority, povIndex);
+		auto& newElement = _elementNodes[newElementIdx].init(priority);
+		_elementInfos[newElementIdx].povIndex = uint32(povIndex);
+		_elementInfos[newElementIdx].bstHeight = 1;
+		_elementValues[newElementIdx] = value;
 		auto& pov = _povs[povIndex];
 
 		if (pov.population == 0)
@@ -198,32 +197,31 @@ namespace QPI
 		}
 		else
 		{
-			int iterations_count = 0;
-			sint64 parentIdx = _searchElement(pov.bstRootIndex, priority, &iterations_count);
-			if (_elements[parentIdx].priority >= priority)
+			sint64 parentIdx = _searchElement(pov.bstRootIndex, priority);
+			if (_elementNodes[parentIdx].priority >= priority)
 			{
-				_elements[parentIdx].bstRightIndex = newElementIdx;
+				_elementNodes[parentIdx].bstRightIndex = newElementIdx;
 			}
 			else
 			{
-				_elements[parentIdx].bstLeftIndex = newElementIdx;
+				_elementNodes[parentIdx].bstLeftIndex = newElementIdx;
 			}
 			newElement.bstParentIndex = parentIdx;
 			pov.population++;
 
-
-			if (_elements[pov.headIndex].priority < priority)
+			if (_elementNodes[pov.headIndex].priority < priority)
 			{
 				pov.headIndex = newElementIdx;
 			}
-			else if (_elements[pov.tailIndex].priority >= priority)
+			else if (_elementNodes[pov.tailIndex].priority >= priority)
 			{
 				pov.tailIndex = newElementIdx;
 			}
-			if (pov.population > 32 && iterations_count > pov.population / 4)
+
+			// keep tree balanced (only needed if parent has been a leaf, otherwise its height doesn't change)
+			if (_elementInfos[parentIdx].bstHeight == 1)
 			{
-				// make balanced binary search tree to get better performance
-				pov.bstRootIndex = _rebuild(pov.bstRootIndex);
+				_rebalance(pov.bstRootIndex, parentIdx);
 			}
 		}
 		return newElementIdx;
@@ -237,32 +235,32 @@ namespace QPI
 		sint64 lastElementIdx = NULL_INDEX;
 		while (elementIdx != NULL_INDEX)
 		{
-			if (lastElementIdx == _elements[elementIdx].bstParentIndex)
+			if (lastElementIdx == _elementNodes[elementIdx].bstParentIndex)
 			{
-				if (_elements[elementIdx].bstLeftIndex != NULL_INDEX)
+				if (_elementNodes[elementIdx].bstLeftIndex != NULL_INDEX)
 				{
 					lastElementIdx = elementIdx;
-					elementIdx = _elements[elementIdx].bstLeftIndex;
+					elementIdx = _elementNodes[elementIdx].bstLeftIndex;
 					continue;
 				}
 				lastElementIdx = NULL_INDEX;
 			}
-			if (lastElementIdx == _elements[elementIdx].bstLeftIndex)
+			if (lastElementIdx == _elementNodes[elementIdx].bstLeftIndex)
 			{
 				sortedElementIndices[count++] = elementIdx;
 
-				if (_elements[elementIdx].bstRightIndex != NULL_INDEX)
+				if (_elementNodes[elementIdx].bstRightIndex != NULL_INDEX)
 				{
 					lastElementIdx = elementIdx;
-					elementIdx = _elements[elementIdx].bstRightIndex;
+					elementIdx = _elementNodes[elementIdx].bstRightIndex;
 					continue;
 				}
 				lastElementIdx = NULL_INDEX;
 			}
-			if (lastElementIdx == _elements[elementIdx].bstRightIndex)
+			if (lastElementIdx == _elementNodes[elementIdx].bstRightIndex)
 			{
 				lastElementIdx = elementIdx;
-				elementIdx = _elements[elementIdx].bstParentIndex;
+				elementIdx = _elementNodes[elementIdx].bstParentIndex;
 			}
 		}
 		return count;
@@ -293,9 +291,11 @@ namespace QPI
 		// initialize root
 		sint64 mid = n / 2;
 		rootIdx = sortedElementIndices[mid];
-		_elements[rootIdx].bstParentIndex = NULL_INDEX;
-		_elements[rootIdx].bstLeftIndex = NULL_INDEX;
-		_elements[rootIdx].bstRightIndex = NULL_INDEX;
+		_elementNodes[rootIdx].bstParentIndex = NULL_INDEX;
+		_elementNodes[rootIdx].bstLeftIndex = NULL_INDEX;
+		_elementNodes[rootIdx].bstRightIndex = NULL_INDEX;
+		// splitting ranges in the middle yields subtree height = bit length of range size
+		_elementInfos[rootIdx].bstHeight = uint32(64 - _lzcnt_u64(n));
 		// initialize queue
 		auto* queue = reinterpret_cast<sint64_4*>(sortedElementIndices + ((n + 3) / 4) * 4);
 		sint64 dequeueIdx = 0;
@@ -330,18 +330,19 @@ namespace QPI
 			{
 				mid = (left + right) / 2;
 				const auto elementIdx = sortedElementIndices[mid];
-				_elements[elementIdx].bstParentIndex = parentElementIdx;
-				_elements[elementIdx].bstLeftIndex = NULL_INDEX;
-				_elements[elementIdx].bstRightIndex = NULL_INDEX;
+				_elementNodes[elementIdx].bstParentIndex = parentElementIdx;
+				_elementNodes[elementIdx].bstLeftIndex = NULL_INDEX;
+				_elementNodes[elementIdx].bstRightIndex = NULL_INDEX;
+				_elementInfos[elementIdx].bstHeight = uint32(64 - _lzcnt_u64(right - left + 1));
 
 				// set the child node for the parent node
 				if (mid < curRange.get(3))
 				{
-					_elements[parentElementIdx].bstLeftIndex = elementIdx;
+					_elementNodes[parentElementIdx].bstLeftIndex = elementIdx;
 				}
 				else
 				{
-					_elements[parentElementIdx].bstRightIndex = elementIdx;
+					_elementNodes[parentElementIdx].bstRightIndex = elementIdx;
 				}
 
 				// push left and right ranges to the queue
@@ -366,9 +367,9 @@ namespace QPI
 	template <typename T, uint64 L>
 	sint64 Collection<T, L>::_getMostLeft(sint64 elementIdx) const
 	{
-		while (_elements[elementIdx].bstLeftIndex != NULL_INDEX)
+		while (_elementNodes[elementIdx].bstLeftIndex != NULL_INDEX)
 		{
-			elementIdx = _elements[elementIdx].bstLeftIndex;
+			elementIdx = _elementNodes[elementIdx].bstLeftIndex;
 		}
 		return elementIdx;
 	}
@@ -376,9 +377,9 @@ namespace QPI
 	template <typename T, uint64 L>
 	sint64 Collection<T, L>::_getMostRight(sint64 elementIdx) const
 	{
-		while (_elements[elementIdx].bstRightIndex != NULL_INDEX)
+		while (_elementNodes[elementIdx].bstRightIndex != NULL_INDEX)
 		{
-			elementIdx = _elements[elementIdx].bstRightIndex;
+			elementIdx = _elementNodes[elementIdx].bstRightIndex;
 		}
 		return elementIdx;
 	}
@@ -389,23 +390,23 @@ namespace QPI
 		elementIdx &= (L - 1);
 		if (uint64(elementIdx) < _population)
 		{
-			if (_elements[elementIdx].bstLeftIndex != NULL_INDEX)
+			if (_elementNodes[elementIdx].bstLeftIndex != NULL_INDEX)
 			{
-				return _getMostRight(_elements[elementIdx].bstLeftIndex);
+				return _getMostRight(_elementNodes[elementIdx].bstLeftIndex);
 			}
-			else if (_elements[elementIdx].bstParentIndex != NULL_INDEX)
+			else if (_elementNodes[elementIdx].bstParentIndex != NULL_INDEX)
 			{
-				auto parentIdx = _elements[elementIdx].bstParentIndex;
-				if (_elements[parentIdx].bstRightIndex == elementIdx)
+				auto parentIdx = _elementNodes[elementIdx].bstParentIndex;
+				if (_elementNodes[parentIdx].bstRightIndex == elementIdx)
 				{
 					return parentIdx;
 				}
-				if (_elements[parentIdx].bstLeftIndex == elementIdx)
+				if (_elementNodes[parentIdx].bstLeftIndex == elementIdx)
 				{
-					while (parentIdx != NULL_INDEX && _elements[parentIdx].bstLeftIndex == elementIdx)
+					while (parentIdx != NULL_INDEX && _elementNodes[parentIdx].bstLeftIndex == elementIdx)
 					{
 						elementIdx = parentIdx;
-						parentIdx = _elements[elementIdx].bstParentIndex;
+						parentIdx = _elementNodes[elementIdx].bstParentIndex;
 					}
 					return parentIdx;
 				}
@@ -420,23 +421,23 @@ namespace QPI
 		elementIdx &= (L - 1);
 		if (uint64(elementIdx) < _population)
 		{
-			if (_elements[elementIdx].bstRightIndex != NULL_INDEX)
+			if (_elementNodes[elementIdx].bstRightIndex != NULL_INDEX)
 			{
-				return _getMostLeft(_elements[elementIdx].bstRightIndex);
+				return _getMostLeft(_elementNodes[elementIdx].bstRightIndex);
 			}
-			else if (_elements[elementIdx].bstParentIndex != NULL_INDEX)
+			else if (_elementNodes[elementIdx].bstParentIndex != NULL_INDEX)
 			{
-				auto parentIdx = _elements[elementIdx].bstParentIndex;
-				if (_elements[parentIdx].bstLeftIndex == elementIdx)
+				auto parentIdx = _elementNodes[elementIdx].bstParentIndex;
+				if (_elementNodes[parentIdx].bstLeftIndex == elementIdx)
 				{
 					return parentIdx;
 				}
-				if (_elements[parentIdx].bstRightIndex == elementIdx)
+				if (_elementNodes[parentIdx].bstRightIndex == elementIdx)
 				{
-					while (parentIdx != NULL_INDEX && _elements[parentIdx].bstRightIndex == elementIdx)
+					while (parentIdx != NULL_INDEX && _elementNodes[parentIdx].bstRightIndex == elementIdx)
 					{
 						elementIdx = parentIdx;
-						parentIdx = _elements[elementIdx].bstParentIndex;
+						parentIdx = _elementNodes[elementIdx].bstParentIndex;
 					}
 					return parentIdx;
 				}
@@ -450,10 +451,10 @@ namespace QPI
 	{
 		if (elementIdx != NULL_INDEX)
 		{
-			auto& curElement = _elements[elementIdx];
+			auto& curElement = _elementNodes[elementIdx];
 			if (curElement.bstParentIndex != NULL_INDEX)
 			{
-				auto& parentElement = _elements[curElement.bstParentIndex];
+				auto& parentElement = _elementNodes[curElement.bstParentIndex];
 				if (parentElement.bstRightIndex == elementIdx)
 				{
 					parentElement.bstRightIndex = newElementIdx;
@@ -464,7 +465,7 @@ namespace QPI
 				}
 				if (newElementIdx != NULL_INDEX)
 				{
-					_elements[newElementIdx].bstParentIndex = curElement.bstParentIndex;
+					_elementNodes[newElementIdx].bstParentIndex = curElement.bstParentIndex;
 				}
 				return true;
 			}
@@ -472,12 +473,119 @@ namespace QPI
 		return false;
 	}
 
+	template <typename T, uint64 L>
+	inline uint32 Collection<T, L>::_height(const sint64 elementIdx) const
+	{
+		return (elementIdx == NULL_INDEX) ? 0 : _elementInfos[elementIdx].bstHeight;
+	}
+
+	template <typename T, uint64 L>
+	inline void Collection<T, L>::_updateHeight(const sint64 elementIdx)
+	{
+		const uint32 leftHeight = _height(_elementNodes[elementIdx].bstLeftIndex);
+		const uint32 rightHeight = _height(_elementNodes[elementIdx].bstRightIndex);
+		_elementInfos[elementIdx].bstHeight = 1 + ((leftHeight > rightHeight) ? leftHeight : rightHeight);
+	}
+
+	template <typename T, uint64 L>
+	sint64 Collection<T, L>::_rotateLeft(sint64& rootIdx, const sint64 elementIdx)
+	{
+		// right child becomes root of subtree, its left subtree becomes right subtree of element
+		auto& element = _elementNodes[elementIdx];
+		const sint64 pivotIdx = element.bstRightIndex;
+		auto& pivot = _elementNodes[pivotIdx];
+		if (!_updateParent(elementIdx, pivotIdx))
+		{
+			rootIdx = pivotIdx;
+			pivot.bstParentIndex = NULL_INDEX;
+		}
+		element.bstRightIndex = pivot.bstLeftIndex;
+		if (pivot.bstLeftIndex != NULL_INDEX)
+		{
+			_elementNodes[pivot.bstLeftIndex].bstParentIndex = elementIdx;
+		}
+		pivot.bstLeftIndex = elementIdx;
+		element.bstParentIndex = pivotIdx;
+		_updateHeight(elementIdx);
+		_updateHeight(pivotIdx);
+		return pivotIdx;
+	}
+
+	template <typename T, uint64 L>
+	sint64 Collection<T, L>::_rotateRight(sint64& rootIdx, const sint64 elementIdx)
+	{
+		// left child becomes root of subtree, its right subtree becomes left subtree of element
+		auto& element = _elementNodes[elementIdx];
+		const sint64 pivotIdx = element.bstLeftIndex;
+		auto& pivot = _elementNodes[pivotIdx];
+		if (!_updateParent(elementIdx, pivotIdx))
+		{
+			rootIdx = pivotIdx;
+			pivot.bstParentIndex = NULL_INDEX;
+		}
+		element.bstLeftIndex = pivot.bstRightIndex;
+		if (pivot.bstRightIndex != NULL_INDEX)
+		{
+			_elementNodes[pivot.bstRightIndex].bstParentIndex = elementIdx;
+		}
+		pivot.bstRightIndex = elementIdx;
+		element.bstParentIndex = pivotIdx;
+		_updateHeight(elementIdx);
+		_updateHeight(pivotIdx);
+		return pivotIdx;
+	}
+
+	template <typename T, uint64 L>
+	void Collection<T, L>::_rebalance(sint64& rootIdx, sint64 elementIdx)
+	{
+		while (elementIdx != NULL_INDEX)
+		{
+			const uint32 oldHeight = _elementInfos[elementIdx].bstHeight;
+			const auto& element = _elementNodes[elementIdx];
+			const uint32 leftHeight = _height(element.bstLeftIndex);
+			const uint32 rightHeight = _height(element.bstRightIndex);
+			if (leftHeight > rightHeight + 1)
+			{
+				// left subtree too high (if left child is right-heavy, double rotation is needed)
+				const auto& left = _elementNodes[element.bstLeftIndex];
+				if (_height(left.bstLeftIndex) < _height(left.bstRightIndex))
+				{
+					_rotateLeft(rootIdx, element.bstLeftIndex);
+				}
+				elementIdx = _rotateRight(rootIdx, elementIdx);
+			}
+			else if (rightHeight > leftHeight + 1)
+			{
+				// right subtree too high (if right child is left-heavy, double rotation is needed)
+				const auto& right = _elementNodes[element.bstRightIndex];
+				if (_height(right.bstRightIndex) < _height(right.bstLeftIndex))
+				{
+					_rotateRight(rootIdx, element.bstRightIndex);
+				}
+				elementIdx = _rotateLeft(rootIdx, elementIdx);
+			}
+			else
+			{
+				_updateHeight(elementIdx);
+			}
+
+			// ancestors are unaffected if height of subtree is unchanged
+			if (_elementInfos[elementIdx].bstHeight == oldHeight)
+			{
+				break;
+			}
+			elementIdx = _elementNodes[elementIdx].bstParentIndex;
+		}
+	}
+
 	template <typename T, uint64 L>
 	void Collection<T, L>::_moveElement(const sint64 srcIdx, const sint64 dstIdx)
 	{
-		copyMem(&_elements[dstIdx], &_elements[srcIdx], sizeof(_elements[0]));
+		copyMem(&_elementNodes[dstIdx], &_elementNodes[srcIdx], sizeof(_elementNodes[0]));
+		_elementInfos[dstIdx] = _elementInfos[srcIdx];
+		copyMem(&_elementValues[dstIdx], &_elementValues[srcIdx], sizeof(T));
 
-		const auto povIndex = _elements[dstIdx].povIndex;
+		const auto povIndex = _elementInfos[dstIdx].povIndex;
 		auto& pov = _povs[povIndex];
 		if (pov.bstRootIndex == srcIdx)
 		{
@@ -492,18 +600,18 @@ namespace QPI
 			pov.tailIndex = dstIdx;
 		}
 
-		auto& element = _elements[dstIdx];
+		auto& element = _elementNodes[dstIdx];
 		if (element.bstLeftIndex != NULL_INDEX)
 		{
-			_elements[element.bstLeftIndex].bstParentIndex = dstIdx;
+			_elementNodes[element.bstLeftIndex].bstParentIndex = dstIdx;
 		}
 		if (element.bstRightIndex != NULL_INDEX)
 		{
-			_elements[element.bstRightIndex].bstParentIndex = dstIdx;
+			_elementNodes[element.bstRightIndex].bstParentIndex = dstIdx;
 		}
 		if (element.bstParentIndex != NULL_INDEX)
 		{
-			auto& parentElement = _elements[element.bstParentIndex];
+			auto& parentElement = _elementNodes[element.bstParentIndex];
 			if (parentElement.bstLeftIndex == srcIdx)
 			{
 				parentElement.bstLeftIndex = dstIdx;
@@ -530,6 +638,8 @@ namespace QPI
 	template <typename T, uint64 L>
 	sint64 Collection<T, L>::add(const id& pov, T element, sint64 priority)
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION);
+
 		if (_population < capacity() && _markRemovalCounter < capacity())
 		{
 			// search in pov hash map
@@ -564,9 +674,11 @@ namespace QPI
 	template <typename T, uint64 L>
 	void Collection<T, L>::cleanup()
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION);
+
 		// _povs gets occupied over time with entries of type 3 which means they are marked for cleanup.
 		// Once cleanup is called it's necessary to remove all these type 3 entries by reconstructing a fresh Collection residing in scratchpad buffer.
-		// The _elements array is not reorganized by the cleanup (only references to _povs are updated).
+		// The element arrays are not reorganized by the cleanup (only references to _povs are updated).
 		// Cleanup() called for a Collection having only type 3 entries in _povs must give the result equal to reset() memory content wise.
 
 		// Quick check to cleanup
@@ -639,8 +751,9 @@ namespace QPI
 						_stackBuffer[stackSize++] = _povsBuffer[newPovIndex].bstRootIndex;
 						while (stackSize > 0)
 						{
-							auto& element = _elements[_stackBuffer[--stackSize]];
-							element.povIndex = newPovIndex;
+							const sint64 elementIdx = _stackBuffer[--stackSize];
+							const auto& element = _elementNodes[elementIdx];
+							_elementInfos[elementIdx].povIndex = uint32(newPovIndex);
 							if (element.bstLeftIndex != NULL_INDEX)
 							{
 								_stackBuffer[stackSize++] = element.bstLeftIndex;
@@ -676,7 +789,7 @@ namespace QPI
 	template <typename T, uint64 L>
 	inline T Collection<T, L>::element(sint64 elementIndex) const
 	{
-		return _elements[elementIndex & (L - 1)].value;
+		return _elementValues[elementIndex & (L - 1)];
 	}
 
 	template <typename T, uint64 L>
@@ -722,7 +835,7 @@ namespace QPI
 	template <typename T, uint64 L>
 	id Collection<T, L>::pov(sint64 elementIndex) const
 	{
-		return _povs[_elements[elementIndex & (L - 1)].povIndex].value;
+		return _povs[_elementInfos[elementIndex & (L - 1)].povIndex].value;
 	}
 
 	template <typename T, uint64 L>
@@ -734,26 +847,31 @@ namespace QPI
 	template <typename T, uint64 L>
 	sint64 Collection<T, L>::priority(sint64 elementIndex) const
 	{
-		return _elements[elementIndex & (L - 1)].priority;
+		return _elementNodes[elementIndex & (L - 1)].priority;
 	}
 
 	template <typename T, uint64 L>
 	sint64 Collection<T, L>::remove(sint64 elementIdx)
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION);
+
 		sint64 nextElementIdxOfRemoved = NULL_INDEX;
 		elementIdx &= (L - 1);
 		if (uint64(elementIdx) < _population)
 		{
 			auto deleteElementIdx = elementIdx;
-			const auto povIndex = _elements[elementIdx].povIndex;
+			const auto povIndex = _elementInfos[elementIdx].povIndex;
 			auto& pov = _povs[povIndex];
 			if (pov.population > 1)
 			{
 				auto& rootIdx = pov.bstRootIndex;
-				auto& curElement = _elements[elementIdx];
+				auto& curElement = _elementNodes[elementIdx];
 
 				nextElementIdxOfRemoved = _nextElementIndex(elementIdx);
 
+				// lowest element whose subtree changes, rebalancing starts there
+				sint64 rebalanceIdx = curElement.bstParentIndex;
+
 				if (curElement.bstRightIndex != NULL_INDEX &&
 					curElement.bstLeftIndex != NULL_INDEX)
 				{
@@ -764,25 +882,27 @@ namespace QPI
 					{
 						pov.tailIndex = _previousElementIndex(tmpIdx);
 					}
-					const auto rightTmpIndex = _elements[tmpIdx].bstRightIndex;
+					const auto rightTmpIndex = _elementNodes[tmpIdx].bstRightIndex;
 					if (tmpIdx == curElement.bstRightIndex)
 					{
+						rebalanceIdx = elementIdx;
 						curElement.bstRightIndex = rightTmpIndex;
 						if (rightTmpIndex != NULL_INDEX)
 						{
-							_elements[rightTmpIndex].bstParentIndex = elementIdx;
+							_elementNodes[rightTmpIndex].bstParentIndex = elementIdx;
 						}
 					}
 					else
 					{
-						_elements[_elements[tmpIdx].bstParentIndex].bstLeftIndex = rightTmpIndex;
+						rebalanceIdx = _elementNodes[tmpIdx].bstParentIndex;
+						_elementNodes[_elementNodes[tmpIdx].bstParentIndex].bstLeftIndex = rightTmpIndex;
 						if (rightTmpIndex != NULL_INDEX)
 						{
-							_elements[rightTmpIndex].bstParentIndex = _elements[tmpIdx].bstParentIndex;
+							_elementNodes[rightTmpIndex].bstParentIndex = _elementNodes[tmpIdx].bstParentIndex;
 						}
 					}
-					copyMem(&curElement.value, &_elements[tmpIdx].value, sizeof(T));
-					curElement.priority = _elements[tmpIdx].priority;
+					copyMem(&_elementValues[elementIdx], &_elementValues[tmpIdx], sizeof(T));
+					curElement.priority = _elementNodes[tmpIdx].priority;
 					nextElementIdxOfRemoved = elementIdx;
 
 					deleteElementIdx = tmpIdx;
@@ -797,7 +917,7 @@ namespace QPI
 					if (!_updateParent(elementIdx, curElement.bstRightIndex))
 					{
 						rootIdx = curElement.bstRightIndex;
-						_elements[rootIdx].bstParentIndex = NULL_INDEX;
+						_elementNodes[rootIdx].bstParentIndex = NULL_INDEX;
 					}
 				}
 				else if (curElement.bstLeftIndex != NULL_INDEX)
@@ -810,7 +930,7 @@ namespace QPI
 					if (!_updateParent(elementIdx, curElement.bstLeftIndex))
 					{
 						rootIdx = curElement.bstLeftIndex;
-						_elements[rootIdx].bstParentIndex = NULL_INDEX;
+						_elementNodes[rootIdx].bstParentIndex = NULL_INDEX;
 					}
 				}
 				else // it's a leaf node
@@ -825,6 +945,7 @@ namespace QPI
 					}
 					_updateParent(elementIdx, NULL_INDEX);
 				}
+				_rebalance(rootIdx, rebalanceIdx);
 				--pov.population;
 			}
 			else
@@ -845,7 +966,9 @@ namespace QPI
 			const bool CLEAR_UNUSED_ELEMENT = true;
 			if (CLEAR_UNUSED_ELEMENT)
 			{
-				setMem(&_elements[_population], sizeof(Element), 0);
+				setMem(&_elementNodes[_population], sizeof(ElementNode), 0);
+				setMem(&_elementInfos[_population], sizeof(ElementInfo), 0);
+				setMem(&_elementValues[_population], sizeof(T), 0);
 			}
 		}
 
@@ -855,15 +978,19 @@ namespace QPI
 	template <typename T, uint64 L>
 	void Collection<T, L>::replace(sint64 oldElementIndex, const T& newElement)
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION);
+
 		if (uint64(oldElementIndex) < _population)
 		{
-			_elements[oldElementIndex].value = newElement;
+			_elementValues[oldElementIndex] = newElement;
 		}
 	}
 
 	template <typename T, uint64 L>
 	void Collection<T, L>::reset()
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION);
+
 		setMem(this, sizeof(*this), 0);
 	}
 
@@ -886,4 +1013,59 @@ namespace QPI
 
 		return _tailIndex(povIndex, minPriority);
 	}
+
+	// Convert collection loaded from a state saved with the former element layout, which stored value, priority, povIndex,
+	// and BST links of each element in one struct, and which didn't keep the trees balanced. The element arrays of the
+	// current layout occupy the same memory, so the used elements are copied to the scratchpad and written back in the
+	// current layout. Afterwards, the tree of each pov is rebuilt as AVL tree. Returns false if the scratchpad is
+	// unavailable.
+	template <typename T, uint64 L>
+	bool migrateCollectionFromElementArrayLayout(Collection<T, L>& coll)
+	{
+		struct FormerElement
+		{
+			T value;
+			sint64 priority;
+			sint64 povIndex;
+			sint64 bstParentIndex;
+			sint64 bstLeftIndex;
+			sint64 bstRightIndex;
+		};
+		static_assert(sizeof(FormerElement) * L == sizeof(coll._elementNodes) + sizeof(coll._elementInfos) + sizeof(coll._elementValues)
+			&& alignof(FormerElement) == alignof(typename Collection<T, L>::ElementNode),
+			"Former and current element layout must occupy the same memory for migration.");
+
+		auto* formerElements = reinterpret_cast<FormerElement*>(::__scratchpad());
+		if (formerElements == NULL)
+		{
+			return false;
+		}
+
+		// elements are filled sequentially, unused elements are zero
+		const uint64 population = coll._population;
+		copyMem(formerElements, coll._elementNodes, population * sizeof(FormerElement));
+		setMem(coll._elementNodes, sizeof(FormerElement) * L, 0);
+		for (uint64 i = 0; i < population; ++i)
+		{
+			const FormerElement& element = formerElements[i];
+			auto& node = coll._elementNodes[i];
+			node.priority = element.priority;
+			node.bstParentIndex = element.bstParentIndex;
+			node.bstLeftIndex = element.bstLeftIndex;
+			node.bstRightIndex = element.bstRightIndex;
+			coll._elementInfos[i].povIndex = uint32(element.povIndex);
+			copyMem(&coll._elementValues[i], &element.value, sizeof(T));
+		}
+
+		// trees haven't been balanced in the former layout and have no heights -> rebuild them as balanced trees
+		for (sint64 povIndex = 0; povIndex < sint64(L); ++povIndex)
+		{
+			auto& pov = coll._povs[povIndex];
+			if (pov.population)
+			{
+				pov.bstRootIndex = coll._rebuild(pov.bstRootIndex);
+			}
+		}
+		return true;
+	}
 }
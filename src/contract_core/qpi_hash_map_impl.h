@@ -8,6 +8,7 @@
 #include "../contracts/qpi.h"
 #include "../platform/memory.h"
 #include "../kangaroo_twelve.h"
+#include "contract_exec_profiler.h"
 
 namespace QPI
 {
@@ -97,6 +98,8 @@ namespace QPI
 	template <typename KeyT, typename ValueT, uint64 L, typename HashFunc>
 	sint64 HashMap<KeyT, ValueT, L, HashFunc>::set(const KeyT& key, const ValueT& value)
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+
 		if (_population < capacity() && _markRemovalCounter < capacity())
 		{
 			// search in hash map
@@ -144,6 +147,8 @@ namespace QPI
 	template <typename KeyT, typename ValueT, uint64 L, typename HashFunc>
 	void HashMap<KeyT, ValueT, L, HashFunc>::removeByIndex(sint64 elementIdx)
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+
 		elementIdx &= (L - 1);
 		uint64 flags = _getEncodedOccupationFlags(_occupationFlags, elementIdx);
 
@@ -179,6 +184,8 @@ namespace QPI
 	template <typename KeyT, typename ValueT, uint64 L, typename HashFunc>
 	void HashMap<KeyT, ValueT, L, HashFunc>::cleanup()
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+
 		// _elements gets occupied over time with entries of type 3 which means they are marked for cleanup.
 		// Once cleanup is called it's necessary to remove all these type 3 entries by reconstructing a fresh hash map residing in scratchpad buffer.
 		// Cleanup() called for a hash map having only type 3 entries must give the result equal to reset() memory content wise.
@@ -269,6 +276,8 @@ namespace QPI
 	template <typename KeyT, typename ValueT, uint64 L, typename HashFunc>
 	bool HashMap<KeyT, ValueT, L, HashFunc>::replace(const KeyT& key, const ValueT& newValue)
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+
 		sint64 elementIndex = getElementIndex(key);
 		if (elementIndex != NULL_INDEX) 
 		{
@@ -281,6 +290,8 @@ namespace QPI
 	template <typename KeyT, typename ValueT, uint64 L, typename HashFunc>
 	void HashMap<KeyT, ValueT, L, HashFunc>::reset()
 	{
+		countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+
 		setMem(this, sizeof(*this), 0);
 	}
 }
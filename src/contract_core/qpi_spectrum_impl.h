@@ -6,6 +6,9 @@
 
 bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity) const
 {
+    if (_entryPoint != USER_FUNCTION_CALL)
+        countContractExecOp(CONTRACT_EXEC_PROFILE_OP_SPECTRUM);
+
     int index = spectrumIndex(id);
     if (index < 0)
     {
@@ -42,6 +45,8 @@ static long long& contractFeeReserve(unsigned int contractIndex)
 
 long long QPI::QpiContextProcedureCall::burn(long long amount) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_SPECTRUM);
+
     if (amount < 0 || amount > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -76,6 +81,8 @@ long long QPI::QpiContextProcedureCall::burn(long long amount) const
 
 long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long long amount) const
 {
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_SPECTRUM);
+
     if (amount < 0 || amount > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -111,6 +118,9 @@ long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long
 
 m256i QPI::QpiContextFunctionCall::nextId(const m256i& currentId) const
 {
+    if (_entryPoint != USER_FUNCTION_CALL)
+        countContractExecOp(CONTRACT_EXEC_PROFILE_OP_SPECTRUM);
+
     int index = spectrumIndex(currentId);
     while (++index < SPECTRUM_CAPACITY)
     {
@@ -126,6 +136,9 @@ m256i QPI::QpiContextFunctionCall::nextId(const m256i& currentId) const
 
 m256i QPI::QpiContextFunctionCall::prevId(const m256i& currentId) const
 {
+    if (_entryPoint != USER_FUNCTION_CALL)
+        countContractExecOp(CONTRACT_EXEC_PROFILE_OP_SPECTRUM);
+
     int index = spectrumIndex(currentId);
     while (--index >= 0)
     {
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "../platform/debugging.h"
+#include "../platform/memory.h"
 
 // Last-In-First-Out storage for data of different size.
 // Size type used for StackBuffer needs to be unsigned.
 // Supports unwinding for analyzing stack in error handling and tagging blocks as "special" (for example those
 // with infos about locks that need to be released).
+// Supports zeroed allocations, which only need to zero the part of the buffer that has been used since the memory
+// above the current size was last zeroed by cleanUp() (which can be called by an idle processor).
 // #define TRACK_MAX_STACK_BUFFER_SIZE to collect info on how much stack is used.
 template <typename StackBufferSizeType, StackBufferSizeType bufferSize>
 struct StackBuffer
@@ -24,6 +27,7 @@ struct StackBuffer
     void init()
     {
         _allocatedSize = 0;
+        _dirtySize = bufferSize;
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
         _maxAllocatedSize = 0;
         _failedAllocAttempts = 0;
@@ -42,6 +46,12 @@ struct StackBuffer
         return _allocatedSize;
     }
 
+    // Number of bytes that may be non-zero (used since last cleanUp()).
+    SizeType dirtySize() const
+    {
+        return _dirtySize;
+    }
+
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
     SizeType maxSizeObserved() const
     {
@@ -96,6 +106,8 @@ struct StackBuffer
          
         // update size
         _allocatedSize = newSize;
+        if (_dirtySize < newSize)
+            _dirtySize = newSize;
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
         ASSERT(_maxAllocatedSize <= bufferSize);
         if (_allocatedSize > _maxAllocatedSize)
@@ -105,6 +117,37 @@ struct StackBuffer
         return allocatedBuffer;
     }
 
+    // Allocate storage in buffer that is filled with zeros. Only the part of the storage that has been used since
+    // the last call of cleanUp() needs to be zeroed, its size is returned in zeroedSize.
+    char* allocateZeroed(SizeType size, SizeType& zeroedSize)
+    {
+        const SizeType dirtySizeBefore = _dirtySize;
+        char* allocatedBuffer = allocate(size);
+        zeroedSize = 0;
+        if (allocatedBuffer)
+        {
+            const SizeType offset = SizeType(allocatedBuffer - _buffer);
+            if (offset < dirtySizeBefore)
+            {
+                zeroedSize = (dirtySizeBefore - offset < size) ? dirtySizeBefore - offset : size;
+                setMem(allocatedBuffer, zeroedSize, 0);
+            }
+        }
+        return allocatedBuffer;
+    }
+
+    // Zero up to maxSize bytes of the unused part of the buffer that may be non-zero, starting from the end of the
+    // used part. Returns number of bytes zeroed.
+    SizeType cleanUp(SizeType maxSize)
+    {
+        if (_dirtySize <= _allocatedSize)
+            return 0;
+        const SizeType size = (_dirtySize - _allocatedSize < maxSize) ? _dirtySize - _allocatedSize : maxSize;
+        setMem(_buffer + _dirtySize - size, size, 0);
+        _dirtySize -= size;
+        return size;
+    }
+
     // Allocate "special block" storage in buffer, which is relevant for unwinding.
     inline char* allocateSpecial(SizeType size)
     {
@@ -196,6 +239,9 @@ protected:
     // number of bytes used in buffer
     SizeType _allocatedSize;
 
+    // all bytes from this offset to the end of the buffer are zero
+    SizeType _dirtySize;
+
     // Flag used internally to indicate a special block (bit set in size on _buffer)
     static constexpr SizeType specialBlockFlag = (1 << (sizeof(StackBufferSizeType) * 8 - 1));
 
@@ -429,6 +429,7 @@ namespace QPI
 		static_assert(L && !(L & (L - 1)),
 			"The capacity of the Collection must be 2^N."
 			);
+		static_assert(L <= 0x100000000ULL, "The capacity of the Collection must not exceed 2^32.");
 		static constexpr sint64 _nEncodedFlags = L > 32 ? 32 : L;
 
 		// Hash map of point of views = element filters, each with one priority queue (or empty)
@@ -445,29 +446,34 @@ namespace QPI
 		// "not occupied" in remove() would potentially undo a collision, create a gap, and mess up the entry search.
 		uint64 _povOccupationFlags[(L * 2 + 63) / 64];
 
-		// Array of elements (filled sequentially), each belongs to one PoV / priority queue (or is empty)
-		// Elements of a POV entry will be stored as a binary search tree (BST); so this structure has some properties related to BST
-		// (bstParentIndex, bstLeftIndex, bstRightIndex).
-		struct Element
+		// Elements (filled sequentially), each belongs to one PoV / priority queue (or is empty). Elements of a POV entry will be
+		// stored as a height-balanced binary search tree (AVL tree), so adding and removing take O(log n) in the worst case.
+		// Elements with equal priority are kept in order of insertion, which rotations don't change. The element data is split
+		// into arrays (structure of arrays): the BST nodes with priority and links are kept dense (two per cache line), because
+		// searching the tree only walks those. The values and the povIndex / subtree height are in separate arrays, which are
+		// only touched when an element is accessed, moved, or the tree is rebalanced.
+		struct ElementNode
 		{
-			T value;
 			sint64 priority;
-			sint64 povIndex;
 			sint64 bstParentIndex;
 			sint64 bstLeftIndex;
 			sint64 bstRightIndex;
 
-			Element& init(const T& value, const sint64& priority, const sint64& povIndex)
+			ElementNode& init(const sint64& priority)
 			{
-				this->value = value;
 				this->priority = priority;
-				this->povIndex = povIndex;
 				this->bstParentIndex = NULL_INDEX;
 				this->bstLeftIndex = NULL_INDEX;
 				this->bstRightIndex = NULL_INDEX;
 				return *this;
 			}
-		} _elements[L];
+		} _elementNodes[L];
+		struct ElementInfo
+		{
+			uint32 povIndex;
+			uint32 bstHeight; // height of subtree with this element as root (leaf: 1)
+		} _elementInfos[L];
+		T _elementValues[L];
 		uint64 _population;
 		uint64 _markRemovalCounter;
 
@@ -486,8 +492,7 @@ namespace QPI
 		sint64 _tailIndex(const sint64 povIndex, const sint64 minPriority) const;
 
 		// Return index of parent element to insert a priority
-		sint64 _searchElement(const sint64 bstRootIndex,
-			const sint64 priority, int* pIterationsCount = nullptr) const;
+		sint64 _searchElement(const sint64 bstRootIndex, const sint64 priority) const;
 
 		// Add element to priority queue, return elementIndex of new element
 		sint64 _addPovElement(const sint64 povIndex, const T value, const sint64 priority);
@@ -498,9 +503,23 @@ namespace QPI
 		// Fill a sint64_4 vector with specified values
 		inline void _set(sint64_4& vec, sint64 v0, sint64 v1, sint64 v2, sint64 v3) const;
 
-		// Rebuild pov's elements indexing as balanced BST
+		// Rebuild pov's elements indexing as balanced BST (including heights), return new root
 		sint64 _rebuild(sint64 rootIdx);
 
+		// Return height of subtree with root elementIdx (0 for NULL_INDEX)
+		inline uint32 _height(const sint64 elementIdx) const;
+
+		// Recompute height of element from heights of its children
+		inline void _updateHeight(const sint64 elementIdx);
+
+		// Rotate subtree left / right, return element index of new root of subtree
+		sint64 _rotateLeft(sint64& rootIdx, const sint64 elementIdx);
+		sint64 _rotateRight(sint64& rootIdx, const sint64 elementIdx);
+
+		// Update heights and rotate where needed to restore AVL balance, starting at elementIdx and going up to the root
+		// until the height of a subtree doesn't change anymore
+		void _rebalance(sint64& rootIdx, sint64 elementIdx);
+
 		// Return most left element index
 		sint64 _getMostLeft(sint64 elementIdx) const;
 
@@ -522,6 +541,11 @@ namespace QPI
 		// Read and encode 32 POV occupation flags, return a 64bits number presents 32 occupation flags
 		uint64 _getEncodedPovOccupationFlags(const uint64* povOccupationFlags, const sint64 povIndex) const;;
 
+		// Convert collection loaded from a state saved with the former element layout (array of structs with value, priority,
+		// povIndex, and BST links per element) to the current layout. Only used by the core when loading old state files.
+		template <typename T2, uint64 L2>
+		friend bool migrateCollectionFromElementArrayLayout(Collection<T2, L2>& coll);
+
 	public:
 		// Add element to priority queue of ID pov, return elementIndex of new element
 		sint64 add(const id& pov, T element, sint64 priority);
@@ -5,6 +5,7 @@
 #include "platform/time.h"
 #include "platform/memory_util.h"
 #include "platform/debugging.h"
+#include "platform/file_io.h"
 
 #include "network_messages/header.h"
 #include "network_messages/logging.h"
@@ -31,6 +32,23 @@ struct Peer;
 #define LOG_BUFFER_SIZE 8589934592ULL // 8GiB
 #endif
 #define LOG_MAX_STORAGE_ENTRIES (LOG_BUFFER_SIZE / sizeof(QuTransfer)) // Adjustable: here we assume most of logs are just qu transfer
+#define LOG_BUFFER_SEGMENT_SIZE 16777216ULL // 16MiB, granularity of checking if log has been overwritten in round buffer
+#define LOG_BUFFER_SEGMENTS ((LOG_BUFFER_SIZE + LOG_BUFFER_SEGMENT_SIZE - 1) / LOG_BUFFER_SEGMENT_SIZE)
+#define LOG_ARCHIVE_SEGMENT_SIZE 4194304ULL // 4MiB, size of files saved if LOG_ARCHIVE is enabled (may be larger for single big log)
+#define LOG_ARCHIVE_MAX_SEGMENTS 65536 // max number of files saved per epoch if LOG_ARCHIVE is enabled
+#ifndef LOG_ARCHIVE_DIRECTORY
+#define LOG_ARCHIVE_DIRECTORY L"logs"
+#endif
+#define LOG_MAX_SUBSCRIPTIONS 16
+#define LOG_SUBSCRIPTION_MAX_RANGES 4096 // per subscription and tick, if exceeded logs in between are pushed even if not matching
+#define LOG_SUBSCRIPTION_BATCH_SIZE 1048576 // 1MiB, max size of message with logs pushed to subscriber (unless single log is larger)
+#ifndef LOG_ENTITY_INDEX_CAPACITY
+#define LOG_ENTITY_INDEX_CAPACITY 4194304 // max number of entities in index if LOG_ENTITY_INDEX is enabled (power of 2)
+#endif
+#ifndef LOG_ENTITY_INDEX_CHUNKS
+#define LOG_ENTITY_INDEX_CHUNKS 16777216 // max number of chunks with log IDs in index if LOG_ENTITY_INDEX is enabled
+#endif
+#define LOG_ENTITY_INDEX_MAX_RESPONSE_IDS 65536
 #define LOG_TX_INFO_STORAGE (MAX_NUMBER_OF_TICKS_PER_EPOCH * LOG_TX_PER_TICK) 
 #define LOG_HEADER_SIZE 26 // 2 bytes epoch + 4 bytes tick + 4 bytes log size/types + 8 bytes log id + 8 bytes log digest
 
@@ -232,7 +250,103 @@ public:
     inline static BlobInfo* mapTxToLogId = NULL;
     inline static BlobInfo* mapLogIdToBufferIndex = NULL;
     inline static unsigned long long logBufferTail;
+    // first log ID written to each segment of logBuffer in the latest pass through the round buffer
+    inline static unsigned long long logBufferSegmentFirstLogId[LOG_BUFFER_SEGMENTS];
     inline static unsigned long long logId;
+#if LOG_ARCHIVE
+    // Contiguous part of logBuffer with logs that are saved to one file of the log archive
+    struct ArchiveSegment
+    {
+        unsigned long long firstLogId;
+        unsigned long long bufferStart;
+        unsigned long long size;
+        unsigned int numberOfLogs;
+        volatile char state;
+        FileItem* pendingSave;
+
+        enum
+        {
+            kSealed = 0, // complete, not saved yet
+            kSaved = 1,
+            kFailed = 2,
+        };
+    };
+
+    inline static ArchiveSegment* archiveSegments = NULL; // sorted by log ID
+    inline static volatile unsigned int numberOfArchiveSegments; // number of sealed segments
+    inline static unsigned int firstUnsubmittedArchiveSegment;
+    inline static unsigned int firstUnsavedArchiveSegment;
+    inline static ArchiveSegment openArchiveSegment; // logs not sealed yet
+    inline static unsigned short archiveEpoch;
+    // Buffer holding an archive segment loaded for serving requests. Loading is done without holding archiveReadLock,
+    // the buffer is protected by the count of request processors using it (loading or reading).
+    struct ArchiveReadBuffer
+    {
+        char* data;
+        long long segment; // index of segment in data, -1 if none or still loading
+        unsigned int users;
+    };
+    static constexpr unsigned int numberOfArchiveReadBuffers = 2;
+    inline static ArchiveReadBuffer archiveReadBuffers[numberOfArchiveReadBuffers] = {};
+    inline static volatile char archiveReadLock = 0; // protects archiveSegments and archiveReadBuffers (except data)
+    static constexpr unsigned long long archiveReadBufferSize = (LOG_ARCHIVE_SEGMENT_SIZE > LOG_HEADER_SIZE + RequestResponseHeader::max_size) ? LOG_ARCHIVE_SEGMENT_SIZE : LOG_HEADER_SIZE + RequestResponseHeader::max_size;
+#endif
+    // Subscription to logs matching a filter, see RequestLogSubscription
+    struct LogSubscription
+    {
+        Peer* peer; // NULL if slot is free
+        void* connection; // connection of peer when subscribing, to detect that it has been closed
+        m256i publicKey;
+        unsigned long long messageTypeFlags;
+        unsigned int contractIndex;
+        unsigned int dejavu;
+        unsigned int numberOfRanges; // ranges of matching log IDs in logSubscriptionRanges that need to be pushed
+    };
+    struct LogIdRange
+    {
+        unsigned long long fromLogId;
+        unsigned long long toLogId; // inclusive
+    };
+
+    inline static LogSubscription logSubscriptions[LOG_MAX_SUBSCRIPTIONS];
+    inline static LogIdRange* logSubscriptionRanges = NULL; // LOG_SUBSCRIPTION_MAX_RANGES per subscription
+    inline static char* logSubscriptionBatch = NULL;
+    inline static volatile unsigned int numberOfLogSubscriptions = 0;
+    inline static volatile char logSubscriptionLock = 0;
+
+#if LOG_ENTITY_INDEX
+    // Part of the list of log IDs of an entity, allocated from arena entityLogIdChunks. Besides the links to the
+    // previous and next chunk, each chunk has a jump link to an earlier chunk of the list (skew-binary jump pointers),
+    // so the chunk containing a log ID can be found in O(log(number of chunks)) by walking backwards from the last chunk.
+    struct EntityLogIdChunk
+    {
+        static constexpr unsigned int capacity = 13;
+
+        unsigned long long logIds[capacity];
+        unsigned int next; // index of next chunk, 0 if last
+        unsigned int prev; // index of previous chunk, 0 if first
+        unsigned int jump; // index of earlier chunk (itself if first)
+        unsigned int position; // position in list of entity (0 if first)
+        unsigned int numberOfLogIds;
+        unsigned int _padding;
+    };
+
+    // Entry of hash map from entity to log ID list
+    struct EntityLogIds
+    {
+        m256i publicKey; // zero if empty
+        unsigned int firstChunk;
+        unsigned int lastChunk;
+    };
+
+    inline static EntityLogIds* entityLogIds = NULL;
+    inline static EntityLogIdChunk* entityLogIdChunks = NULL; // chunk 0 is unused
+    inline static unsigned int numberOfEntityLogIdChunks;
+    inline static unsigned int numberOfIndexedEntities;
+    inline static bool entityLogIndexIncomplete;
+    inline static volatile char entityLogIndexLock = 0;
+#endif
+
     inline static unsigned int tickBegin; // initial tick of the epoch
     inline static unsigned int tickLoadedFrom; // tick that this node load from (save/load state feature)
     inline static unsigned int lastUpdatedTick; // tick number that the system has generated all log
@@ -269,31 +383,232 @@ public:
         return sizeAndType & 0xFFFFFF; // last 24 bits are message size
     }
 
-    // since we use round buffer, verifying digest for each log is needed to avoid sending out wrong log
-    static bool verifyLog(const char* ptr, unsigned long long logId)
+    // since we use round buffer, checking that a log hasn't been overwritten is needed to avoid sending out wrong log.
+    // The log is valid if the segment containing its start hasn't been entered again after writing the log. This
+    // is checked in O(1) and may reject a log that is in the segment currently being overwritten but still intact.
+    static bool verifyLog(long long startIndex, unsigned long long logId)
     {
 #if ENABLED_LOGGING
-        if (getLogId(ptr) != logId)
+        if (startIndex < 0 || logId >= qLogger::logId)
         {
             return false;
         }
-        unsigned long long computedLogDigest = 0;
-        unsigned long long logDigest = getLogDigest(ptr);
+        if (logId < logBufferSegmentFirstLogId[startIndex / LOG_BUFFER_SEGMENT_SIZE])
+        {
+            // segment has been overwritten
+            return false;
+        }
+        if (getLogId(logBuffer + startIndex) != logId)
+        {
+            // entry of map has been reused by newer log
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    // the stored digest is only needed for checking integrity of log content (overwriting is checked by verifyLog())
+    static bool verifyLogDigest(const char* ptr)
+    {
         unsigned int msgSize = getLogSize(ptr);
         if (msgSize >= RequestResponseHeader::max_size)
         {
             // invalid size
             return false;
         }
+        unsigned long long computedLogDigest = 0;
         KangarooTwelve(ptr + LOG_HEADER_SIZE, msgSize, &computedLogDigest, 8);
-        if (logDigest != computedLogDigest)
+        return getLogDigest(ptr) == computedLogDigest;
+    }
+
+    static unsigned long long getLogTypeFlag(unsigned char messageType)
+    {
+        return (messageType == CUSTOM_MESSAGE) ? (1ULL << 63) : (1ULL << messageType);
+    }
+
+    // check if log message matches filter of subscription
+    static bool matchesLogSubscription(const LogSubscription& subscription, unsigned char messageType, const void* message, unsigned int messageSize)
+    {
+        if (!(subscription.messageTypeFlags & getLogTypeFlag(messageType)))
         {
             return false;
         }
-#endif
+
+        if (subscription.contractIndex)
+        {
+            switch (messageType)
+            {
+            case CONTRACT_ERROR_MESSAGE:
+            case CONTRACT_WARNING_MESSAGE:
+            case CONTRACT_INFORMATION_MESSAGE:
+            case CONTRACT_DEBUG_MESSAGE:
+                if (*((const unsigned int*)message) != subscription.contractIndex)
+                {
+                    return false;
+                }
+                break;
+            case ASSET_OWNERSHIP_MANAGING_CONTRACT_CHANGE:
+            {
+                const AssetOwnershipManagingContractChange* change = (const AssetOwnershipManagingContractChange*)message;
+                if (change->sourceContractIndex != subscription.contractIndex && change->destinationContractIndex != subscription.contractIndex)
+                {
+                    return false;
+                }
+                break;
+            }
+            case ASSET_POSSESSION_MANAGING_CONTRACT_CHANGE:
+            {
+                const AssetPossessionManagingContractChange* change = (const AssetPossessionManagingContractChange*)message;
+                if (change->sourceContractIndex != subscription.contractIndex && change->destinationContractIndex != subscription.contractIndex)
+                {
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+
+        if (!isZero(subscription.publicKey))
+        {
+            const m256i& publicKey = subscription.publicKey;
+            switch (messageType)
+            {
+            case QU_TRANSFER:
+            {
+                const QuTransfer* transfer = (const QuTransfer*)message;
+                return transfer->sourcePublicKey == publicKey || transfer->destinationPublicKey == publicKey;
+            }
+            case ASSET_ISSUANCE:
+                return ((const AssetIssuance*)message)->issuerPublicKey == publicKey;
+            case ASSET_OWNERSHIP_CHANGE:
+            {
+                const AssetOwnershipChange* change = (const AssetOwnershipChange*)message;
+                return change->sourcePublicKey == publicKey || change->destinationPublicKey == publicKey || change->issuerPublicKey == publicKey;
+            }
+            case ASSET_POSSESSION_CHANGE:
+            {
+                const AssetPossessionChange* change = (const AssetPossessionChange*)message;
+                return change->sourcePublicKey == publicKey || change->destinationPublicKey == publicKey || change->issuerPublicKey == publicKey;
+            }
+            case ASSET_OWNERSHIP_MANAGING_CONTRACT_CHANGE:
+            {
+                const AssetOwnershipManagingContractChange* change = (const AssetOwnershipManagingContractChange*)message;
+                return change->ownershipPublicKey == publicKey || change->issuerPublicKey == publicKey;
+            }
+            case ASSET_POSSESSION_MANAGING_CONTRACT_CHANGE:
+            {
+                const AssetPossessionManagingContractChange* change = (const AssetPossessionManagingContractChange*)message;
+                return change->possessionPublicKey == publicKey || change->ownershipPublicKey == publicKey || change->issuerPublicKey == publicKey;
+            }
+            case BURNING:
+                return ((const Burning*)message)->sourcePublicKey == publicKey;
+            case DUST_BURNING:
+            {
+                // entities are not aligned in message
+                const unsigned short numberOfBurns = *((const unsigned short*)message);
+                const char* entities = (const char*)message + sizeof(numberOfBurns);
+                m256i entityPublicKey;
+                for (unsigned int i = 0; i < numberOfBurns && sizeof(numberOfBurns) + (i + 1) * sizeof(DustBurning::Entity) <= messageSize; ++i)
+                {
+                    copyMem(&entityPublicKey, entities + i * sizeof(DustBurning::Entity), sizeof(entityPublicKey));
+                    if (entityPublicKey == publicKey)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            default:
+                return false;
+            }
+        }
+
         return true;
     }
 
+    // Add / replace (if messageTypeFlags != 0) or remove (if messageTypeFlags == 0) subscription of peer connection.
+    // Returns ID of first log that may be pushed or -1 if not subscribed. logSubscriptionLock must be locked.
+    static long long subscribeLogs(Peer* peer, void* connection, unsigned int dejavu, const m256i& publicKey, unsigned long long messageTypeFlags, unsigned int contractIndex)
+    {
+#if ENABLED_LOGGING
+        int slot = -1;
+        for (int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+        {
+            if (logSubscriptions[i].peer == peer && logSubscriptions[i].connection == connection)
+            {
+                slot = i;
+                break;
+            }
+            if (slot < 0 && !logSubscriptions[i].peer)
+            {
+                slot = i;
+            }
+        }
+        if (slot < 0)
+        {
+            return -1;
+        }
+
+        LogSubscription& subscription = logSubscriptions[slot];
+        if (!messageTypeFlags)
+        {
+            if (subscription.peer)
+            {
+                unsubscribeLogs(slot);
+            }
+            return -1;
+        }
+        if (!subscription.peer)
+        {
+            subscription.peer = peer;
+            subscription.connection = connection;
+            subscription.numberOfRanges = 0;
+            ++numberOfLogSubscriptions;
+        }
+        subscription.publicKey = publicKey;
+        subscription.messageTypeFlags = messageTypeFlags;
+        subscription.contractIndex = contractIndex;
+        subscription.dejavu = dejavu;
+        return logId;
+#else
+        return -1;
+#endif
+    }
+
+    // logSubscriptionLock must be locked
+    static void unsubscribeLogs(unsigned int slot)
+    {
+        logSubscriptions[slot].peer = NULL;
+        --numberOfLogSubscriptions;
+    }
+
+    // Add log to ranges of subscriptions that it matches. logSubscriptionLock must be locked.
+    static void addLogToSubscriptions(unsigned long long logId, unsigned char messageType, const void* message, unsigned int messageSize)
+    {
+        for (unsigned int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+        {
+            LogSubscription& subscription = logSubscriptions[i];
+            if (!subscription.peer || !matchesLogSubscription(subscription, messageType, message, messageSize))
+            {
+                continue;
+            }
+            LogIdRange* ranges = logSubscriptionRanges + i * LOG_SUBSCRIPTION_MAX_RANGES;
+            if (subscription.numberOfRanges && (ranges[subscription.numberOfRanges - 1].toLogId + 1 == logId || subscription.numberOfRanges == LOG_SUBSCRIPTION_MAX_RANGES))
+            {
+                // extend last range (also including non-matching logs if no range is left)
+                ranges[subscription.numberOfRanges - 1].toLogId = logId;
+            }
+            else
+            {
+                ranges[subscription.numberOfRanges].fromLogId = logId;
+                ranges[subscription.numberOfRanges].toLogId = logId;
+                ++subscription.numberOfRanges;
+            }
+        }
+    }
+
 #if ENABLED_LOGGING
     // Struct to map log buffer from log id    
     static struct mapLogIdToBuffer
@@ -305,11 +620,12 @@ public:
             {
                 mapLogIdToBufferIndex[i] = null_blob;
             }
+            setMem(logBufferSegmentFirstLogId, sizeof(logBufferSegmentFirstLogId), 0);
         }
         static long long getIndex(unsigned long long logId)
         {
             BlobInfo res = mapLogIdToBufferIndex[logId % LOG_MAX_STORAGE_ENTRIES];
-            if (verifyLog(logBuffer + res.startIndex, logId))
+            if (verifyLog(res.startIndex, logId))
             {
                 return res.startIndex;
             }
@@ -319,7 +635,7 @@ public:
         static BlobInfo getBlobInfo(unsigned long long logId)
         {
             BlobInfo res = mapLogIdToBufferIndex[logId % LOG_MAX_STORAGE_ENTRIES];
-            if (verifyLog(logBuffer + res.startIndex, logId))
+            if (verifyLog(res.startIndex, logId))
             {
                 return res;
             }
@@ -387,6 +703,404 @@ public:
             }
         }
     } tx;
+
+#if LOG_ARCHIVE
+    // Archive saving segments of logBuffer to disk via AsyncFileIO (in the main thread), so logs can still be
+    // requested after logBuffer has been overwritten. Logs are written by one thread at a time (tick processor).
+    // Requests of archived logs are served from a few buffers holding the segments loaded last. Disk reads are done
+    // without holding archiveReadLock, so requests of buffered segments aren't blocked by loading another segment.
+    static struct LogArchive
+    {
+        static void init()
+        {
+            numberOfArchiveSegments = 0;
+            firstUnsubmittedArchiveSegment = 0;
+            firstUnsavedArchiveSegment = 0;
+            openArchiveSegment.numberOfLogs = 0;
+            archiveEpoch = system.epoch;
+            for (unsigned int i = 0; i < numberOfArchiveReadBuffers; ++i)
+            {
+                ASSERT(archiveReadBuffers[i].users == 0);
+                archiveReadBuffers[i].segment = -1;
+            }
+        }
+
+        static bool isReadBufferUsed()
+        {
+            for (unsigned int i = 0; i < numberOfArchiveReadBuffers; ++i)
+            {
+                if (archiveReadBuffers[i].users)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static void getFileName(CHAR16* fileName, unsigned int segmentIndex)
+        {
+            // "logArchive000000.???" with segment index and epoch
+            setText(fileName, L"logArchive000000.???");
+            for (int i = 15; i >= 10; --i)
+            {
+                fileName[i] = L'0' + segmentIndex % 10;
+                segmentIndex /= 10;
+            }
+            addEpochToFileName(fileName, 21, archiveEpoch);
+        }
+
+        // Add the log that is going to be written to logBuffer[bufferStart, bufferStart + size). Waits until
+        // segments that will be overwritten have been saved.
+        static void addLog(unsigned long long logId, unsigned long long bufferStart, unsigned long long size)
+        {
+            ArchiveSegment& open = openArchiveSegment;
+            if (open.numberOfLogs && (bufferStart != open.bufferStart + open.size || open.size + size > LOG_ARCHIVE_SEGMENT_SIZE))
+            {
+                seal();
+            }
+            if (!open.numberOfLogs)
+            {
+                open.firstLogId = logId;
+                open.bufferStart = bufferStart;
+                open.size = 0;
+            }
+            ++open.numberOfLogs;
+            open.size += size;
+
+            processSaves(bufferStart, bufferStart + size);
+        }
+
+        // Seal open segment so it will be saved
+        static void seal()
+        {
+            if (!openArchiveSegment.numberOfLogs)
+            {
+                return;
+            }
+            if (numberOfArchiveSegments < LOG_ARCHIVE_MAX_SEGMENTS)
+            {
+                ArchiveSegment& segment = archiveSegments[numberOfArchiveSegments];
+                segment = openArchiveSegment;
+                segment.state = ArchiveSegment::kSealed;
+                segment.pendingSave = NULL;
+                _mm_sfence();
+                ++numberOfArchiveSegments;
+            }
+            openArchiveSegment.numberOfLogs = 0;
+        }
+
+        // Submit saving of sealed segments and finish processed saves. Wait for saves of segments overlapping
+        // logBuffer[overwriteBegin, overwriteEnd), which is going to be overwritten.
+        static void processSaves(unsigned long long overwriteBegin, unsigned long long overwriteEnd)
+        {
+            CHAR16 fileName[21];
+            for (; firstUnsubmittedArchiveSegment < numberOfArchiveSegments; ++firstUnsubmittedArchiveSegment)
+            {
+                ArchiveSegment& segment = archiveSegments[firstUnsubmittedArchiveSegment];
+                getFileName(fileName, firstUnsubmittedArchiveSegment);
+                segment.pendingSave = (gAsyncFileIO) ? gAsyncFileIO->beginBlockingSave(fileName, segment.size, (unsigned char*)logBuffer + segment.bufferStart, LOG_ARCHIVE_DIRECTORY) : NULL;
+                if (!segment.pendingSave)
+                {
+                    // queue is full, retry later
+                    break;
+                }
+            }
+            for (; firstUnsavedArchiveSegment < numberOfArchiveSegments; ++firstUnsavedArchiveSegment)
+            {
+                ArchiveSegment& segment = archiveSegments[firstUnsavedArchiveSegment];
+                const bool overwritten = segment.bufferStart < overwriteEnd && overwriteBegin < segment.bufferStart + segment.size;
+                if (segment.pendingSave)
+                {
+                    if (!overwritten && !segment.pendingSave->isProcessed())
+                    {
+                        break;
+                    }
+                    const long long result = gAsyncFileIO->waitFor(segment.pendingSave);
+                    segment.pendingSave = NULL;
+                    segment.state = (result == (long long)segment.size) ? ArchiveSegment::kSaved : ArchiveSegment::kFailed;
+                }
+                else
+                {
+                    if (!overwritten)
+                    {
+                        break;
+                    }
+                    // not submitted before being overwritten (AsyncFileIO not available or queue full)
+                    segment.state = ArchiveSegment::kFailed;
+                    if (firstUnsubmittedArchiveSegment == firstUnsavedArchiveSegment)
+                    {
+                        ++firstUnsubmittedArchiveSegment;
+                    }
+                }
+            }
+        }
+
+        // Seal open segment and wait until all segments are saved
+        static void flush()
+        {
+            seal();
+            processSaves(0, LOG_BUFFER_SIZE);
+        }
+
+        // Get logs [fromId, toId] of the same archive segment that fit into maxSize bytes. If found, returns pointer
+        // to the logs, sets toId, size, and readBufferIndex, and keeps the read buffer in use until unlockLogs() is
+        // called. Returns NULL if the logs aren't available or all read buffers are in use (request again later).
+        static const char* lockLogs(unsigned long long fromId, unsigned long long& toId, long long maxSize, long long& size, unsigned int& readBufferIndex)
+        {
+            ACQUIRE(archiveReadLock);
+
+            // find last segment with firstLogId <= fromId
+            unsigned int begin = 0, end = numberOfArchiveSegments;
+            while (end - begin > 1)
+            {
+                const unsigned int middle = (begin + end) / 2;
+                if (archiveSegments[middle].firstLogId <= fromId)
+                    begin = middle;
+                else
+                    end = middle;
+            }
+            const ArchiveSegment* segment = (begin < end) ? &archiveSegments[begin] : NULL;
+            if (!segment || fromId < segment->firstLogId || fromId >= segment->firstLogId + segment->numberOfLogs
+                || toId < fromId || segment->state != ArchiveSegment::kSaved)
+            {
+                RELEASE(archiveReadLock);
+                return NULL;
+            }
+            const unsigned long long segmentFirstLogId = segment->firstLogId;
+            const unsigned long long segmentNumberOfLogs = segment->numberOfLogs;
+            const unsigned long long segmentSize = segment->size;
+
+            // use buffer holding the segment or load it into a buffer that isn't used
+            readBufferIndex = numberOfArchiveReadBuffers;
+            unsigned int unusedBufferIndex = numberOfArchiveReadBuffers;
+            for (unsigned int i = 0; i < numberOfArchiveReadBuffers; ++i)
+            {
+                if (archiveReadBuffers[i].segment == begin)
+                {
+                    readBufferIndex = i;
+                    break;
+                }
+                if (!archiveReadBuffers[i].users && (unusedBufferIndex == numberOfArchiveReadBuffers || archiveReadBuffers[i].segment < 0))
+                {
+                    unusedBufferIndex = i;
+                }
+            }
+            if (readBufferIndex < numberOfArchiveReadBuffers)
+            {
+                ++archiveReadBuffers[readBufferIndex].users;
+                RELEASE(archiveReadLock);
+            }
+            else
+            {
+                if (unusedBufferIndex == numberOfArchiveReadBuffers)
+                {
+                    RELEASE(archiveReadLock);
+                    return NULL;
+                }
+                readBufferIndex = unusedBufferIndex;
+                ArchiveReadBuffer& buffer = archiveReadBuffers[readBufferIndex];
+                buffer.segment = -1;
+                buffer.users = 1;
+                RELEASE(archiveReadLock);
+
+                CHAR16 fileName[21];
+                getFileName(fileName, begin);
+                const bool loaded = (asyncLoad(fileName, segmentSize, (unsigned char*)buffer.data, LOG_ARCHIVE_DIRECTORY) == (long long)segmentSize);
+
+                ACQUIRE(archiveReadLock);
+                if (!loaded)
+                {
+                    --buffer.users;
+                    RELEASE(archiveReadLock);
+                    return NULL;
+                }
+                buffer.segment = begin;
+                RELEASE(archiveReadLock);
+            }
+
+            const char* data = archiveReadBuffers[readBufferIndex].data;
+            unsigned long long offset = 0;
+            unsigned long long logId = segmentFirstLogId;
+            for (; logId < fromId; ++logId)
+            {
+                offset += LOG_HEADER_SIZE + getLogSize(data + offset);
+            }
+            const unsigned long long lastLogId = (toId < segmentFirstLogId + segmentNumberOfLogs) ? toId : segmentFirstLogId + segmentNumberOfLogs - 1;
+            size = 0;
+            for (; logId <= lastLogId; ++logId)
+            {
+                const long long logSize = LOG_HEADER_SIZE + getLogSize(data + offset + size);
+                if (size && size + logSize > maxSize)
+                {
+                    break;
+                }
+                size += logSize;
+            }
+            toId = logId - 1;
+            return data + offset;
+        }
+
+        static void unlockLogs(unsigned int readBufferIndex)
+        {
+            ASSERT(readBufferIndex < numberOfArchiveReadBuffers);
+            ACQUIRE(archiveReadLock);
+            ASSERT(archiveReadBuffers[readBufferIndex].users > 0);
+            --archiveReadBuffers[readBufferIndex].users;
+            RELEASE(archiveReadLock);
+        }
+    } archive;
+#endif
+
+#if LOG_ENTITY_INDEX
+    // Index of log IDs by entity for the current epoch. Logs are added by tick processor and read by request
+    // processors, both holding entityLogIndexLock.
+    static struct EntityLogIndex
+    {
+        static void init()
+        {
+            setMem(entityLogIds, LOG_ENTITY_INDEX_CAPACITY * sizeof(EntityLogIds), 0);
+            numberOfEntityLogIdChunks = 1;
+            numberOfIndexedEntities = 0;
+            entityLogIndexIncomplete = false;
+        }
+
+        // Return index of the slot of the entity or of the empty slot where it would be inserted
+        static unsigned int findSlot(const m256i& publicKey)
+        {
+            unsigned int index = publicKey.m256i_u32[0] & (LOG_ENTITY_INDEX_CAPACITY - 1);
+            while (!isZero(entityLogIds[index].publicKey) && entityLogIds[index].publicKey != publicKey)
+            {
+                index = (index + 1) & (LOG_ENTITY_INDEX_CAPACITY - 1);
+            }
+            return index;
+        }
+
+        // Allocate chunk and append it to list with last chunk prevChunk (0 if list is empty)
+        static unsigned int allocateChunk(unsigned int prevChunk)
+        {
+            if (numberOfEntityLogIdChunks >= LOG_ENTITY_INDEX_CHUNKS)
+            {
+                entityLogIndexIncomplete = true;
+                return 0;
+            }
+            const unsigned int chunkIndex = numberOfEntityLogIdChunks++;
+            EntityLogIdChunk& chunk = entityLogIdChunks[chunkIndex];
+            chunk.next = 0;
+            chunk.prev = prevChunk;
+            chunk.numberOfLogIds = 0;
+            if (!prevChunk)
+            {
+                chunk.position = 0;
+                chunk.jump = chunkIndex;
+            }
+            else
+            {
+                // jump over two equally long jumps if possible, otherwise to previous chunk
+                const EntityLogIdChunk& prev = entityLogIdChunks[prevChunk];
+                const EntityLogIdChunk& prevJump = entityLogIdChunks[prev.jump];
+                const EntityLogIdChunk& prevJumpJump = entityLogIdChunks[prevJump.jump];
+                chunk.position = prev.position + 1;
+                chunk.jump = (prev.position - prevJump.position == prevJump.position - prevJumpJump.position) ? prevJump.jump : prevChunk;
+                entityLogIdChunks[prevChunk].next = chunkIndex;
+            }
+            return chunkIndex;
+        }
+
+        // Append log ID to list of entity. entityLogIndexLock must be locked.
+        static void add(const m256i& publicKey, unsigned long long logId)
+        {
+            if (isZero(publicKey))
+            {
+                return;
+            }
+            EntityLogIds& entity = entityLogIds[findSlot(publicKey)];
+            if (isZero(entity.publicKey))
+            {
+                // keep hash map at most 3/4 full for short probing sequences
+                if (numberOfIndexedEntities >= LOG_ENTITY_INDEX_CAPACITY / 4 * 3)
+                {
+                    entityLogIndexIncomplete = true;
+                    return;
+                }
+                const unsigned int chunkIndex = allocateChunk(0);
+                if (!chunkIndex)
+                {
+                    return;
+                }
+                entity.publicKey = publicKey;
+                entity.firstChunk = chunkIndex;
+                entity.lastChunk = chunkIndex;
+                ++numberOfIndexedEntities;
+            }
+            else if (entityLogIdChunks[entity.lastChunk].numberOfLogIds == EntityLogIdChunk::capacity)
+            {
+                const unsigned int chunkIndex = allocateChunk(entity.lastChunk);
+                if (!chunkIndex)
+                {
+                    return;
+                }
+                entity.lastChunk = chunkIndex;
+            }
+            EntityLogIdChunk& chunk = entityLogIdChunks[entity.lastChunk];
+            chunk.logIds[chunk.numberOfLogIds++] = logId;
+        }
+
+        // Add last log to lists of source and destination
+        static void addLog(const m256i& sourcePublicKey, const m256i& destinationPublicKey)
+        {
+            ACQUIRE(entityLogIndexLock);
+            add(sourcePublicKey, logId - 1);
+            if (destinationPublicKey != sourcePublicKey)
+            {
+                add(destinationPublicKey, logId - 1);
+            }
+            RELEASE(entityLogIndexLock);
+        }
+
+        // Get up to maxLogIds log IDs >= fromLogId of entity in O(log(number of chunks of entity) + maxLogIds).
+        // Returns number of IDs written to logIds and sets moreLogIds. entityLogIndexLock must be locked.
+        static unsigned int getLogIds(const m256i& publicKey, unsigned long long fromLogId, unsigned long long* logIds, unsigned int maxLogIds, bool& moreLogIds)
+        {
+            moreLogIds = false;
+            if (isZero(publicKey))
+            {
+                return 0;
+            }
+            const EntityLogIds& entity = entityLogIds[findSlot(publicKey)];
+            if (isZero(entity.publicKey))
+            {
+                return 0;
+            }
+
+            // find last chunk starting with log ID <= fromLogId (or first chunk), skipping earlier chunks with jumps
+            unsigned int chunkIndex = entity.lastChunk;
+            while (chunkIndex != entity.firstChunk && entityLogIdChunks[chunkIndex].logIds[0] > fromLogId)
+            {
+                const EntityLogIdChunk& chunk = entityLogIdChunks[chunkIndex];
+                chunkIndex = (entityLogIdChunks[chunk.jump].logIds[0] > fromLogId) ? chunk.jump : chunk.prev;
+            }
+
+            unsigned int numberOfLogIds = 0;
+            for (; chunkIndex; chunkIndex = entityLogIdChunks[chunkIndex].next)
+            {
+                const EntityLogIdChunk& chunk = entityLogIdChunks[chunkIndex];
+                for (unsigned int i = 0; i < chunk.numberOfLogIds; ++i)
+                {
+                    if (chunk.logIds[i] >= fromLogId)
+                    {
+                        if (numberOfLogIds == maxLogIds)
+                        {
+                            moreLogIds = true;
+                            return numberOfLogIds;
+                        }
+                        logIds[numberOfLogIds++] = chunk.logIds[i];
+                    }
+                }
+            }
+            return numberOfLogIds;
+        }
+    } entityIndex;
+#endif
 #endif
 
     static void registerNewTx(const unsigned int tick, const unsigned int txId)
@@ -423,6 +1137,58 @@ public:
                 return false;
             }
         }
+        if (logSubscriptionRanges == NULL)
+        {
+            if (!allocPoolWithErrorLog(L"logSubscriptionRanges", LOG_MAX_SUBSCRIPTIONS * LOG_SUBSCRIPTION_MAX_RANGES * sizeof(LogIdRange), (void**)&logSubscriptionRanges, __LINE__))
+            {
+                return false;
+            }
+        }
+        if (logSubscriptionBatch == NULL)
+        {
+            if (!allocPoolWithErrorLog(L"logSubscriptionBatch", LOG_SUBSCRIPTION_BATCH_SIZE, (void**)&logSubscriptionBatch, __LINE__))
+            {
+                return false;
+            }
+        }
+        setMem(logSubscriptions, sizeof(logSubscriptions), 0);
+        numberOfLogSubscriptions = 0;
+#if LOG_ENTITY_INDEX
+        if (entityLogIds == NULL)
+        {
+            if (!allocPoolWithErrorLog(L"entityLogIds", LOG_ENTITY_INDEX_CAPACITY * sizeof(EntityLogIds), (void**)&entityLogIds, __LINE__))
+            {
+                return false;
+            }
+        }
+        if (entityLogIdChunks == NULL)
+        {
+            if (!allocPoolWithErrorLog(L"entityLogIdChunks", LOG_ENTITY_INDEX_CHUNKS * sizeof(EntityLogIdChunk), (void**)&entityLogIdChunks, __LINE__))
+            {
+                return false;
+            }
+        }
+#endif
+#if LOG_ARCHIVE
+        if (archiveSegments == NULL)
+        {
+            if (!allocPoolWithErrorLog(L"archiveSegments", LOG_ARCHIVE_MAX_SEGMENTS * sizeof(ArchiveSegment), (void**)&archiveSegments, __LINE__))
+            {
+                return false;
+            }
+        }
+        for (unsigned int i = 0; i < numberOfArchiveReadBuffers; ++i)
+        {
+            if (archiveReadBuffers[i].data == NULL)
+            {
+                if (!allocPoolWithErrorLog(L"archiveReadBuffer", archiveReadBufferSize, (void**)&archiveReadBuffers[i].data, __LINE__))
+                {
+                    return false;
+                }
+            }
+        }
+        archive.init();
+#endif
         reset(0, 0);
 #endif
         return true;
@@ -431,6 +1197,23 @@ public:
     static void deinitLogging()
     {
 #if ENABLED_LOGGING
+#if LOG_ARCHIVE
+        if (archiveSegments)
+        {
+            // logBuffer must not be freed before pending saves are done
+            archive.flush();
+            freePool(archiveSegments);
+            archiveSegments = nullptr;
+        }
+        for (unsigned int i = 0; i < numberOfArchiveReadBuffers; ++i)
+        {
+            if (archiveReadBuffers[i].data)
+            {
+                freePool(archiveReadBuffers[i].data);
+                archiveReadBuffers[i].data = nullptr;
+            }
+        }
+#endif
         if (logBuffer)
         {
             freePool(logBuffer);
@@ -446,14 +1229,64 @@ public:
             freePool(mapLogIdToBufferIndex);
             mapLogIdToBufferIndex = nullptr;
         }
+        if (logSubscriptionRanges)
+        {
+            freePool(logSubscriptionRanges);
+            logSubscriptionRanges = nullptr;
+        }
+        if (logSubscriptionBatch)
+        {
+            freePool(logSubscriptionBatch);
+            logSubscriptionBatch = nullptr;
+        }
+        setMem(logSubscriptions, sizeof(logSubscriptions), 0);
+        numberOfLogSubscriptions = 0;
+#if LOG_ENTITY_INDEX
+        if (entityLogIds)
+        {
+            freePool(entityLogIds);
+            entityLogIds = nullptr;
+        }
+        if (entityLogIdChunks)
+        {
+            freePool(entityLogIdChunks);
+            entityLogIdChunks = nullptr;
+        }
+#endif
 #endif
     }
 
     static void reset(unsigned int _tickBegin, unsigned int _tickLoadedFrom)
     {
 #if ENABLED_LOGGING
+#if LOG_ARCHIVE
+        // save logs of previous epoch / run before log IDs restart
+        archive.flush();
+        ACQUIRE(archiveReadLock);
+        while (archive.isReadBufferUsed())
+        {
+            // wait for request processors serving archived logs
+            RELEASE(archiveReadLock);
+            _mm_pause();
+            ACQUIRE(archiveReadLock);
+        }
+        archive.init();
+        RELEASE(archiveReadLock);
+#endif
         logBuf.init();
         tx.init();
+        // log IDs restart, so drop logs not pushed to subscribers yet
+        ACQUIRE(logSubscriptionLock);
+        for (unsigned int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+        {
+            logSubscriptions[i].numberOfRanges = 0;
+        }
+        RELEASE(logSubscriptionLock);
+#if LOG_ENTITY_INDEX
+        ACQUIRE(entityLogIndexLock);
+        entityIndex.init();
+        RELEASE(entityLogIndexLock);
+#endif
         logBufferTail = 0;
         logId = 0;
         lastUpdatedTick = 0;
@@ -475,6 +1308,15 @@ public:
         {
             logBufferTail = 0; // reset back to beginning
         }
+#if LOG_ARCHIVE
+        archive.addLog(logId, logBufferTail, LOG_HEADER_SIZE + messageSize);
+#endif
+        // mark segments entered by this log as overwritten before writing
+        const unsigned long long logEnd = logBufferTail + LOG_HEADER_SIZE + messageSize;
+        for (unsigned long long segment = (logBufferTail + LOG_BUFFER_SEGMENT_SIZE - 1) / LOG_BUFFER_SEGMENT_SIZE; segment * LOG_BUFFER_SEGMENT_SIZE < logEnd; ++segment)
+        {
+            logBufferSegmentFirstLogId[segment] = logId;
+        }
         logBuf.set(logId, logBufferTail, LOG_HEADER_SIZE + messageSize);
         *((unsigned short*)(logBuffer + (logBufferTail))) = system.epoch;
         *((unsigned int*)(logBuffer + (logBufferTail + 2))) = system.tick;
@@ -485,6 +1327,12 @@ public:
         *((unsigned long long*)(logBuffer + (logBufferTail + 18))) = logDigest;
         copyMem(logBuffer + (logBufferTail + LOG_HEADER_SIZE), message, messageSize);
         logBufferTail += LOG_HEADER_SIZE + messageSize;
+        if (numberOfLogSubscriptions)
+        {
+            ACQUIRE(logSubscriptionLock);
+            addLogToSubscriptions(logId - 1, messageType, message, messageSize);
+            RELEASE(logSubscriptionLock);
+        }
 #endif
     }
 
@@ -493,6 +1341,9 @@ public:
     {
 #if LOG_QU_TRANSFERS
         logMessage(offsetof(T, _terminator), QU_TRANSFER, &message);
+#if LOG_ENTITY_INDEX
+        entityIndex.addLog(message.sourcePublicKey, message.destinationPublicKey);
+#endif
 #endif
     }
 
@@ -509,6 +1360,9 @@ public:
     {
 #if LOG_ASSET_OWNERSHIP_CHANGES
         logMessage(offsetof(T, _terminator), ASSET_OWNERSHIP_CHANGE, &message);
+#if LOG_ENTITY_INDEX
+        entityIndex.addLog(message.sourcePublicKey, message.destinationPublicKey);
+#endif
 #endif
     }
 
@@ -517,6 +1371,9 @@ public:
     {
 #if LOG_ASSET_POSSESSION_CHANGES
         logMessage(offsetof(T, _terminator), ASSET_POSSESSION_CHANGE, &message);
+#if LOG_ENTITY_INDEX
+        entityIndex.addLog(message.sourcePublicKey, message.destinationPublicKey);
+#endif
 #endif
     }
 
@@ -636,6 +1493,15 @@ public:
 
     // get all log ID (mapping to tx id) from a tick
     static void processRequestTickTxLogInfo(Peer* peer, RequestResponseHeader* header);
+
+    // subscribe to logs matching filter
+    static void processRequestLogSubscription(Peer* peer, RequestResponseHeader* header);
+
+    // get log IDs of entity
+    static void processRequestEntityLogIds(Peer* peer, RequestResponseHeader* header);
+
+    // push logs of the tick to subscribers, called by tick processor after updateTick()
+    static void pushLogSubscriptions();
 };
 
 GLOBAL_VAR_DECL qLogger logger;
@@ -14,6 +14,7 @@ void qLogger::processRequestLog(Peer* peer, RequestResponseHeader* header)
         && request->passcode[2] == logReaderPasscodes[2]
         && request->passcode[3] == logReaderPasscodes[3])
     {
+        constexpr long long maxPayloadSize = RequestResponseHeader::max_size - sizeof(sizeof(RequestResponseHeader));
         BlobInfo startIdBufferRange = logBuf.getBlobInfo(request->fromID);
         BlobInfo endIdBufferRange = logBuf.getBlobInfo(request->toID); // inclusive
         if (startIdBufferRange.startIndex != -1 && startIdBufferRange.length != -1
@@ -41,7 +42,6 @@ void qLogger::processRequestLog(Peer* peer, RequestResponseHeader* header)
 
             long long startFrom = startIdBufferRange.startIndex;
             long long length = endIdBufferRange.length + endIdBufferRange.startIndex - startFrom;
-            constexpr long long maxPayloadSize = RequestResponseHeader::max_size - sizeof(sizeof(RequestResponseHeader));
             if (length > maxPayloadSize)
             {
                 length -= endIdBufferRange.length;
@@ -57,6 +57,23 @@ void qLogger::processRequestLog(Peer* peer, RequestResponseHeader* header)
         }
         else
         {
+#if LOG_ARCHIVE
+            if (startIdBufferRange.startIndex == -1)
+            {
+                // logs have been overwritten in logBuffer, try to load from disk (only logs of one archive segment
+                // are sent, the client requests the rest later; empty response if all read buffers are busy)
+                unsigned long long toID = request->toID;
+                long long length = 0;
+                unsigned int readBufferIndex;
+                const char* archivedLogs = archive.lockLogs(request->fromID, toID, maxPayloadSize, length, readBufferIndex);
+                if (archivedLogs)
+                {
+                    enqueueResponse(peer, (unsigned int)(length), RespondLog::type, header->dejavu(), archivedLogs);
+                    archive.unlockLogs(readBufferIndex);
+                    return;
+                }
+            }
+#endif
             enqueueResponse(peer, 0, RespondLog::type, header->dejavu(), NULL);
         }
         return;
@@ -155,3 +172,122 @@ void qLogger::processRequestTickTxLogInfo(Peer* peer, RequestResponseHeader* hea
 #endif
     enqueueResponse(peer, 0, ResponseAllLogIdRangesFromTick::type, header->dejavu(), NULL);
 }
+
+void qLogger::processRequestLogSubscription(Peer* peer, RequestResponseHeader* header)
+{
+#if ENABLED_LOGGING
+    RequestLogSubscription* request = header->getPayload<RequestLogSubscription>();
+    if (request->passcode[0] == logReaderPasscodes[0]
+        && request->passcode[1] == logReaderPasscodes[1]
+        && request->passcode[2] == logReaderPasscodes[2]
+        && request->passcode[3] == logReaderPasscodes[3])
+    {
+        // respond before pushing first logs
+        RespondLogSubscription response;
+        ACQUIRE(logSubscriptionLock);
+        response.fromLogId = subscribeLogs(peer, peer->connectAcceptToken.NewChildHandle, header->dejavu(),
+            request->publicKey, request->messageTypeFlags, request->contractIndex);
+        enqueueResponse(peer, sizeof(response), RespondLogSubscription::type, header->dejavu(), &response);
+        RELEASE(logSubscriptionLock);
+        return;
+    }
+#endif
+    enqueueResponse(peer, 0, RespondLogSubscription::type, header->dejavu(), NULL);
+}
+
+void qLogger::processRequestEntityLogIds(Peer* peer, RequestResponseHeader* header)
+{
+#if ENABLED_LOGGING && LOG_ENTITY_INDEX
+    RequestEntityLogIds* request = header->getPayload<RequestEntityLogIds>();
+    if (request->passcode[0] == logReaderPasscodes[0]
+        && request->passcode[1] == logReaderPasscodes[1]
+        && request->passcode[2] == logReaderPasscodes[2]
+        && request->passcode[3] == logReaderPasscodes[3])
+    {
+        // The response is built in the buffer of the request processor (after copying the request), so it can be
+        // enqueued after releasing entityLogIndexLock, which the tick processor needs for logging.
+        static_assert(sizeof(RequestResponseHeader) + sizeof(RespondEntityLogIds) + LOG_ENTITY_INDEX_MAX_RESPONSE_IDS * sizeof(unsigned long long) <= BUFFER_SIZE,
+            "Request processor buffer is too small for response.");
+        const m256i publicKey = request->publicKey;
+        const unsigned long long fromLogId = request->fromLogId;
+        const unsigned int dejavu = header->dejavu();
+        RespondEntityLogIds* response = header->getPayload<RespondEntityLogIds>();
+        unsigned long long* logIds = (unsigned long long*)(response + 1);
+        bool moreLogIds;
+
+        ACQUIRE(entityLogIndexLock);
+        response->numberOfLogIds = entityIndex.getLogIds(publicKey, fromLogId, logIds, LOG_ENTITY_INDEX_MAX_RESPONSE_IDS, moreLogIds);
+        response->flags = (moreLogIds ? RespondEntityLogIds::moreLogIds : 0)
+            | (entityLogIndexIncomplete ? RespondEntityLogIds::incompleteIndex : 0);
+        RELEASE(entityLogIndexLock);
+
+        response->fromTick = tickLoadedFrom;
+        response->_padding = 0;
+        enqueueResponse(peer, sizeof(RespondEntityLogIds) + response->numberOfLogIds * sizeof(unsigned long long),
+            RespondEntityLogIds::type, dejavu, response);
+        return;
+    }
+#endif
+    enqueueResponse(peer, 0, RespondEntityLogIds::type, header->dejavu(), NULL);
+}
+
+void qLogger::pushLogSubscriptions()
+{
+#if ENABLED_LOGGING
+    if (!numberOfLogSubscriptions)
+    {
+        return;
+    }
+
+    ACQUIRE(logSubscriptionLock);
+    for (unsigned int i = 0; i < LOG_MAX_SUBSCRIPTIONS; i++)
+    {
+        LogSubscription& subscription = logSubscriptions[i];
+        Peer* peer = subscription.peer;
+        if (!peer)
+        {
+            continue;
+        }
+        if (!peer->tcp4Protocol || !peer->isConnectedAccepted || peer->isClosing || peer->connectAcceptToken.NewChildHandle != subscription.connection)
+        {
+            // connection has been closed
+            unsubscribeLogs(i);
+            continue;
+        }
+
+        // gather logs of ranges in messages of up to LOG_SUBSCRIPTION_BATCH_SIZE
+        const LogIdRange* ranges = logSubscriptionRanges + i * LOG_SUBSCRIPTION_MAX_RANGES;
+        unsigned long long batchSize = 0;
+        for (unsigned int r = 0; r < subscription.numberOfRanges; r++)
+        {
+            for (unsigned long long id = ranges[r].fromLogId; id <= ranges[r].toLogId; id++)
+            {
+                const BlobInfo blob = logBuf.getBlobInfo(id);
+                if (blob.startIndex < 0)
+                {
+                    // already overwritten in logBuffer
+                    continue;
+                }
+                if (batchSize + blob.length > LOG_SUBSCRIPTION_BATCH_SIZE && batchSize)
+                {
+                    enqueueResponse(peer, (unsigned int)batchSize, RespondLog::type, subscription.dejavu, logSubscriptionBatch);
+                    batchSize = 0;
+                }
+                if (blob.length > LOG_SUBSCRIPTION_BATCH_SIZE)
+                {
+                    enqueueResponse(peer, (unsigned int)blob.length, RespondLog::type, subscription.dejavu, logBuffer + blob.startIndex);
+                    continue;
+                }
+                copyMem(logSubscriptionBatch + batchSize, logBuffer + blob.startIndex, blob.length);
+                batchSize += blob.length;
+            }
+        }
+        if (batchSize)
+        {
+            enqueueResponse(peer, (unsigned int)batchSize, RespondLog::type, subscription.dejavu, logSubscriptionBatch);
+        }
+        subscription.numberOfRanges = 0;
+    }
+    RELEASE(logSubscriptionLock);
+#endif
+}
@@ -73,4 +73,63 @@ struct ResponseAllLogIdRangesFromTick
     enum {
         type = 51,
     };
+};
+
+
+// Subscribe to logs matching the filter. After each tick, matching logs are pushed in RespondLog messages with the
+// dejavu of this request. A new subscription of the same connection replaces the previous one.
+struct RequestLogSubscription
+{
+    unsigned long long passcode[4];
+    m256i publicKey; // if not zero, only logs involving this entity (source, destination, issuer, owner, possessor)
+    unsigned long long messageTypeFlags; // bit N enables logs of type N (QU_TRANSFER = 0, ...), bit 63 enables custom messages; 0 unsubscribes
+    unsigned int contractIndex; // if not zero, only contract messages and managing contract changes of this contract
+
+    enum {
+        type = 55,
+    };
+};
+
+
+// Response to RequestLogSubscription
+struct RespondLogSubscription
+{
+    long long fromLogId; // ID of first log that may be pushed, -1 if not subscribed (unsubscribed or no free slot)
+
+    enum {
+        type = 56,
+    };
+};
+
+
+// Request IDs of logs of the current epoch involving the entity as source or destination of QU transfers and asset
+// ownership / possession changes (only answered by nodes with entity log index)
+struct RequestEntityLogIds
+{
+    unsigned long long passcode[4];
+    m256i publicKey;
+    unsigned long long fromLogId; // only IDs >= fromLogId are returned, for requesting more IDs after response with moreLogIds flag
+
+    enum {
+        type = 57,
+    };
+};
+
+
+// Response to RequestEntityLogIds, followed by numberOfLogIds log IDs (unsigned long long, ascending)
+struct RespondEntityLogIds
+{
+    unsigned int fromTick; // logs of earlier ticks are not indexed
+    unsigned int numberOfLogIds;
+    unsigned int flags;
+    unsigned int _padding;
+
+    enum {
+        moreLogIds = 1, // request again with fromLogId after last ID returned
+        incompleteIndex = 2, // some logs haven't been indexed, because index is full
+    };
+
+    enum {
+        type = 58,
+    };
 };
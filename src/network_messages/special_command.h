@@ -85,4 +85,88 @@ struct SpecialCommandSetConsoleLoggingModeRequestAndResponse
     unsigned char padding[7];
 };
 
+#define SPECIAL_COMMAND_GET_TICK_PROFILE 18ULL
+// Phases of processing a tick, measured in CPU cycles by the tick processor
+#define TICK_PROFILE_PHASE_TOTAL 0              // whole processTick()
+#define TICK_PROFILE_PHASE_BEGIN_TICK 1         // BEGIN_TICK procedures of contracts (including INITIALIZE and BEGIN_EPOCH in first tick)
+#define TICK_PROFILE_PHASE_SOLUTIONS 2          // scoring of mining solutions
+#define TICK_PROFILE_PHASE_TRANSACTIONS 3       // executing the transactions of the tick
+#define TICK_PROFILE_PHASE_END_TICK 4           // END_TICK procedures of contracts
+#define TICK_PROFILE_PHASE_SPECTRUM_DIGEST 5
+#define TICK_PROFILE_PHASE_UNIVERSE_DIGEST 6
+#define TICK_PROFILE_PHASE_COMPUTER_DIGEST 7
+#define TICK_PROFILE_PHASE_TICK_DATA 8          // preparing future tick data if node is tick leader
+#define TICK_PROFILE_PHASE_VOTES 9              // preparing vote counter and solution transactions of own computors
+#define TICK_PROFILE_PHASE_COUNT 10
+
+struct SpecialCommandGetTickProfileRequest
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned short epoch; // only current and previous epoch are available
+    unsigned char padding[6];
+};
+
+struct SpecialCommandGetTickProfileResponse
+{
+    struct PhaseStats
+    {
+        unsigned long long count;  // number of measured ticks
+        unsigned long long p50;    // median in CPU cycles (upper bound of histogram bucket)
+        unsigned long long p99;
+        unsigned long long max;
+    };
+
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned short epoch; // 0 if no profile of requested epoch is available
+    unsigned char padding[6];
+    unsigned long long frequency; // CPU cycles per second
+    PhaseStats phases[TICK_PROFILE_PHASE_COUNT];
+};
+
+#define SPECIAL_COMMAND_GET_CONTRACT_EXEC_PROFILE 19ULL
+// Kinds of contract entry points profiled by the contract execution profiler
+#define CONTRACT_EXEC_PROFILE_KIND_SYSTEM_PROCEDURE 0   // inputType is the SystemProcedureID (INITIALIZE, BEGIN_TICK, ...)
+#define CONTRACT_EXEC_PROFILE_KIND_USER_PROCEDURE 1
+#define CONTRACT_EXEC_PROFILE_KIND_USER_FUNCTION 2
+// Operations counted during execution of procedures (including nested calls of other contracts)
+#define CONTRACT_EXEC_PROFILE_OP_NESTED_CALLS 0         // contract functions and procedures entered, including the entry point
+#define CONTRACT_EXEC_PROFILE_OP_COLLECTION 1           // modifying Collection operations (add, remove, replace, cleanup, reset)
+#define CONTRACT_EXEC_PROFILE_OP_HASH_MAP 2             // modifying HashMap operations (set, remove, replace, cleanup, reset)
+#define CONTRACT_EXEC_PROFILE_OP_SPECTRUM 3             // QPI calls reading or changing balances of entities
+#define CONTRACT_EXEC_PROFILE_OP_UNIVERSE 4             // QPI calls reading or changing assets
+#define CONTRACT_EXEC_PROFILE_OP_COUNT 5
+
+struct SpecialCommandGetContractExecProfileRequest
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned short epoch; // only current and previous epoch are available
+    unsigned char padding[6];
+};
+
+struct ContractExecProfileEntry
+{
+    unsigned short contractIndex;
+    unsigned short inputType;
+    unsigned char kind;
+    unsigned char padding[3];
+    unsigned int maxLocalsStackBytes;   // max size of locals stack used by one call
+    unsigned long long count;           // number of calls
+    unsigned long long totalCycles;
+    unsigned long long p50;             // median in CPU cycles (upper bound of histogram bucket)
+    unsigned long long p99;
+    unsigned long long max;
+    unsigned long long ops[CONTRACT_EXEC_PROFILE_OP_COUNT]; // summed over all calls, only counted for procedures
+};
+
+template <unsigned int maxNumberOfEntries>
+struct SpecialCommandGetContractExecProfileResponse
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned short epoch; // 0 if no profile of requested epoch is available
+    unsigned char padding[2];
+    unsigned int numberOfEntries;
+    unsigned long long frequency; // CPU cycles per second
+    ContractExecProfileEntry entries[maxNumberOfEntries]; // only numberOfEntries are sent
+};
+
 #pragma pack(pop)
@@ -1,16 +1,16 @@
-#pragma once
-
-#include "memory_util.h"
-#include "debugging.h"
-
-typedef unsigned int CustomStackSizeType;
-typedef EFI_AP_PROCEDURE CustomStackProcessorFunc;
-
-// Function call stack with custom size that can be used for running a function on it. Memory is allocated with allocPoolWithErrorLog().
+#pragma once
+
+#include "memory_util.h"
+#include "debugging.h"
+
+typedef unsigned int CustomStackSizeType;
+typedef EFI_AP_PROCEDURE CustomStackProcessorFunc;
+
+// Function call stack with custom size that can be used for running a function on it. Memory is allocated with allocPoolWithErrorLog().
 class CustomStack
 {
 public:
-    // Constructor (disabled because not called without MS CRT, you need to call init() to init)
+    // Constructor (disabled because not called without MS CRT, you need to call init() to init)
     //CustomStack()
     //{
     //    init();
@@ -63,6 +63,18 @@ public:
         return 0;
     }
 
+    // Get lowest address of stack memory (nullptr if not allocated)
+    const char* getStackBottom() const
+    {
+        return stackBottom;
+    }
+
+    // Get address after highest address of stack memory (nullptr if not allocated)
+    const char* getStackTop() const
+    {
+        return stackTop;
+    }
+
     // Prepare function call with run()
     void setupFunction(CustomStackProcessorFunc functionToCall, void* dataToPassToFunction)
     {
@@ -0,0 +1,610 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "file_io.h"
+#include "memory_util.h"
+#include "parallel_job.h"
+
+// Compressed file format written by saveCompressed():
+// - CompressedFileHeader
+// - one record per block of compressedFileBlockSize bytes (the last block may be smaller), consisting of a 4 byte
+//   block header (block type in upper 2 bits, payload size in lower 30 bits) followed by the payload.
+//
+// Block types:
+// - zero: all bytes of the block are 0, no payload (fast path for the large empty parts of spectrum, universe, and
+//   contract states)
+// - raw: payload is the uncompressed block (used if the block doesn't compress)
+// - lz: payload is a stream of sequences (see compressBlock())
+//
+// Blocks are compressed and decompressed in parallel (see runParallelJob()) in batches of compressedFileBatchBlocks
+// blocks, so memory usage doesn't depend on the file size. Files without header (written by save() or by older
+// versions) are still loaded by loadCompressed().
+//
+// The header also stores a content version passed by the caller, which allows to detect files whose content has been
+// saved in a former format (content version 0 is reported for files without header).
+
+static constexpr unsigned long long compressedFileMagic = 0x3130465a43425551ULL; // "QUBCZF01"
+static constexpr unsigned int compressedFileBlockSize = 1 << 20;
+static constexpr unsigned int compressedFileBatchBlocks = 64;
+static constexpr unsigned long long compressedFileMinSize = 4096; // smaller files are saved uncompressed
+
+static constexpr unsigned int compressedBlockTypeZero = 0;
+static constexpr unsigned int compressedBlockTypeRaw = 1;
+static constexpr unsigned int compressedBlockTypeLz = 2;
+static constexpr unsigned int compressedBlockSizeMask = (1 << 30) - 1;
+
+static constexpr unsigned int compressionMinMatch = 4;
+static constexpr unsigned int compressionHashBits = 14;
+static constexpr unsigned long long compressionHashTableSize = sizeof(unsigned int) << compressionHashBits;
+
+struct CompressedFileHeader
+{
+    unsigned long long magic;
+    unsigned long long uncompressedSize;
+    unsigned int blockSize;
+    unsigned int contentVersion; // 0 in files written before content versions were introduced
+};
+
+static_assert(sizeof(CompressedFileHeader) < compressedFileMinSize, "Header must be smaller than uncompressed files");
+
+static void writeCompressionVarint(unsigned char* dst, unsigned int& pos, unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        dst[pos++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    dst[pos++] = (unsigned char)value;
+}
+
+static bool readCompressionVarint(const unsigned char* src, unsigned int srcSize, unsigned int& pos, unsigned int& value)
+{
+    value = 0;
+    for (unsigned int shift = 0; shift < 35; shift += 7)
+    {
+        if (pos >= srcSize)
+        {
+            return false;
+        }
+        const unsigned char byte = src[pos++];
+        value |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Append sequence with literals and match to dst. Returns false if dstCapacity would be exceeded.
+static bool writeCompressionSequence(unsigned char* dst, unsigned int& pos, unsigned int dstCapacity, const unsigned char* literals, unsigned int literalCount, unsigned int matchCode, unsigned int offset)
+{
+    // up to 5 bytes per varint
+    if ((unsigned long long)pos + literalCount + 15 > dstCapacity)
+    {
+        return false;
+    }
+    writeCompressionVarint(dst, pos, literalCount);
+    copyMem(dst + pos, literals, literalCount);
+    pos += literalCount;
+    writeCompressionVarint(dst, pos, matchCode);
+    if (matchCode)
+    {
+        writeCompressionVarint(dst, pos, offset);
+    }
+    return true;
+}
+
+// Return number of equal bytes of a and b (at most maxLength)
+static unsigned int compressionMatchLength(const unsigned char* a, const unsigned char* b, unsigned int maxLength)
+{
+    unsigned int length = 0;
+    while (length + 8 <= maxLength)
+    {
+        const unsigned long long diff = *((unsigned long long*)(a + length)) ^ *((unsigned long long*)(b + length));
+        if (diff)
+        {
+            return length + (unsigned int)(_tzcnt_u64(diff) >> 3);
+        }
+        length += 8;
+    }
+    while (length < maxLength && a[length] == b[length])
+    {
+        length++;
+    }
+    return length;
+}
+
+// Return number of zero bytes at beginning of data (at most maxLength)
+static unsigned int compressionZeroLength(const unsigned char* data, unsigned int maxLength)
+{
+    unsigned int length = 0;
+    while (length + 8 <= maxLength)
+    {
+        const unsigned long long value = *((unsigned long long*)(data + length));
+        if (value)
+        {
+            return length + (unsigned int)(_tzcnt_u64(value) >> 3);
+        }
+        length += 8;
+    }
+    while (length < maxLength && !data[length])
+    {
+        length++;
+    }
+    return length;
+}
+
+// Compress block of size bytes to dst using hashTable (compressionHashTableSize bytes) as workspace. Returns
+// compressed size, or 0 if it doesn't fit into dstCapacity bytes.
+//
+// The compressed stream is a sequence of [varint literalCount] [literals] [varint matchCode] [varint offset]. If
+// matchCode is 0, the block ends after the literals and there is no offset. Otherwise, the match of
+// matchCode + compressionMinMatch - 1 bytes is copied from offset bytes before the current output position, or it is
+// a run of zeros if offset is 0.
+static unsigned int compressBlock(const unsigned char* src, unsigned int size, unsigned char* dst, unsigned int dstCapacity, unsigned int* hashTable)
+{
+    setMem(hashTable, compressionHashTableSize, 0);
+    unsigned int dstPos = 0;
+    unsigned int anchor = 0;
+    unsigned int pos = 0;
+    while (pos + compressionMinMatch <= size)
+    {
+        const unsigned int value = *((unsigned int*)(src + pos));
+        unsigned int matchLength = 0;
+        unsigned int offset = 0;
+        if (!value)
+        {
+            matchLength = compressionZeroLength(src + pos, size - pos);
+        }
+        else
+        {
+            const unsigned int hash = (value * 2654435761U) >> (32 - compressionHashBits);
+            const unsigned int candidate = hashTable[hash];
+            hashTable[hash] = pos + 1;
+            if (candidate && *((unsigned int*)(src + candidate - 1)) == value)
+            {
+                offset = pos - (candidate - 1);
+                matchLength = compressionMatchLength(src + candidate - 1, src + pos, size - pos);
+            }
+        }
+
+        if (matchLength < compressionMinMatch)
+        {
+            // skip faster through data that doesn't compress
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        if (!writeCompressionSequence(dst, dstPos, dstCapacity, src + anchor, pos - anchor, matchLength - compressionMinMatch + 1, offset))
+        {
+            return 0;
+        }
+        pos += matchLength;
+        anchor = pos;
+    }
+
+    if (!writeCompressionSequence(dst, dstPos, dstCapacity, src + anchor, size - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return dstPos;
+}
+
+// Decompress block compressed with compressBlock(). Returns false if the compressed data is invalid.
+static bool decompressBlock(const unsigned char* src, unsigned int srcSize, unsigned char* dst, unsigned int dstSize)
+{
+    unsigned int srcPos = 0;
+    unsigned int dstPos = 0;
+    while (true)
+    {
+        unsigned int literalCount, matchCode, offset;
+        if (!readCompressionVarint(src, srcSize, srcPos, literalCount)
+            || literalCount > srcSize - srcPos || literalCount > dstSize - dstPos)
+        {
+            return false;
+        }
+        copyMem(dst + dstPos, src + srcPos, literalCount);
+        srcPos += literalCount;
+        dstPos += literalCount;
+
+        if (!readCompressionVarint(src, srcSize, srcPos, matchCode))
+        {
+            return false;
+        }
+        if (!matchCode)
+        {
+            return srcPos == srcSize && dstPos == dstSize;
+        }
+        if (!readCompressionVarint(src, srcSize, srcPos, offset)
+            || (unsigned long long)matchCode + compressionMinMatch - 1 > dstSize - dstPos
+            || offset > dstPos)
+        {
+            return false;
+        }
+        const unsigned int matchLength = matchCode + compressionMinMatch - 1;
+        if (!offset)
+        {
+            setMem(dst + dstPos, matchLength, 0);
+        }
+        else if (offset >= matchLength)
+        {
+            copyMem(dst + dstPos, dst + dstPos - offset, matchLength);
+        }
+        else
+        {
+            // overlapping match repeats pattern of offset bytes
+            for (unsigned int i = 0; i < matchLength; i++)
+            {
+                dst[dstPos + i] = dst[dstPos + i - offset];
+            }
+        }
+        dstPos += matchLength;
+    }
+}
+
+// Work of one batch of blocks processed by compressFileBlock() / decompressFileBlock() in parallel
+struct CompressedFileBatch
+{
+    // uncompressed data of first block of the batch
+    unsigned char* data;
+    unsigned long long dataSize;
+
+    // workspace of one block: 4 byte block header + compressed data (compressedFileBlockSize) + hash table
+    unsigned char* workspace;
+    static constexpr unsigned long long workspaceSize = 4 + compressedFileBlockSize + compressionHashTableSize;
+
+    unsigned int numberOfBlocks;
+    volatile long failed;
+
+    unsigned int blockSize(unsigned int blockIndex) const
+    {
+        const unsigned long long begin = (unsigned long long)blockIndex * compressedFileBlockSize;
+        return (unsigned int)((dataSize - begin < compressedFileBlockSize) ? dataSize - begin : compressedFileBlockSize);
+    }
+
+    // Size of workspace needed for all batches of file with totalSize bytes
+    static unsigned long long workspaceSizeForFile(unsigned long long totalSize)
+    {
+        const unsigned long long numberOfBlocks = (totalSize + compressedFileBlockSize - 1) / compressedFileBlockSize;
+        return ((numberOfBlocks < compressedFileBatchBlocks) ? numberOfBlocks : compressedFileBatchBlocks) * workspaceSize;
+    }
+
+    unsigned int& blockHeader(unsigned int blockIndex)
+    {
+        return *((unsigned int*)(workspace + blockIndex * workspaceSize));
+    }
+
+    unsigned char* blockPayload(unsigned int blockIndex)
+    {
+        return workspace + blockIndex * workspaceSize + 4;
+    }
+};
+
+static void compressFileBlock(void* context, unsigned int blockIndex)
+{
+    CompressedFileBatch& batch = *(CompressedFileBatch*)context;
+    const unsigned char* src = batch.data + (unsigned long long)blockIndex * compressedFileBlockSize;
+    const unsigned int size = batch.blockSize(blockIndex);
+    if (compressionZeroLength(src, size) == size)
+    {
+        batch.blockHeader(blockIndex) = compressedBlockTypeZero << 30;
+        return;
+    }
+    unsigned char* payload = batch.blockPayload(blockIndex);
+    const unsigned int compressedSize = compressBlock(src, size, payload, size - 1, (unsigned int*)(payload + compressedFileBlockSize));
+    if (compressedSize)
+    {
+        batch.blockHeader(blockIndex) = (compressedBlockTypeLz << 30) | compressedSize;
+    }
+    else
+    {
+        batch.blockHeader(blockIndex) = (compressedBlockTypeRaw << 30) | size;
+    }
+}
+
+static void decompressFileBlock(void* context, unsigned int blockIndex)
+{
+    CompressedFileBatch& batch = *(CompressedFileBatch*)context;
+    unsigned char* dst = batch.data + (unsigned long long)blockIndex * compressedFileBlockSize;
+    const unsigned int size = batch.blockSize(blockIndex);
+    const unsigned int blockHeader = batch.blockHeader(blockIndex);
+    switch (blockHeader >> 30)
+    {
+    case compressedBlockTypeZero:
+        setMem(dst, size, 0);
+        break;
+    case compressedBlockTypeLz:
+        if (!decompressBlock(batch.blockPayload(blockIndex), blockHeader & compressedBlockSizeMask, dst, size))
+        {
+            batch.failed = 1;
+        }
+        break;
+    default:
+        // raw blocks are read directly into destination
+        break;
+    }
+}
+
+// Save buffer of totalSize bytes to file in compressed format. Returns totalSize on success and -1 on error (like
+// save()). The size of the file is returned in storedSize if it is not NULL. The contentVersion is stored in the
+// header, which is omitted for files smaller than compressedFileMinSize. Must be called from the main thread in UEFI.
+static long long saveCompressed(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory = NULL, unsigned long long* storedSize = NULL, unsigned int contentVersion = 0)
+{
+    if (totalSize < compressedFileMinSize)
+    {
+        if (storedSize)
+        {
+            *storedSize = totalSize;
+        }
+        return save(fileName, totalSize, buffer, directory);
+    }
+
+    CompressedFileBatch batch;
+    if (!allocPoolWithErrorLog(L"compressedFileWorkspace", CompressedFileBatch::workspaceSizeForFile(totalSize), (void**)&batch.workspace, __LINE__))
+    {
+        return -1;
+    }
+    FileHandle file;
+    if (!openFile(file, fileName, true, directory))
+    {
+        freePool(batch.workspace);
+        return -1;
+    }
+
+    CompressedFileHeader header;
+    header.magic = compressedFileMagic;
+    header.uncompressedSize = totalSize;
+    header.blockSize = compressedFileBlockSize;
+    header.contentVersion = contentVersion;
+    bool ok = writeFile(file, sizeof(header), (unsigned char*)&header);
+    unsigned long long fileSize = sizeof(header);
+
+    for (unsigned long long batchBegin = 0; ok && batchBegin < totalSize; batchBegin += (unsigned long long)compressedFileBatchBlocks * compressedFileBlockSize)
+    {
+        batch.data = (unsigned char*)buffer + batchBegin;
+        batch.dataSize = totalSize - batchBegin;
+        if (batch.dataSize > (unsigned long long)compressedFileBatchBlocks * compressedFileBlockSize)
+        {
+            batch.dataSize = (unsigned long long)compressedFileBatchBlocks * compressedFileBlockSize;
+        }
+        batch.numberOfBlocks = (unsigned int)((batch.dataSize + compressedFileBlockSize - 1) / compressedFileBlockSize);
+        runParallelJob(compressFileBlock, &batch, batch.numberOfBlocks);
+
+        for (unsigned int blockIndex = 0; ok && blockIndex < batch.numberOfBlocks; blockIndex++)
+        {
+            const unsigned int blockHeader = batch.blockHeader(blockIndex);
+            const unsigned int payloadSize = blockHeader & compressedBlockSizeMask;
+            if ((blockHeader >> 30) == compressedBlockTypeRaw)
+            {
+                ok = writeFile(file, 4, (unsigned char*)&blockHeader)
+                    && writeFile(file, payloadSize, batch.data + (unsigned long long)blockIndex * compressedFileBlockSize);
+            }
+            else
+            {
+                ok = writeFile(file, 4 + payloadSize, (unsigned char*)&batch.blockHeader(blockIndex));
+            }
+            fileSize += 4 + payloadSize;
+        }
+    }
+
+    closeFile(file);
+    freePool(batch.workspace);
+    if (!ok)
+    {
+        return -1;
+    }
+    if (storedSize)
+    {
+        *storedSize = fileSize;
+    }
+    return totalSize;
+}
+
+// Load file of totalSize uncompressed bytes to buffer. Supports files written by saveCompressed() as well as
+// uncompressed files. Returns totalSize on success and -1 on error (like load()). The size of the file is returned
+// in storedSize and the version passed to saveCompressed() in contentVersion (0 for files without header) if they
+// are not NULL. Must be called from the main thread in UEFI.
+static long long loadCompressed(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL, unsigned long long* storedSize = NULL, unsigned int* contentVersion = NULL)
+{
+    FileHandle file;
+    if (!openFile(file, fileName, false, directory))
+    {
+        return -1;
+    }
+
+    CompressedFileHeader header;
+    const long long headerSize = readFile(file, (totalSize < sizeof(header)) ? totalSize : sizeof(header), (unsigned char*)&header);
+    if (headerSize < 0)
+    {
+        closeFile(file);
+        return -1;
+    }
+    if (headerSize != sizeof(header) || totalSize < compressedFileMinSize || header.magic != compressedFileMagic)
+    {
+        // uncompressed file
+        copyMem(buffer, &header, headerSize);
+        const long long remainingSize = readFile(file, totalSize - headerSize, buffer + headerSize);
+        closeFile(file);
+        if (remainingSize != (long long)(totalSize - headerSize))
+        {
+            return -1;
+        }
+        if (storedSize)
+        {
+            *storedSize = totalSize;
+        }
+        if (contentVersion)
+        {
+            *contentVersion = 0;
+        }
+        return totalSize;
+    }
+    if (header.uncompressedSize != totalSize || header.blockSize != compressedFileBlockSize)
+    {
+        logToConsole(L"Compressed file has unexpected size or block size!");
+        closeFile(file);
+        return -1;
+    }
+
+    CompressedFileBatch batch;
+    if (!allocPoolWithErrorLog(L"compressedFileWorkspace", CompressedFileBatch::workspaceSizeForFile(totalSize), (void**)&batch.workspace, __LINE__))
+    {
+        closeFile(file);
+        return -1;
+    }
+    batch.failed = 0;
+    bool ok = true;
+    unsigned long long fileSize = sizeof(header);
+
+    for (unsigned long long batchBegin = 0; ok && batchBegin < totalSize; batchBegin += (unsigned long long)compressedFileBatchBlocks * compressedFileBlockSize)
+    {
+        batch.data = buffer + batchBegin;
+        batch.dataSize = totalSize - batchBegin;
+        if (batch.dataSize > (unsigned long long)compressedFileBatchBlocks * compressedFileBlockSize)
+        {
+            batch.dataSize = (unsigned long long)compressedFileBatchBlocks * compressedFileBlockSize;
+        }
+        batch.numberOfBlocks = (unsigned int)((batch.dataSize + compressedFileBlockSize - 1) / compressedFileBlockSize);
+
+        // read blocks of batch, raw blocks directly into buffer
+        for (unsigned int blockIndex = 0; ok && blockIndex < batch.numberOfBlocks; blockIndex++)
+        {
+            unsigned int& blockHeader = batch.blockHeader(blockIndex);
+            ok = readFile(file, 4, (unsigned char*)&blockHeader) == 4;
+            if (!ok)
+            {
+                break;
+            }
+            const unsigned int blockType = blockHeader >> 30;
+            const unsigned int payloadSize = blockHeader & compressedBlockSizeMask;
+            const unsigned int blockSize = batch.blockSize(blockIndex);
+            switch (blockType)
+            {
+            case compressedBlockTypeZero:
+                ok = payloadSize == 0;
+                break;
+            case compressedBlockTypeRaw:
+                ok = payloadSize == blockSize
+                    && readFile(file, payloadSize, batch.data + (unsigned long long)blockIndex * compressedFileBlockSize) == payloadSize;
+                break;
+            case compressedBlockTypeLz:
+                ok = payloadSize < blockSize
+                    && readFile(file, payloadSize, batch.blockPayload(blockIndex)) == payloadSize;
+                break;
+            default:
+                ok = false;
+            }
+            fileSize += 4 + payloadSize;
+        }
+
+        if (ok)
+        {
+            runParallelJob(decompressFileBlock, &batch, batch.numberOfBlocks);
+            ok = !batch.failed;
+        }
+    }
+
+    closeFile(file);
+    freePool(batch.workspace);
+    if (!ok)
+    {
+        logToConsole(L"Compressed file is invalid!");
+        return -1;
+    }
+    if (storedSize)
+    {
+        *storedSize = fileSize;
+    }
+    if (contentVersion)
+    {
+        *contentVersion = header.contentVersion;
+    }
+    return totalSize;
+}
+
+// Save large buffer in chunk files like saveLargeFile(), but compressed with saveCompressed()
+static long long saveCompressedLargeFile(CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, CHAR16* directory = NULL, unsigned long long* storedSize = NULL)
+{
+    const unsigned long long maxWriteSizePerChunk = FILE_CHUNK_SIZE;
+    if (totalSize < maxWriteSizePerChunk)
+    {
+        return saveCompressed(fileName, totalSize, buffer, directory, storedSize);
+    }
+    int chunkId = 0;
+    unsigned long long totalWriteSize = 0;
+    unsigned long long totalStoredSize = 0;
+    while (totalSize)
+    {
+        CHAR16 fileNameWithChunkId[64];
+        setText(fileNameWithChunkId, fileName);
+        appendText(fileNameWithChunkId, L".XXX");
+        addEpochToFileName(fileNameWithChunkId, getTextSize(fileNameWithChunkId, 64) + 1, chunkId);
+        const unsigned long long writeSize = maxWriteSizePerChunk < totalSize ? maxWriteSizePerChunk : totalSize;
+        unsigned long long chunkStoredSize = 0;
+        long long res = saveCompressed(fileNameWithChunkId, writeSize, buffer, directory, &chunkStoredSize);
+        if (res != writeSize)
+        {
+            return totalWriteSize;
+        }
+        buffer += writeSize;
+        totalWriteSize += writeSize;
+        totalStoredSize += chunkStoredSize;
+        totalSize -= writeSize;
+        chunkId++;
+    }
+    if (storedSize)
+    {
+        *storedSize = totalStoredSize;
+    }
+    return totalWriteSize;
+}
+
+// Load large buffer from chunk files like loadLargeFile(), supporting compressed and uncompressed chunks
+static long long loadCompressedLargeFile(CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, CHAR16* directory = NULL)
+{
+    const unsigned long long maxReadSizePerChunk = FILE_CHUNK_SIZE;
+    if (totalSize < maxReadSizePerChunk)
+    {
+        return loadCompressed(fileName, totalSize, buffer, directory);
+    }
+    int chunkId = 0;
+    unsigned long long totalReadSize = 0;
+    while (totalSize)
+    {
+        CHAR16 fileNameWithChunkId[64];
+        setText(fileNameWithChunkId, fileName);
+        appendText(fileNameWithChunkId, L".XXX");
+        addEpochToFileName(fileNameWithChunkId, getTextSize(fileNameWithChunkId, 64) + 1, chunkId);
+        const unsigned long long readSize = maxReadSizePerChunk < totalSize ? maxReadSizePerChunk : totalSize;
+        long long res = loadCompressed(fileNameWithChunkId, readSize, buffer, directory);
+        if (res != readSize)
+        {
+            return totalReadSize;
+        }
+        buffer += readSize;
+        totalReadSize += readSize;
+        totalSize -= readSize;
+        chunkId++;
+    }
+    return totalReadSize;
+}
+
+// Append " (FILE_SIZE bytes in file, PERCENT%, MICROSECONDS microseconds, THROUGHPUT MB/s)" to message, where
+// size is the uncompressed size and storedSize the file size
+static void appendCompressionStats(CHAR16* message, unsigned long long size, unsigned long long storedSize, unsigned long long microseconds)
+{
+    const unsigned long long permille = size ? storedSize * 1000 / size : 0;
+    appendText(message, L" (");
+    appendNumber(message, storedSize, TRUE);
+    appendText(message, L" bytes in file, ");
+    appendNumber(message, permille / 10, FALSE);
+    appendText(message, L".");
+    appendNumber(message, permille % 10, FALSE);
+    appendText(message, L"%, ");
+    appendNumber(message, microseconds, TRUE);
+    appendText(message, L" microseconds, ");
+    appendNumber(message, microseconds ? size / microseconds : 0, TRUE);
+    appendText(message, L" MB/s)");
+}
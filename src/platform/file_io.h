@@ -10,6 +10,7 @@
 #include "console_logging.h"
 #include "concurrency.h"
 #include "memory.h"
+#include "time_stamp_counter.h"
 
 // If you get an error reading and writing files, set the chunk sizes below to
 // the cluster size set for formatting you disk. If you have no idea about the
@@ -27,6 +28,8 @@ static constexpr int ASYNC_FILE_IO_MAX_QUEUE_ITEMS_2FACTOR = 4;
 static constexpr int ASYNC_FILE_IO_MAX_FILE_NAME = 64;
 static constexpr int ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS = (1ULL << ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS_2FACTOR);
 static constexpr int ASYNC_FILE_IO_MAX_QUEUE_ITEMS = (1ULL << ASYNC_FILE_IO_MAX_QUEUE_ITEMS_2FACTOR);
+static constexpr unsigned int ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS = 64; // Max chunks of asyncLoadLargeFile() and per batch of blocking asyncSaveLargeFile()
+static constexpr long long ASYNC_FILE_IO_LOG_MIN_SIZE = 1024 * 1024; // Log throughput of files from this size
 
 static EFI_FILE_PROTOCOL* root = NULL;
 class AsyncFileIO;
@@ -304,6 +307,160 @@ static long long save(const CHAR16* fileName, unsigned long long totalSize, cons
 #endif
 }
 
+// Handle of a file that is read or written sequentially in multiple steps, see openFile()
+struct FileHandle
+{
+#ifdef NO_UEFI
+    FILE* file;
+#else
+    EFI_FILE_PROTOCOL* file;
+#endif
+};
+
+// Open file for reading (write = false) or writing (write = true) with multiple calls of readFile() or
+// writeFile(). Writing does not truncate an existing file. Close the file with closeFile().
+static bool openFile(FileHandle& handle, const CHAR16* fileName, bool write, const CHAR16* directory = NULL)
+{
+#ifdef NO_UEFI
+    if (directory)
+    {
+        logToConsole(L"Argument directory not implemented for NO_UEFI openFile()! Pass full path as fileName!");
+        return false;
+    }
+    handle.file = nullptr;
+    if (_wfopen_s(&handle.file, fileName, write ? L"wb" : L"rb") != 0 || !handle.file)
+    {
+        wprintf(L"Error opening file %s!\n", fileName);
+        return false;
+    }
+    return true;
+#else
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL* directoryProtocol = NULL;
+    const unsigned long long mode = write ? (EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE) : EFI_FILE_MODE_READ;
+    handle.file = NULL;
+
+    // Check if there is a directory provided
+    if (NULL != directory)
+    {
+        if (write)
+        {
+            createDir(directory);
+        }
+
+        // Open the directory
+        if (status = root->Open(root, (void**)&directoryProtocol, (CHAR16*)directory, EFI_FILE_MODE_READ, 0))
+        {
+            logStatusToConsole(L"FileIOOpen:OpenDir EFI_FILE_PROTOCOL.Open() fails", status, __LINE__);
+            return false;
+        }
+
+        // Open the file from the directory.
+        status = directoryProtocol->Open(directoryProtocol, (void**)&handle.file, (CHAR16*)fileName, mode, 0);
+        directoryProtocol->Close(directoryProtocol);
+    }
+    else
+    {
+        status = root->Open(root, (void**)&handle.file, (CHAR16*)fileName, mode, 0);
+    }
+    if (status)
+    {
+        logStatusToConsole(L"FileIOOpen:OpenFile EFI_FILE_PROTOCOL.Open() fails", status, __LINE__);
+        handle.file = NULL;
+        return false;
+    }
+    return true;
+#endif
+}
+
+// Read up to size bytes from file opened with openFile(). Returns number of bytes read (less than size only at
+// the end of the file) or -1 on error.
+static long long readFile(FileHandle& handle, unsigned long long size, unsigned char* buffer)
+{
+#ifdef NO_UEFI
+    const unsigned long long readSize = fread(buffer, 1, size, handle.file);
+    if (readSize != size && ferror(handle.file))
+    {
+        return -1;
+    }
+    return readSize;
+#else
+    unsigned long long readSize = 0;
+    while (readSize < size)
+    {
+        const unsigned long long requestedSize = (READING_CHUNK_SIZE <= (size - readSize) ? READING_CHUNK_SIZE : (size - readSize));
+        unsigned long long chunkSize = requestedSize;
+        EFI_STATUS status = handle.file->Read(handle.file, &chunkSize, &buffer[readSize]);
+        if (status)
+        {
+            // If this error occurs, see the definition of READING_CHUNK_SIZE above.
+            logStatusToConsole(L"EFI_FILE_PROTOCOL.Read() fails", status, __LINE__);
+            return -1;
+        }
+        readSize += chunkSize;
+        if (chunkSize != requestedSize)
+        {
+            // end of file
+            break;
+        }
+    }
+    return readSize;
+#endif
+}
+
+// Write size bytes to file opened with openFile(). Returns false on error.
+static bool writeFile(FileHandle& handle, unsigned long long size, const unsigned char* buffer)
+{
+#ifdef NO_UEFI
+    return fwrite(buffer, 1, size, handle.file) == size;
+#else
+    unsigned long long writtenSize = 0;
+    while (writtenSize < size)
+    {
+        const unsigned long long requestedSize = (WRITING_CHUNK_SIZE <= (size - writtenSize) ? WRITING_CHUNK_SIZE : (size - writtenSize));
+        unsigned long long chunkSize = requestedSize;
+        EFI_STATUS status = handle.file->Write(handle.file, &chunkSize, (void*)&buffer[writtenSize]);
+        if (status || chunkSize != requestedSize)
+        {
+            // If this error occurs, see the definition of WRITING_CHUNK_SIZE above.
+            logStatusToConsole(L"EFI_FILE_PROTOCOL.Write() fails", status, __LINE__);
+            return false;
+        }
+        writtenSize += chunkSize;
+    }
+    return true;
+#endif
+}
+
+// Write all data written with writeFile() to the device. Returns false on error.
+static bool flushFile(FileHandle& handle)
+{
+#ifdef NO_UEFI
+    return fflush(handle.file) == 0;
+#else
+    EFI_STATUS status = handle.file->Flush(handle.file);
+    if (status)
+    {
+        logStatusToConsole(L"EFI_FILE_PROTOCOL.Flush() fails", status, __LINE__);
+        return false;
+    }
+    return true;
+#endif
+}
+
+static void closeFile(FileHandle& handle)
+{
+    if (handle.file)
+    {
+#ifdef NO_UEFI
+        fclose(handle.file);
+#else
+        handle.file->Close(handle.file);
+#endif
+        handle.file = NULL;
+    }
+}
+
 #pragma optimize("", off)
 
 struct FileItem
@@ -315,6 +472,7 @@ struct FileItem
         kBlockingWait,
         kWait,
         kFillingData,
+        kInProgress,
     };
 
     CHAR16 mFileName[ASYNC_FILE_IO_MAX_FILE_NAME];
@@ -326,6 +484,19 @@ struct FileItem
     char mState;
     unsigned long long mReservedSize;
 
+    // State before the item has been claimed by an I/O worker (kBlockingWait or kWait)
+    char mWaitState;
+
+    // Order of submission, used for coalescing writes of the same file
+    long long mSequence;
+
+    // Newer item writing the same file, which makes writing this item unnecessary
+    FileItem* mpSupersededBy;
+
+    // Result of load() / save() and CPU cycles needed for it
+    long long mResult;
+    unsigned long long mCycles;
+
     void set(const CHAR16* fileName, unsigned long long fileSize, const CHAR16* directory)
     {
         setText(mFileName, fileName);
@@ -365,14 +536,48 @@ struct FileItem
         return (state == FileItem::kFree);
     }
 
-    void markAsDone()
+    // Try to take item waiting for processing, so no other I/O worker processes it
+    bool tryClaim()
+    {
+        const char state = mState;
+        if ((state != FileItem::kBlockingWait && state != FileItem::kWait)
+            || _InterlockedCompareExchange8(&mState, FileItem::kInProgress, state) != state)
+        {
+            return false;
+        }
+        mWaitState = state;
+        return true;
+    }
+
+    bool hasSamePath(const FileItem& other) const
     {
+        if (mHaveDirectory != other.mHaveDirectory
+            || (mHaveDirectory && !textsEqual(mDirectory, other.mDirectory)))
+        {
+            return false;
+        }
+        return textsEqual(mFileName, other.mFileName);
+    }
+
+    static bool textsEqual(const CHAR16* a, const CHAR16* b)
+    {
+        while (*a && *a == *b)
+        {
+            a++;
+            b++;
+        }
+        return *a == *b;
+    }
+
+    void markAsDone(long long result)
+    {
+        mResult = result;
         char stateChange = FileItem::kProcessed;
-        if (mState == FileItem::kBlockingWait)
+        if (mWaitState == FileItem::kBlockingWait)
         {
             stateChange = FileItem::kProcessed;
         }
-        else if (mState == FileItem::kWait)
+        else if (mWaitState == FileItem::kWait)
         {
             stateChange = FileItem::kFree;
         }
@@ -381,6 +586,22 @@ struct FileItem
 
 };
 
+// Statistics of the file operations done by AsyncFileIO
+struct AsyncFileIOStats
+{
+    unsigned long long filesWritten;
+    unsigned long long bytesWritten;
+    unsigned long long writeCycles;
+    unsigned long long coalescedWrites;
+    unsigned long long filesRead;
+    unsigned long long bytesRead;
+    unsigned long long readCycles;
+    unsigned long long failedOperations;
+};
+
+// Queue of file operations. Items are processed by I/O workers calling flushItems(). Several workers can process
+// the items of one queue concurrently if the file system backend allows calling it from several processors (the
+// POSIX backend used with NO_UEFI). In UEFI, only the main thread may call the file protocol, so it is the only worker.
 template<int maxItems>
 class FileItemStorage
 {
@@ -393,6 +614,12 @@ public:
             mFileItems[i].mpConstBuffer = NULL;
         }
         mCurrentIdx = 0;
+        mNextSequence = 0;
+        mFlushLock = 0;
+        mWorkReady = 0;
+        mActiveWorkers = 0;
+        mWorkCount = 0;
+        mNextWork = 0;
 
         for (int i = 0; i < maxItems; i++)
         {
@@ -420,39 +647,200 @@ public:
         for (int i = 0; i < maxItems; i++)
         {
             long long index = ATOMIC_INC64(mCurrentIdx) & (maxItems - 1);
-            if (FileItem::kFree == mFileItems[index].mState)
+            if (FileItem::kFree == mFileItems[index].mState
+                && _InterlockedCompareExchange8(&mFileItems[index].mState, FileItem::kFillingData, FileItem::kFree) == FileItem::kFree)
             {
-                mFileItems[index].mState = FileItem::kFillingData;
                 mFileItems[index].mSize = requestedSize;
                 return &mFileItems[index];
             }
         }
         return NULL;
     }
+
+    // Make filled item visible to the I/O workers
+    void submit(FileItem* pFileItem, char waitState)
+    {
+        pFileItem->mSequence = ATOMIC_INC64(mNextSequence);
+        pFileItem->setState(waitState);
+    }
+
+    // Process all items waiting at the time of the call. The first worker collects the items and processes them
+    // together with the workers that call this function while it is running. Writes of the same file are coalesced
+    // (only the newest one is written). Returns after all collected items are done if this worker collected them,
+    // otherwise as soon as there are no more items to take.
+    void flushItems(bool write, AsyncFileIOStats& stats)
+    {
+        if (!TRY_ACQUIRE(mFlushLock))
+        {
+            _InterlockedIncrement(&mActiveWorkers);
+            if (mWorkReady)
+            {
+                processWork(write);
+            }
+            _InterlockedDecrement(&mActiveWorkers);
+            return;
+        }
+
+        // Collect waiting items
+        FileItem* claimed[maxItems];
+        int claimedCount = 0;
+        for (int i = 0; i < maxItems; i++)
+        {
+            if (mFileItems[i].tryClaim())
+            {
+                mFileItems[i].mpSupersededBy = NULL;
+                claimed[claimedCount++] = &mFileItems[i];
+            }
+        }
+        if (!claimedCount)
+        {
+            ATOMIC_AND64(mCurrentIdx, maxItems - 1);
+            RELEASE(mFlushLock);
+            return;
+        }
+
+        // Only the newest write of each file needs to be done
+        mWorkCount = 0;
+        for (int i = 0; i < claimedCount; i++)
+        {
+            if (write)
+            {
+                for (int j = 0; j < claimedCount; j++)
+                {
+                    if (claimed[j]->mSequence > claimed[i]->mSequence && claimed[j]->hasSamePath(*claimed[i])
+                        && (!claimed[i]->mpSupersededBy || claimed[j]->mSequence > claimed[i]->mpSupersededBy->mSequence))
+                    {
+                        claimed[i]->mpSupersededBy = claimed[j];
+                    }
+                }
+            }
+            if (!claimed[i]->mpSupersededBy)
+            {
+                mWork[mWorkCount++] = claimed[i];
+            }
+        }
+
+        // Process items with helping workers
+        mNextWork = 0;
+        _mm_mfence();
+        mWorkReady = 1;
+        processWork(write);
+        mWorkReady = 0;
+        _mm_mfence();
+        while (mActiveWorkers)
+        {
+            _mm_pause();
+        }
+
+        // Report results, superseded items get the result of the item written instead of them
+        for (int i = 0; i < claimedCount; i++)
+        {
+            FileItem& item = *claimed[i];
+            if (item.mpSupersededBy)
+            {
+                const long long newestResult = item.mpSupersededBy->mResult;
+                item.mResult = (newestResult < 0) ? newestResult : (long long)item.mSize;
+                stats.coalescedWrites++;
+            }
+            else if (item.mResult < 0)
+            {
+                stats.failedOperations++;
+            }
+            else
+            {
+                logThroughput(write, item);
+                if (write)
+                {
+                    stats.filesWritten++;
+                    stats.bytesWritten += item.mResult;
+                    stats.writeCycles += item.mCycles;
+                }
+                else
+                {
+                    stats.filesRead++;
+                    stats.bytesRead += item.mResult;
+                    stats.readCycles += item.mCycles;
+                }
+            }
+        }
+        for (int i = 0; i < claimedCount; i++)
+        {
+            claimed[i]->markAsDone(claimed[i]->mResult);
+        }
+
+        // Clean up the index
+        ATOMIC_AND64(mCurrentIdx, maxItems - 1);
+        RELEASE(mFlushLock);
+    }
+
 protected:
+    void processWork(bool write)
+    {
+        long workIndex;
+        while ((workIndex = _InterlockedIncrement(&mNextWork) - 1) < mWorkCount)
+        {
+            FileItem& item = *mWork[workIndex];
+            const unsigned long long beginningTick = __rdtsc();
+            if (write)
+            {
+                item.mResult = save(item.mFileName, item.mSize, item.mpConstBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
+            }
+            else
+            {
+                item.mResult = load(item.mFileName, item.mSize, item.mpBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
+            }
+            item.mCycles = __rdtsc() - beginningTick;
+        }
+    }
+
+    // Log throughput of large files (small files would flood the log)
+    static void logThroughput(bool write, const FileItem& item)
+    {
+        if (item.mResult < ASYNC_FILE_IO_LOG_MIN_SIZE || !frequency)
+        {
+            return;
+        }
+        const unsigned long long microseconds = item.mCycles * 1000000 / frequency;
+        CHAR16 logMessage[64 + 2 * ASYNC_FILE_IO_MAX_FILE_NAME + 64];
+        setText(logMessage, write ? L"Saved " : L"Loaded ");
+        appendNumber(logMessage, item.mResult, TRUE);
+        appendText(logMessage, write ? L" bytes to " : L" bytes from ");
+        if (item.mHaveDirectory)
+        {
+            appendText(logMessage, item.mDirectory);
+            appendText(logMessage, L"/");
+        }
+        appendText(logMessage, item.mFileName);
+        appendText(logMessage, L" in ");
+        appendNumber(logMessage, microseconds, TRUE);
+        appendText(logMessage, L" microseconds (");
+        appendNumber(logMessage, microseconds ? item.mResult / microseconds : 0, TRUE);
+        appendText(logMessage, L" MB/s).");
+        logToConsole(logMessage);
+    }
+
     // List of files need to be written
     FileItem mFileItems[maxItems];
     long long mCurrentIdx;
+    long long mNextSequence;
+
+    // Items collected by the worker holding mFlushLock, processed by all workers
+    FileItem* mWork[maxItems];
+    long mWorkCount;
+    volatile long mNextWork;
+    volatile long mActiveWorkers;
+    volatile char mWorkReady;
+    volatile char mFlushLock;
 };
 
 template<int maxItems>
 class LoadFileItemStorage : public FileItemStorage<maxItems>
 {
 public:
-    // Real read happen here. This function expected call in main thread only
-    int flushRead()
+    // Real read happen here. In UEFI, this function is expected to be called in main thread only
+    int flushRead(AsyncFileIOStats& stats)
     {
-        for (unsigned int i = 0; i < maxItems; i++)
-        {
-            FileItem& item = this->mFileItems[i];
-            if (item.waitForProcess())
-            {
-                long long sts = load(item.mFileName, item.mSize, item.mpBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
-                item.markAsDone();
-            }
-        }
-        // Clean up the index
-        ATOMIC_AND64(this->mCurrentIdx, maxItems - 1);
+        this->flushItems(false, stats);
         return 0;
     }
 };
@@ -461,22 +849,11 @@ template<int maxItems>
 class SaveFileItemStorage : public FileItemStorage<maxItems>
 {
 public:
-    // Real write happen here. This function expected call in main thread only. Need to flush all data in queue
-    int flushWrite()
+    // Real write happen here. In UEFI, this function is expected to be called in main thread only. Need to flush all
+    // data in queue
+    int flushWrite(AsyncFileIOStats& stats)
     {
-        for (unsigned int i = 0; i < maxItems; i++)
-        {
-            FileItem& item = this->mFileItems[i];
-            if (item.waitForProcess())
-            {
-                long long sts = save(item.mFileName, item.mSize, item.mpConstBuffer, item.mHaveDirectory ? item.mDirectory : NULL);
-                item.markAsDone();
-            }
-        }
-
-        // Clean up the index
-        ATOMIC_AND64(this->mCurrentIdx, maxItems - 1);
-
+        this->flushItems(true, stats);
         return 0;
     }
 };
@@ -525,6 +902,8 @@ public:
         mFileBlockingWriteQueue.initializeQueue(NULL);
         mEnableNonBlockSave = false;
         mIsStop = false;
+        setMem(&mStats, sizeof(mStats), 0);
+        mStatsLock = 0;
 
         // Init byte buffer and allocate memory
         mpSaveBuffer = NULL;
@@ -551,7 +930,7 @@ public:
 
         // Flush all remained tasks
         flush();
-        if (mpSaveBuffer == NULL)
+        if (mpSaveBuffer != NULL)
         {
             freePool(mpSaveBuffer);
         }
@@ -599,95 +978,136 @@ public:
         pFileItem->set(fileName, totalSize, directory);
         copyMem(pFileItem->mpBuffer, buffer, totalSize);
         pFileItem->mpConstBuffer = pFileItem->mpBuffer;
-        pFileItem->mState = FileItem::kWait;
+        mFileWriteQueue.submit(pFileItem, FileItem::kWait);
         return (long long)totalSize;
     }
 
-    long long asyncBlockingSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory = NULL)
+    // Schedule write without waiting for it. The buffer must stay untouched until waitFor() returns. Returns NULL if
+    // the queue is full or stopped.
+    FileItem* beginBlockingSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory = NULL)
     {
         if (mIsStop)
         {
-            return kStop;
+            return NULL;
         }
 
         FileItem* pFileItem = mFileBlockingWriteQueue.requestFreeSlot(totalSize);
-
         if (pFileItem == NULL)
         {
-            return kBufferFull;
+            return NULL;
         }
 
         // Blocking just steal the buffer
         pFileItem->set(fileName, totalSize, directory);
         pFileItem->mpConstBuffer = buffer;
-        pFileItem->mState = FileItem::kBlockingWait;
+        mFileBlockingWriteQueue.submit(pFileItem, FileItem::kBlockingWait);
+        return pFileItem;
+    }
 
-        // Mainthread. Flush the save queue immediately
+    // Schedule load without waiting for it. Buffer will be filled data, make sure the buffer is untouched until
+    // waitFor() returns. Returns NULL if the queue is full or stopped.
+    FileItem* beginLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
+    {
+        if (mIsStop)
+        {
+            return NULL;
+        }
+
+        FileItem* pFileItem = mFileBlockingReadQueue.requestFreeSlot(totalSize);
+        if (pFileItem == NULL)
+        {
+            return NULL;
+        }
+
+        // Get the buffer. Load operation will be execute later in main thread
+        pFileItem->set(fileName, totalSize, directory);
+        pFileItem->mpBuffer = buffer;
+        mFileBlockingReadQueue.submit(pFileItem, FileItem::kBlockingWait);
+        return pFileItem;
+    }
+
+    // Wait until item scheduled with beginBlockingSave() or beginLoad() is processed and return result of
+    // save() / load(). The main thread processes the queues itself.
+    long long waitFor(FileItem* pFileItem)
+    {
         if (isMainThread())
         {
-            mFileBlockingWriteQueue.flushWrite();
-            return (long long)totalSize;
+            flush();
         }
 
-        // Blocking wait for the save operator finish
+        // Blocking wait for the operation to finish
         while (!pFileItem->isProcessed() && !mIsStop)
         {
             sleep(1000);
         }
-        pFileItem->mState = FileItem::kFree;
-        return (long long)totalSize;
+        const long long result = pFileItem->isProcessed() ? pFileItem->mResult : kStop;
+        pFileItem->setState(FileItem::kFree);
+        return result;
     }
 
-    // Function to schedule load. Buffer will be filled data, make sure the buffer is untouched until this function done
-    long long asyncLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
+    long long asyncBlockingSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory = NULL)
     {
-        // Stop already. Don't process further
         if (mIsStop)
         {
             return kStop;
         }
-
-        int sts = kUnknown;
-        bool mainThread = isMainThread();
-        FileItem* pFileItem = mFileBlockingReadQueue.requestFreeSlot(totalSize);
-
+        FileItem* pFileItem = beginBlockingSave(fileName, totalSize, buffer, directory);
         if (pFileItem == NULL)
         {
             return kBufferFull;
         }
+        return waitFor(pFileItem);
+    }
 
-        // Get the buffer. Load operation will be execute later in main thread
-        pFileItem->set(fileName, totalSize, directory);
-        pFileItem->mpBuffer = buffer;
-        pFileItem->mState = FileItem::kBlockingWait;
-
-        // In case of main thread. Read immediately.
-        if (mainThread)
+    // Function to schedule load. Buffer will be filled data, make sure the buffer is untouched until this function done
+    long long asyncLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
+    {
+        // Stop already. Don't process further
+        if (mIsStop)
         {
-            mFileBlockingReadQueue.flushRead();
-            return (long long)totalSize;
+            return kStop;
         }
-
-        // Wait for data is processed
-        while (!pFileItem->isProcessed() && !mIsStop)
+        FileItem* pFileItem = beginLoad(fileName, totalSize, buffer, directory);
+        if (pFileItem == NULL)
         {
-            sleep(1000);
+            return kBufferFull;
         }
-        pFileItem->mState = FileItem::kFree;
-        return (long long)totalSize;
+        return waitFor(pFileItem);
     }
 
+    // Process all queued file operations. In UEFI, this must be called from the main thread. With NO_UEFI, it may be
+    // called by several threads at the same time, which then process the queued files in parallel.
     int flush()
     {
-        mFileBlockingReadQueue.flushRead();
-        mFileBlockingWriteQueue.flushWrite();
+        AsyncFileIOStats stats;
+        setMem(&stats, sizeof(stats), 0);
+        mFileBlockingReadQueue.flushRead(stats);
+        mFileBlockingWriteQueue.flushWrite(stats);
         if (mEnableNonBlockSave)
         {
-            mFileWriteQueue.flushWrite();
+            mFileWriteQueue.flushWrite(stats);
         }
+
+        ACQUIRE(mStatsLock);
+        mStats.filesWritten += stats.filesWritten;
+        mStats.bytesWritten += stats.bytesWritten;
+        mStats.writeCycles += stats.writeCycles;
+        mStats.coalescedWrites += stats.coalescedWrites;
+        mStats.filesRead += stats.filesRead;
+        mStats.bytesRead += stats.bytesRead;
+        mStats.readCycles += stats.readCycles;
+        mStats.failedOperations += stats.failedOperations;
+        RELEASE(mStatsLock);
         return 0;
     }
 
+    void getStats(AsyncFileIOStats& stats)
+    {
+        ACQUIRE(mStatsLock);
+        stats = mStats;
+        RELEASE(mStatsLock);
+    }
+
 private:
     EFI_MP_SERVICES_PROTOCOL* mpFileSystemMPServices;
     unsigned int mBSProcID;
@@ -702,13 +1122,17 @@ private:
     SaveFileItemStorage<ASYNC_FILE_IO_MAX_QUEUE_ITEMS> mFileWriteQueue;
     SaveFileItemStorage<ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS> mFileBlockingWriteQueue;
     LoadFileItemStorage<ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS> mFileBlockingReadQueue;
+
+    AsyncFileIOStats mStats;
+    volatile char mStatsLock;
 };
 
 #pragma optimize("", on)
 
 // Asynchorous save file
 // This function can be called from any thread and have blocking and non blocking mode
-// - Blocking mode: to avoid lock and the actual save happen, flushAsyncFileIOBuffer must be called in main thread
+// - Blocking mode: to avoid lock and the actual save happen, flushAsyncFileIOBuffer must be called in main thread.
+//   Returns the result of save() (totalSize or -1) or a negative AsyncFileIO::Status.
 // - non-blocking mode: return immediately, the save operation happen in flushAsyncFileIOBuffer
 static long long asyncSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory = NULL, bool blocking = true)
 {
@@ -730,6 +1154,7 @@ static long long asyncSave(const CHAR16* fileName, unsigned long long totalSize,
 // Asynchorous load a file
 // This function can be called from any thread and is a blocking function
 // To avoid lock and the actual load happen, flushAsyncFileIOBuffer must be called in main thread
+// Returns the result of load() (totalSize or -1) or a negative AsyncFileIO::Status.
 static long long asyncLoad(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
 {
     if (gAsyncFileIO)
@@ -961,11 +1386,12 @@ static long long loadLargeFile(CHAR16* fileName, unsigned long long totalSize, u
     return totalReadSize;
 }
 
-// Asynchorous load a large file
-// File with size greater than FILE_CHUNK_SIZE will be break into smaller file to be written. So this function will load the smaller chunks
-// into a large bugger
+// Asynchorous save a large file
+// File with size greater than FILE_CHUNK_SIZE will be break into smaller file to be written
 // This function can be called from any thread and have blocking and non blocking mode
-// - Blocking mode: to avoid lock and the actual save happen, flushAsyncFileIOBuffer must be called in main thread
+// - Blocking mode: chunks are queued in batches of up to ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS, each batch is written
+//   in the same flushAsyncFileIOBuffer() call (in parallel if there are several I/O workers), which must be called
+//   in main thread
 // - non-blocking mode: return immediately, the save operation happen in flushAsyncFileIOBuffer
 static long long asyncSaveLargeFile(
     CHAR16* fileName,
@@ -980,31 +1406,66 @@ static long long asyncSaveLargeFile(
     {
         return asyncSave(fileName, totalSize, buffer, directory, blocking);
     }
-    int chunkId = 0;
+    if (!gAsyncFileIO)
+    {
+        return (long long)AsyncFileIO::kUnknown;
+    }
+    const unsigned int numberOfChunks = (unsigned int)((totalSize + maxWriteSizePerChunk - 1) / maxWriteSizePerChunk);
+    FileItem* chunkItems[ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS];
     unsigned long long totalWriteSize = 0;
-    while (totalSize)
+    for (unsigned int batchBegin = 0; batchBegin < numberOfChunks; batchBegin += ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS)
     {
-        CHAR16 fileNameWithChunkId[64];
-        setText(fileNameWithChunkId, fileName);
-        appendText(fileNameWithChunkId, L".XXX");
-        addEpochToFileName(fileNameWithChunkId, getTextSize(fileNameWithChunkId, 64) + 1, chunkId);
-        const unsigned long long writeSize = maxWriteSizePerChunk < totalSize ? maxWriteSizePerChunk : totalSize;
-        long long res = asyncSave(fileNameWithChunkId, writeSize, buffer, directory, blocking);
-        if (res != writeSize)
+        const unsigned int batchEnd = (numberOfChunks - batchBegin < ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS) ? numberOfChunks : batchBegin + ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS;
+        for (unsigned int chunkId = batchBegin; chunkId < batchEnd; chunkId++)
         {
-            return totalWriteSize;
+            CHAR16 fileNameWithChunkId[64];
+            setText(fileNameWithChunkId, fileName);
+            appendText(fileNameWithChunkId, L".XXX");
+            addEpochToFileName(fileNameWithChunkId, getTextSize(fileNameWithChunkId, 64) + 1, chunkId);
+            const unsigned long long offset = chunkId * maxWriteSizePerChunk;
+            const unsigned long long writeSize = maxWriteSizePerChunk < totalSize - offset ? maxWriteSizePerChunk : totalSize - offset;
+            if (blocking)
+            {
+                chunkItems[chunkId - batchBegin] = gAsyncFileIO->beginBlockingSave(fileNameWithChunkId, writeSize, buffer + offset, directory);
+            }
+            else
+            {
+                long long res = asyncSave(fileNameWithChunkId, writeSize, buffer + offset, directory, blocking);
+                if (res != writeSize)
+                {
+                    return totalWriteSize;
+                }
+                totalWriteSize += writeSize;
+            }
+        }
+        if (!blocking)
+        {
+            continue;
+        }
+
+        // Wait for all chunks of the batch, the size written is the size of the leading chunks that have been written successfully
+        bool leadingChunksOk = true;
+        for (unsigned int chunkId = batchBegin; chunkId < batchEnd; chunkId++)
+        {
+            const unsigned long long writeSize = maxWriteSizePerChunk < totalSize - chunkId * maxWriteSizePerChunk ? maxWriteSizePerChunk : totalSize - chunkId * maxWriteSizePerChunk;
+            const long long res = chunkItems[chunkId - batchBegin] ? gAsyncFileIO->waitFor(chunkItems[chunkId - batchBegin]) : (long long)AsyncFileIO::kBufferFull;
+            leadingChunksOk = leadingChunksOk && res == writeSize;
+            if (leadingChunksOk)
+            {
+                totalWriteSize += writeSize;
+            }
+        }
+        if (!leadingChunksOk)
+        {
+            break;
         }
-        buffer += writeSize;
-        totalWriteSize += writeSize;
-        totalSize -= writeSize;
-        chunkId++;
     }
     return totalWriteSize;
 }
 
 // Asynchorous load a large file
 // File with size greater than FILE_CHUNK_SIZE will be break into smaller file to be written. So this function will load the smaller chunks
-// into a large bugger
+// into a large bugger. All chunks are queued at once and loaded in the same flushAsyncFileIOBuffer() call.
 // This function is blocking call and can be called from any thread
 // To avoid lock and the actual load happen, flushAsyncFileIOBuffer must be called in main thread
 static long long asyncLoadLargeFile(CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, CHAR16* directory = NULL)
@@ -1014,24 +1475,40 @@ static long long asyncLoadLargeFile(CHAR16* fileName, unsigned long long totalSi
     {
         return asyncLoad(fileName, totalSize, buffer, directory);
     }
-    int chunkId = 0;
-    unsigned long long totalReadSize = 0;
-    while (totalSize)
+    if (!gAsyncFileIO)
+    {
+        return 0;
+    }
+    const unsigned int numberOfChunks = (unsigned int)((totalSize + maxReadSizePerChunk - 1) / maxReadSizePerChunk);
+    if (numberOfChunks > ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS)
+    {
+        return (long long)AsyncFileIO::kUnsupported;
+    }
+    FileItem* chunkItems[ASYNC_FILE_IO_MAX_LARGE_FILE_CHUNKS];
+    for (unsigned int chunkId = 0; chunkId < numberOfChunks; chunkId++)
     {
         CHAR16 fileNameWithChunkId[64];
         setText(fileNameWithChunkId, fileName);
         appendText(fileNameWithChunkId, L".XXX");
         addEpochToFileName(fileNameWithChunkId, getTextSize(fileNameWithChunkId, 64) + 1, chunkId);
-        const unsigned long long readSize = maxReadSizePerChunk < totalSize ? maxReadSizePerChunk : totalSize;
-        unsigned long long res = asyncLoad(fileNameWithChunkId, readSize, buffer, directory);
-        if (res != readSize)
+        const unsigned long long offset = chunkId * maxReadSizePerChunk;
+        const unsigned long long readSize = maxReadSizePerChunk < totalSize - offset ? maxReadSizePerChunk : totalSize - offset;
+        chunkItems[chunkId] = gAsyncFileIO->beginLoad(fileNameWithChunkId, readSize, buffer + offset, directory);
+    }
+
+    // Wait for all chunks, the size read is the size of the leading chunks that have been read successfully
+    unsigned long long totalReadSize = 0;
+    bool leadingChunksOk = true;
+    for (unsigned int chunkId = 0; chunkId < numberOfChunks; chunkId++)
+    {
+        const unsigned long long offset = chunkId * maxReadSizePerChunk;
+        const unsigned long long readSize = maxReadSizePerChunk < totalSize - offset ? maxReadSizePerChunk : totalSize - offset;
+        const long long res = chunkItems[chunkId] ? gAsyncFileIO->waitFor(chunkItems[chunkId]) : (long long)AsyncFileIO::kBufferFull;
+        leadingChunksOk = leadingChunksOk && res == readSize;
+        if (leadingChunksOk)
         {
-            return totalReadSize;
+            totalReadSize += readSize;
         }
-        buffer += readSize;
-        totalReadSize += readSize;
-        totalSize -= readSize;
-        chunkId++;
     }
     return totalReadSize;
 }
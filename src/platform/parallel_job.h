@@ -0,0 +1,85 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "global_var.h"
+#include "concurrency.h"
+
+// Function processing one part of a parallel job
+typedef void (*ParallelJobFunction)(void* context, unsigned int partIndex);
+
+// Long-running work of one processor (the job owner) that is split into independent parts. Other processors
+// help with processing the parts by calling tryHelpWithParallelJob() in their polling loops. The owner processes
+// parts itself as well, so the job is finished even if no other processor helps (for example in the tests).
+struct ParallelJob
+{
+    ParallelJobFunction function;
+    void* context;
+    unsigned int numberOfParts;
+    volatile long nextPart;
+
+    // Get next part and process it. Return false if all parts have been taken already.
+    bool processNextPart()
+    {
+        const long partIndex = _InterlockedIncrement(&nextPart) - 1;
+        if (partIndex >= (long)numberOfParts)
+        {
+            return false;
+        }
+        function(context, partIndex);
+        return true;
+    }
+};
+
+GLOBAL_VAR_DECL ParallelJob* volatile currentParallelJob GLOBAL_VAR_INIT(nullptr);
+GLOBAL_VAR_DECL volatile long parallelJobHelpers GLOBAL_VAR_INIT(0);
+GLOBAL_VAR_DECL volatile char parallelJobLock GLOBAL_VAR_INIT(0);
+
+// Run function(context, partIndex) for all partIndex < numberOfParts, using all processors that call
+// tryHelpWithParallelJob(). Returns after all parts are finished. Only one job runs at a time, so do not start
+// a parallel job from within a job function.
+static void runParallelJob(ParallelJobFunction function, void* context, unsigned int numberOfParts)
+{
+    ParallelJob job;
+    job.function = function;
+    job.context = context;
+    job.numberOfParts = numberOfParts;
+    job.nextPart = 0;
+
+    ACQUIRE(parallelJobLock);
+    currentParallelJob = &job;
+
+    while (job.processNextPart())
+    {
+    }
+
+    // Withdraw job and wait for helpers that are still processing a part (or have just seen the job)
+    currentParallelJob = nullptr;
+    _mm_mfence();
+    while (parallelJobHelpers)
+    {
+        _mm_pause();
+    }
+
+    RELEASE(parallelJobLock);
+}
+
+// Help processing the current parallel job if there is one. Cheap if there is no job, so it can be called in
+// the main loop of processors that may be idle, such as the request processors.
+static void tryHelpWithParallelJob()
+{
+    if (!currentParallelJob)
+    {
+        return;
+    }
+
+    _InterlockedIncrement(&parallelJobHelpers);
+    ParallelJob* job = currentParallelJob;
+    if (job)
+    {
+        while (job->processNextPart())
+        {
+        }
+    }
+    _InterlockedDecrement(&parallelJobHelpers);
+}
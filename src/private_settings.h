@@ -38,6 +38,17 @@ static const unsigned char whiteListPeers[][4] = {
 #define LOG_CONTRACT_INFO_MESSAGES 0
 #define LOG_CONTRACT_DEBUG_MESSAGES 0
 #define LOG_CUSTOM_MESSAGES 0
+// "1" saves logBuffer in segments to disk, so logs of the epoch can be requested after being overwritten in the round buffer
+#define LOG_ARCHIVE 0
+// "1" indexes log IDs of QU transfers and asset ownership / possession changes by entity for RequestEntityLogIds
+#define LOG_ENTITY_INDEX 0
+// "1" runs contract user functions on double-buffered snapshots of the contract states, which are updated after each
+// tick. Function calls then neither wait for nor delay contract procedures, but see the state of the end of the last
+// tick. Requires twice the memory of all contract states in addition.
+#define CONTRACT_STATE_SNAPSHOTS 0
+// "1" caches responses to contract function requests until the state changes with the next tick, so identical
+// requests between two ticks only run the function once. Requires about 10 MB of memory.
+#define CONTRACT_FUNCTION_CACHE 0
 static unsigned long long logReaderPasscodes[4] = {
     0, 0, 0, 0 // REMOVE THIS ENTRY AND REPLACE IT WITH YOUR OWN RANDOM NUMBERS IN [0..18446744073709551615] RANGE IF LOGGING IS ENABLED
 };
@@ -51,4 +62,12 @@ static unsigned long long logReaderPasscodes[4] = {
 // Perform state persisting when your node is misaligned will also make your node misaligned after resuming.
 // Thus, picking various TICK_STORAGE_AUTOSAVE_TICK_PERIOD numbers across AUX nodes is recommended.
 // some suggested prime numbers you can try: 971 977 983 991 997
-#define TICK_STORAGE_AUTOSAVE_TICK_PERIOD 1000
\ No newline at end of file
+#define TICK_STORAGE_AUTOSAVE_TICK_PERIOD 1000
+
+// Mode for write-ahead journal of state changes between node state snapshots (requires TICK_STORAGE_AUTOSAVE_MODE):
+// 0: disable
+// 1: journal state changes of every tick and replay the journal after loading the snapshot, so a node can recover the
+//    state of the last processed tick. With journal, a larger TICK_STORAGE_AUTOSAVE_TICK_PERIOD can be used.
+#define STATE_JOURNAL_MODE 0
+// Journaled ticks are written to disk in groups, at least every STATE_JOURNAL_COMMIT_PERIOD_MS milliseconds
+#define STATE_JOURNAL_COMMIT_PERIOD_MS 1000
\ No newline at end of file
@@ -20,6 +20,9 @@
 #define SCORE_CACHE_SIZE 2000000 // the larger the better
 #define SCORE_CACHE_COLLISION_RETRIES 20 // number of retries to find entry in cache in case of hash collision
 
+// Keep a 1 byte fingerprint per spectrum slot for SIMD-accelerated lookup of entities (+16 MB RAM)
+#define USE_SPECTRUM_FINGERPRINTS 1
+
 // Number of ticks from prior epoch that are kept after seamless epoch transition. These can be requested after transition.
 #define TICKS_TO_KEEP_FROM_PRIOR_EPOCH 100
 
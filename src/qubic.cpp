@@ -5,6 +5,7 @@
 // contract_def.h needs to be included first to make sure that contracts have minimal access
 #include "contract_core/contract_def.h"
 #include "contract_core/contract_exec.h"
+#include "contract_core/contract_processor_mailbox.h"
 
 #include <intrin.h>
 
@@ -25,6 +26,7 @@
 #include "platform/uefi.h"
 #include "platform/time.h"
 #include "platform/file_io.h"
+#include "platform/file_compression.h"
 #include "platform/time_stamp_counter.h"
 #include "platform/memory_util.h"
 
@@ -54,6 +56,8 @@
 #include "logging/net_msg_impl.h"
 
 #include "ticking/ticking.h"
+#include "ticking/tick_profiler.h"
+#include "ticking/state_journal.h"
 #include "contract_core/qpi_ticking_impl.h"
 #include "vote_counter.h"
 
@@ -148,6 +152,7 @@ static unsigned int contractProcessorPhase;
 static const Transaction* contractProcessorTransaction = 0;
 static int contractProcessorTransactionMoneyflew = 0;
 static EFI_EVENT contractProcessorEvent;
+static ContractProcessorMailbox contractProcessorMailbox;
 static m256i contractStateDigests[MAX_NUMBER_OF_CONTRACTS * 2 - 1];
 const unsigned long long contractStateDigestsSizeInBytes = sizeof(contractStateDigests);
 
@@ -204,6 +209,8 @@ static unsigned long long K12MeasurementsCount = 0;
 static unsigned long long K12MeasurementsSum = 0;
 static volatile char minerScoreArrayLock = 0;
 static SpecialCommandGetMiningScoreRanking<MAX_NUMBER_OF_MINERS> requestMiningScoreRanking;
+static volatile char contractExecProfileResponseLock = 0;
+static SpecialCommandGetContractExecProfileResponse<ContractExecProfiler::capacity> contractExecProfileResponse;
 
 
 static unsigned long long customMiningMessageCounters[NUMBER_OF_COMPUTORS] = { 0 };
@@ -217,6 +224,11 @@ static bool loadMiningSeedFromFile = false;
 static bool loadAllNodeStateFromFile = false;
 #if TICK_STORAGE_AUTOSAVE_MODE
 static unsigned int nextPersistingNodeStateTick = 0;
+// Tick storage snapshot is saved by a request processor after the other node states have been saved by the main thread:
+// 0 = idle, 1 = scheduled by saveAllNodeStates(), 2 = saving, 3 = finished (result is logged by main loop)
+static volatile long persistingTickStorageState = 0;
+static int persistingTickStorageResult = 0;
+static CHAR16 persistingTickStorageDirectory[16];
 struct
 {
     Tick etalonTick;
@@ -236,6 +248,20 @@ struct
     unsigned long long lastLogId;
 } nodeStateBuffer;
 #endif
+#if STATE_JOURNAL_MODE
+static_assert(TICK_STORAGE_AUTOSAVE_MODE, "STATE_JOURNAL_MODE requires TICK_STORAGE_AUTOSAVE_MODE");
+
+// Memory regions of the state journal, followed by one region per contract state in order of contract index
+static constexpr unsigned int STATE_JOURNAL_REGION_SPECTRUM = 0;
+static constexpr unsigned int STATE_JOURNAL_REGION_UNIVERSE = 1;
+static constexpr unsigned int STATE_JOURNAL_REGION_SYSTEM = 2;
+static constexpr unsigned int STATE_JOURNAL_REGION_NODE_STATE = 3;
+static constexpr unsigned int STATE_JOURNAL_REGION_MINER_SOLUTION_FLAGS = 4;
+static constexpr unsigned int STATE_JOURNAL_REGION_CONTRACT_STATES = 5;
+static constexpr unsigned long long STATE_JOURNAL_FRAME_BUFFER_SIZE = 64ULL * 1024 * 1024; // max size of changes of one tick
+static constexpr unsigned long long STATE_JOURNAL_RING_BUFFER_SIZE = 512ULL * 1024 * 1024; // max size of ticks waiting to be written
+static StateJournal<STATE_JOURNAL_REGION_CONTRACT_STATES + contractCount> stateJournal;
+#endif
 static bool saveComputer(CHAR16* directory = NULL);
 static bool saveSystem(CHAR16* directory = NULL);
 static bool loadComputer(CHAR16* directory = NULL, bool forceLoadFromFile = false);
@@ -405,6 +431,10 @@ static void getComputerDigest(m256i& digest)
                 // K12 of state is included in contract execution time
                 _interlockedadd64(&contractTotalExecutionTicks[digestIndex], executionTicks);
 
+#if CONTRACT_STATE_SNAPSHOTS
+                contractStateSnapshots.markChanged(digestIndex);
+#endif
+
                 // Gather data for comparing different versions of K12
                 if (K12MeasurementsCount < 500)
                 {
@@ -434,8 +464,74 @@ static void getComputerDigest(m256i& digest)
     contractStateChangeFlags[0] = 0;
 
     digest = contractStateDigests[(MAX_NUMBER_OF_CONTRACTS * 2 - 1) - 1];
+
+#if CONTRACT_STATE_SNAPSHOTS
+    // Publish changed states for user functions (no procedure is running while computer digest is computed)
+    contractStateSnapshots.update(system.tick);
+#endif
 }
 
+#if STATE_JOURNAL_MODE
+static bool initStateJournal()
+{
+    if (!stateJournal.init(STATE_JOURNAL_FRAME_BUFFER_SIZE, STATE_JOURNAL_RING_BUFFER_SIZE, STATE_JOURNAL_COMMIT_PERIOD_MS)
+        || !stateJournal.registerRegion(STATE_JOURNAL_REGION_SPECTRUM, spectrum, spectrumSizeInBytes, false)
+        || !stateJournal.registerRegion(STATE_JOURNAL_REGION_UNIVERSE, assets, ASSETS_CAPACITY * sizeof(AssetRecord), false, assetChangeFlags, 0, sizeof(AssetRecord))
+        || !stateJournal.registerRegion(STATE_JOURNAL_REGION_SYSTEM, &system, sizeof(system), true)
+        || !stateJournal.registerRegion(STATE_JOURNAL_REGION_NODE_STATE, &nodeStateBuffer, sizeof(nodeStateBuffer), true)
+        || !stateJournal.registerRegion(STATE_JOURNAL_REGION_MINER_SOLUTION_FLAGS, minerSolutionFlags, NUMBER_OF_MINER_SOLUTION_FLAGS / 8, false))
+    {
+        return false;
+    }
+
+    // Only changed spectrum slots are journaled, anti-dust burning during a tick reorganizes the whole hash map
+    stateJournal.watchRewrites(STATE_JOURNAL_REGION_SPECTRUM, &spectrumReorgCount, L"spectrum reorganized by anti-dust burning");
+
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+    {
+        const unsigned long long size = contractDescriptions[contractIndex].stateSize;
+        if (!stateJournal.registerRegion(STATE_JOURNAL_REGION_CONTRACT_STATES + contractIndex, contractStates[contractIndex], size, true, contractStateChangeFlags, contractIndex, size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Add asset records changed in the current tick to the state journal. Needs to be called before getUniverseDigest()
+// clears assetChangeFlags.
+static void journalChangedAssets()
+{
+    if (!stateJournal.isFrameOpen())
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < ASSETS_CAPACITY / 64; i++)
+    {
+        unsigned long long flags = assetChangeFlags[i];
+        while (flags)
+        {
+            const unsigned int index = i * 64 + (unsigned int)_tzcnt_u64(flags);
+            stateJournal.addRecord(STATE_JOURNAL_REGION_UNIVERSE, index * sizeof(AssetRecord), &assets[index], sizeof(AssetRecord));
+            flags &= flags - 1;
+        }
+    }
+}
+
+// Add pages of contract states changed in the current tick to the state journal. Needs to be called before
+// getComputerDigest() clears contractStateChangeFlags.
+static void journalChangedContractStates()
+{
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+    {
+        if (contractStateChangeFlags[contractIndex >> 6] & (1ULL << (contractIndex & 63)))
+        {
+            stateJournal.addChangedPages(STATE_JOURNAL_REGION_CONTRACT_STATES + contractIndex);
+        }
+    }
+}
+#endif
+
 
 static void processExchangePublicPeers(Peer* peer, RequestResponseHeader* header)
 {
@@ -660,8 +756,9 @@ static void processBroadcastComputors(Peer* peer, RequestResponseHeader* header)
                 enqueueResponse(NULL, header);
             }
 
-            // Copy computor list
+            // Copy computor list and drop cached function results that may depend on the old list (qpi.computor())
             bs->CopyMem(&broadcastedComputors.computors, &request->computors, sizeof(Computors));
+            contractFunctionCache.invalidate();
 
             // Update ownComputorIndices and minerPublicKeys
             if (request->computors.epoch == system.epoch)
@@ -1175,8 +1272,19 @@ static void processRequestContractFunction(Peer* peer, const unsigned long long
     }
     else
     {
-        QpiContextUserFunctionCall qpiContext(request->contractIndex);
-        qpiContext.call(request->inputType, (((unsigned char*)request) + sizeof(RequestContractFunction)), request->inputSize);
+        const unsigned char* input = ((unsigned char*)request) + sizeof(RequestContractFunction);
+        unsigned char cachedOutput[contractFunctionCache.maxOutputSize];
+        unsigned short cachedOutputSize;
+        unsigned long long callGeneration;
+        if (contractFunctionCache.tryFetching(request->contractIndex, request->inputType, input, request->inputSize, cachedOutput, cachedOutputSize, callGeneration))
+        {
+            enqueueResponse(peer, cachedOutputSize, RespondContractFunction::type, header->dejavu(), cachedOutput);
+            return;
+        }
+
+        QpiContextUserFunctionCall qpiContext(request->contractIndex, (unsigned int)processorNumber);
+        qpiContext.call(request->inputType, input, request->inputSize);
+        contractFunctionCache.add(callGeneration, request->contractIndex, request->inputType, input, request->inputSize, qpiContext.outputBuffer, qpiContext.outputSize);
         enqueueResponse(peer, qpiContext.outputSize, RespondContractFunction::type, header->dejavu(), qpiContext.outputBuffer);
     }
 }
@@ -1347,6 +1455,35 @@ static void processSpecialCommand(Peer* peer, RequestResponseHeader* header)
                 enqueueResponse(peer, sizeof(SpecialCommandToggleMainModeRequestAndResponse), SpecialCommand::type, header->dejavu(), _request);
             }
             break;
+
+            case SPECIAL_COMMAND_GET_TICK_PROFILE:
+            {
+                const auto* _request = header->getPayload<SpecialCommandGetTickProfileRequest>();
+                SpecialCommandGetTickProfileResponse response;
+                response.everIncreasingNonceAndCommandType = _request->everIncreasingNonceAndCommandType;
+                setMem(response.padding, sizeof(response.padding), 0);
+                response.frequency = frequency;
+                tickProfiler.getStats(_request->epoch, response);
+                enqueueResponse(peer, sizeof(response), SpecialCommand::type, header->dejavu(), &response);
+            }
+            break;
+
+            case SPECIAL_COMMAND_GET_CONTRACT_EXEC_PROFILE:
+            {
+                const auto* _request = header->getPayload<SpecialCommandGetContractExecProfileRequest>();
+                ACQUIRE(contractExecProfileResponseLock);
+                contractExecProfileResponse.everIncreasingNonceAndCommandType = _request->everIncreasingNonceAndCommandType;
+                setMem(contractExecProfileResponse.padding, sizeof(contractExecProfileResponse.padding), 0);
+                contractExecProfileResponse.frequency = frequency;
+                const unsigned int numberOfEntries = contractExecProfiler.getStats(_request->epoch, contractExecProfileResponse);
+                enqueueResponse(peer,
+                    offsetof(SpecialCommandGetContractExecProfileResponse<ContractExecProfiler::capacity>, entries) + sizeof(ContractExecProfileEntry) * numberOfEntries,
+                    SpecialCommand::type,
+                    header->dejavu(),
+                    &contractExecProfileResponse);
+                RELEASE(contractExecProfileResponseLock);
+            }
+            break;
             }
         }
     }
@@ -1411,6 +1548,18 @@ static void updateNumberOfTickTransactions()
     ts.tickData.releaseLock();
 }
 
+#if TICK_STORAGE_AUTOSAVE_MODE
+// Save tick storage snapshot scheduled by saveAllNodeStates() if no other request processor has started it yet
+static void tryPersistTickStorage()
+{
+    if (persistingTickStorageState == 1 && _InterlockedCompareExchange(&persistingTickStorageState, 2, 1) == 1)
+    {
+        persistingTickStorageResult = ts.finishSaveToFile(persistingTickStorageDirectory);
+        persistingTickStorageState = 3;
+    }
+}
+#endif
+
 // Disabling the optimizer for requestProcessor() is a workaround introduced to solve an issue
 // that has been observed in testnets/2024-11-23-release-227-qvault.
 // In this test, the processors calling requestProcessor() were stuck before entering the function.
@@ -1435,6 +1584,8 @@ static void requestProcessor(void* ProcedureArgument)
             _InterlockedIncrement(&epochTransitionWaitingRequestProcessors);
             while (epochTransitionState)
             {
+                // help with parallel parts of the epoch transition, such as reorganizing the spectrum
+                tryHelpWithParallelJob();
                 _mm_pause();
             }
             _InterlockedDecrement(&epochTransitionWaitingRequestProcessors);
@@ -1445,10 +1596,20 @@ static void requestProcessor(void* ProcedureArgument)
         {
             score->tryProcessSolution(processorNumber);
         }
+
+        // help with parallel job of tick processor or contract processor, such as reorganizing the spectrum
+        tryHelpWithParallelJob();
+
+#if TICK_STORAGE_AUTOSAVE_MODE
+        // write tick storage snapshot while the main thread keeps serving the peers
+        tryPersistTickStorage();
+#endif
         
         if (requestQueueElementTail == requestQueueElementHead)
         {
-            _mm_pause();
+            // idle -> zero unused contract locals memory in the background
+            if (!cleanUpContractLocalsStack())
+                _mm_pause();
         }
         else
         {
@@ -1605,6 +1766,18 @@ static void requestProcessor(void* ProcedureArgument)
                 }
                 break;
 
+                case RequestLogSubscription::type:
+                {
+                    logger.processRequestLogSubscription(peer, header);
+                }
+                break;
+
+                case RequestEntityLogIds::type:
+                {
+                    logger.processRequestEntityLogIds(peer, header);
+                }
+                break;
+
                 case REQUEST_SYSTEM_INFO:
                 {
                     processRequestSystemInfo(peer, header);
@@ -1651,6 +1824,12 @@ static void contractProcessor(void*)
     unsigned long long processorNumber;
     mpServicesProtocol->WhoAmI(mpServicesProtocol, &processorNumber);
 
+    if (contractSystemProcedureListsEpoch != system.epoch)
+    {
+        // first phase of the epoch (or of the node run) -> update contracts that are active in this epoch
+        buildContractSystemProcedureLists(system.epoch);
+    }
+
     unsigned int executedContractIndex;
     switch (contractProcessorPhase)
     {
@@ -1671,56 +1850,40 @@ static void contractProcessor(void*)
 
     case BEGIN_EPOCH:
     {
-        for (executedContractIndex = 1; executedContractIndex < contractCount; executedContractIndex++)
+        for (unsigned int i = 0; i < contractSystemProcedureListSizes[BEGIN_EPOCH]; i++)
         {
-            if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
-                && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
-            {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, BEGIN_EPOCH);
-                qpiContext.call();
-            }
+            QpiContextSystemProcedureCall qpiContext(contractSystemProcedureLists[BEGIN_EPOCH][i], BEGIN_EPOCH);
+            qpiContext.call();
         }
     }
     break;
 
     case BEGIN_TICK:
     {
-        for (executedContractIndex = 1; executedContractIndex < contractCount; executedContractIndex++)
+        for (unsigned int i = 0; i < contractSystemProcedureListSizes[BEGIN_TICK]; i++)
         {
-            if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
-                && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
-            {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, BEGIN_TICK);
-                qpiContext.call();
-            }
+            QpiContextSystemProcedureCall qpiContext(contractSystemProcedureLists[BEGIN_TICK][i], BEGIN_TICK);
+            qpiContext.call();
         }
     }
     break;
 
     case END_TICK:
     {
-        for (executedContractIndex = contractCount; executedContractIndex-- > 1; )
+        for (unsigned int i = contractSystemProcedureListSizes[END_TICK]; i-- > 0; )
         {
-            if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
-                && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
-            {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, END_TICK);
-                qpiContext.call();
-            }
+            QpiContextSystemProcedureCall qpiContext(contractSystemProcedureLists[END_TICK][i], END_TICK);
+            qpiContext.call();
         }
     }
     break;
 
     case END_EPOCH:
     {
-        for (executedContractIndex = contractCount; executedContractIndex-- > 1; )
+        for (unsigned int i = contractSystemProcedureListSizes[END_EPOCH]; i-- > 0; )
         {
-            if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
-                && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
-            {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, END_EPOCH);
-                qpiContext.call();
-            }
+            QpiContextSystemProcedureCall qpiContext(contractSystemProcedureLists[END_EPOCH][i], END_EPOCH);
+            qpiContext.call();
         }
     }
     break;
@@ -1749,6 +1912,42 @@ static void contractProcessor(void*)
     }
 }
 
+// Execute calls posted to contractProcessorMailbox. Without timeout, the contract processor is resident and polls
+// the mailbox until shutdown. With timeout, it is started by the main loop for each call and returns after the call.
+static void runContractProcessor(void*)
+{
+    do
+    {
+        if (contractProcessorMailbox.tryStartCall())
+        {
+            contractProcessor(NULL);
+            contractProcessorMailbox.finishCall();
+        }
+        else
+        {
+            _mm_pause();
+        }
+    } while (!MAX_CONTRACT_ITERATION_DURATION && !shutDownNode);
+}
+
+// Run phase in contract processor and wait for completion (called by tick processor)
+static void callContractProcessor(unsigned int phase)
+{
+    contractProcessorPhase = phase;
+#if MAX_CONTRACT_ITERATION_DURATION
+    // Main loop starts contract processor with timeout
+    contractProcessorMailbox.post();
+    contractProcessorState = 1;
+    while (contractProcessorState)
+    {
+        _mm_pause();
+    }
+    contractProcessorMailbox.abortUnfinishedCall();
+#else
+    contractProcessorMailbox.call();
+#endif
+}
+
 static bool bidInContractIPO(long long price, unsigned short quantity, const m256i& sourcePublicKey, const int spectrumIndex, const unsigned int contractIndex)
 {
     ASSERT(spectrumIndex >= 0);
@@ -1898,12 +2097,7 @@ static bool processTickTransactionContractProcedure(const Transaction* transacti
         // Run user procedure call of transaction in contract processor
         // and wait for completion
         contractProcessorTransaction = transaction;
-        contractProcessorPhase = USER_PROCEDURE_CALL;
-        contractProcessorState = 1;
-        while (contractProcessorState)
-        {
-            _mm_pause();
-        }
+        callContractProcessor(USER_PROCEDURE_CALL);
 
         return contractProcessorTransactionMoneyflew;
     }
@@ -1930,6 +2124,9 @@ static void processTickTransactionSolution(const MiningSolutionTransaction* tran
     if (!(minerSolutionFlags[flagIndex >> 6] & (1ULL << (flagIndex & 63))))
     {
         minerSolutionFlags[flagIndex >> 6] |= (1ULL << (flagIndex & 63));
+#if STATE_JOURNAL_MODE
+        stateJournal.addRecord(STATE_JOURNAL_REGION_MINER_SOLUTION_FLAGS, (flagIndex >> 6) * 8ULL, &minerSolutionFlags[flagIndex >> 6], 8);
+#endif
 
         unsigned int solutionScore = (*::score)(processorNumber, transaction->sourcePublicKey, transaction->miningSeed, transaction->nonce);
         if (score->isValidScore(solutionScore))
@@ -2287,6 +2484,12 @@ static void processTickTransaction(const Transaction* transaction, const m256i&
 #pragma optimize("", off)
 static void processTick(unsigned long long processorNumber)
 {
+    tickProfiler.beginTick(system.epoch);
+    contractExecProfiler.beginEpoch(system.epoch);
+#if STATE_JOURNAL_MODE
+    stateJournal.beginFrame(system.tick);
+#endif
+
     if (system.tick > system.initialTick)
     {
         etalonTick.prevResourceTestingDigest = resourceTestingDigest;
@@ -2320,34 +2523,21 @@ static void processTick(unsigned long long processorNumber)
     {
         // it should never go here
     }
+    tickProfiler.skipPhase(); // time for previous digests is only included in total
 
     if (system.tick == system.initialTick)
     {
         logger.reset(system.initialTick, system.initialTick); // clear logs here to give more time for querying and persisting the data when we do seamless transition
         logger.registerNewTx(system.tick, logger.SC_INITIALIZE_TX);
-        contractProcessorPhase = INITIALIZE;
-        contractProcessorState = 1;
-        while (contractProcessorState)
-        {
-            _mm_pause();
-        }
+        callContractProcessor(INITIALIZE);
 
         logger.registerNewTx(system.tick, logger.SC_BEGIN_EPOCH_TX);
-        contractProcessorPhase = BEGIN_EPOCH;
-        contractProcessorState = 1;
-        while (contractProcessorState)
-        {
-            _mm_pause();
-        }
+        callContractProcessor(BEGIN_EPOCH);
     }
 
     logger.registerNewTx(system.tick, logger.SC_BEGIN_TICK_TX);
-    contractProcessorPhase = BEGIN_TICK;
-    contractProcessorState = 1;
-    while (contractProcessorState)
-    {
-        _mm_pause();
-    }
+    callContractProcessor(BEGIN_TICK);
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_BEGIN_TICK);
 
     unsigned int tickIndex = ts.tickToIndexCurrentEpoch(system.tick);
     ts.tickData.acquireLock();
@@ -2410,6 +2600,7 @@ static void processTick(unsigned long long processorNumber)
             score->stopProcessTaskQueue();
         }
         solutionTotalExecutionTicks = __rdtsc() - solutionProcessStartTick; // for tracking the time processing solutions
+        tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_SOLUTIONS);
 
         // Process all transaction of the tick
         for (unsigned int transactionIndex = 0; transactionIndex < NUMBER_OF_TRANSACTIONS_PER_TICK; transactionIndex++)
@@ -2431,15 +2622,12 @@ static void processTick(unsigned long long processorNumber)
                 }
             }
         }
+        tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_TRANSACTIONS);
     }
 
     logger.registerNewTx(system.tick, logger.SC_END_TICK_TX);
-    contractProcessorPhase = END_TICK;
-    contractProcessorState = 1;
-    while (contractProcessorState)
-    {
-        _mm_pause();
-    }
+    callContractProcessor(END_TICK);
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_END_TICK);
 
     unsigned int digestIndex;
     ACQUIRE(spectrumLock);
@@ -2449,6 +2637,9 @@ static void processTick(unsigned long long processorNumber)
         {
             KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
             spectrumChangeFlags[digestIndex >> 6] |= (1ULL << (digestIndex & 63));
+#if STATE_JOURNAL_MODE
+            stateJournal.addRecord(STATE_JOURNAL_REGION_SPECTRUM, digestIndex * sizeof(::Entity), &spectrum[digestIndex], sizeof(::Entity));
+#endif
         }
     }
     unsigned int previousLevelBeginning = 0;
@@ -2472,9 +2663,18 @@ static void processTick(unsigned long long processorNumber)
 
     etalonTick.saltedSpectrumDigest = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
     RELEASE(spectrumLock);
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_SPECTRUM_DIGEST);
 
+#if STATE_JOURNAL_MODE
+    journalChangedAssets();
+#endif
     getUniverseDigest(etalonTick.saltedUniverseDigest);
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_UNIVERSE_DIGEST);
+#if STATE_JOURNAL_MODE
+    journalChangedContractStates();
+#endif
     getComputerDigest(etalonTick.saltedComputerDigest);
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_COMPUTER_DIGEST);
 
     // If node is MAIN and has ID of tickleader for system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET,
     // prepare tickData and enqueue it
@@ -2591,6 +2791,7 @@ static void processTick(unsigned long long processorNumber)
             break;
         }
     }
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_TICK_DATA);
 
     for (unsigned int i = 0; i < numberOfOwnComputorIndices; i++)
     {
@@ -2702,21 +2903,33 @@ static void processTick(unsigned long long processorNumber)
             }
         }
     }
+    tickProfiler.endPhase(system.epoch, TICK_PROFILE_PHASE_VOTES);
 
 #ifndef NDEBUG
     // Check that continuous updating of spectrum info is consistent with counting from scratch
     SpectrumInfo si;
-    updateSpectrumInfo(si);
+    unsigned int categoryPopulations[entityCategoryCount];
+    updateSpectrumInfo(si, categoryPopulations);
     if (si.numberOfEntities != spectrumInfo.numberOfEntities || si.totalAmount != spectrumInfo.totalAmount)
     {
         addDebugMessage(L"BUG DETECTED: Spectrum info of continuous updating is inconsistent with counting from scratch!");
     }
+    for (unsigned int i = 0; i < entityCategoryCount; i++)
+    {
+        if (categoryPopulations[i] != entityCategoryPopulations[i])
+        {
+            addDebugMessage(L"BUG DETECTED: Entity category populations of continuous updating are inconsistent with counting from scratch!");
+            break;
+        }
+    }
 #endif
 
-    // Update entity category populations and dust thresholds each 8 ticks
-    if ((system.tick & 7) == 0)
-        updateAndAnalzeEntityCategoryPopulations();
+    // Update dust thresholds (cheap, because entity category populations are updated continuously)
+    analyzeEntityCategoryPopulations();
     logger.updateTick(system.tick);
+    logger.pushLogSubscriptions();
+
+    tickProfiler.endTick(system.epoch);
 }
 
 #pragma optimize("", on)
@@ -2806,12 +3019,7 @@ static void beginEpoch()
 static void endEpoch()
 {
     logger.registerNewTx(system.tick, logger.SC_END_EPOCH_TX);
-    contractProcessorPhase = END_EPOCH;
-    contractProcessorState = 1;
-    while (contractProcessorState)
-    {
-        _mm_pause();
-    }
+    callContractProcessor(END_EPOCH);
 
     // treating endEpoch as a tick, start updating etalonTick:
     // this is the last tick of an epoch, should we set prevResourceTestingDigest to zero? nodes that start from scratch (for the new epoch)
@@ -3045,6 +3253,7 @@ static void endEpoch()
     assetsEndEpoch();
 
     logger.updateTick(system.tick);
+    logger.pushLogSubscriptions();
 #if PAUSE_BEFORE_CLEAR_MEMORY
     // re-open request processors for other services to query
     epochTransitionState = 0;
@@ -3866,6 +4075,76 @@ static bool invalidateNodeStates(CHAR16* directory)
     return ts.saveInvalidateData(system.epoch, directory);
 }
 
+static void fillNodeStateBuffer()
+{
+    copyMem(&nodeStateBuffer.etalonTick, &etalonTick, sizeof(etalonTick));
+    copyMem(nodeStateBuffer.minerPublicKeys, (void*)minerPublicKeys, sizeof(minerPublicKeys));
+    copyMem(nodeStateBuffer.minerScores, (void*)minerScores, sizeof(minerScores));
+    copyMem(nodeStateBuffer.competitorPublicKeys, (void*)competitorPublicKeys, sizeof(competitorPublicKeys));
+    copyMem(nodeStateBuffer.competitorScores, (void*)competitorScores, sizeof(competitorScores));
+    copyMem(nodeStateBuffer.competitorComputorStatuses, (void*)competitorComputorStatuses, sizeof(competitorComputorStatuses));
+    copyMem(nodeStateBuffer.solutionPublicationTicks, (void*)solutionPublicationTicks, sizeof(solutionPublicationTicks));
+    copyMem(nodeStateBuffer.faultyComputorFlags, (void*)faultyComputorFlags, sizeof(faultyComputorFlags));
+    copyMem(&nodeStateBuffer.broadcastedComputors, (void*)&broadcastedComputors, sizeof(broadcastedComputors));
+    copyMem(&nodeStateBuffer.resourceTestingDigest, &resourceTestingDigest, sizeof(resourceTestingDigest));
+    nodeStateBuffer.currentRandomSeed = score->currentRandomSeed;
+    nodeStateBuffer.numberOfMiners = numberOfMiners;
+    nodeStateBuffer.numberOfTransactions = numberOfTransactions;
+    nodeStateBuffer.lastLogId = logger.logId;
+    voteCounter.saveAllDataToArray(nodeStateBuffer.voteCounterData);
+}
+
+static void applyNodeStateBuffer()
+{
+    copyMem(&etalonTick, &nodeStateBuffer.etalonTick, sizeof(etalonTick));
+    copyMem((void*)minerPublicKeys, nodeStateBuffer.minerPublicKeys, sizeof(minerPublicKeys));
+    copyMem((void*)minerScores, nodeStateBuffer.minerScores, sizeof(minerScores));
+    copyMem((void*)competitorPublicKeys, nodeStateBuffer.competitorPublicKeys, sizeof(competitorPublicKeys));
+    copyMem((void*)competitorScores, nodeStateBuffer.competitorScores, sizeof(competitorScores));
+    copyMem((void*)competitorComputorStatuses, nodeStateBuffer.competitorComputorStatuses, sizeof(competitorComputorStatuses));
+    copyMem((void*)solutionPublicationTicks, nodeStateBuffer.solutionPublicationTicks, sizeof(solutionPublicationTicks));
+    copyMem((void*)faultyComputorFlags, nodeStateBuffer.faultyComputorFlags, sizeof(faultyComputorFlags));
+    copyMem((void*)&broadcastedComputors, &nodeStateBuffer.broadcastedComputors, sizeof(broadcastedComputors));
+    copyMem(&resourceTestingDigest, &nodeStateBuffer.resourceTestingDigest, sizeof(resourceTestingDigest));
+    numberOfMiners = nodeStateBuffer.numberOfMiners;
+    initialRandomSeedFromPersistingState = nodeStateBuffer.currentRandomSeed;
+    numberOfTransactions = nodeStateBuffer.numberOfTransactions;
+    logger.logId = nodeStateBuffer.lastLogId;
+    loadMiningSeedFromFile = true;
+    voteCounter.loadAllDataFromArray(nodeStateBuffer.voteCounterData);
+
+    // update own computor indices
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+    {
+        for (unsigned int j = 0; j < sizeof(computorSeeds) / sizeof(computorSeeds[0]); j++)
+        {
+            if (broadcastedComputors.computors.publicKeys[i] == computorPublicKeys[j])
+            {
+                ownComputorIndices[numberOfOwnComputorIndices] = i;
+                ownComputorIndicesMapping[numberOfOwnComputorIndices++] = j;
+
+                break;
+            }
+        }
+    }
+}
+
+#if STATE_JOURNAL_MODE
+// Add changes of system and node state to the current frame of the state journal and queue the frame for writing.
+// Called from the tick processor after system.tick has been advanced, so replaying the frame restores the state
+// before processing the next tick.
+static void commitStateJournalFrame()
+{
+    if (stateJournal.isFrameOpen())
+    {
+        fillNodeStateBuffer();
+        stateJournal.addChangedPages(STATE_JOURNAL_REGION_SYSTEM);
+        stateJournal.addChangedPages(STATE_JOURNAL_REGION_NODE_STATE);
+        stateJournal.commitFrame();
+    }
+}
+#endif
+
 // can only called from main thread
 static bool saveAllNodeStates()
 {
@@ -3875,6 +4154,11 @@ static bool saveAllNodeStates()
 
     logToConsole(L"Start saving node states from main thread");
 
+#if STATE_JOURNAL_MODE
+    // Write remaining ticks of journal of previous snapshot, it will be replaced by a new one after saving
+    stateJournal.stop();
+#endif
+
     // Mark current snapshot metadata as invalid at the beginning.
     // Any reasons make the valid metadata can not be overwritten at the final step will keep this invalid file
     // and make the loadAllNodeStates see this saving as an invalid save.
@@ -3933,21 +4217,7 @@ static bool saveAllNodeStates()
     
     score->saveScoreCache(system.epoch, directory);
     
-    copyMem(&nodeStateBuffer.etalonTick, &etalonTick, sizeof(etalonTick));
-    copyMem(nodeStateBuffer.minerPublicKeys, (void*)minerPublicKeys, sizeof(minerPublicKeys));
-    copyMem(nodeStateBuffer.minerScores, (void*)minerScores, sizeof(minerScores));
-    copyMem(nodeStateBuffer.competitorPublicKeys, (void*)competitorPublicKeys, sizeof(competitorPublicKeys));
-    copyMem(nodeStateBuffer.competitorScores, (void*)competitorScores, sizeof(competitorScores));
-    copyMem(nodeStateBuffer.competitorComputorStatuses, (void*)competitorComputorStatuses, sizeof(competitorComputorStatuses));
-    copyMem(nodeStateBuffer.solutionPublicationTicks, (void*)solutionPublicationTicks, sizeof(solutionPublicationTicks));
-    copyMem(nodeStateBuffer.faultyComputorFlags, (void*)faultyComputorFlags, sizeof(faultyComputorFlags));
-    copyMem(&nodeStateBuffer.broadcastedComputors, (void*)&broadcastedComputors, sizeof(broadcastedComputors));
-    copyMem(&nodeStateBuffer.resourceTestingDigest, &resourceTestingDigest, sizeof(resourceTestingDigest));
-    nodeStateBuffer.currentRandomSeed = score->currentRandomSeed;
-    nodeStateBuffer.numberOfMiners = numberOfMiners;
-    nodeStateBuffer.numberOfTransactions = numberOfTransactions;
-    nodeStateBuffer.lastLogId = logger.logId;
-    voteCounter.saveAllDataToArray(nodeStateBuffer.voteCounterData);
+    fillNodeStateBuffer();
 
     CHAR16 NODE_STATE_FILE_NAME[] = L"snapshotNodeMiningState";
     savedSize = save(NODE_STATE_FILE_NAME, sizeof(nodeStateBuffer), (unsigned char*)&nodeStateBuffer, directory);
@@ -3994,14 +4264,6 @@ static bool saveAllNodeStates()
         return false;
     }
 
-    setText(message, L"Saving tick storage ");
-    logToConsole(message);
-    if (ts.trySaveToFile(system.epoch, system.tick, directory) != 0)
-    {
-        logToConsole(L"Failed to save tick storage");
-        return false;
-    }
-
 #if ADDON_TX_STATUS_REQUEST
     if (!saveStateTxStatus(numberOfTransactions, directory))
     {
@@ -4010,6 +4272,23 @@ static bool saveAllNodeStates()
     }
 #endif
 
+#if STATE_JOURNAL_MODE
+    // Journal ticks from system.tick on, which is the next tick to be processed
+    stateJournal.start(system.epoch, system.tick, directory);
+#endif
+
+    // Tick storage is saved last, because the snapshot only becomes valid with its metadata. The ticks before
+    // system.tick are selected here and written by a request processor after tick processing has been resumed.
+    setText(message, L"Saving tick storage ");
+    logToConsole(message);
+    if (ts.beginSaveToFile(system.epoch, system.tick) != 0)
+    {
+        logToConsole(L"Failed to save tick storage");
+        return false;
+    }
+    setText(persistingTickStorageDirectory, directory);
+    persistingTickStorageState = 1;
+
     return true;
 }
 
@@ -4070,37 +4349,10 @@ static bool loadAllNodeStates()
         logToConsole(L"Failed to load mining state");
         return false;
     }
-    copyMem(&etalonTick, &nodeStateBuffer.etalonTick, sizeof(etalonTick));
-    copyMem((void*)minerPublicKeys, nodeStateBuffer.minerPublicKeys, sizeof(minerPublicKeys));
-    copyMem((void*)minerScores, nodeStateBuffer.minerScores, sizeof(minerScores));
-    copyMem((void*)competitorPublicKeys, nodeStateBuffer.competitorPublicKeys, sizeof(competitorPublicKeys));
-    copyMem((void*)competitorScores, nodeStateBuffer.competitorScores, sizeof(competitorScores));
-    copyMem((void*)competitorComputorStatuses, nodeStateBuffer.competitorComputorStatuses, sizeof(competitorComputorStatuses));
-    copyMem((void*)solutionPublicationTicks, nodeStateBuffer.solutionPublicationTicks, sizeof(solutionPublicationTicks));
-    copyMem((void*)faultyComputorFlags, nodeStateBuffer.faultyComputorFlags, sizeof(faultyComputorFlags));
-    copyMem((void*)&broadcastedComputors, &nodeStateBuffer.broadcastedComputors, sizeof(broadcastedComputors));
-    copyMem(&resourceTestingDigest, &nodeStateBuffer.resourceTestingDigest, sizeof(resourceTestingDigest));
-    numberOfMiners = nodeStateBuffer.numberOfMiners;
-    initialRandomSeedFromPersistingState = nodeStateBuffer.currentRandomSeed;
-    numberOfTransactions = nodeStateBuffer.numberOfTransactions;
-    logger.logId = nodeStateBuffer.lastLogId;
-    loadMiningSeedFromFile = true;
-    voteCounter.loadAllDataFromArray(nodeStateBuffer.voteCounterData);
-
-    // update own computor indices
-    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
-    {
-        for (unsigned int j = 0; j < sizeof(computorSeeds) / sizeof(computorSeeds[0]); j++)
-        {
-            if (broadcastedComputors.computors.publicKeys[i] == computorPublicKeys[j])
-            {
-                ownComputorIndices[numberOfOwnComputorIndices] = i;
-                ownComputorIndicesMapping[numberOfOwnComputorIndices++] = j;
-
-                break;
-            }
-        }
-    }
+#if ADDON_TX_STATUS_REQUEST
+    // tx status data is not journaled
+    const unsigned int snapshotNumberOfTransactions = nodeStateBuffer.numberOfTransactions;
+#endif
 
     static unsigned short SYSTEM_SNAPSHOT_FILE_NAME[] = L"system.snp";
     loadedSize = load(SYSTEM_SNAPSHOT_FILE_NAME, sizeof(system), (unsigned char*)&system, directory);
@@ -4109,7 +4361,6 @@ static bool loadAllNodeStates()
         logToConsole(L"Failed to load system");
         return false;
     }
-    updateNumberOfTickTransactions();
 
     setMem(assetChangeFlags, sizeof(assetChangeFlags), 0);
     setMem(spectrumChangeFlags, sizeof(spectrumChangeFlags), 0);
@@ -4149,8 +4400,31 @@ static bool loadAllNodeStates()
         return false;
     }
 
+#if STATE_JOURNAL_MODE
+    // Replay ticks processed after the snapshot (updating system and nodeStateBuffer) and continue the journal
+    unsigned int journalTick = system.tick;
+    unsigned int journalFileIndex = 0;
+    unsigned long long journalId = 0;
+    const long long replayedTicks = stateJournal.replay(system.epoch, journalTick, directory, journalFileIndex, journalId);
+    if (replayedTicks < 0 || journalTick != system.tick)
+    {
+        logToConsole(L"Failed to replay state journal");
+        return false;
+    }
+    if (replayedTicks > 0)
+    {
+        updateSpectrumFingerprints();
+        updateSpectrumInfo();
+        computeSpectrumDigests();
+        as.indexLists.rebuild();
+    }
+#endif
+
+    applyNodeStateBuffer();
+    updateNumberOfTickTransactions();
+
 #if ADDON_TX_STATUS_REQUEST
-    if (!loadStateTxStatus(numberOfTransactions, directory))
+    if (!loadStateTxStatus(snapshotNumberOfTransactions, directory))
     {
         logToConsole(L"Failed to load tx status");
         return false;
@@ -4161,6 +4435,10 @@ static bool loadAllNodeStates()
     logToConsole(L"Initializing logger");
     logger.reset(system.initialTick, system.tick); // initialize the logger
 #endif
+
+#if STATE_JOURNAL_MODE
+    stateJournal.start(system.epoch, system.tick, directory, journalFileIndex, journalId);
+#endif
     return true;
 }
 
@@ -4776,7 +5054,9 @@ static void tickProcessor(void*)
                     while (requestPersistingNodeState) _mm_pause();
                     persistingNodeStateTickProcWaiting = 0;
                 }
+                contractFunctionCache.beginStateChange();
                 processTick(processorNumber);
+                contractFunctionCache.endStateChange();
                 latestProcessedTick = system.tick;
             }
 
@@ -5012,11 +5292,22 @@ static void tickProcessor(void*)
                             }
                             if (tickDataSuits)
                             {
+                                // tick data, tick number, and (in epoch transition) the whole state change below
+                                contractFunctionCache.beginStateChange();
+
                                 const int dayIndex = ::dayIndex(etalonTick.year, etalonTick.month, etalonTick.day);
                                 if ((dayIndex == 738570 + system.epoch * 7 && etalonTick.hour >= 12)
                                     || dayIndex > 738570 + system.epoch * 7)
                                 {
                                     // start seamless epoch transition
+#if TICK_STORAGE_AUTOSAVE_MODE
+                                    // (after tick storage snapshot of the ending epoch has been written, because
+                                    // request processors stop taking jobs and beginEpoch() resets the tick storage)
+                                    while (persistingTickStorageState)
+                                    {
+                                        _mm_pause();
+                                    }
+#endif
                                     epochTransitionState = 1;
                                     forceSwitchEpoch = false;
                                 }
@@ -5086,6 +5377,18 @@ static void tickProcessor(void*)
 
                                 checkAndSwitchMiningPhase();
 
+#if STATE_JOURNAL_MODE
+                                if (epochTransitionState == 1)
+                                {
+                                    // journal only continues the snapshot of the current epoch
+                                    stateJournal.suspend(L"epoch transition");
+                                }
+                                else
+                                {
+                                    commitStateJournalFrame();
+                                }
+#endif
+
                                 if (epochTransitionState == 1)
                                 {
 
@@ -5140,6 +5443,7 @@ static void tickProcessor(void*)
 
                                     epochTransitionState = 0;
                                 }
+                                contractFunctionCache.endStateChange();
                                 ASSERT(epochTransitionWaitingRequestProcessors >= 0 && epochTransitionWaitingRequestProcessors <= nRequestProcessorIDs);
 
                                 gTickNumberOfComputors = 0;
@@ -5198,7 +5502,8 @@ static bool loadComputer(CHAR16* directory, bool forceLoadFromFile)
             CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
             CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 7] = (contractIndex % 100) / 10 + L'0';
             CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 6] = contractIndex % 10 + L'0';
-            long long loadedSize = load(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex], directory);
+            unsigned int formatVersion = 0;
+            long long loadedSize = loadCompressed(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex], directory, NULL, &formatVersion);
             if (loadedSize != contractDescriptions[contractIndex].stateSize)
             {
                 if (system.epoch < contractDescriptions[contractIndex].constructionEpoch && contractDescriptions[contractIndex].stateSize >= sizeof(IPO))
@@ -5216,6 +5521,23 @@ static bool loadComputer(CHAR16* directory, bool forceLoadFromFile)
             }
             else
             {
+                if (formatVersion > CONTRACT_STATE_FORMAT_VERSION)
+                {
+                    setText(message, CONTRACT_FILE_NAME);
+                    appendText(message, L" has been saved by a newer version with unknown state format!");
+                    logToConsole(message);
+                    return false;
+                }
+                // format version is only stored in files with header, which saveCompressed() omits for small files
+                static_assert(sizeof(QX) >= compressedFileMinSize, "Format version of QX state isn't stored in file");
+                if (!migrateContractStateFormat(contractIndex, contractStates[contractIndex], formatVersion))
+                {
+                    setText(message, L"Failed to convert ");
+                    appendText(message, CONTRACT_FILE_NAME);
+                    appendText(message, L" from former state format!");
+                    logToConsole(message);
+                    return false;
+                }
                 appendText(message, CONTRACT_FILE_NAME);
                 appendText(message, L" ");
             }
@@ -5233,6 +5555,7 @@ static bool saveComputer(CHAR16* directory)
 
     bool ok = true;
     unsigned long long totalSize = 0;
+    unsigned long long totalStoredSize = 0;
 
     for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
     {
@@ -5241,9 +5564,11 @@ static bool saveComputer(CHAR16* directory)
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 7] = (contractIndex % 100) / 10 + L'0';
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 6] = contractIndex % 10 + L'0';
         contractStateLock[contractIndex].acquireRead();
-        long long savedSize = save(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex], directory);
+        unsigned long long storedSize = 0;
+        long long savedSize = saveCompressed(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex], directory, &storedSize, CONTRACT_STATE_FORMAT_VERSION);
         contractStateLock[contractIndex].releaseRead();
         totalSize += savedSize;
+        totalStoredSize += storedSize;
         if (savedSize != contractDescriptions[contractIndex].stateSize)
         {
             ok = false;
@@ -5255,9 +5580,9 @@ static bool saveComputer(CHAR16* directory)
     if (ok)
     {
         setNumber(message, totalSize, TRUE);
-        appendText(message, L" bytes of the computer data are saved (");
-        appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
-        appendText(message, L" microseconds).");
+        appendText(message, L" bytes of the computer data are saved");
+        appendCompressionStats(message, totalSize, totalStoredSize, (__rdtsc() - beginningTick) * 1000000 / frequency);
+        appendText(message, L".");
         logToConsole(message);
         return true;
     }
@@ -5301,6 +5626,8 @@ static bool initialize()
     initTimeStampCounter();
 
     bs->SetMem(&tickTicks, sizeof(tickTicks), 0);
+    tickProfiler.reset();
+    contractProcessorMailbox.init();
 
     bs->SetMem(processors, sizeof(processors), 0);
     bs->SetMem(peers, sizeof(peers), 0);
@@ -5356,7 +5683,19 @@ static bool initialize()
             {
                 return false;
             }
+#if CONTRACT_STATE_SNAPSHOTS
+            if (!contractStateSnapshots.registerContract(contractIndex, contractStates[contractIndex], size))
+            {
+                return false;
+            }
+#endif
         }
+#if CONTRACT_FUNCTION_CACHE
+        if (!contractFunctionCache.init())
+        {
+            return false;
+        }
+#endif
 
         if (!allocPoolWithErrorLog(L"score", sizeof(*score), (void**)&score, __LINE__))
         {
@@ -5370,6 +5709,13 @@ static bool initialize()
             return false;
         }
 
+#if STATE_JOURNAL_MODE
+        if (!initStateJournal())
+        {
+            return false;
+        }
+#endif
+
         if (!logger.initLogging())
         {
             return false;
@@ -5427,32 +5773,6 @@ static bool initialize()
 
             loadSpectrum();
             {
-                const unsigned long long beginningTick = __rdtsc();
-
-                unsigned int digestIndex;
-                for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
-                {
-                    KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
-                }
-                unsigned int previousLevelBeginning = 0;
-                unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-                while (numberOfLeafs > 1)
-                {
-                    for (unsigned int i = 0; i < numberOfLeafs; i += 2)
-                    {
-                        KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex++]);
-                    }
-
-                    previousLevelBeginning += numberOfLeafs;
-                    numberOfLeafs >>= 1;
-                }
-
-                setNumber(message, SPECTRUM_CAPACITY * sizeof(::Entity), TRUE);
-                appendText(message, L" bytes of the spectrum data are hashed (");
-                appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
-                appendText(message, L" microseconds).");
-                logToConsole(message);
-
                 CHAR16 digestChars[60 + 1];
                 getIdentity((unsigned char*)&spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1], digestChars, true);
                 updateSpectrumInfo();
@@ -5606,6 +5926,10 @@ static void deinitialize()
         root->Close(root);
     }
 
+#if STATE_JOURNAL_MODE
+    stateJournal.deinit();
+#endif
+
     deinitAssets();
     deinitSpectrum();
     deinitCommonBuffers();
@@ -6040,7 +6364,12 @@ static void logHealthStatus()
     {
         appendText(message, L"buf ");
         appendNumber(message, i, FALSE);
-        if (contractLocalsStackLock[i])
+        if (i >= contractLocalsStackPool.activeStacks)
+        {
+            appendText(message, L" (reserved) | ");
+            continue;
+        }
+        if (contractLocalsStackPool.isAcquired(i))
             appendText(message, L" (locked)");
         appendText(message, L" current ");
         appendNumber(message, contractLocalsStack[i].size(), TRUE);
@@ -6054,10 +6383,69 @@ static void logHealthStatus()
     }
     appendText(message, L"capacity per buf ");
     appendNumber(message, contractLocalsStack[0].capacity(), TRUE);
-    appendText(message, L" | max processors waiting ");
-    appendNumber(message, contractLocalsStackLockWaitingCountMax, TRUE);
     logToConsole(message);
 
+    // Print amount of memory zeroed for contract input, output, and locals (on allocation / in background)
+    setText(message, L"Contract stack buffer zeroing: allocated ");
+    appendNumber(message, contractLocalsZeroingStats.allocatedBytes, TRUE);
+    appendText(message, L" bytes, zeroed on allocation ");
+    appendNumber(message, contractLocalsZeroingStats.zeroedBytes, TRUE);
+    appendText(message, L" bytes (cycles per allocation p50 ");
+    appendNumber(message, contractLocalsZeroingStats.zeroingCycles.percentile(500), TRUE);
+    appendText(message, L", p99 ");
+    appendNumber(message, contractLocalsZeroingStats.zeroingCycles.percentile(990), TRUE);
+    appendText(message, L", max ");
+    appendNumber(message, contractLocalsZeroingStats.zeroingCycles.max, TRUE);
+    appendText(message, L"), zeroed in background ");
+    appendNumber(message, contractLocalsZeroingStats.cleanedBytes, TRUE);
+    appendText(message, L" bytes in ");
+    appendNumber(message, contractLocalsZeroingStats.cleanUpCycles, TRUE);
+    appendText(message, L" cycles");
+    logToConsole(message);
+
+    // Print cycles needed to acquire a stack buffer (including waiting if all are in use)
+    setText(message, L"Contract stack buffer acquire cycles: ");
+    for (int i = 0; i < 2; ++i)
+    {
+        const CycleHistogram& histogram = contractLocalsStackPool.acquireCycles[i];
+        appendText(message, (i == 0) ? L"procedures count " : L" | functions count ");
+        appendNumber(message, histogram.count, TRUE);
+        appendText(message, L", p50 ");
+        appendNumber(message, histogram.percentile(500), TRUE);
+        appendText(message, L", p99 ");
+        appendNumber(message, histogram.percentile(990), TRUE);
+        appendText(message, L", max ");
+        appendNumber(message, histogram.max, TRUE);
+    }
+    logToConsole(message);
+
+#if CONTRACT_FUNCTION_CACHE
+    // Print hit rate of contract function cache (hits / lookups) of contracts that have been queried
+    setText(message, L"Contract function cache hits:");
+    long long totalLookups = 0, totalHits = 0;
+    for (unsigned int i = 0; i < contractCount; ++i)
+    {
+        const long long lookups = contractFunctionCache.stats[i].lookups;
+        const long long hits = contractFunctionCache.stats[i].hits;
+        if (lookups)
+        {
+            appendText(message, L" #");
+            appendNumber(message, i, FALSE);
+            appendText(message, L" ");
+            appendNumber(message, hits, TRUE);
+            appendText(message, L"/");
+            appendNumber(message, lookups, TRUE);
+            totalLookups += lookups;
+            totalHits += hits;
+        }
+    }
+    appendText(message, L" | total ");
+    appendNumber(message, totalHits, TRUE);
+    appendText(message, L"/");
+    appendNumber(message, totalLookups, TRUE);
+    logToConsole(message);
+#endif
+
     setText(message, L"Connections:");
     for (int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; ++i)
     {
@@ -6519,9 +6907,15 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                 if (numberOfProcessors == 2)
                 {
                     processors[numberOfProcessors].type = Processor::ContractProcessor;
-                    processors[numberOfProcessors].setupFunction(contractProcessor, 0);
+                    processors[numberOfProcessors].setupFunction(runContractProcessor, 0);
                     computingProcessorNumber = numberOfProcessors;
+                    contractExecProfiler.setContractProcessorStack(processors[numberOfProcessors].getStackBottom(), processors[numberOfProcessors].getStackTop());
                     contractProcessorIDs[nContractProcessorIDs++] = i;
+#if !MAX_CONTRACT_ITERATION_DURATION
+                    // Resident contract processor waiting for calls in contractProcessorMailbox
+                    bs->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, shutdownCallback, NULL, &processors[numberOfProcessors].event);
+                    mpServicesProtocol->StartupThisAP(mpServicesProtocol, Processor::runFunction, i, processors[numberOfProcessors].event, 0, &processors[numberOfProcessors], NULL);
+#endif
                 }
                 else
                 {
@@ -6638,12 +7032,23 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                     updateTime();
                 }
 
+#if MAX_CONTRACT_ITERATION_DURATION
                 if (contractProcessorState == 1)
                 {
                     contractProcessorState = 2;
                     bs->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_NOTIFY, contractProcessorShutdownCallback, NULL, &contractProcessorEvent);
                     mpServicesProtocol->StartupThisAP(mpServicesProtocol, Processor::runFunction, contractProcessorIDs[0], contractProcessorEvent, MAX_CONTRACT_ITERATION_DURATION * 1000, &processors[computingProcessorNumber], NULL);
                 }
+#endif
+                if (contractProcessorMailbox.checkWatchdog(CONTRACT_CALL_WARNING_DURATION * frequency / 1000))
+                {
+                    setText(message, L"WARNING: Contract processor phase ");
+                    appendNumber(message, contractProcessorPhase, FALSE);
+                    appendText(message, L" is running for more than ");
+                    appendNumber(message, CONTRACT_CALL_WARNING_DURATION, TRUE);
+                    appendText(message, L" ms!");
+                    logToConsole(message);
+                }
                 /*if (!computationProcessorState && (computation || __computation))
                 {
                     numberOfAllSCs++;
@@ -6908,19 +7313,35 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                         }
                     }
                 }
-                if (requestPersistingNodeState == 1 && persistingNodeStateTickProcWaiting == 1)
+                if (persistingTickStorageState == 3)
+                {
+                    if (persistingTickStorageResult != 0)
+                    {
+                        TickStorage::logSaveToFileResult(persistingTickStorageResult);
+                        logToConsole(L"Failed to save tick storage");
+                    }
+                    else
+                    {
+                        logToConsole(L"Complete saving all node states");
+                    }
+                    persistingTickStorageState = 0;
+                }
+                if (requestPersistingNodeState == 1 && persistingNodeStateTickProcWaiting == 1 && persistingTickStorageState == 0)
                 {
                     // Saving node state takes a lot of time -> Close peer connections before to signal that
-                    // the peers should connect to another node.
+                    // the peers should connect to another node. Only the tick storage, which is the largest part,
+                    // is written in the background after tick processing has been resumed.
                     for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
                     {
                         closePeer(&peers[i]);
                     }
 
                     logToConsole(L"Saving node state...");
-                    saveAllNodeStates();
+                    if (saveAllNodeStates())
+                    {
+                        logToConsole(L"Saving tick storage in the background...");
+                    }
                     requestPersistingNodeState = 0;
-                    logToConsole(L"Complete saving all node states");
                 }
                 if (nextAutoSaveTickUpdated)
                 {
@@ -6958,6 +7379,30 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                     tickerLoopNumerator = 0;
                     tickerLoopDenominator = 0;
 
+                    if (contractProcessorMailbox.numberOfCalls)
+                    {
+                        const unsigned long long numberOfCalls = contractProcessorMailbox.numberOfCalls;
+                        setText(message, L"Contract processor calls = ");
+                        appendNumber(message, numberOfCalls, TRUE);
+                        appendText(message, L" | Dispatch latency = ");
+                        appendNumber(message, (contractProcessorMailbox.dispatchLatencySum / numberOfCalls) * 1000000 / frequency, TRUE);
+                        appendText(message, L" mcs (max ");
+                        appendNumber(message, contractProcessorMailbox.maxDispatchLatency * 1000000 / frequency, TRUE);
+                        appendText(message, L" mcs) | Execution time = ");
+                        appendNumber(message, (contractProcessorMailbox.executionTimeSum / numberOfCalls) * 1000000 / frequency, TRUE);
+                        appendText(message, L" mcs (max ");
+                        appendNumber(message, contractProcessorMailbox.maxExecutionTime * 1000000 / frequency, TRUE);
+                        appendText(message, L" mcs)");
+                        if (contractProcessorMailbox.numberOfAbortedCalls)
+                        {
+                            appendText(message, L" | Aborted by timeout = ");
+                            appendNumber(message, contractProcessorMailbox.numberOfAbortedCalls, TRUE);
+                        }
+                        appendText(message, L".");
+                        logToConsole(message);
+                    }
+                    contractProcessorMailbox.resetStats();
+
                     // output if misalignment happened
                     if (gTickTotalNumberOfComputors - gTickNumberOfComputors >= QUORUM && numberOfKnownNextTickTransactions == numberOfNextTickTransactions)
                     {
@@ -7009,7 +7454,21 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
 #endif
                 // Flush the file system
                 flushAsyncFileIOBuffer();
+
+#if STATE_JOURNAL_MODE
+                stateJournal.writeCommittedFrames();
+#endif
+            }
+
+#if TICK_STORAGE_AUTOSAVE_MODE
+            // Cancel tick storage save that no request processor has started and finish writing the one in progress
+            // before the tick storage is freed (snapshot stays invalid if canceled)
+            _InterlockedCompareExchange(&persistingTickStorageState, 0, 1);
+            while (persistingTickStorageState == 2)
+            {
+                flushAsyncFileIOBuffer();
             }
+#endif
 
             saveSystem();
             score->saveScoreCache(system.epoch);
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/m256.h"
+#include "platform/file_io.h"
+#include "platform/file_compression.h"
+#include "platform/memory_util.h"
+#include "platform/parallel_job.h"
+
+#include "kangaroo_twelve.h"
+
+// Sparse state file format written by saveSparseStateFile(), used for the spectrum and the universe:
+// - SparseStateFileHeader, including the root of the Merkle tree of all records (as in spectrumDigests and
+//   assetDigests)
+// - numberOfRecords entries in ascending order of the record index, each consisting of the 4 byte index followed by
+//   the record. Only records that are not all zero are stored.
+//
+// Both saving and loading skip hashing subtrees without non-empty records and use the precomputed digests of empty
+// subtrees instead, which is much cheaper than hashing the full tree if the array is sparse. Subtrees are processed
+// in parallel (see runParallelJob()). Files without header (written by saveCompressed(), save(), or by older
+// versions) are still loaded by loadSparseStateFile().
+
+static constexpr unsigned long long sparseStateFileMagic = 0x3130465343425551; // "QUBCSF01"
+
+// Number of subtrees that the Merkle tree is split into for processing in parallel
+static constexpr unsigned int sparseStateParts = 256;
+
+// Maximum number of entries written with one call of writeFile()
+static constexpr unsigned int sparseStateWriteBatchEntries = 65536;
+
+struct SparseStateFileHeader
+{
+    unsigned long long magic;
+    unsigned long long numberOfRecords;
+    unsigned int capacity;
+    unsigned int recordSize;
+    unsigned long long reserved;
+    m256i root;
+};
+
+// Compute digest of non-empty record
+typedef void (*SparseStateLeafDigestFunction)(const void* record, m256i& digest);
+
+// Fixed-capacity array of records (capacity is a power of 2 and multiple of sparseStateParts, recordSize is a
+// multiple of 8 and at most sizeof(emptyDigests)) with the Merkle tree of their digests. The digests array has the
+// layout of spectrumDigests: leaf digests followed by the digests of each level above, capacity * 2 - 1 digests in
+// total.
+struct SparseStateTree
+{
+    unsigned char* records;
+    unsigned int recordSize;
+    unsigned int capacity;
+    SparseStateLeafDigestFunction leafDigest;
+
+    // Digests of all nodes of the tree, or NULL if only the root is needed
+    m256i* digests;
+
+    // Digests of subtrees without non-empty records, per level
+    m256i emptyDigests[33];
+    unsigned int partLevel;
+
+    void init(unsigned char* records, unsigned int recordSize, unsigned int capacity, SparseStateLeafDigestFunction leafDigest, m256i* digests)
+    {
+        this->records = records;
+        this->recordSize = recordSize;
+        this->capacity = capacity;
+        this->leafDigest = leafDigest;
+        this->digests = digests;
+
+        // zeroed emptyDigests are used as empty record for computing the digest of an empty leaf
+        setMem(emptyDigests, sizeof(emptyDigests), 0);
+        leafDigest(emptyDigests, emptyDigests[0]);
+        partLevel = 0;
+        for (unsigned int level = 1; (capacity >> level) > 0; level++)
+        {
+            m256i children[2];
+            children[0] = emptyDigests[level - 1];
+            children[1] = emptyDigests[level - 1];
+            KangarooTwelve64To32(children, &emptyDigests[level]);
+            if ((capacity >> level) == sparseStateParts)
+            {
+                partLevel = level;
+            }
+        }
+    }
+
+    const unsigned char* record(unsigned int index) const
+    {
+        return records + (unsigned long long)index * recordSize;
+    }
+
+    bool isEmpty(unsigned int index) const
+    {
+        const unsigned long long* words = (const unsigned long long*)record(index);
+        for (unsigned int i = 0; i < recordSize / 8; i++)
+        {
+            if (words[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Index of first digest of level in digests
+    unsigned long long levelBeginning(unsigned int level) const
+    {
+        return 2ULL * capacity - ((2ULL * capacity) >> level);
+    }
+
+    // Compute digest of node with index in level from the digests of its two children (stored consecutively)
+    void combine(unsigned int level, const m256i* children, m256i& digest) const
+    {
+        if (children[0] == emptyDigests[level - 1] && children[1] == emptyDigests[level - 1])
+        {
+            digest = emptyDigests[level];
+        }
+        else
+        {
+            KangarooTwelve64To32(children, &digest);
+        }
+    }
+
+    // Compute digest of subtree with root node index in level, storing all nodes of the subtree in digests if
+    // available. Adds number of non-empty records to nonEmptyRecords.
+    void subtreeDigest(unsigned int level, unsigned int index, m256i& digest, unsigned int& nonEmptyRecords) const
+    {
+        if (level == 0)
+        {
+            if (isEmpty(index))
+            {
+                digest = emptyDigests[0];
+            }
+            else
+            {
+                leafDigest(record(index), digest);
+                nonEmptyRecords++;
+            }
+        }
+        else
+        {
+            m256i children[2];
+            subtreeDigest(level - 1, index * 2, children[0], nonEmptyRecords);
+            subtreeDigest(level - 1, index * 2 + 1, children[1], nonEmptyRecords);
+            combine(level, children, digest);
+        }
+        if (digests)
+        {
+            digests[levelBeginning(level) + index] = digest;
+        }
+    }
+};
+
+// Work of one step of saveSparseStateFile() / loadSparseStateFile() processed in parallel
+struct SparseStateJob
+{
+    SparseStateTree* tree;
+
+    // roots and number of non-empty records of the subtrees of the parts
+    m256i partRoots[sparseStateParts];
+    unsigned int partRecords[sparseStateParts];
+
+    // entries read from file that are scattered to records
+    const unsigned char* entries;
+    unsigned int numberOfEntries;
+    unsigned int entriesPerPart;
+    volatile long invalid;
+
+    unsigned int entrySize() const
+    {
+        return 4 + tree->recordSize;
+    }
+};
+
+static void computeSparseStatePart(void* context, unsigned int partIndex)
+{
+    SparseStateJob& job = *(SparseStateJob*)context;
+    job.partRecords[partIndex] = 0;
+    job.tree->subtreeDigest(job.tree->partLevel, partIndex, job.partRoots[partIndex], job.partRecords[partIndex]);
+}
+
+static void clearSparseStatePart(void* context, unsigned int partIndex)
+{
+    SparseStateJob& job = *(SparseStateJob*)context;
+    const unsigned long long partSize = (unsigned long long)(job.tree->capacity / sparseStateParts) * job.tree->recordSize;
+    setMem(job.tree->records + partIndex * partSize, partSize, 0);
+}
+
+// Copy entries of part to their records, checking that indices are valid and ascending
+static void scatterSparseStatePart(void* context, unsigned int partIndex)
+{
+    SparseStateJob& job = *(SparseStateJob*)context;
+    const unsigned int entrySize = job.entrySize();
+    const unsigned int first = partIndex * job.entriesPerPart;
+    const unsigned int end = (first + job.entriesPerPart < job.numberOfEntries) ? first + job.entriesPerPart : job.numberOfEntries;
+    for (unsigned int i = first; i < end; i++)
+    {
+        const unsigned char* entry = job.entries + (unsigned long long)i * entrySize;
+        const unsigned int index = *((unsigned int*)entry);
+        if (index >= job.tree->capacity || (i > 0 && index <= *((unsigned int*)(entry - entrySize))))
+        {
+            job.invalid = 1;
+            return;
+        }
+        copyMem(job.tree->records + (unsigned long long)index * job.tree->recordSize, entry + 4, job.tree->recordSize);
+    }
+}
+
+// Compute root of tree (and all digests if tree.digests is set) in parallel. Returns number of non-empty records.
+static unsigned long long computeSparseStateRoot(SparseStateJob& job, m256i& root)
+{
+    runParallelJob(computeSparseStatePart, &job, sparseStateParts);
+
+    unsigned long long numberOfRecords = 0;
+    for (unsigned int i = 0; i < sparseStateParts; i++)
+    {
+        numberOfRecords += job.partRecords[i];
+    }
+
+    // Combine roots of the parts in place, level by level
+    const SparseStateTree& tree = *job.tree;
+    for (unsigned int level = tree.partLevel + 1, count = sparseStateParts / 2; count > 0; level++, count >>= 1)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            tree.combine(level, &job.partRoots[i * 2], job.partRoots[i]);
+            if (tree.digests)
+            {
+                tree.digests[tree.levelBeginning(level) + i] = job.partRoots[i];
+            }
+        }
+    }
+    root = job.partRoots[0];
+    return numberOfRecords;
+}
+
+// Save non-empty records of array in sparse format, including the root of the Merkle tree of the records. Returns
+// capacity * recordSize on success and -1 on error (like saveCompressed()). The size of the file is returned in
+// storedSize if it is not NULL. Must be called from the main thread in UEFI.
+static long long saveSparseStateFile(const CHAR16* fileName, const unsigned char* records, unsigned int recordSize, unsigned int capacity, SparseStateLeafDigestFunction leafDigest, const CHAR16* directory = NULL, unsigned long long* storedSize = NULL)
+{
+    SparseStateTree tree;
+    tree.init((unsigned char*)records, recordSize, capacity, leafDigest, NULL);
+    SparseStateJob job;
+    job.tree = &tree;
+
+    SparseStateFileHeader header;
+    header.magic = sparseStateFileMagic;
+    header.capacity = capacity;
+    header.recordSize = recordSize;
+    header.reserved = 0;
+    header.numberOfRecords = computeSparseStateRoot(job, header.root);
+
+    const unsigned int entrySize = job.entrySize();
+    unsigned char* batch;
+    if (!allocPoolWithErrorLog(L"sparseStateBatch", (unsigned long long)sparseStateWriteBatchEntries * entrySize, (void**)&batch, __LINE__))
+    {
+        return -1;
+    }
+    FileHandle file;
+    if (!openFile(file, fileName, true, directory))
+    {
+        freePool(batch);
+        return -1;
+    }
+
+    bool ok = writeFile(file, sizeof(header), (unsigned char*)&header);
+    unsigned long long numberOfRecords = 0;
+    unsigned int batchEntries = 0;
+    for (unsigned int index = 0; ok && index < capacity; index++)
+    {
+        if (!tree.isEmpty(index))
+        {
+            unsigned char* entry = batch + (unsigned long long)batchEntries * entrySize;
+            *((unsigned int*)entry) = index;
+            copyMem(entry + 4, tree.record(index), recordSize);
+            numberOfRecords++;
+            if (++batchEntries == sparseStateWriteBatchEntries)
+            {
+                ok = writeFile(file, (unsigned long long)batchEntries * entrySize, batch);
+                batchEntries = 0;
+            }
+        }
+    }
+    if (ok && batchEntries)
+    {
+        ok = writeFile(file, (unsigned long long)batchEntries * entrySize, batch);
+    }
+
+    closeFile(file);
+    freePool(batch);
+    if (!ok || numberOfRecords != header.numberOfRecords)
+    {
+        return -1;
+    }
+    if (storedSize)
+    {
+        *storedSize = sizeof(header) + numberOfRecords * entrySize;
+    }
+    return (unsigned long long)capacity * recordSize;
+}
+
+// Load array of records and compute all digests of the Merkle tree of the records. Supports files written by
+// saveSparseStateFile(), which are checked against the stored root, as well as the formats supported by
+// loadCompressed(). The digests array is used as buffer for reading the entries of sparse files. Returns
+// capacity * recordSize on success and -1 on error (like loadCompressed()). The size of the file is returned in
+// storedSize if it is not NULL. Must be called from the main thread in UEFI.
+static long long loadSparseStateFile(const CHAR16* fileName, unsigned char* records, unsigned int recordSize, unsigned int capacity, SparseStateLeafDigestFunction leafDigest, m256i* digests, const CHAR16* directory = NULL, unsigned long long* storedSize = NULL)
+{
+    const unsigned long long totalSize = (unsigned long long)capacity * recordSize;
+    SparseStateTree tree;
+    tree.init(records, recordSize, capacity, leafDigest, digests);
+    SparseStateJob job;
+    job.tree = &tree;
+    m256i root;
+
+    FileHandle file;
+    if (!openFile(file, fileName, false, directory))
+    {
+        return -1;
+    }
+    SparseStateFileHeader header;
+    const long long headerSize = readFile(file, sizeof(header), (unsigned char*)&header);
+    if (headerSize != sizeof(header) || header.magic != sparseStateFileMagic)
+    {
+        // full array, possibly compressed
+        closeFile(file);
+        if (loadCompressed(fileName, totalSize, records, directory, storedSize) != (long long)totalSize)
+        {
+            return -1;
+        }
+        computeSparseStateRoot(job, root);
+        return totalSize;
+    }
+    if (header.capacity != capacity || header.recordSize != recordSize || header.numberOfRecords > capacity)
+    {
+        logToConsole(L"Sparse state file has unexpected capacity, record size, or number of records!");
+        closeFile(file);
+        return -1;
+    }
+
+    runParallelJob(clearSparseStatePart, &job, sparseStateParts);
+
+    // Read entries in batches that fit into digests and scatter them to the records in parallel
+    const unsigned int entrySize = job.entrySize();
+    const unsigned int batchEntries = (unsigned int)(((capacity * 2ULL - 1) * sizeof(m256i)) / entrySize);
+    unsigned char* buffer = (unsigned char*)digests;
+    unsigned long long previousIndex = 0;
+    bool ok = true;
+    job.invalid = 0;
+    for (unsigned long long loadedEntries = 0; ok && loadedEntries < header.numberOfRecords; loadedEntries += job.numberOfEntries)
+    {
+        job.numberOfEntries = (header.numberOfRecords - loadedEntries < batchEntries) ? (unsigned int)(header.numberOfRecords - loadedEntries) : batchEntries;
+        const unsigned long long batchSize = (unsigned long long)job.numberOfEntries * entrySize;
+        ok = readFile(file, batchSize, buffer) == (long long)batchSize;
+        if (!ok)
+        {
+            break;
+        }
+
+        // indices within batch are checked by scatterSparseStatePart(), the first one here
+        const unsigned int firstIndex = *((unsigned int*)buffer);
+        ok = loadedEntries == 0 || firstIndex > previousIndex;
+        previousIndex = *((unsigned int*)(buffer + batchSize - entrySize));
+
+        job.entries = buffer;
+        job.entriesPerPart = (job.numberOfEntries + sparseStateParts - 1) / sparseStateParts;
+        runParallelJob(scatterSparseStatePart, &job, sparseStateParts);
+        ok = ok && !job.invalid;
+    }
+    closeFile(file);
+    if (!ok)
+    {
+        logToConsole(L"Sparse state file is invalid!");
+        return -1;
+    }
+
+    computeSparseStateRoot(job, root);
+    if (root != header.root)
+    {
+        logToConsole(L"Sparse state file digest does not match!");
+        return -1;
+    }
+    if (storedSize)
+    {
+        *storedSize = sizeof(header) + header.numberOfRecords * entrySize;
+    }
+    return totalSize;
+}
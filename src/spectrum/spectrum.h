@@ -4,8 +4,10 @@
 #include "platform/m256.h"
 #include "platform/concurrency.h"
 #include "platform/file_io.h"
+#include "platform/file_compression.h"
 #include "platform/time_stamp_counter.h"
 #include "platform/memory.h"
+#include "platform/parallel_job.h"
 
 #include "network_messages/entity.h"
 
@@ -15,6 +17,7 @@
 #include "system.h"
 #include "kangaroo_twelve.h"
 #include "common_buffers.h"
+#include "sparse_state_file.h"
 
 GLOBAL_VAR_DECL volatile char spectrumLock GLOBAL_VAR_INIT(0);
 GLOBAL_VAR_DECL ::Entity* spectrum GLOBAL_VAR_INIT(nullptr);
@@ -32,10 +35,153 @@ static constexpr unsigned long long spectrumDigestsSizeInByte = (SPECTRUM_CAPACI
 
 GLOBAL_VAR_DECL unsigned long long spectrumReorgTotalExecutionTicks GLOBAL_VAR_INIT(0);
 
+// Incremented by reorganizeSpectrum(), which moves entities all over the hash map (state journal cannot record this)
+GLOBAL_VAR_DECL volatile unsigned int spectrumReorgCount GLOBAL_VAR_INIT(0);
 
-// Update SpectrumInfo data (exensive, because it iterates the whole spectrum), acquire no lock
-static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
+#if USE_SPECTRUM_FINGERPRINTS
+// One byte fingerprint of the public key per spectrum slot (0 means empty slot), allowing to compare many slots at
+// once with SIMD instead of loading each 64 byte entity while probing. Not part of the spectrum data and digests.
+// The first spectrumFingerprintsPadding fingerprints are repeated at the end, so probing can load beyond the last slot.
+GLOBAL_VAR_DECL unsigned char* spectrumFingerprints GLOBAL_VAR_INIT(nullptr);
+static constexpr unsigned int spectrumFingerprintsPadding = 64;
+
+static inline unsigned char spectrumFingerprint(const m256i& publicKey)
+{
+    // Byte that is not used for the hash map index (derived from m256i_u32[0])
+    const unsigned char fingerprint = publicKey.m256i_u8[8];
+    return fingerprint ? fingerprint : 1;
+}
+
+static inline void setSpectrumFingerprint(unsigned int index, unsigned char fingerprint)
+{
+    spectrumFingerprints[index] = fingerprint;
+    if (index < spectrumFingerprintsPadding)
+    {
+        spectrumFingerprints[SPECTRUM_CAPACITY + index] = fingerprint;
+    }
+}
+#endif
+
+// Set public key of spectrum slot (zero for clearing it), keeping fingerprints up to date
+static inline void setSpectrumSlotPublicKey(unsigned int index, const m256i& publicKey)
+{
+    spectrum[index].publicKey = publicKey;
+#if USE_SPECTRUM_FINGERPRINTS
+    setSpectrumFingerprint(index, isZero(publicKey) ? 0 : spectrumFingerprint(publicKey));
+#endif
+}
+
+// Rebuild fingerprints of all spectrum slots, needed after spectrum has been changed without the functions of this file
+static void updateSpectrumFingerprints()
+{
+#if USE_SPECTRUM_FINGERPRINTS
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        spectrumFingerprints[i] = isZero(spectrum[i].publicKey) ? 0 : spectrumFingerprint(spectrum[i].publicKey);
+    }
+    copyMem(spectrumFingerprints + SPECTRUM_CAPACITY, spectrumFingerprints, spectrumFingerprintsPadding);
+#endif
+}
+
+// Return index of the slot of the entity with publicKey or of the empty slot where it would be inserted.
+// Caller must hold spectrumLock.
+static unsigned int findSpectrumSlot(const m256i& publicKey)
+{
+    unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+
+#if USE_SPECTRUM_FINGERPRINTS
+    // Only compare full public key if fingerprint matches, stop at first empty slot
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    const __m512i fingerprint = _mm512_set1_epi8(spectrumFingerprint(publicKey));
+    while (true)
+    {
+        const __m512i fingerprints = _mm512_loadu_si512(spectrumFingerprints + index);
+        const unsigned long long emptyMask = _mm512_cmpeq_epi8_mask(fingerprints, _mm512_setzero_si512());
+        unsigned long long matchMask = _mm512_cmpeq_epi8_mask(fingerprints, fingerprint);
+        if (emptyMask)
+        {
+            matchMask &= (emptyMask & (0 - emptyMask)) - 1;
+        }
+        while (matchMask)
+        {
+            const unsigned int matchIndex = (index + (unsigned int)_tzcnt_u64(matchMask)) & (SPECTRUM_CAPACITY - 1);
+            if (spectrum[matchIndex].publicKey == publicKey)
+            {
+                return matchIndex;
+            }
+            matchMask &= matchMask - 1;
+        }
+        if (emptyMask)
+        {
+            return (index + (unsigned int)_tzcnt_u64(emptyMask)) & (SPECTRUM_CAPACITY - 1);
+        }
+        index = (index + 64) & (SPECTRUM_CAPACITY - 1);
+    }
+#else
+    const __m256i fingerprint = _mm256_set1_epi8(spectrumFingerprint(publicKey));
+    while (true)
+    {
+        const __m256i fingerprints = _mm256_loadu_si256((const __m256i*)(spectrumFingerprints + index));
+        const unsigned int emptyMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(fingerprints, _mm256_setzero_si256()));
+        unsigned int matchMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(fingerprints, fingerprint));
+        if (emptyMask)
+        {
+            matchMask &= (emptyMask & (0 - emptyMask)) - 1;
+        }
+        while (matchMask)
+        {
+            const unsigned int matchIndex = (index + _tzcnt_u32(matchMask)) & (SPECTRUM_CAPACITY - 1);
+            if (spectrum[matchIndex].publicKey == publicKey)
+            {
+                return matchIndex;
+            }
+            matchMask &= matchMask - 1;
+        }
+        if (emptyMask)
+        {
+            return (index + _tzcnt_u32(emptyMask)) & (SPECTRUM_CAPACITY - 1);
+        }
+        index = (index + 32) & (SPECTRUM_CAPACITY - 1);
+    }
+#endif
+#else
+    while (!(spectrum[index].publicKey == publicKey) && !isZero(spectrum[index].publicKey))
+    {
+        index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+    }
+    return index;
+#endif
+}
+
+
+// Return index of the entity category (in entityCategoryPopulations) of a balance > 0
+static inline unsigned int entityCategory(unsigned long long balance)
+{
+    return 63 - (unsigned int)__lzcnt64(balance);
+}
+
+// Move entity from the category of oldBalance to the one of newBalance in entityCategoryPopulations.
+// Entities with balance 0 are not counted. Has to be called on every balance change while spectrumLock is held.
+static inline void updateEntityCategoryPopulations(unsigned long long oldBalance, unsigned long long newBalance)
 {
+    if (oldBalance)
+    {
+        entityCategoryPopulations[entityCategory(oldBalance)]--;
+    }
+    if (newBalance)
+    {
+        entityCategoryPopulations[entityCategory(newBalance)]++;
+    }
+}
+
+// Update SpectrumInfo data and entity category populations from scratch (exensive, because it iterates the
+// whole spectrum), acquire no lock. Only needed after loading the spectrum, because both are updated continuously
+// afterwards. Pass other arguments than the default to check the consistency of the continuously updated data.
+static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo, unsigned int* categoryPopulations = entityCategoryPopulations)
+{
+    static_assert(MAX_SUPPLY < (1llu << entityCategoryCount));
+    setMem(categoryPopulations, sizeof(entityCategoryPopulations), 0);
+
     si.numberOfEntities = 0;
     si.totalAmount = 0;
     for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
@@ -45,6 +191,10 @@ static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
         {
             si.numberOfEntities++;
             si.totalAmount += balance;
+            if (balance)
+            {
+                categoryPopulations[entityCategory(balance)]++;
+            }
         }
     }
 }
@@ -52,20 +202,9 @@ static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
 // Compute balances that count as dust and are burned if 75% of spectrum hash map is filled.
 // All balances <= dustThresholdBurnAll are burned in this case.
 // Every 2nd balance <= dustThresholdBurnHalf is burned in this case.
-static void updateAndAnalzeEntityCategoryPopulations()
+// Cheap, because entityCategoryPopulations is kept up to date by increaseEnergy() and decreaseEnergy().
+static void analyzeEntityCategoryPopulations()
 {
-    static_assert(MAX_SUPPLY < (1llu << entityCategoryCount));
-    setMem(entityCategoryPopulations, sizeof(entityCategoryPopulations), 0);
-
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
-    {
-        const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
-        if (balance)
-        {
-            entityCategoryPopulations[63 - __lzcnt64(balance)]++;
-        }
-    }
-
     dustThresholdBurnAll = 0;
     dustThresholdBurnHalf = 0;
     unsigned int numberOfEntities = 0;
@@ -139,90 +278,245 @@ private:
     DustBurning* buf;
 };
 
-// Clean up spectrum hash map, removing all entities with balance 0. Updates spectrumInfo.
-static void reorganizeSpectrum()
+// Number of parts that spectrum reorganization and digest computation are split into for parallel processing
+static constexpr unsigned int spectrumReorgParts = 256;
+static_assert((spectrumReorgParts & (spectrumReorgParts - 1)) == 0 && SPECTRUM_CAPACITY % spectrumReorgParts == 0);
+
+struct SpectrumReorgContext
 {
-    unsigned long long spectrumReorgStartTick = __rdtsc();
+    // Part p is the index range [partBegin[p], partBegin[p + 1]). Parts start after an empty slot, so each cluster
+    // of occupied slots belongs to exactly one part. The cluster that wraps around the end of the hash map is not
+    // included in any of these parts, but processed as additional part spectrumReorgParts.
+    unsigned int partBegin[spectrumReorgParts + 1];
+    unsigned int numberOfEntities[spectrumReorgParts + 1];
+};
 
-    ::Entity* reorgSpectrum = (::Entity*)reorgBuffer;
-    setMem(reorgSpectrum, SPECTRUM_CAPACITY * sizeof(::Entity), 0);
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+// Remove entities with balance 0 from the clusters in [begin, end) in place, returning the number of entities kept.
+// Processing each cluster in order of increasing index gives the same result as inserting the entities with
+// balance into an empty hash map in this order, because entities never move beyond their current slot.
+static unsigned int reorganizeSpectrumRange(unsigned int begin, unsigned int end)
+{
+    unsigned int numberOfEntities = 0;
+    for (unsigned int i = begin; i < end; i++)
     {
+        if (isZero(spectrum[i].publicKey))
+        {
+            continue;
+        }
+
         if (spectrum[i].incomingAmount - spectrum[i].outgoingAmount)
         {
+            numberOfEntities++;
             unsigned int index = spectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
-        iteration:
-            if (isZero(reorgSpectrum[index].publicKey))
+            while (index != i && !isZero(spectrum[index].publicKey))
             {
-                copyMem(&reorgSpectrum[index], &spectrum[i], sizeof(::Entity));
+                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
             }
-            else
+            if (index != i)
             {
-                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
-
-                goto iteration;
+                copyMem(&spectrum[index], &spectrum[i], sizeof(::Entity));
+                setMem(&spectrum[i], sizeof(::Entity), 0);
+#if USE_SPECTRUM_FINGERPRINTS
+                setSpectrumFingerprint(index, spectrumFingerprints[i]);
+                setSpectrumFingerprint(i, 0);
+#endif
             }
         }
+        else
+        {
+            setMem(&spectrum[i], sizeof(::Entity), 0);
+#if USE_SPECTRUM_FINGERPRINTS
+            setSpectrumFingerprint(i, 0);
+#endif
+        }
     }
-    copyMem(spectrum, reorgSpectrum, SPECTRUM_CAPACITY * sizeof(::Entity));
+    return numberOfEntities;
+}
 
-    unsigned int digestIndex;
-    for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
+// Remove entities with balance 0 from the cluster that wraps around the end of the hash map. Its entities are
+// reinserted in order of their index via reorgBuffer, because the in-place approach requires that no slot of the
+// cluster in front of the currently processed one is still unprocessed.
+static unsigned int reorganizeSpectrumWrappingCluster(unsigned int begin, unsigned int endAfterWrap)
+{
+    ::Entity* clusterEntities = (::Entity*)reorgBuffer;
+    unsigned int clusterSize = 0;
+    for (unsigned int i = 0; i < endAfterWrap; i++)
+    {
+        copyMem(&clusterEntities[clusterSize++], &spectrum[i], sizeof(::Entity));
+    }
+    for (unsigned int i = begin; i < SPECTRUM_CAPACITY; i++)
+    {
+        copyMem(&clusterEntities[clusterSize++], &spectrum[i], sizeof(::Entity));
+    }
+    setMem(&spectrum[0], endAfterWrap * sizeof(::Entity), 0);
+    setMem(&spectrum[begin], (SPECTRUM_CAPACITY - begin) * sizeof(::Entity), 0);
+#if USE_SPECTRUM_FINGERPRINTS
+    for (unsigned int i = 0; i < endAfterWrap; i++)
     {
-        KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
+        setSpectrumFingerprint(i, 0);
     }
-    unsigned int previousLevelBeginning = 0;
-    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-    while (numberOfLeafs > 1)
+    setMem(&spectrumFingerprints[begin], SPECTRUM_CAPACITY - begin, 0);
+#endif
+
+    unsigned int numberOfEntities = 0;
+    for (unsigned int i = 0; i < clusterSize; i++)
     {
-        for (unsigned int i = 0; i < numberOfLeafs; i += 2)
+        if (clusterEntities[i].incomingAmount - clusterEntities[i].outgoingAmount)
         {
-            KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex++]);
+            numberOfEntities++;
+            unsigned int index = clusterEntities[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+            while (!isZero(spectrum[index].publicKey))
+            {
+                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+            }
+            copyMem(&spectrum[index], &clusterEntities[i], sizeof(::Entity));
+#if USE_SPECTRUM_FINGERPRINTS
+            setSpectrumFingerprint(index, spectrumFingerprint(clusterEntities[i].publicKey));
+#endif
         }
-
-        previousLevelBeginning += numberOfLeafs;
-        numberOfLeafs >>= 1;
     }
+    return numberOfEntities;
+}
 
-    updateSpectrumInfo();
-
-    spectrumReorgTotalExecutionTicks += __rdtsc() - spectrumReorgStartTick;
+static void reorganizeSpectrumPart(void* context, unsigned int partIndex)
+{
+    SpectrumReorgContext& ctx = *(SpectrumReorgContext*)context;
+    if (partIndex < spectrumReorgParts)
+    {
+        ctx.numberOfEntities[partIndex] = reorganizeSpectrumRange(ctx.partBegin[partIndex], ctx.partBegin[partIndex + 1]);
+    }
+    else if (ctx.partBegin[spectrumReorgParts] < SPECTRUM_CAPACITY)
+    {
+        ctx.numberOfEntities[partIndex] = reorganizeSpectrumWrappingCluster(ctx.partBegin[spectrumReorgParts], ctx.partBegin[0]);
+    }
+    else
+    {
+        ctx.numberOfEntities[partIndex] = 0;
+    }
 }
 
-static int spectrumIndex(const m256i& publicKey)
+// Compute leaf digests and inner nodes of the subtree of spectrumDigests covering one part of the spectrum
+static void computeSpectrumDigestsPart(void*, unsigned int partIndex)
 {
-    if (isZero(publicKey))
+    constexpr unsigned int partSize = SPECTRUM_CAPACITY / spectrumReorgParts;
+    unsigned int first = partIndex * partSize;
+    for (unsigned int i = first; i < first + partSize; i++)
     {
-        return -1;
+        KangarooTwelve64To32(&spectrum[i], &spectrumDigests[i]);
     }
 
-    unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    unsigned long long levelBeginning = 0;
+    unsigned int numberOfNodes = SPECTRUM_CAPACITY;
+    for (unsigned int count = partSize; count > 1; count >>= 1)
+    {
+        const unsigned long long nextLevelBeginning = levelBeginning + numberOfNodes;
+        for (unsigned int i = first; i < first + count; i += 2)
+        {
+            KangarooTwelve64To32(&spectrumDigests[levelBeginning + i], &spectrumDigests[nextLevelBeginning + (i >> 1)]);
+        }
+        levelBeginning = nextLevelBeginning;
+        numberOfNodes >>= 1;
+        first >>= 1;
+    }
+}
 
-    ACQUIRE(spectrumLock);
+// Recompute all spectrumDigests from scratch, using other processors if available. Acquire no lock.
+static void computeSpectrumDigests()
+{
+    runParallelJob(computeSpectrumDigestsPart, nullptr, spectrumReorgParts);
 
-iteration:
-    if (spectrum[index].publicKey == publicKey)
+    // Compute the top levels above the subtrees of the parts
+    unsigned long long levelBeginning = 0;
+    unsigned int numberOfNodes = SPECTRUM_CAPACITY;
+    while (numberOfNodes > spectrumReorgParts)
     {
-        RELEASE(spectrumLock);
-
-        return index;
+        levelBeginning += numberOfNodes;
+        numberOfNodes >>= 1;
     }
-    else
+    while (numberOfNodes > 1)
     {
-        if (isZero(spectrum[index].publicKey))
+        const unsigned long long nextLevelBeginning = levelBeginning + numberOfNodes;
+        for (unsigned int i = 0; i < numberOfNodes; i += 2)
         {
-            RELEASE(spectrumLock);
+            KangarooTwelve64To32(&spectrumDigests[levelBeginning + i], &spectrumDigests[nextLevelBeginning + (i >> 1)]);
+        }
+        levelBeginning = nextLevelBeginning;
+        numberOfNodes >>= 1;
+    }
+}
+
+// Clean up spectrum hash map, removing all entities with balance 0. Updates spectrumInfo.
+// The result is the same as reinserting all entities with balance into an empty hash map in order of their index,
+// but the work is done in place and split into independent clusters that are processed in parallel.
+static void reorganizeSpectrum()
+{
+    unsigned long long spectrumReorgStartTick = __rdtsc();
 
-            return -1;
+    SpectrumReorgContext ctx;
+
+    // Find cluster wrapping around the end of the hash map (begin is SPECTRUM_CAPACITY if there is none)
+    unsigned int wrapBegin = SPECTRUM_CAPACITY;
+    unsigned int firstPartBegin = 0;
+    if (!isZero(spectrum[SPECTRUM_CAPACITY - 1].publicKey))
+    {
+        while (!isZero(spectrum[wrapBegin - 1].publicKey))
+        {
+            wrapBegin--;
         }
-        else
+        while (!isZero(spectrum[firstPartBegin].publicKey))
         {
-            index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+            firstPartBegin++;
+        }
+    }
 
-            goto iteration;
+    // Split the remaining range into parts of similar size, each beginning after an empty slot
+    ctx.partBegin[0] = firstPartBegin;
+    for (unsigned int p = 1; p < spectrumReorgParts; p++)
+    {
+        unsigned int begin = p * (SPECTRUM_CAPACITY / spectrumReorgParts);
+        if (begin < ctx.partBegin[p - 1])
+        {
+            begin = ctx.partBegin[p - 1];
+        }
+        while (begin < wrapBegin && !isZero(spectrum[begin - 1].publicKey))
+        {
+            begin++;
         }
+        ctx.partBegin[p] = (begin < wrapBegin) ? begin : wrapBegin;
     }
+    ctx.partBegin[spectrumReorgParts] = wrapBegin;
+
+    runParallelJob(reorganizeSpectrumPart, &ctx, spectrumReorgParts + 1);
+
+    computeSpectrumDigests();
+
+    // Only entities with balance 0 have been removed, so totalAmount and entityCategoryPopulations stay valid
+    unsigned int numberOfEntities = 0;
+    for (unsigned int p = 0; p <= spectrumReorgParts; p++)
+    {
+        numberOfEntities += ctx.numberOfEntities[p];
+    }
+    spectrumInfo.numberOfEntities = numberOfEntities;
+
+    spectrumReorgCount++;
+    spectrumReorgTotalExecutionTicks += __rdtsc() - spectrumReorgStartTick;
+}
+
+static int spectrumIndex(const m256i& publicKey)
+{
+    if (isZero(publicKey))
+    {
+        return -1;
+    }
+
+    ACQUIRE(spectrumLock);
+
+    const unsigned int index = findSpectrumSlot(publicKey);
+    const bool found = !isZero(spectrum[index].publicKey);
+
+    RELEASE(spectrumLock);
+
+    return found ? index : -1;
 }
 
 static long long energy(const int index)
@@ -235,15 +529,13 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
 {
     if (!isZero(publicKey) && amount >= 0)
     {
-        unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
         ACQUIRE(spectrumLock);
 
         // Anti-dust feature: prevent that spectrum fills to more than 75% of capacity to keep hash map lookup fast
         if (spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4))
         {
             // Update anti-dust burn thresholds (and log spectrum stats before burning)
-            updateAndAnalzeEntityCategoryPopulations();
+            analyzeEntityCategoryPopulations();
 #if LOG_SPECTRUM_STATS
             logSpectrumStats();
 #endif
@@ -260,6 +552,8 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
                     if (balance <= dustThresholdBurnAll && balance)
                     {
                         spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                        spectrumInfo.totalAmount -= balance;
+                        updateEntityCategoryPopulations(balance, 0);
 #if LOG_DUST_BURNINGS
                         dbl.addDustBurn(spectrum[i].publicKey, balance);
 #endif
@@ -279,6 +573,8 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
                         if (++countBurnCanadiates & 1)
                         {
                             spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                            spectrumInfo.totalAmount -= balance;
+                            updateEntityCategoryPopulations(balance, 0);
 #if LOG_DUST_BURNINGS
                             dbl.addDustBurn(spectrum[i].publicKey, balance);
 #endif
@@ -297,48 +593,42 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
 
 #if LOG_SPECTRUM_STATS
             // Log spectrum stats after burning (before increasing energy / potenitally creating entity)
-            updateAndAnalzeEntityCategoryPopulations();
+            analyzeEntityCategoryPopulations();
             logSpectrumStats();
 #endif
         }
 
-    iteration:
-        if (spectrum[index].publicKey == publicKey)
+        const unsigned int index = findSpectrumSlot(publicKey);
+        if (!isZero(spectrum[index].publicKey))
         {
+            const unsigned long long oldBalance = energy(index);
             spectrum[index].incomingAmount += amount;
             spectrum[index].numberOfIncomingTransfers++;
             spectrum[index].latestIncomingTransferTick = system.tick;
 
             spectrumInfo.totalAmount += amount;
+            updateEntityCategoryPopulations(oldBalance, oldBalance + amount);
         }
         else
         {
-            if (isZero(spectrum[index].publicKey))
-            {
-                spectrum[index].publicKey = publicKey;
-                spectrum[index].incomingAmount = amount;
-                spectrum[index].numberOfIncomingTransfers = 1;
-                spectrum[index].latestIncomingTransferTick = system.tick;
+            setSpectrumSlotPublicKey(index, publicKey);
+            spectrum[index].incomingAmount = amount;
+            spectrum[index].numberOfIncomingTransfers = 1;
+            spectrum[index].latestIncomingTransferTick = system.tick;
 
-                spectrumInfo.numberOfEntities++;
-                spectrumInfo.totalAmount += amount;
+            spectrumInfo.numberOfEntities++;
+            spectrumInfo.totalAmount += amount;
+            updateEntityCategoryPopulations(0, amount);
 
 #if LOG_SPECTRUM_STATS
-                if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
-                {
-                    // Log spectrum stats when the number of entities hits the next half million
-                    // (== 1 is to avoid duplicate when anti-dust is triggered)
-                    updateAndAnalzeEntityCategoryPopulations();
-                    logSpectrumStats();
-                }
-#endif
-            }
-            else
+            if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
             {
-                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
-
-                goto iteration;
+                // Log spectrum stats when the number of entities hits the next half million
+                // (== 1 is to avoid duplicate when anti-dust is triggered)
+                analyzeEntityCategoryPopulations();
+                logSpectrumStats();
             }
+#endif
         }
 
         RELEASE(spectrumLock);
@@ -352,13 +642,15 @@ static bool decreaseEnergy(const int index, long long amount)
     {
         ACQUIRE(spectrumLock);
 
-        if (energy(index) >= amount)
+        const long long oldBalance = energy(index);
+        if (oldBalance >= amount)
         {
             spectrum[index].outgoingAmount += amount;
             spectrum[index].numberOfOutgoingTransfers++;
             spectrum[index].latestOutgoingTransferTick = system.tick;
 
             spectrumInfo.totalAmount -= amount;
+            updateEntityCategoryPopulations(oldBalance, oldBalance - amount);
 
             RELEASE(spectrumLock);
 
@@ -372,17 +664,31 @@ static bool decreaseEnergy(const int index, long long amount)
 }
 
 
+static void spectrumLeafDigest(const void* record, m256i& digest)
+{
+    KangarooTwelve64To32(record, &digest);
+}
+
+// Load spectrum and compute all spectrumDigests. Sparse files are checked against the stored digest.
 static bool loadSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR16* directory = nullptr)
 {
     logToConsole(L"Loading spectrum file ...");
-    long long loadedSize = load(fileName, SPECTRUM_CAPACITY * sizeof(::Entity), (unsigned char*)spectrum, directory);
+    const unsigned long long beginningTick = __rdtsc();
+    unsigned long long storedSize = 0;
+    long long loadedSize = loadSparseStateFile(fileName, (unsigned char*)spectrum, sizeof(::Entity), SPECTRUM_CAPACITY, spectrumLeafDigest, spectrumDigests, directory, &storedSize);
     if (loadedSize != SPECTRUM_CAPACITY * sizeof(::Entity))
     {
         logStatusToConsole(L"EFI_FILE_PROTOCOL.Read() reads invalid number of bytes", loadedSize, __LINE__);
 
         return false;
     }
+    setNumber(message, loadedSize, TRUE);
+    appendText(message, L" bytes of the spectrum data are loaded and hashed");
+    appendCompressionStats(message, loadedSize, storedSize, (__rdtsc() - beginningTick) * 1000000 / frequency);
+    appendText(message, L".");
+    logToConsole(message);
     updateSpectrumInfo();
+    updateSpectrumFingerprints();
     return true;
 }
 
@@ -392,16 +698,17 @@ static bool saveSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR
 
     const unsigned long long beginningTick = __rdtsc();
 
+    unsigned long long storedSize = 0;
     ACQUIRE(spectrumLock);
-    long long savedSize = save(fileName, SPECTRUM_CAPACITY * sizeof(::Entity), (unsigned char*)spectrum, directory);
+    long long savedSize = saveSparseStateFile(fileName, (unsigned char*)spectrum, sizeof(::Entity), SPECTRUM_CAPACITY, spectrumLeafDigest, directory, &storedSize);
     RELEASE(spectrumLock);
 
     if (savedSize == SPECTRUM_CAPACITY * sizeof(::Entity))
     {
         setNumber(message, savedSize, TRUE);
-        appendText(message, L" bytes of the spectrum data are saved (");
-        appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
-        appendText(message, L" microseconds).");
+        appendText(message, L" bytes of the spectrum data are saved");
+        appendCompressionStats(message, savedSize, storedSize, (__rdtsc() - beginningTick) * 1000000 / frequency);
+        appendText(message, L".");
         logToConsole(message);
         return true;
     }
@@ -415,6 +722,14 @@ static bool initSpectrum()
     {
         return false;
     }
+#if USE_SPECTRUM_FINGERPRINTS
+    if (!allocPoolWithErrorLog(L"spectrumFingerprints", SPECTRUM_CAPACITY + spectrumFingerprintsPadding, (void**)&spectrumFingerprints, __LINE__))
+    {
+        return false;
+    }
+    setMem(spectrumFingerprints, SPECTRUM_CAPACITY + spectrumFingerprintsPadding, 0);
+#endif
+    setMem(entityCategoryPopulations, sizeof(entityCategoryPopulations), 0);
     spectrumLock = 0;
 
     return true;
@@ -422,6 +737,13 @@ static bool initSpectrum()
 
 static void deinitSpectrum()
 {
+#if USE_SPECTRUM_FINGERPRINTS
+    if (spectrumFingerprints)
+    {
+        freePool(spectrumFingerprints);
+        spectrumFingerprints = nullptr;
+    }
+#endif
     if (spectrumDigests)
     {
         freePool(spectrumDigests);
@@ -0,0 +1,636 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/assert.h"
+#include "platform/concurrency.h"
+#include "platform/console_logging.h"
+#include "platform/file_io.h"
+#include "platform/memory_util.h"
+#include "platform/parallel_job.h"
+#include "platform/time_stamp_counter.h"
+
+#include "kangaroo_twelve.h"
+
+// Write-ahead journal of the state changes of each tick since the last node state snapshot. A node that crashes
+// between snapshots recovers by loading the snapshot and replaying the journal.
+//
+// The journaled state consists of memory regions (spectrum, universe, contract states, ...) registered with
+// registerRegion(). The tick processor collects the changes of a tick in a frame of records, each record holding
+// bytes to be written at an offset of a region (beginFrame(), addRecord(), addChangedPages(), commitFrame()).
+// Committed frames are queued in a ring buffer that the main thread writes to the journal file in groups of all
+// frames committed in the meantime (writeCommittedFrames()), so the tick processor never waits for the disk. If a
+// buffer is full or a region is rewritten without records (watchRewrites()), journaling is suspended until the next
+// start(); the frames written so far stay valid.
+//
+// File format: StateJournalFileHeader, followed by frames each consisting of StateJournalFrameHeader and the
+// records of the tick (StateJournalRecordHeader followed by the bytes). Frames carry the ID of the journal file and
+// a checksum, so replay() stops at the first incomplete frame or at stale data of an older file with the same name.
+// Files cannot be appended to on all platforms, so journaling after recovery starts the next file of the chain
+// (file index as 3-digit extension), which references the ID of the previous one.
+
+static constexpr unsigned long long stateJournalMagic = 0x31304e4a53425551; // "QUBSJN01"
+
+struct StateJournalFileHeader
+{
+    unsigned long long magic;
+    unsigned long long journalId;
+    unsigned long long previousJournalId; // 0 for the first file after the snapshot
+    unsigned short epoch;
+    unsigned short reserved;
+    unsigned int baseTick; // first tick journaled in this file
+};
+
+struct StateJournalFrameHeader
+{
+    unsigned long long journalId;
+    unsigned int tick;
+    unsigned int payloadSize; // size of records following the header
+    unsigned long long checksum; // of the frame including header with checksum = 0
+};
+
+struct StateJournalRecordHeader
+{
+    unsigned int region;
+    unsigned int size;
+    unsigned long long offset;
+};
+
+struct StateJournalRegion
+{
+    unsigned char* data;
+    unsigned long long size;
+
+    // Digests of pages, used by addChangedPages() to find changed pages (nullptr if pages are not tracked)
+    unsigned long long* pageDigests;
+    unsigned long long* changedPageFlags;
+
+    // Optional bit array for marking the records changed by replay(), for example for updating digests. One flag
+    // covers changeFlagRecordSize bytes, the first one has index changeFlagOffset.
+    unsigned long long* changeFlags;
+    unsigned long long changeFlagOffset;
+    unsigned long long changeFlagRecordSize;
+
+    // Optional counter incremented by code that rewrites the region in a way that isn't covered by records (see
+    // watchRewrites()), value at beginFrame(), and reason for suspending the journal if it has changed
+    const volatile unsigned int* rewriteCounter;
+    unsigned int rewriteCounterAtFrameBegin;
+    const CHAR16* rewriteReason;
+};
+
+template <unsigned int maxRegions>
+class StateJournal
+{
+public:
+    static constexpr unsigned long long pageSize = 4096;
+    static constexpr unsigned int maxFiles = 1000; // file index is stored as 3-digit file extension
+
+private:
+    static constexpr char stateInactive = 0;
+    static constexpr char stateActive = 1;
+    static constexpr char stateSuspended = 2;
+
+    StateJournalRegion regions[maxRegions];
+
+    // Frame of the current tick, only accessed by the tick processor
+    unsigned char* frameBuffer;
+    unsigned long long frameCapacity;
+    unsigned long long frameSize;
+    unsigned int frameTick;
+    bool frameOpen;
+    bool frameOverflow;
+
+    // Committed frames, written by the tick processor and read by the main thread
+    unsigned char* ringBuffer;
+    unsigned long long ringCapacity; // power of 2
+    volatile unsigned long long committedPosition;
+    volatile unsigned long long writtenPosition;
+
+    volatile char state;
+    const CHAR16* volatile suspendReason;
+
+    // Only accessed by the main thread
+    FileHandle file;
+    unsigned long long id;
+    unsigned int index;
+    unsigned long long commitPeriodMilliseconds;
+    unsigned long long lastWriteTick;
+    unsigned long long numberOfWrittenBytes;
+    unsigned int numberOfWrittenFrames;
+    volatile unsigned int numberOfCommittedFrames;
+    CHAR16 fileName[25]; // "snapshotStateJournal.???"
+
+    void setFileName(unsigned int fileIndex)
+    {
+        setText(fileName, L"snapshotStateJournal.???");
+        addEpochToFileName(fileName, sizeof(fileName) / sizeof(fileName[0]), fileIndex);
+    }
+
+    static void hashPagesPart(void* context, unsigned int partIndex)
+    {
+        StateJournalRegion& region = *(StateJournalRegion*)context;
+        const unsigned long long numberOfPages = (region.size + pageSize - 1) / pageSize;
+        const unsigned long long firstPage = partIndex * 64ULL;
+        const unsigned long long endPage = (firstPage + 64 < numberOfPages) ? firstPage + 64 : numberOfPages;
+        unsigned long long changedPages = 0;
+        for (unsigned long long page = firstPage; page < endPage; page++)
+        {
+            const unsigned long long offset = page * pageSize;
+            const unsigned long long size = (region.size - offset < pageSize) ? region.size - offset : pageSize;
+            unsigned long long digest;
+            KangarooTwelve(region.data + offset, (unsigned int)size, &digest, sizeof(digest));
+            if (digest != region.pageDigests[page])
+            {
+                region.pageDigests[page] = digest;
+                changedPages |= 1ULL << (page - firstPage);
+            }
+        }
+        region.changedPageFlags[partIndex] = changedPages;
+    }
+
+    static unsigned int numberOfPageFlagWords(const StateJournalRegion& region)
+    {
+        return (unsigned int)((region.size + pageSize * 64 - 1) / (pageSize * 64));
+    }
+
+    // Update pageDigests of region and set changedPageFlags of the pages that have changed
+    static void hashPages(StateJournalRegion& region)
+    {
+        runParallelJob(hashPagesPart, &region, numberOfPageFlagWords(region));
+    }
+
+    // Copy record to region and mark it in changeFlags. Returns false if the record is outside of the region.
+    bool applyRecord(const StateJournalRecordHeader& record, const unsigned char* data)
+    {
+        if (record.region >= maxRegions || !regions[record.region].data || !record.size)
+        {
+            return false;
+        }
+        StateJournalRegion& region = regions[record.region];
+        if (record.offset > region.size || record.size > region.size - record.offset)
+        {
+            return false;
+        }
+        copyMem(region.data + record.offset, data, record.size);
+        if (region.changeFlags)
+        {
+            const unsigned long long lastFlag = region.changeFlagOffset + (record.offset + record.size - 1) / region.changeFlagRecordSize;
+            for (unsigned long long flag = region.changeFlagOffset + record.offset / region.changeFlagRecordSize; flag <= lastFlag; flag++)
+            {
+                region.changeFlags[flag >> 6] |= (1ULL << (flag & 63));
+            }
+        }
+        return true;
+    }
+
+    bool writeRingBuffer(unsigned long long begin, unsigned long long end)
+    {
+        const unsigned long long offset = begin & (ringCapacity - 1);
+        const unsigned long long size = end - begin;
+        const unsigned long long firstSize = (size < ringCapacity - offset) ? size : ringCapacity - offset;
+        return writeFile(file, firstSize, ringBuffer + offset)
+            && (firstSize == size || writeFile(file, size - firstSize, ringBuffer))
+            && flushFile(file);
+    }
+
+public:
+    // Allocate buffers. frameBufferSize limits the size of the changes of one tick, ringBufferSize (power of 2)
+    // the size of frames waiting to be written.
+    bool init(unsigned long long frameBufferSize, unsigned long long ringBufferSize, unsigned long long commitPeriodMs)
+    {
+        ASSERT((ringBufferSize & (ringBufferSize - 1)) == 0);
+        setMem(regions, sizeof(regions), 0);
+        frameBuffer = nullptr;
+        ringBuffer = nullptr;
+        file.file = NULL;
+        state = stateInactive;
+        frameOpen = false;
+        committedPosition = 0;
+        writtenPosition = 0;
+        id = 0;
+        index = 0;
+        frameCapacity = frameBufferSize;
+        ringCapacity = ringBufferSize;
+        commitPeriodMilliseconds = commitPeriodMs;
+        return allocPoolWithErrorLog(L"stateJournalFrameBuffer", frameCapacity, (void**)&frameBuffer, __LINE__)
+            && allocPoolWithErrorLog(L"stateJournalRingBuffer", ringCapacity, (void**)&ringBuffer, __LINE__);
+    }
+
+    void deinit()
+    {
+        stop();
+        for (unsigned int i = 0; i < maxRegions; i++)
+        {
+            if (regions[i].pageDigests)
+            {
+                freePool(regions[i].pageDigests);
+            }
+            if (regions[i].changedPageFlags)
+            {
+                freePool(regions[i].changedPageFlags);
+            }
+        }
+        setMem(regions, sizeof(regions), 0);
+        if (frameBuffer)
+        {
+            freePool(frameBuffer);
+            frameBuffer = nullptr;
+        }
+        if (ringBuffer)
+        {
+            freePool(ringBuffer);
+            ringBuffer = nullptr;
+        }
+    }
+
+    // Register memory region. If trackPages is set, changes can be journaled with addChangedPages().
+    bool registerRegion(unsigned int regionIndex, void* data, unsigned long long size, bool trackPages,
+        unsigned long long* changeFlags = nullptr, unsigned long long changeFlagOffset = 0, unsigned long long changeFlagRecordSize = 0)
+    {
+        ASSERT(regionIndex < maxRegions && !regions[regionIndex].data && size);
+        StateJournalRegion& region = regions[regionIndex];
+        region.data = (unsigned char*)data;
+        region.size = size;
+        region.changeFlags = changeFlags;
+        region.changeFlagOffset = changeFlagOffset;
+        region.changeFlagRecordSize = changeFlagRecordSize;
+        if (trackPages)
+        {
+            const unsigned long long numberOfFlagWords = numberOfPageFlagWords(region);
+            if (!allocPoolWithErrorLog(L"stateJournalPageDigests", numberOfFlagWords * 64 * sizeof(unsigned long long), (void**)&region.pageDigests, __LINE__)
+                || !allocPoolWithErrorLog(L"stateJournalChangedPageFlags", numberOfFlagWords * sizeof(unsigned long long), (void**)&region.changedPageFlags, __LINE__))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Set counter that is incremented whenever region is rewritten by code that doesn't add records, for example
+    // when the whole spectrum hash map is reorganized. Journaling is suspended with reason if the counter changes
+    // while a frame is open, so replay stops before that tick (the region can be too large for a frame).
+    void watchRewrites(unsigned int regionIndex, const volatile unsigned int* counter, const CHAR16* reason)
+    {
+        ASSERT(regionIndex < maxRegions && regions[regionIndex].data);
+        regions[regionIndex].rewriteCounter = counter;
+        regions[regionIndex].rewriteReason = reason;
+    }
+
+    // Start new journal file with index fileIndex in directory, journaling the ticks from baseTick on. Called from
+    // the main thread while the tick processor is not processing a tick, after the state of baseTick - 1 has been
+    // saved as snapshot (fileIndex 0) or recovered with replay() (fileIndex and previousJournalId as returned).
+    bool start(unsigned short epoch, unsigned int baseTick, const CHAR16* directory, unsigned int fileIndex = 0, unsigned long long previousJournalId = 0)
+    {
+        stop();
+        if (fileIndex >= maxFiles)
+        {
+            logToConsole(L"Maximum number of state journal files reached, journaling disabled until next snapshot");
+            return false;
+        }
+
+        StateJournalFileHeader header;
+        unsigned long long seed[4] = { __rdtsc(), previousJournalId, epoch, baseTick };
+        KangarooTwelve(seed, sizeof(seed), &header.journalId, sizeof(header.journalId));
+        header.magic = stateJournalMagic;
+        header.journalId |= 1; // 0 is no valid ID
+        header.previousJournalId = previousJournalId;
+        header.epoch = epoch;
+        header.reserved = 0;
+        header.baseTick = baseTick;
+
+        setFileName(fileIndex);
+        if (!openFile(file, fileName, true, directory))
+        {
+            return false;
+        }
+        if (!writeFile(file, sizeof(header), (const unsigned char*)&header) || !flushFile(file))
+        {
+            closeFile(file);
+            return false;
+        }
+
+        // The state at start is the reference for finding changed pages
+        for (unsigned int i = 0; i < maxRegions; i++)
+        {
+            if (regions[i].pageDigests)
+            {
+                hashPages(regions[i]);
+            }
+        }
+
+        id = header.journalId;
+        index = fileIndex;
+        frameOpen = false;
+        committedPosition = 0;
+        writtenPosition = 0;
+        numberOfCommittedFrames = 0;
+        numberOfWrittenFrames = 0;
+        numberOfWrittenBytes = sizeof(header);
+        lastWriteTick = __rdtsc();
+        suspendReason = nullptr;
+        state = stateActive;
+
+        setText(message, L"Started state journal ");
+        appendText(message, fileName);
+        appendText(message, L" at tick ");
+        appendNumber(message, baseTick, FALSE);
+        logToConsole(message);
+        return true;
+    }
+
+    // Write remaining frames and close file. Called from the main thread while the tick processor is not
+    // processing a tick.
+    void stop()
+    {
+        if (state != stateInactive)
+        {
+            state = stateSuspended;
+            writeCommittedFrames();
+        }
+        frameOpen = false;
+    }
+
+    bool isActive() const
+    {
+        return state == stateActive;
+    }
+
+    unsigned long long journalId() const
+    {
+        return id;
+    }
+
+    unsigned int fileIndex() const
+    {
+        return index;
+    }
+
+    // Stop journaling until next start(), discarding the current frame. Called from the tick processor, the main
+    // thread closes the file in writeCommittedFrames().
+    void suspend(const CHAR16* reason)
+    {
+        frameOpen = false;
+        if (state == stateActive)
+        {
+            suspendReason = reason;
+            state = stateSuspended;
+        }
+    }
+
+    // Begin collecting the changes of tick. Called from the tick processor.
+    void beginFrame(unsigned int tick)
+    {
+        frameOpen = (state == stateActive);
+        frameOverflow = false;
+        frameTick = tick;
+        frameSize = sizeof(StateJournalFrameHeader);
+        for (unsigned int i = 0; i < maxRegions; i++)
+        {
+            if (regions[i].rewriteCounter)
+            {
+                regions[i].rewriteCounterAtFrameBegin = *regions[i].rewriteCounter;
+            }
+        }
+    }
+
+    bool isFrameOpen() const
+    {
+        return frameOpen;
+    }
+
+    // Add record to current frame (if any). Called from the tick processor.
+    void addRecord(unsigned int regionIndex, unsigned long long offset, const void* data, unsigned int size)
+    {
+        if (!frameOpen)
+        {
+            return;
+        }
+        ASSERT(regionIndex < maxRegions && offset + size <= regions[regionIndex].size);
+        if (frameSize + sizeof(StateJournalRecordHeader) + size > frameCapacity)
+        {
+            frameOverflow = true;
+            return;
+        }
+        StateJournalRecordHeader* record = (StateJournalRecordHeader*)(frameBuffer + frameSize);
+        record->region = regionIndex;
+        record->size = size;
+        record->offset = offset;
+        copyMem(record + 1, data, size);
+        frameSize += sizeof(StateJournalRecordHeader) + size;
+    }
+
+    // Add all pages of region that have changed since they were added last time (or since start()) to current
+    // frame. Pages are hashed in parallel. Called from the tick processor.
+    void addChangedPages(unsigned int regionIndex)
+    {
+        if (!frameOpen)
+        {
+            return;
+        }
+        StateJournalRegion& region = regions[regionIndex];
+        ASSERT(region.pageDigests);
+        hashPages(region);
+        const unsigned int numberOfFlagWords = numberOfPageFlagWords(region);
+        for (unsigned int i = 0; i < numberOfFlagWords; i++)
+        {
+            unsigned long long changedPages = region.changedPageFlags[i];
+            while (changedPages)
+            {
+                const unsigned long long offset = (i * 64ULL + _tzcnt_u64(changedPages)) * pageSize;
+                addRecord(regionIndex, offset, region.data + offset, (unsigned int)((region.size - offset < pageSize) ? region.size - offset : pageSize));
+                changedPages &= changedPages - 1;
+            }
+        }
+    }
+
+    // Queue current frame for writing. Called from the tick processor.
+    void commitFrame()
+    {
+        if (!frameOpen)
+        {
+            return;
+        }
+        frameOpen = false;
+        if (frameOverflow)
+        {
+            suspend(L"changes of tick exceed frame buffer");
+            return;
+        }
+        for (unsigned int i = 0; i < maxRegions; i++)
+        {
+            if (regions[i].rewriteCounter && *regions[i].rewriteCounter != regions[i].rewriteCounterAtFrameBegin)
+            {
+                suspend(regions[i].rewriteReason);
+                return;
+            }
+        }
+        if (state != stateActive)
+        {
+            return;
+        }
+
+        StateJournalFrameHeader* header = (StateJournalFrameHeader*)frameBuffer;
+        header->journalId = id;
+        header->tick = frameTick;
+        header->payloadSize = (unsigned int)(frameSize - sizeof(StateJournalFrameHeader));
+        header->checksum = 0;
+        unsigned long long checksum;
+        KangarooTwelve(frameBuffer, (unsigned int)frameSize, &checksum, sizeof(checksum));
+        header->checksum = checksum;
+
+        const unsigned long long begin = committedPosition;
+        if (frameSize > ringCapacity - (begin - writtenPosition))
+        {
+            suspend(L"ring buffer full");
+            return;
+        }
+        const unsigned long long offset = begin & (ringCapacity - 1);
+        const unsigned long long firstSize = (frameSize < ringCapacity - offset) ? frameSize : ringCapacity - offset;
+        copyMem(ringBuffer + offset, frameBuffer, firstSize);
+        copyMem(ringBuffer, frameBuffer + firstSize, frameSize - firstSize);
+        _mm_sfence();
+        committedPosition = begin + frameSize;
+        numberOfCommittedFrames++;
+    }
+
+    // Write all committed frames to the journal file if the commit period has passed (or if journaling has been
+    // suspended) and close the file after suspension. Called from the main thread.
+    void writeCommittedFrames()
+    {
+        if (state == stateInactive)
+        {
+            return;
+        }
+        const bool suspended = (state == stateSuspended);
+        const unsigned long long begin = writtenPosition;
+        const unsigned long long end = committedPosition;
+        const unsigned int committedFrames = numberOfCommittedFrames;
+        const unsigned long long now = __rdtsc();
+        if (end != begin && (suspended || end - begin >= ringCapacity / 4 || now - lastWriteTick >= commitPeriodMilliseconds * frequency / 1000))
+        {
+            if (!writeRingBuffer(begin, end))
+            {
+                closeFile(file);
+                state = stateInactive;
+                logToConsole(L"Failed to write state journal, journaling suspended until next snapshot");
+                return;
+            }
+            writtenPosition = end;
+            numberOfWrittenBytes += end - begin;
+            numberOfWrittenFrames = committedFrames;
+            lastWriteTick = now;
+        }
+
+        if (suspended)
+        {
+            closeFile(file);
+            state = stateInactive;
+            setText(message, L"Closed state journal ");
+            appendText(message, fileName);
+            appendText(message, L" with ");
+            appendNumber(message, numberOfWrittenFrames, TRUE);
+            appendText(message, L" ticks (");
+            appendNumber(message, numberOfWrittenBytes, TRUE);
+            appendText(message, L" bytes)");
+            if (suspendReason)
+            {
+                appendText(message, L", journaling suspended until next snapshot: ");
+                appendText(message, suspendReason);
+            }
+            logToConsole(message);
+        }
+    }
+
+    // Replay all complete frames of the journal files in directory that continue the snapshot of epoch taken
+    // before processing tick. On return, tick is the next tick to process, fileIndex and previousJournalId are the
+    // arguments for start() to continue the chain. Returns the number of replayed ticks or -1 on invalid records.
+    long long replay(unsigned short epoch, unsigned int& tick, const CHAR16* directory, unsigned int& fileIndex, unsigned long long& previousJournalId)
+    {
+        const unsigned long long beginningTick = __rdtsc();
+        long long replayedTicks = 0;
+        unsigned long long replayedBytes = 0;
+        fileIndex = 0;
+        previousJournalId = 0;
+        for (; fileIndex < maxFiles; fileIndex++)
+        {
+            FileHandle replayFile;
+            setFileName(fileIndex);
+            if (!openFile(replayFile, fileName, false, directory))
+            {
+                break;
+            }
+
+            StateJournalFileHeader header;
+            if (readFile(replayFile, sizeof(header), (unsigned char*)&header) != sizeof(header)
+                || header.magic != stateJournalMagic || header.epoch != epoch
+                || header.previousJournalId != previousJournalId || header.baseTick != tick)
+            {
+                // File of older snapshot
+                closeFile(replayFile);
+                break;
+            }
+
+            while (true)
+            {
+                StateJournalFrameHeader* frameHeader = (StateJournalFrameHeader*)frameBuffer;
+                if (readFile(replayFile, sizeof(StateJournalFrameHeader), frameBuffer) != sizeof(StateJournalFrameHeader)
+                    || frameHeader->journalId != header.journalId || frameHeader->tick != tick
+                    || frameHeader->payloadSize > frameCapacity - sizeof(StateJournalFrameHeader)
+                    || readFile(replayFile, frameHeader->payloadSize, frameBuffer + sizeof(StateJournalFrameHeader)) != frameHeader->payloadSize)
+                {
+                    // End of journal or incomplete last frame
+                    break;
+                }
+                const unsigned long long checksum = frameHeader->checksum;
+                const unsigned long long size = sizeof(StateJournalFrameHeader) + frameHeader->payloadSize;
+                frameHeader->checksum = 0;
+                unsigned long long expectedChecksum;
+                KangarooTwelve(frameBuffer, (unsigned int)size, &expectedChecksum, sizeof(expectedChecksum));
+                if (checksum != expectedChecksum)
+                {
+                    break;
+                }
+
+                unsigned long long offset = sizeof(StateJournalFrameHeader);
+                while (offset < size)
+                {
+                    const StateJournalRecordHeader& record = *(const StateJournalRecordHeader*)(frameBuffer + offset);
+                    if (size - offset < sizeof(StateJournalRecordHeader)
+                        || record.size > size - offset - sizeof(StateJournalRecordHeader)
+                        || !applyRecord(record, frameBuffer + offset + sizeof(StateJournalRecordHeader)))
+                    {
+                        closeFile(replayFile);
+                        setText(message, L"Invalid record in state journal ");
+                        appendText(message, fileName);
+                        appendText(message, L" at tick ");
+                        appendNumber(message, tick, FALSE);
+                        logToConsole(message);
+                        return -1;
+                    }
+                    offset += sizeof(StateJournalRecordHeader) + record.size;
+                }
+                replayedBytes += size;
+                replayedTicks++;
+                tick++;
+            }
+            closeFile(replayFile);
+            previousJournalId = header.journalId;
+        }
+
+        setText(message, L"Replayed ");
+        appendNumber(message, replayedTicks, TRUE);
+        appendText(message, L" ticks (");
+        appendNumber(message, replayedBytes, TRUE);
+        appendText(message, L" bytes) of state journal in ");
+        appendNumber(message, fileIndex, TRUE);
+        appendText(message, L" files");
+        if (frequency)
+        {
+            appendText(message, L" in ");
+            appendNumber(message, (__rdtsc() - beginningTick) * 1000 / frequency, TRUE);
+            appendText(message, L" ms");
+        }
+        logToConsole(message);
+        return replayedTicks;
+    }
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "platform/global_var.h"
+#include "platform/memory_util.h"
+
+#include "network_messages/special_command.h"
+
+
+// Histogram of CPU cycle counts with logarithmic buckets that are linearly subdivided (as in HdrHistogram).
+// Values below 2^subBucketBits are counted exactly, larger values with a relative error below 2^-subBucketBits.
+// record() may only be used if there is only one writer (such as the tick processor in TickProfiler). Histograms
+// that are updated by several processors, such as the ones of the contract locals stack pool, the locals zeroing
+// statistics, and the contract execution profiler, have to use recordConcurrent(). Readers may see a histogram that
+// is being updated, which is fine for statistics.
+struct CycleHistogram
+{
+    static constexpr unsigned int subBucketBits = 4;
+    static constexpr unsigned int subBucketCount = 1 << subBucketBits;
+    static constexpr unsigned int bucketCount = (64 - subBucketBits + 1) * subBucketCount;
+
+    unsigned long long count;
+    unsigned long long max;
+    unsigned long long buckets[bucketCount];
+
+    static unsigned int bucketIndex(unsigned long long value)
+    {
+        if (value < subBucketCount)
+        {
+            return (unsigned int)value;
+        }
+        const unsigned int exponent = 63 - (unsigned int)__lzcnt64(value);
+        const unsigned int subBucket = (unsigned int)(value >> (exponent - subBucketBits)) & (subBucketCount - 1);
+        return (exponent - subBucketBits + 1) * subBucketCount + subBucket;
+    }
+
+    // Return largest value counted in bucket
+    static unsigned long long bucketUpperBound(unsigned int index)
+    {
+        if (index < subBucketCount)
+        {
+            return index;
+        }
+        const unsigned int exponent = index / subBucketCount + subBucketBits - 1;
+        const unsigned long long subBucket = index & (subBucketCount - 1);
+        const unsigned long long lowerBound = (subBucketCount + subBucket) << (exponent - subBucketBits);
+        return lowerBound + ((1ULL << (exponent - subBucketBits)) - 1);
+    }
+
+    void reset()
+    {
+        setMem(this, sizeof(*this), 0);
+    }
+
+    void record(unsigned long long cycles)
+    {
+        buckets[bucketIndex(cycles)]++;
+        count++;
+        if (cycles > max)
+        {
+            max = cycles;
+        }
+    }
+
+    // Variant of record() that may be called by several processors concurrently
+    void recordConcurrent(unsigned long long cycles)
+    {
+        _InterlockedIncrement64((volatile long long*)&buckets[bucketIndex(cycles)]);
+        _InterlockedIncrement64((volatile long long*)&count);
+        long long currentMax = max;
+        while ((unsigned long long)currentMax < cycles)
+        {
+            const long long previousMax = _InterlockedCompareExchange64((volatile long long*)&max, cycles, currentMax);
+            if (previousMax == currentMax)
+                break;
+            currentMax = previousMax;
+        }
+    }
+
+    // Return value below or equal to which permille/1000 of the recorded values are (upper bound of bucket, but at
+    // most max). Returns 0 if histogram is empty.
+    unsigned long long percentile(unsigned int permille) const
+    {
+        const unsigned long long total = count;
+        if (!total)
+        {
+            return 0;
+        }
+        const unsigned long long rank = (total * permille + 999) / 1000;
+        unsigned long long cumulated = 0;
+        for (unsigned int i = 0; i < bucketCount; i++)
+        {
+            cumulated += buckets[i];
+            if (cumulated >= rank && cumulated)
+            {
+                const unsigned long long upperBound = bucketUpperBound(i);
+                return (upperBound < max) ? upperBound : max;
+            }
+        }
+        return max;
+    }
+};
+
+// Profile of the phases of processTick(), collected for the current and the previous epoch
+struct TickProfiler
+{
+    struct EpochProfile
+    {
+        unsigned short epoch;
+        CycleHistogram phases[TICK_PROFILE_PHASE_COUNT];
+    };
+
+    EpochProfile epochs[2];
+    unsigned long long tickBeginning;
+    unsigned long long phaseBeginning;
+
+    void reset()
+    {
+        setMem(this, sizeof(*this), 0);
+    }
+
+    // Start measuring processing of a tick in epoch
+    void beginTick(unsigned short epoch)
+    {
+        EpochProfile& profile = epochs[epoch & 1];
+        if (profile.epoch != epoch)
+        {
+            for (unsigned int i = 0; i < TICK_PROFILE_PHASE_COUNT; i++)
+            {
+                profile.phases[i].reset();
+            }
+            profile.epoch = epoch;
+        }
+        tickBeginning = phaseBeginning = __rdtsc();
+    }
+
+    // Record time since end of last phase (or beginTick()) for phase
+    void endPhase(unsigned short epoch, unsigned int phase)
+    {
+        const unsigned long long now = __rdtsc();
+        epochs[epoch & 1].phases[phase].record(now - phaseBeginning);
+        phaseBeginning = now;
+    }
+
+    // Restart phase time measurement, skipping time since end of last phase
+    void skipPhase()
+    {
+        phaseBeginning = __rdtsc();
+    }
+
+    void endTick(unsigned short epoch)
+    {
+        const unsigned long long now = __rdtsc();
+        epochs[epoch & 1].phases[TICK_PROFILE_PHASE_TOTAL].record(now - tickBeginning);
+        phaseBeginning = now;
+    }
+
+    // Fill response statistics for requested epoch. Sets response.epoch = 0 if epoch is not available.
+    void getStats(unsigned short epoch, SpecialCommandGetTickProfileResponse& response) const
+    {
+        const EpochProfile& profile = epochs[epoch & 1];
+        setMem(response.phases, sizeof(response.phases), 0);
+        response.epoch = (epoch && profile.epoch == epoch) ? epoch : 0;
+        if (response.epoch)
+        {
+            for (unsigned int i = 0; i < TICK_PROFILE_PHASE_COUNT; i++)
+            {
+                response.phases[i].count = profile.phases[i].count;
+                response.phases[i].p50 = profile.phases[i].percentile(500);
+                response.phases[i].p99 = profile.phases[i].percentile(990);
+                response.phases[i].max = profile.phases[i].max;
+            }
+        }
+    }
+};
+
+GLOBAL_VAR_DECL TickProfiler tickProfiler;
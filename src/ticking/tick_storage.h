@@ -11,11 +11,15 @@
 #include "public_settings.h"
 
 #if TICK_STORAGE_AUTOSAVE_MODE
+#include "platform/file_io.h"
+#include "platform/file_compression.h"
+#include "kangaroo_twelve.h"
+
 static unsigned short SNAPSHOT_METADATA_FILE_NAME[] = L"snapshotMetadata.???";
-static unsigned short SNAPSHOT_TICK_DATA_FILE_NAME[] = L"snapshotTickdata.???";
-static unsigned short SNAPSHOT_TICKS_FILE_NAME[] = L"snapshotTicks.???";
-static unsigned short SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME[] = L"snapshotTickTransactionOffsets.???";
-static unsigned short SNAPSHOT_TRANSACTIONS_FILE_NAME[] = L"snapshotTickTransaction.???";
+static unsigned short SNAPSHOT_TICK_DATA_FILE_NAME[] = L"snapshotTickdata.???.???";
+static unsigned short SNAPSHOT_TICKS_FILE_NAME[] = L"snapshotTicks.???.???";
+static unsigned short SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME[] = L"snapshotTickTransactionOffsets.???.???";
+static unsigned short SNAPSHOT_TRANSACTIONS_FILE_NAME[] = L"snapshotTickTransaction.???.???";
 #endif
 // Encapsulated tick storage of current epoch that can additionally keep the last ticks of the previous epoch.
 // The number of ticks to keep from the previous epoch is TICKS_TO_KEEP_FROM_PRIOR_EPOCH (defined in public_settings.h).
@@ -99,26 +103,63 @@ private:
     inline static volatile char tickTransactionsDigestAccessLock = 0;
 
 #if TICK_STORAGE_AUTOSAVE_MODE
-    struct MetaData {
+    // Snapshots are saved incrementally: each save appends one segment with the ticks (tick data, computor ticks,
+    // transaction offsets) and the transaction bytes added since the previous save. The metadata file is the
+    // manifest listing all valid segments with their ranges and digests. Loading replays all segments in order.
+    static constexpr unsigned int snapshotVersion = 2;
+    static constexpr unsigned int maxSnapshotSegments = 1000; // segment index is stored as 3-digit file extension
+
+    struct SnapshotSegment
+    {
+        unsigned int tickBegin; // first tick of segment
+        unsigned int tickEnd; // last tick of segment (inclusive)
+        unsigned long long transactionBegin; // offset of first transaction byte of segment in tickTransactions
+        unsigned long long transactionEnd; // offset after last transaction byte of segment
+        m256i digest; // digest of all data of the segment (see computeSegmentDigest())
+    };
+
+    struct MetaDataHeader {
         unsigned int epoch;
         unsigned int tickBegin;
         unsigned int tickEnd;
         long long outTotalTransactionSize;
         unsigned long long outNextTickTransactionOffset;
         // may need to store more meta data here to verify consistency when loading (ie: some nodes have different configs and can't use the saved files)
+        unsigned int version;
+        unsigned int numberOfSegments;
+    };
+    struct MetaData : MetaDataHeader {
+        SnapshotSegment segments[maxSnapshotSegments];
     } metaData;
-    inline static unsigned long long lastCheckTransactionOffset = 0; // use for save/load transaction state
+
+    // Save started by beginSaveToFile() and completed by finishSaveToFile()
+    struct PendingSave
+    {
+        unsigned int epoch;
+        unsigned int lastTick;
+        unsigned int segmentIndex;
+        bool writeSegment; // false if there are no new ticks and only the metadata is saved
+    } pendingSave;
+
     void prepareMetaDataFilename(short epoch)
     {
         addEpochToFileName(SNAPSHOT_METADATA_FILE_NAME, sizeof(SNAPSHOT_METADATA_FILE_NAME) / sizeof(SNAPSHOT_METADATA_FILE_NAME[0]), epoch);
     }
     void prepareFilenames(short epoch)
     {
+        // segment files have the extension .EPOCH.SEGMENT
         prepareMetaDataFilename(epoch);
-        addEpochToFileName(SNAPSHOT_TICK_DATA_FILE_NAME, sizeof(SNAPSHOT_TICK_DATA_FILE_NAME) / sizeof(SNAPSHOT_TICK_DATA_FILE_NAME[0]), epoch);
-        addEpochToFileName(SNAPSHOT_TICKS_FILE_NAME, sizeof(SNAPSHOT_TICKS_FILE_NAME) / sizeof(SNAPSHOT_TICKS_FILE_NAME[0]), epoch);
-        addEpochToFileName(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, sizeof(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME) / sizeof(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME[0]), epoch);
-        addEpochToFileName(SNAPSHOT_TRANSACTIONS_FILE_NAME, sizeof(SNAPSHOT_TRANSACTIONS_FILE_NAME) / sizeof(SNAPSHOT_TRANSACTIONS_FILE_NAME[0]), epoch);
+        addEpochToFileName(SNAPSHOT_TICK_DATA_FILE_NAME, sizeof(SNAPSHOT_TICK_DATA_FILE_NAME) / sizeof(SNAPSHOT_TICK_DATA_FILE_NAME[0]) - 4, epoch);
+        addEpochToFileName(SNAPSHOT_TICKS_FILE_NAME, sizeof(SNAPSHOT_TICKS_FILE_NAME) / sizeof(SNAPSHOT_TICKS_FILE_NAME[0]) - 4, epoch);
+        addEpochToFileName(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, sizeof(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME) / sizeof(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME[0]) - 4, epoch);
+        addEpochToFileName(SNAPSHOT_TRANSACTIONS_FILE_NAME, sizeof(SNAPSHOT_TRANSACTIONS_FILE_NAME) / sizeof(SNAPSHOT_TRANSACTIONS_FILE_NAME[0]) - 4, epoch);
+    }
+    void prepareSegmentFilenames(unsigned int segmentIndex)
+    {
+        addEpochToFileName(SNAPSHOT_TICK_DATA_FILE_NAME, sizeof(SNAPSHOT_TICK_DATA_FILE_NAME) / sizeof(SNAPSHOT_TICK_DATA_FILE_NAME[0]), segmentIndex);
+        addEpochToFileName(SNAPSHOT_TICKS_FILE_NAME, sizeof(SNAPSHOT_TICKS_FILE_NAME) / sizeof(SNAPSHOT_TICKS_FILE_NAME[0]), segmentIndex);
+        addEpochToFileName(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, sizeof(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME) / sizeof(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME[0]), segmentIndex);
+        addEpochToFileName(SNAPSHOT_TRANSACTIONS_FILE_NAME, sizeof(SNAPSHOT_TRANSACTIONS_FILE_NAME) / sizeof(SNAPSHOT_TRANSACTIONS_FILE_NAME[0]), segmentIndex);
     }
     bool saveMetaData(short epoch, unsigned int tickEnd, long long outTotalTransactionSize, unsigned long long outNextTickTransactionOffset, CHAR16* directory = NULL)
     {
@@ -127,86 +168,130 @@ private:
         metaData.tickEnd = tickEnd;
         metaData.outTotalTransactionSize = outTotalTransactionSize;
         metaData.outNextTickTransactionOffset = outNextTickTransactionOffset;
-        auto sz = saveLargeFile(SNAPSHOT_METADATA_FILE_NAME, sizeof(metaData), (unsigned char*) & metaData, directory);
+        metaData.version = snapshotVersion;
+        long long sz;
+        if (gAsyncFileIO && !gAsyncFileIO->isMainThread())
+        {
+            sz = asyncSave(SNAPSHOT_METADATA_FILE_NAME, sizeof(metaData), (unsigned char*)&metaData, directory, true);
+        }
+        else
+        {
+            sz = saveLargeFile(SNAPSHOT_METADATA_FILE_NAME, sizeof(metaData), (unsigned char*)&metaData, directory);
+        }
         if (sz != sizeof(metaData))
         {
             return false;
         }
         return true;
     }
-    bool saveTickData(unsigned long long nTick, CHAR16* directory = NULL)
+
+    // Hash buffer of any size (K12 input size is limited to 32 bits) and combine result with digest
+    static void addToSegmentDigest(m256i& digest, const unsigned char* buffer, unsigned long long size)
     {
-        long long totalWriteSize = nTick * sizeof(TickData);
-        auto sz = saveLargeFile(SNAPSHOT_TICK_DATA_FILE_NAME, totalWriteSize, (unsigned char*)tickDataPtr, directory);
-        if (sz != totalWriteSize)
+        constexpr unsigned long long maxChunkSize = 1ULL << 30;
+        do
         {
-            return false;
-        }
-        return true;
+            const unsigned long long chunkSize = (size < maxChunkSize) ? size : maxChunkSize;
+            m256i digests[2];
+            digests[0] = digest;
+            KangarooTwelve(buffer, (unsigned int)chunkSize, &digests[1], sizeof(digests[1]));
+            KangarooTwelve64To32(digests, &digest);
+            buffer += chunkSize;
+            size -= chunkSize;
+        } while (size);
     }
-    bool saveTicks(unsigned long long nTick, CHAR16* directory = NULL)
+
+    // Compute digest of tick data, ticks, transaction offsets, and transactions of a segment
+    static m256i computeSegmentDigest(const SnapshotSegment& segment)
     {
-        long long totalWriteSize = nTick * sizeof(Tick) * NUMBER_OF_COMPUTORS;
-        auto sz = saveLargeFile(SNAPSHOT_TICKS_FILE_NAME, totalWriteSize, (unsigned char*)ticksPtr, directory);
-        if (sz != totalWriteSize)
+        const unsigned int tickIndex = tickToIndexCurrentEpoch(segment.tickBegin);
+        const unsigned long long nTick = segment.tickEnd - segment.tickBegin + 1;
+        m256i digest = m256i::zero();
+        addToSegmentDigest(digest, (const unsigned char*)(tickDataPtr + tickIndex), nTick * sizeof(TickData));
+        addToSegmentDigest(digest, (const unsigned char*)(ticksPtr + tickIndex * NUMBER_OF_COMPUTORS), nTick * NUMBER_OF_COMPUTORS * sizeof(Tick));
+        addToSegmentDigest(digest, (const unsigned char*)(tickTransactionOffsetsPtr + tickIndex * NUMBER_OF_TRANSACTIONS_PER_TICK), nTick * NUMBER_OF_TRANSACTIONS_PER_TICK * sizeof(tickTransactionOffsetsPtr[0]));
+        addToSegmentDigest(digest, tickTransactionsPtr + segment.transactionBegin, segment.transactionEnd - segment.transactionBegin);
+        return digest;
+    }
+
+    // Save part of array as segment file (empty parts are skipped). Called from the main thread (or without
+    // AsyncFileIO in the tests), the file is written compressed. Called from another processor, the data is written
+    // uncompressed through AsyncFileIO without copying (the data of a segment isn't modified anymore): the main
+    // thread writes it in flushAsyncFileIOBuffer() while this one waits.
+    static bool saveSegmentPart(CHAR16* fileName, const void* buffer, unsigned long long size, CHAR16* directory)
+    {
+        if (!size)
         {
-            return false;
+            return true;
         }
-        return true;
+        long long sz;
+        if (gAsyncFileIO && !gAsyncFileIO->isMainThread())
+        {
+            sz = asyncSaveLargeFile(fileName, size, (unsigned char*)buffer, directory, false, true);
+        }
+        else
+        {
+            sz = saveCompressedLargeFile(fileName, size, (const unsigned char*)buffer, directory);
+        }
+        return sz == (long long)size;
     }
-    bool saveTickTransactionOffsets(unsigned long long nTick, CHAR16* directory = NULL)
+
+    // Load part of array from segment file (empty parts are skipped)
+    static bool loadSegmentPart(CHAR16* fileName, void* buffer, unsigned long long size, CHAR16* directory)
     {
-        long long totalWriteSize = nTick * sizeof(tickTransactionOffsetsPtr[0]) * NUMBER_OF_TRANSACTIONS_PER_TICK;
-        auto sz = saveLargeFile(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, totalWriteSize, (unsigned char*)tickTransactionOffsetsPtr, directory);
-        if (sz != totalWriteSize)
+        if (!size)
         {
-            return false;
+            return true;
         }
-        return true;
+        const long long sz = loadCompressedLargeFile(fileName, size, (unsigned char*)buffer, directory);
+        return sz == (long long)size;
     }
-    bool saveTransactions(unsigned long long nTick, long long& outTotalTransactionSize, unsigned long long& outNextTickTransactionOffset, CHAR16* directory = NULL)
+
+    // Find end of transaction bytes of the ticks in [firstTick, lastTick] (at least minEnd)
+    unsigned long long findTransactionEnd(unsigned int firstTick, unsigned int lastTick, unsigned long long minEnd)
     {
-        unsigned int toTick = tickBegin + (unsigned int)(nTick);
-        unsigned long long toPtr = 0;
-        outNextTickTransactionOffset = FIRST_TICK_TRANSACTION_OFFSET;
-        lastCheckTransactionOffset = tickBegin > lastCheckTransactionOffset ? tickBegin : lastCheckTransactionOffset;
-        // find the offset
+        unsigned long long maxOffset = minEnd;
+        for (unsigned int tick = firstTick; tick <= lastTick; tick++)
         {
-            unsigned long long maxOffset = FIRST_TICK_TRANSACTION_OFFSET;
-            unsigned int tick = 0;
-            for (tick = toTick; tick >= lastCheckTransactionOffset; tick--)
+            const unsigned long long* offsets = tickTransactionOffsets.getByTickInCurrentEpoch(tick);
+            for (unsigned int idx = 0; idx < NUMBER_OF_TRANSACTIONS_PER_TICK; idx++)
             {
-                for (int idx = NUMBER_OF_TRANSACTIONS_PER_TICK - 1; idx >= 0; idx--)
+                if (offsets[idx])
                 {
-                    if (this->tickTransactionOffsets(tick, idx))
+                    const Transaction* tx = (const Transaction*)(tickTransactionsPtr + offsets[idx]);
+                    const unsigned long long end = offsets[idx] + tx->totalSize();
+                    if (end > maxOffset)
                     {
-                        unsigned long long offset = this->tickTransactionOffsets(tick, idx);
-                        Transaction* tx = (Transaction*)(tickTransactionsPtr + offset);
-                        unsigned long long tmp = offset + tx->totalSize();
-                        if (tmp > maxOffset){
-                            maxOffset = tmp;
-                            lastCheckTransactionOffset = tick;
-                        }
+                        maxOffset = end;
                     }
                 }
             }
-            toPtr = maxOffset;
-            outNextTickTransactionOffset = maxOffset;
-        }
-        
-        // saving from the first tx of from tick to the last tx of (totick)
-        long long totalWriteSize = toPtr;
-        unsigned char* ptr = tickTransactionsPtr;
-        auto sz = saveLargeFile(SNAPSHOT_TRANSACTIONS_FILE_NAME, totalWriteSize, (unsigned char*)ptr, directory);
-        if (sz != totalWriteSize)
-        {
-            outTotalTransactionSize = -1;
-            return false;
         }
-        outTotalTransactionSize = totalWriteSize;
+        return maxOffset;
+    }
 
-        return true;
+    bool saveSegment(unsigned int segmentIndex, const SnapshotSegment& segment, CHAR16* directory = NULL)
+    {
+        const unsigned int tickIndex = tickToIndexCurrentEpoch(segment.tickBegin);
+        const unsigned long long nTick = segment.tickEnd - segment.tickBegin + 1;
+        prepareSegmentFilenames(segmentIndex);
+        return saveSegmentPart(SNAPSHOT_TICK_DATA_FILE_NAME, tickDataPtr + tickIndex, nTick * sizeof(TickData), directory)
+            && saveSegmentPart(SNAPSHOT_TICKS_FILE_NAME, ticksPtr + tickIndex * NUMBER_OF_COMPUTORS, nTick * NUMBER_OF_COMPUTORS * sizeof(Tick), directory)
+            && saveSegmentPart(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, tickTransactionOffsetsPtr + tickIndex * NUMBER_OF_TRANSACTIONS_PER_TICK, nTick * NUMBER_OF_TRANSACTIONS_PER_TICK * sizeof(tickTransactionOffsetsPtr[0]), directory)
+            && saveSegmentPart(SNAPSHOT_TRANSACTIONS_FILE_NAME, tickTransactionsPtr + segment.transactionBegin, segment.transactionEnd - segment.transactionBegin, directory);
     }
+
+    bool loadSegment(unsigned int segmentIndex, const SnapshotSegment& segment, CHAR16* directory = NULL)
+    {
+        const unsigned int tickIndex = tickToIndexCurrentEpoch(segment.tickBegin);
+        const unsigned long long nTick = segment.tickEnd - segment.tickBegin + 1;
+        prepareSegmentFilenames(segmentIndex);
+        return loadSegmentPart(SNAPSHOT_TICK_DATA_FILE_NAME, tickDataPtr + tickIndex, nTick * sizeof(TickData), directory)
+            && loadSegmentPart(SNAPSHOT_TICKS_FILE_NAME, ticksPtr + tickIndex * NUMBER_OF_COMPUTORS, nTick * NUMBER_OF_COMPUTORS * sizeof(Tick), directory)
+            && loadSegmentPart(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, tickTransactionOffsetsPtr + tickIndex * NUMBER_OF_TRANSACTIONS_PER_TICK, nTick * NUMBER_OF_TRANSACTIONS_PER_TICK * sizeof(tickTransactionOffsetsPtr[0]), directory)
+            && loadSegmentPart(SNAPSHOT_TRANSACTIONS_FILE_NAME, tickTransactionsPtr + segment.transactionBegin, segment.transactionEnd - segment.transactionBegin, directory);
+    }
+
     bool loadMetaData(CHAR16* directory = NULL)
     {
         auto sz = loadLargeFile(SNAPSHOT_METADATA_FILE_NAME, sizeof(metaData), (unsigned char*)&metaData, directory);
@@ -218,6 +303,9 @@ private:
     }
     bool checkMetaData()
     {
+        if (metaData.version != snapshotVersion) {
+            return false;
+        }
         if (metaData.tickBegin > metaData.tickEnd) {
             return false;
         }
@@ -232,44 +320,24 @@ private:
             return false;
         }
 #endif
-        return true;
-    }
-    bool loadTickData(unsigned long long nTick, CHAR16* directory = NULL)
-    {
-        long long totalLoadSize = nTick * sizeof(TickData);
-        auto sz = loadLargeFile(SNAPSHOT_TICK_DATA_FILE_NAME, totalLoadSize, (unsigned char*)tickDataPtr, directory);
-        if (sz != totalLoadSize)
-        {
+        // segments must be consecutive and cover [tickBegin, tickEnd] and all saved transactions
+        if (metaData.numberOfSegments == 0 || metaData.numberOfSegments > maxSnapshotSegments) {
             return false;
         }
-        return true;
-    }
-    bool loadTicks(unsigned long long nTick, CHAR16* directory = NULL)
-    {
-        long long totalLoadSize = nTick * sizeof(Tick) * NUMBER_OF_COMPUTORS;
-        auto sz = loadLargeFile(SNAPSHOT_TICKS_FILE_NAME, totalLoadSize, (unsigned char*)ticksPtr, directory);
-        if (sz != totalLoadSize)
+        unsigned int nextTick = metaData.tickBegin;
+        unsigned long long nextTransactionOffset = FIRST_TICK_TRANSACTION_OFFSET;
+        for (unsigned int i = 0; i < metaData.numberOfSegments; i++)
         {
-            return false;
-        }
-        return true;
-    }
-    bool loadTickTransactionOffsets(unsigned long long nTick, CHAR16* directory = NULL)
-    {
-        long long totalLoadSize = nTick * sizeof(tickTransactionOffsetsPtr[0]) * NUMBER_OF_TRANSACTIONS_PER_TICK;
-        auto sz = loadLargeFile(SNAPSHOT_TICK_TRANSACTION_OFFSET_FILE_NAME, totalLoadSize, (unsigned char*)tickTransactionOffsetsPtr, directory);
-        if (sz != totalLoadSize)
-        {
-            return false;
+            const SnapshotSegment& segment = metaData.segments[i];
+            if (segment.tickBegin != nextTick || segment.tickEnd < segment.tickBegin
+                || segment.transactionBegin != nextTransactionOffset || segment.transactionEnd < segment.transactionBegin) {
+                return false;
+            }
+            nextTick = segment.tickEnd + 1;
+            nextTransactionOffset = segment.transactionEnd;
         }
-        return true;
-    }
-    bool loadTransactions(unsigned long long nTick, unsigned long long totalLoadSize, CHAR16* directory = NULL)
-    {
-        unsigned char* ptr = tickTransactionsPtr;
-        auto sz = loadLargeFile(SNAPSHOT_TRANSACTIONS_FILE_NAME, totalLoadSize, (unsigned char*)ptr, directory);
-        if (sz != totalLoadSize)
-        {
+        if (nextTick != metaData.tickEnd + 1 || nextTransactionOffset != metaData.outNextTickTransactionOffset
+            || nextTransactionOffset > tickTransactionsSizeCurrentEpoch) {
             return false;
         }
         return true;
@@ -279,6 +347,7 @@ private:
 
 public:
 #if TICK_STORAGE_AUTOSAVE_MODE
+    // Return last tick loaded from (or saved to) snapshot
     unsigned int getPreloadTick() const
     {
         return metaData.tickEnd;
@@ -291,71 +360,121 @@ public:
     // And probably cause critical bugs if we forget to do update this feature.
     // 
     // Save procedure:
-    // (1) check current meta data state
-    // (2) write all missing chunks to disk
+    // (1) check current meta data state (ticks saved before)
+    // (2) write segment with ticks and transactions added since last save (or one segment with everything if there
+    //     is no valid previous save or the maximum number of segments is reached)
     // (3) update metadata state
+    //
+    // The snapshot is a cut by tick number: only the ticks before tick (the current tick system.tick) are saved.
+    // Data of these ticks isn't modified anymore (votes, tick data, and transactions are only accepted for the
+    // current and future ticks), so no locks are needed and processing of incoming ticks and transactions never
+    // waits for the file writes. The current tick is requested from the network again after loading.
+    //
+    // The node runs (1) in the main thread with beginSaveToFile() and (2) and (3) with finishSaveToFile() in a
+    // request processor, which writes the files through AsyncFileIO while the main thread keeps serving the peers.
     int trySaveToFile(unsigned int epoch, unsigned int tick, CHAR16* directory = NULL)
+    {
+        int result = beginSaveToFile(epoch, tick);
+        if (result == 0)
+        {
+            result = finishSaveToFile(directory);
+            logSaveToFileResult(result);
+        }
+        return result;
+    }
+
+    // Select ticks of snapshot. Must be called from the main thread while tick processing is paused at tick.
+    int beginSaveToFile(unsigned int epoch, unsigned int tick)
     {   
         if (tick <= tickBegin) {
             return 6;
         }
-        unsigned long long nTick = tick - tickBegin + 1; // inclusive [tickBegin, tick]
         prepareFilenames(epoch);
+        const unsigned int lastTick = tick - 1;
+        pendingSave.epoch = epoch;
+        pendingSave.lastTick = lastTick;
+
+        // Start new snapshot if previous one cannot be continued
+        const bool continueSnapshot = metaData.version == snapshotVersion && metaData.epoch == epoch && metaData.tickBegin == tickBegin
+            && metaData.numberOfSegments > 0 && metaData.tickEnd <= lastTick;
+        if (continueSnapshot && metaData.tickEnd == lastTick)
+        {
+            // no new ticks, only restore metadata (that may have been invalidated)
+            pendingSave.writeSegment = false;
+            logToConsole(L"Saving meta data");
+            return 0;
+        }
+        const bool appendSegment = continueSnapshot && metaData.numberOfSegments < maxSnapshotSegments;
+        const unsigned int segmentIndex = appendSegment ? metaData.numberOfSegments : 0;
+        SnapshotSegment& segment = metaData.segments[segmentIndex];
+        segment.tickBegin = appendSegment ? metaData.tickEnd + 1 : tickBegin;
+        segment.tickEnd = lastTick;
+        segment.transactionBegin = appendSegment ? metaData.outNextTickTransactionOffset : FIRST_TICK_TRANSACTION_OFFSET;
+        pendingSave.segmentIndex = segmentIndex;
+        pendingSave.writeSegment = true;
+
+        setText(message, L"Saving tick storage segment ");
+        appendNumber(message, segmentIndex, FALSE);
+        appendText(message, L" with ticks ");
+        appendNumber(message, segment.tickBegin, FALSE);
+        appendText(message, L" to ");
+        appendNumber(message, segment.tickEnd, FALSE);
+        logToConsole(message);
+        return 0;
+    }
 
-        logToConsole(L"Saving tick data...");
-        tickData.acquireLock();
-        if (!saveTickData(nTick, directory))
+    // Write segment and metadata of save started with beginSaveToFile(). May be called from any processor while
+    // ticks are processed, because the selected ticks aren't modified anymore. Doesn't log to console.
+    int finishSaveToFile(CHAR16* directory = NULL)
+    {
+        long long outTotalTransactionSize = metaData.outTotalTransactionSize;
+        unsigned long long outNextTickTransactionOffset = metaData.outNextTickTransactionOffset;
+        if (pendingSave.writeSegment)
         {
-            tickData.releaseLock();
-            logToConsole(L"Failed to save tickData");
-            return 5;
+            // Transactions are only appended to tickTransactions and each one is completely written before its offset
+            // is published, so all bytes up to the end of the last transaction of the segment's ticks are final.
+            SnapshotSegment& segment = metaData.segments[pendingSave.segmentIndex];
+            segment.transactionEnd = findTransactionEnd(segment.tickBegin, segment.tickEnd, segment.transactionBegin);
+            segment.digest = computeSegmentDigest(segment);
+            if (!saveSegment(pendingSave.segmentIndex, segment, directory))
+            {
+                initMetaData(pendingSave.epoch);
+                return 2;
+            }
+            metaData.numberOfSegments = pendingSave.segmentIndex + 1;
+            outTotalTransactionSize = segment.transactionEnd - FIRST_TICK_TRANSACTION_OFFSET;
+            outNextTickTransactionOffset = segment.transactionEnd;
         }
-        tickData.releaseLock();
 
-        logToConsole(L"Saving quorum ticks");
-        for (int i = 0; i < NUMBER_OF_COMPUTORS; i++) ticks.acquireLock(i);
-        if (!saveTicks(nTick, directory))
+        if (!saveMetaData(pendingSave.epoch, pendingSave.lastTick, outTotalTransactionSize, outNextTickTransactionOffset, directory))
         {
-            for (int i = 0; i < NUMBER_OF_COMPUTORS; i++) ticks.releaseLock(i);
-            logToConsole(L"Failed to save Ticks");
-            return 4;
+            if (pendingSave.writeSegment)
+            {
+                initMetaData(pendingSave.epoch);
+            }
+            return 1;
         }
-        for (int i = 0; i < NUMBER_OF_COMPUTORS; i++) ticks.releaseLock(i);
 
+        return 0;
+    }
 
-        tickTransactions.acquireLock();
-        logToConsole(L"Saving tick transaction offset");
-        if (!saveTickTransactionOffsets(nTick, directory))
-        {
-            tickTransactions.releaseLock();
-            logToConsole(L"Failed to save transactionOffset");
-            return 3;
-        }
-        logToConsole(L"Saving transactions");
-        long long outTotalTransactionSize = 0;
-        unsigned long long outNextTickTransactionOffset = 0;
-        if (!saveTransactions(nTick, outTotalTransactionSize, outNextTickTransactionOffset, directory))
+    // Log error returned by finishSaveToFile() (main thread only)
+    static void logSaveToFileResult(int result)
+    {
+        if (result == 2)
         {
-            tickTransactions.releaseLock();
-            logToConsole(L"Failed to save transactions");
-            return 2;
+            logToConsole(L"Failed to save tick storage segment");
         }
-        tickTransactions.releaseLock();
-
-        logToConsole(L"Saving meta data");
-        if (!saveMetaData(epoch, tick, outTotalTransactionSize, outNextTickTransactionOffset, directory))
+        else if (result == 1)
         {
             logToConsole(L"Failed to save metaData");
-            return 1;
         }
-
-        return 0;
     }
 
     // Load procedure:
     // (1) try to load metadata file
     // (2) sanity check meta data file
-    // (3) load these in order: tickData -> Ticks -> tx offset -> tx 
+    // (3) load all segments in order and check their digests
     // only load once at start up
     int tryLoadFromFile(unsigned short epoch, CHAR16* directory)
     {
@@ -372,54 +491,49 @@ public:
             initMetaData(epoch);
             return 2;
         }
-        nextTickTransactionOffset = metaData.outNextTickTransactionOffset;
-        unsigned long long nTick = metaData.tickEnd - metaData.tickBegin + 1;
         prepareFilenames(epoch);
 
-        logToConsole(L"Loading tick data...");
-        if (!loadTickData(nTick, directory))
-        {
-            logToConsole(L"Failed to load loadTickData");
-            initMetaData(epoch);
-            return 5;
-        }
-
-        logToConsole(L"Loading ticks...");
-        if (!loadTicks(nTick, directory))
-        {
-            logToConsole(L"Failed to load loadTicks");
-            initMetaData(epoch);
-            return 4;
-        }
-
-        logToConsole(L"Loading transaction offset...");
-        if (!loadTickTransactionOffsets(nTick, directory))
+        for (unsigned int segmentIndex = 0; segmentIndex < metaData.numberOfSegments; segmentIndex++)
         {
-            logToConsole(L"Failed to load loadTickTransactionOffsets");
-            initMetaData(epoch);
-            return 3;
-        }
-
-        logToConsole(L"Loading transactions...");
-        if (!loadTransactions(nTick, metaData.outTotalTransactionSize, directory))
-        {
-            logToConsole(L"Failed to load loadTransactions");
-            initMetaData(epoch);
-            return 2;
+            const SnapshotSegment& segment = metaData.segments[segmentIndex];
+            setText(message, L"Loading tick storage segment ");
+            appendNumber(message, segmentIndex, FALSE);
+            appendText(message, L" with ticks ");
+            appendNumber(message, segment.tickBegin, FALSE);
+            appendText(message, L" to ");
+            appendNumber(message, segment.tickEnd, FALSE);
+            logToConsole(message);
+            if (!loadSegment(segmentIndex, segment, directory))
+            {
+                logToConsole(L"Failed to load tick storage segment");
+                initMetaData(epoch);
+                return 3;
+            }
+            if (computeSegmentDigest(segment) != segment.digest)
+            {
+                logToConsole(L"Digest of tick storage segment does not match");
+                initMetaData(epoch);
+                return 4;
+            }
         }
+        nextTickTransactionOffset = metaData.outNextTickTransactionOffset;
         return 0;
     }
 
-    // Save a dummy metadata that invalidate the current snapshot
+    // Save a dummy metadata that invalidate the current snapshot. The segment files and the valid metadata in memory
+    // are kept, so the next save only needs to append a segment.
     bool saveInvalidateData(unsigned int epoch, CHAR16* directory = NULL)
     {
-        MetaData invalidMetaData;
+        MetaDataHeader invalidMetaData;
         invalidMetaData.epoch = 0;
         invalidMetaData.tickBegin = 0;
         invalidMetaData.tickEnd = 0;
         invalidMetaData.outTotalTransactionSize = 0;
         invalidMetaData.outNextTickTransactionOffset = 0;
+        invalidMetaData.version = 0;
+        invalidMetaData.numberOfSegments = 0;
         prepareMetaDataFilename(epoch);
+        // only the header is written, so loading fails due to the size mismatch
         auto sz = saveLargeFile(SNAPSHOT_METADATA_FILE_NAME, sizeof(invalidMetaData), (unsigned char*)&invalidMetaData, directory);
         if (sz != sizeof(invalidMetaData))
         {
@@ -434,7 +548,10 @@ public:
         metaData.tickBegin = tickBegin;
         metaData.tickEnd = tickBegin;
         metaData.epoch = epoch;
-        lastCheckTransactionOffset = tickBegin;
+        metaData.outTotalTransactionSize = 0;
+        metaData.outNextTickTransactionOffset = FIRST_TICK_TRANSACTION_OFFSET;
+        metaData.version = snapshotVersion;
+        metaData.numberOfSegments = 0;
         return true;
     }
 #endif
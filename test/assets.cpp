@@ -12,6 +12,11 @@
 
 #include "test_util.h"
 
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+
 
 class AssetsTest : public AssetStorage, LoggingTest
 {
@@ -704,6 +709,128 @@ TEST(TestCoreAssets, AssetTransferShareManagementRights)
         }
     }
 }
+
+TEST(TestCoreAssets, AssetsEndEpochParallel)
+{
+    AssetsTest test;
+    test.clearUniverse();
+    std::mt19937_64 gen64(42);
+
+    // Build universe with many issuances and transfers, including transfers of all shares of a possession
+    const char name[7] = "ASSET";
+    for (int i = 0; i < 100; ++i)
+    {
+        int issuanceIdx, ownershipIdx, possessionIdx;
+        EXPECT_EQ(issueAsset(m256i(gen64(), gen64(), gen64(), gen64()), name, 0, CONTRACT_ASSET_UNIT_OF_MEASUREMENT,
+            1000000, 1, &issuanceIdx, &ownershipIdx, &possessionIdx), 1000000);
+        for (int j = 0; j < 200; ++j)
+        {
+            const long long availableShares = assets[possessionIdx].varStruct.possession.numberOfShares;
+            const bool transferAll = (gen64() % 4 == 0);
+            const long long sharesToTransfer = transferAll ? availableShares : std::min<long long>(gen64() % 1000 + 1, availableShares);
+            int destOwnershipIdx, destPossessionIdx;
+            EXPECT_TRUE(transferShareOwnershipAndPossession(ownershipIdx, possessionIdx, m256i(gen64(), gen64(), gen64(), gen64()),
+                sharesToTransfer, &destOwnershipIdx, &destPossessionIdx, true));
+            if (transferAll)
+            {
+                ownershipIdx = destOwnershipIdx;
+                possessionIdx = destPossessionIdx;
+            }
+        }
+    }
+    test.checkAssetsConsistency();
+
+    // Rebuild hash map with helper threads
+    std::atomic<bool> stopHelpers = false;
+    std::vector<std::thread> helpers;
+    for (int i = 0; i < 3; ++i)
+    {
+        helpers.emplace_back([&stopHelpers]()
+            {
+                while (!stopHelpers)
+                    tryHelpWithParallelJob();
+            });
+    }
+    assetsEndEpoch();
+    stopHelpers = true;
+    for (auto& helper : helpers)
+        helper.join();
+    test.checkAssetsConsistency();
+
+    // Records with zero shares have been removed
+    for (unsigned int i = 0; i < ASSETS_CAPACITY; ++i)
+    {
+        if (assets[i].varStruct.possession.type == POSSESSION)
+            EXPECT_GT(assets[i].varStruct.possession.numberOfShares, 0);
+        if (assets[i].varStruct.ownership.type == OWNERSHIP)
+            EXPECT_GT(assets[i].varStruct.ownership.numberOfShares, 0);
+    }
+
+    // Index lists match the ones of a full rebuild
+    auto indexListsCopy = std::make_unique<AssetStorage::IndexLists>(as.indexLists);
+    as.indexLists.rebuild();
+    EXPECT_EQ(memcmp(indexListsCopy.get(), &as.indexLists, sizeof(AssetStorage::IndexLists)), 0);
+
+    // Digests are up to date and match hashing the whole universe from scratch
+    m256i digest, digestFromScratch;
+    getUniverseDigest(digest);
+    setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
+    getUniverseDigest(digestFromScratch);
+    EXPECT_EQ(digest, digestFromScratch);
+}
+
+TEST(TestCoreAssets, SparseFileSaveAndLoad)
+{
+    AssetsTest test;
+    test.clearUniverse();
+    std::mt19937_64 gen64(123);
+    CHAR16 fileName[32];
+    setText(fileName, L"universeSparseTest.tmp");
+    frequency = 1000000000; // for timing in log messages
+
+    const char name[7] = "SPARSE";
+    for (int i = 0; i < 50; ++i)
+    {
+        int issuanceIdx, ownershipIdx, possessionIdx;
+        EXPECT_EQ(issueAsset(m256i(gen64(), gen64(), gen64(), gen64()), name, 0, CONTRACT_ASSET_UNIT_OF_MEASUREMENT,
+            1000000, 1, &issuanceIdx, &ownershipIdx, &possessionIdx), 1000000);
+        for (int j = 0; j < 20; ++j)
+        {
+            int destOwnershipIdx, destPossessionIdx;
+            EXPECT_TRUE(transferShareOwnershipAndPossession(ownershipIdx, possessionIdx, m256i(gen64(), gen64(), gen64(), gen64()),
+                gen64() % 1000 + 1, &destOwnershipIdx, &destPossessionIdx, true));
+        }
+    }
+    std::vector<unsigned char> oldAssets((unsigned char*)assets, (unsigned char*)(assets + ASSETS_CAPACITY));
+    m256i digest;
+    setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
+    getUniverseDigest(digest);
+    std::vector<m256i> oldDigests(assetDigests, assetDigests + ASSETS_CAPACITY * 2 - 1);
+
+    // Loading sparse file restores records, index lists, and digests without rehashing in getUniverseDigest()
+    EXPECT_TRUE(saveUniverse(fileName));
+    test.clearUniverse();
+    setMem(assetDigests, assetDigestsSizeInBytes, 0);
+    EXPECT_TRUE(loadUniverse(fileName));
+    EXPECT_EQ(memcmp(assets, oldAssets.data(), ASSETS_CAPACITY * sizeof(AssetRecord)), 0);
+    EXPECT_EQ(memcmp(assetDigests, oldDigests.data(), assetDigestsSizeInBytes), 0);
+    for (unsigned int i = 0; i < ASSETS_CAPACITY / 64; ++i)
+        EXPECT_EQ(assetChangeFlags[i], 0);
+    m256i loadedDigest;
+    getUniverseDigest(loadedDigest);
+    EXPECT_EQ(loadedDigest, digest);
+    test.checkAssetsConsistency();
+
+    // Files of full universe are still supported
+    EXPECT_EQ(save(fileName, ASSETS_CAPACITY * sizeof(AssetRecord), (unsigned char*)assets), (long long)(ASSETS_CAPACITY * sizeof(AssetRecord)));
+    test.clearUniverse();
+    setMem(assetDigests, assetDigestsSizeInBytes, 0);
+    EXPECT_TRUE(loadUniverse(fileName));
+    EXPECT_EQ(memcmp(assets, oldAssets.data(), ASSETS_CAPACITY * sizeof(AssetRecord)), 0);
+    EXPECT_EQ(memcmp(assetDigests, oldDigests.data(), assetDigestsSizeInBytes), 0);
+
+    remove("universeSparseTest.tmp");
+}
 
 
 
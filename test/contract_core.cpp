@@ -5,6 +5,11 @@
 #define TRACK_MAX_STACK_BUFFER_SIZE
 #include "../src/contract_core/stack_buffer.h"
 #include "../src/contract_core/contract_action_tracker.h"
+#include "../src/contract_core/contract_processor_mailbox.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
 
 TEST(TestCoreContractCore, StackBuffer)
 {
@@ -115,6 +120,59 @@ TEST(TestCoreContractCore, StackBuffer)
     }
 }
 
+TEST(TestCoreContractCore, StackBufferZeroedAllocation)
+{
+    auto s = std::make_unique<StackBuffer<unsigned int, 10000>>();
+    s->init();
+    EXPECT_EQ(s->dirtySize(), 10000);
+
+    // Buffer may contain garbage after init -> zero everything allocated
+    unsigned int zeroedSize;
+    char* p1 = s->allocateZeroed(1000, zeroedSize);
+    ASSERT_NE(p1, nullptr);
+    EXPECT_EQ(zeroedSize, 1000);
+    setMem(p1, 1000, 0xAB);
+    EXPECT_TRUE(s->free());
+
+    // Idle cleanup zeros unused part from the top, in chunks
+    EXPECT_EQ(s->cleanUp(6000), 6000);
+    EXPECT_EQ(s->dirtySize(), 4000);
+    EXPECT_EQ(s->cleanUp(6000), 4000);
+    EXPECT_EQ(s->dirtySize(), 0);
+    EXPECT_EQ(s->cleanUp(6000), 0);
+    for (int i = 0; i < 1000; ++i)
+        EXPECT_EQ(p1[i], 0);
+
+    // After cleanup, allocations don't need zeroing
+    p1 = s->allocateZeroed(500, zeroedSize);
+    EXPECT_EQ(zeroedSize, 0);
+    setMem(p1, 500, 0xCD);
+    char* p2 = s->allocateZeroed(300, zeroedSize);
+    EXPECT_EQ(zeroedSize, 0);
+    setMem(p2, 300, 0xCD);
+    EXPECT_EQ(s->dirtySize(), s->size());
+    const unsigned int dirtySize = s->dirtySize();
+    EXPECT_TRUE(s->free());
+    EXPECT_TRUE(s->free());
+
+    // Only part used before needs zeroing
+    char* p3 = s->allocateZeroed(2000, zeroedSize);
+    EXPECT_EQ(zeroedSize, dirtySize);
+    for (int i = 0; i < 2000; ++i)
+        EXPECT_EQ(p3[i], 0);
+
+    // Cleanup doesn't touch used part
+    char* p4 = s->allocate(100);
+    setMem(p4, 100, 0xEF);
+    EXPECT_EQ(s->cleanUp(10000), 0);
+    EXPECT_TRUE(s->free());
+    const unsigned int unusedDirtySize = s->dirtySize() - s->size();
+    EXPECT_EQ(unusedDirtySize, 100 + sizeof(unsigned int));
+    EXPECT_EQ(s->cleanUp(10000), unusedDirtySize);
+    EXPECT_EQ(s->dirtySize(), s->size());
+    EXPECT_EQ(p4[0], 0);
+}
+
 TEST(TestCoreContractCore, ContractActionTracker)
 {
     m256i id0(0, 1, 2, 3);
@@ -165,3 +223,67 @@ TEST(TestCoreContractCore, ContractActionTracker)
 
     at.freeBuffer();
 }
+
+TEST(TestCoreContractCore, ContractProcessorMailbox)
+{
+    static ContractProcessorMailbox mailbox;
+    mailbox.init();
+    EXPECT_TRUE(mailbox.isFinished());
+    EXPECT_FALSE(mailbox.tryStartCall());
+    EXPECT_EQ(mailbox.runningCallDuration(), 0);
+
+    // resident processor executes calls in order of posting
+    static volatile int callParameter;
+    std::atomic<bool> stop = false;
+    std::vector<int> executedCalls;
+    std::thread processor([&]()
+        {
+            while (!stop)
+            {
+                if (mailbox.tryStartCall())
+                {
+                    executedCalls.push_back((int)callParameter);
+                    mailbox.finishCall();
+                }
+            }
+        });
+    for (int i = 0; i < 100; ++i)
+    {
+        callParameter = i;
+        mailbox.call();
+        EXPECT_TRUE(mailbox.isFinished());
+    }
+    stop = true;
+    processor.join();
+    ASSERT_EQ(executedCalls.size(), 100);
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(executedCalls[i], i);
+    EXPECT_EQ(mailbox.numberOfCalls, 100);
+    EXPECT_LE(mailbox.maxDispatchLatency * 1000, mailbox.dispatchLatencySum * 1000);
+    EXPECT_GE(mailbox.maxDispatchLatency * 1000, mailbox.dispatchLatencySum);
+    EXPECT_EQ(mailbox.numberOfAbortedCalls, 0);
+    mailbox.resetStats();
+    EXPECT_EQ(mailbox.numberOfCalls, 0);
+    EXPECT_EQ(mailbox.dispatchLatencySum, 0);
+
+    // watchdog reports long running call once
+    mailbox.post();
+    EXPECT_FALSE(mailbox.checkWatchdog(0));
+    EXPECT_TRUE(mailbox.tryStartCall());
+    while (mailbox.runningCallDuration() <= 1000)
+    {
+    }
+    EXPECT_FALSE(mailbox.checkWatchdog(1000000000000ULL));
+    EXPECT_TRUE(mailbox.checkWatchdog(1000));
+    EXPECT_FALSE(mailbox.checkWatchdog(1000));
+    EXPECT_FALSE(mailbox.isFinished());
+
+    // call of stopped processor is aborted
+    mailbox.abortUnfinishedCall();
+    EXPECT_TRUE(mailbox.isFinished());
+    EXPECT_EQ(mailbox.runningCallDuration(), 0);
+    EXPECT_EQ(mailbox.numberOfAbortedCalls, 1);
+    mailbox.abortUnfinishedCall();
+    EXPECT_EQ(mailbox.numberOfAbortedCalls, 1);
+    EXPECT_FALSE(mailbox.tryStartCall());
+}
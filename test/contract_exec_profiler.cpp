@@ -0,0 +1,169 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/contract_core/contract_exec_profiler.h"
+
+#include <memory>
+
+
+typedef SpecialCommandGetContractExecProfileResponse<ContractExecProfiler::capacity> ContractExecProfileResponse;
+
+static const ContractExecProfileEntry* findEntry(const ContractExecProfileResponse& response, unsigned short contractIndex, unsigned char kind, unsigned short inputType)
+{
+    for (unsigned int i = 0; i < response.numberOfEntries; ++i)
+    {
+        const ContractExecProfileEntry& entry = response.entries[i];
+        if (entry.contractIndex == contractIndex && entry.kind == kind && entry.inputType == inputType)
+            return &entry;
+    }
+    return nullptr;
+}
+
+TEST(TestCoreContractExecProfiler, RecordProceduresAndFunctions)
+{
+    auto profiler = std::make_unique<ContractExecProfiler>();
+    EXPECT_TRUE(profiler->init());
+    auto response = std::make_unique<ContractExecProfileResponse>();
+
+    // Epoch not prepared yet -> nothing recorded
+    profiler->recordFunction(100, 1, 1, 1000, 64);
+    EXPECT_EQ(profiler->getStats(100, *response), 0);
+    EXPECT_EQ(response->epoch, 0);
+
+    profiler->beginEpoch(100);
+    for (int i = 0; i < 10; ++i)
+    {
+        profiler->beginProcedure();
+        countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION); // global profiler has no active procedure -> ignored
+        profiler->procedureOps.ops[CONTRACT_EXEC_PROFILE_OP_COLLECTION] += 3;
+        profiler->procedureOps.ops[CONTRACT_EXEC_PROFILE_OP_SPECTRUM] += 1;
+        profiler->procedureOps.maxLocalsStackBytes = 1000 + i;
+        profiler->endProcedure(100, 1, CONTRACT_EXEC_PROFILE_KIND_USER_PROCEDURE, 6, 5000 + i, 200);
+        EXPECT_EQ(profiler->activeOps, nullptr);
+    }
+    profiler->endProcedure(100, 1, CONTRACT_EXEC_PROFILE_KIND_SYSTEM_PROCEDURE, 3, 42, 0);
+    for (int i = 0; i < 5; ++i)
+    {
+        profiler->recordFunction(100, 1, 6, 100 * i, 64 * i);
+    }
+
+    EXPECT_EQ(profiler->getStats(100, *response), 3);
+    EXPECT_EQ(response->epoch, 100);
+
+    const ContractExecProfileEntry* procedure = findEntry(*response, 1, CONTRACT_EXEC_PROFILE_KIND_USER_PROCEDURE, 6);
+    ASSERT_NE(procedure, nullptr);
+    EXPECT_EQ(procedure->count, 10);
+    EXPECT_EQ(procedure->totalCycles, 10 * 5000 + 45);
+    EXPECT_EQ(procedure->max, 5009);
+    EXPECT_LE(procedure->p50, procedure->p99);
+    EXPECT_LE(procedure->p99, procedure->max);
+    EXPECT_EQ(procedure->maxLocalsStackBytes, 1009);
+    EXPECT_EQ(procedure->ops[CONTRACT_EXEC_PROFILE_OP_COLLECTION], 30);
+    EXPECT_EQ(procedure->ops[CONTRACT_EXEC_PROFILE_OP_SPECTRUM], 10);
+    EXPECT_EQ(procedure->ops[CONTRACT_EXEC_PROFILE_OP_HASH_MAP], 0);
+
+    const ContractExecProfileEntry* systemProcedure = findEntry(*response, 1, CONTRACT_EXEC_PROFILE_KIND_SYSTEM_PROCEDURE, 3);
+    ASSERT_NE(systemProcedure, nullptr);
+    EXPECT_EQ(systemProcedure->count, 1);
+    EXPECT_EQ(systemProcedure->max, 42);
+
+    // Function with same inputType as procedure has own entry without op counts
+    const ContractExecProfileEntry* function = findEntry(*response, 1, CONTRACT_EXEC_PROFILE_KIND_USER_FUNCTION, 6);
+    ASSERT_NE(function, nullptr);
+    EXPECT_EQ(function->count, 5);
+    EXPECT_EQ(function->totalCycles, 1000);
+    EXPECT_EQ(function->maxLocalsStackBytes, 256);
+    EXPECT_EQ(function->ops[CONTRACT_EXEC_PROFILE_OP_COLLECTION], 0);
+
+    // Previous epoch stays available, epoch before is reset
+    profiler->beginEpoch(101);
+    profiler->recordFunction(101, 2, 1, 10, 0);
+    EXPECT_EQ(profiler->getStats(100, *response), 3);
+    EXPECT_EQ(profiler->getStats(101, *response), 1);
+    EXPECT_NE(findEntry(*response, 2, CONTRACT_EXEC_PROFILE_KIND_USER_FUNCTION, 1), nullptr);
+    profiler->beginEpoch(102);
+    EXPECT_EQ(profiler->getStats(100, *response), 0);
+    EXPECT_EQ(response->epoch, 0);
+    EXPECT_EQ(profiler->getStats(102, *response), 0);
+    EXPECT_EQ(response->epoch, 102);
+
+    profiler->deinit();
+}
+
+TEST(TestCoreContractExecProfiler, CountOpsOfActiveProcedure)
+{
+    ContractExecProfiler::OpCounters* activeOpsBefore = contractExecProfiler.activeOps;
+    ContractExecProfiler::OpCounters ops;
+    setMem(&ops, sizeof(ops), 0);
+
+    contractExecProfiler.activeOps = &ops;
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_UNIVERSE);
+    trackContractExecLocalsStackBytes(300);
+    trackContractExecLocalsStackBytes(100);
+    contractExecProfiler.activeOps = nullptr;
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_HASH_MAP);
+    trackContractExecLocalsStackBytes(1000);
+    contractExecProfiler.activeOps = activeOpsBefore;
+
+    EXPECT_EQ(ops.ops[CONTRACT_EXEC_PROFILE_OP_HASH_MAP], 2);
+    EXPECT_EQ(ops.ops[CONTRACT_EXEC_PROFILE_OP_UNIVERSE], 1);
+    EXPECT_EQ(ops.ops[CONTRACT_EXEC_PROFILE_OP_COLLECTION], 0);
+    EXPECT_EQ(ops.maxLocalsStackBytes, 300);
+}
+
+TEST(TestCoreContractExecProfiler, CountOpsOnlyOnContractProcessor)
+{
+    ContractExecProfiler::OpCounters* activeOpsBefore = contractExecProfiler.activeOps;
+    ContractExecProfiler::OpCounters ops;
+    setMem(&ops, sizeof(ops), 0);
+    contractExecProfiler.activeOps = &ops;
+
+    // Stack of contract processor elsewhere -> caller is another processor, such as a request processor running a
+    // user function concurrently to the procedure
+    static char otherStack[1024];
+    contractExecProfiler.setContractProcessorStack(otherStack, otherStack + sizeof(otherStack));
+    EXPECT_FALSE(contractExecProfiler.isContractProcessor());
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_COLLECTION);
+    trackContractExecLocalsStackBytes(500);
+
+    // Stack of this thread -> counted
+    char stackVariable;
+    contractExecProfiler.setContractProcessorStack(&stackVariable - 1024 * 1024, &stackVariable + 1024);
+    EXPECT_TRUE(contractExecProfiler.isContractProcessor());
+    countContractExecOp(CONTRACT_EXEC_PROFILE_OP_SPECTRUM);
+    trackContractExecLocalsStackBytes(200);
+
+    contractExecProfiler.setContractProcessorStack(nullptr, nullptr);
+    contractExecProfiler.activeOps = activeOpsBefore;
+
+    EXPECT_EQ(ops.ops[CONTRACT_EXEC_PROFILE_OP_COLLECTION], 0);
+    EXPECT_EQ(ops.ops[CONTRACT_EXEC_PROFILE_OP_SPECTRUM], 1);
+    EXPECT_EQ(ops.maxLocalsStackBytes, 200);
+}
+
+TEST(TestCoreContractExecProfiler, FullTable)
+{
+    auto profiler = std::make_unique<ContractExecProfiler>();
+    EXPECT_TRUE(profiler->init());
+    auto response = std::make_unique<ContractExecProfileResponse>();
+    profiler->beginEpoch(7);
+
+    for (unsigned int i = 0; i < ContractExecProfiler::capacity + 10; ++i)
+    {
+        profiler->recordFunction(7, i / 100, i % 100, 1, 0);
+    }
+    EXPECT_EQ(profiler->getStats(7, *response), ContractExecProfiler::capacity);
+    EXPECT_EQ(profiler->epochs[1].droppedCalls, 10);
+
+    // Existing entries can still be updated
+    profiler->recordFunction(7, 0, 0, 1, 0);
+    profiler->getStats(7, *response);
+    const ContractExecProfileEntry* entry = findEntry(*response, 0, CONTRACT_EXEC_PROFILE_KIND_USER_FUNCTION, 0);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->count, 2);
+
+    profiler->deinit();
+}
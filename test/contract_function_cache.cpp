@@ -0,0 +1,147 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/contract_core/contract_function_cache.h"
+
+#include <memory>
+#include <vector>
+
+
+typedef ContractFunctionCache<4> TestContractFunctionCache;
+
+TEST(TestCoreContractFunctionCache, FetchAndInvalidate)
+{
+    auto cache = std::make_unique<TestContractFunctionCache>();
+    cache->sets = nullptr;
+    cache->generation = 0;
+
+    unsigned char input[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    unsigned char output[16] = { 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25 };
+    std::vector<unsigned char> fetched(TestContractFunctionCache::maxOutputSize);
+    unsigned short fetchedSize = 0;
+    unsigned long long callGeneration = 1;
+
+    // Not initialized -> always miss and nothing is added
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(callGeneration, 0);
+    cache->add(callGeneration, 1, 2, input, sizeof(input), output, sizeof(output));
+
+    EXPECT_TRUE(cache->init());
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_NE(callGeneration, 0);
+    cache->add(callGeneration, 1, 2, input, sizeof(input), output, sizeof(output));
+
+    // Hit with same key
+    EXPECT_TRUE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(fetchedSize, sizeof(output));
+    EXPECT_EQ(memcmp(fetched.data(), output, sizeof(output)), 0);
+
+    // Miss with other contract, inputType, input size, or input data
+    EXPECT_FALSE(cache->tryFetching(2, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_FALSE(cache->tryFetching(1, 3, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input) - 1, fetched.data(), fetchedSize, callGeneration));
+    input[7] = 0;
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    input[7] = 8;
+
+    // Stats per contract
+    EXPECT_EQ(cache->stats[1].lookups, 5);
+    EXPECT_EQ(cache->stats[1].hits, 1);
+    EXPECT_EQ(cache->stats[2].lookups, 1);
+    EXPECT_EQ(cache->stats[2].hits, 0);
+
+    // State change invalidates entries and disables cache until it is finished
+    cache->beginStateChange();
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(callGeneration, 0);
+    cache->endStateChange();
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(cache->stats[1].lookups, 6);
+
+    // Result of call that overlapped with state change isn't added
+    cache->beginStateChange();
+    cache->add(callGeneration, 1, 2, input, sizeof(input), output, sizeof(output));
+    cache->endStateChange();
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    cache->add(callGeneration, 1, 2, input, sizeof(input), output, 0);
+    EXPECT_TRUE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(fetchedSize, 0);
+
+    // Invalidation by other processor drops entries and results of overlapping calls, but keeps the cache enabled
+    const unsigned long long generationBeforeInvalidate = cache->generation;
+    cache->invalidate();
+    EXPECT_EQ(cache->generation & 1, 0);
+    EXPECT_NE(cache->generation, generationBeforeInvalidate);
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_NE(callGeneration, 0);
+    cache->invalidate();
+    cache->add(callGeneration, 1, 2, input, sizeof(input), output, sizeof(output));
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+
+    // Invalidation while tick processor changes the state keeps cache disabled until endStateChange()
+    cache->beginStateChange();
+    cache->invalidate();
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(callGeneration, 0);
+    cache->endStateChange();
+    EXPECT_FALSE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    cache->add(callGeneration, 1, 2, input, sizeof(input), output, sizeof(output));
+    EXPECT_TRUE(cache->tryFetching(1, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+
+    // Too large input or output bypasses cache
+    std::vector<unsigned char> largeInput(TestContractFunctionCache::maxInputSize + 1, 1);
+    EXPECT_FALSE(cache->tryFetching(1, 2, largeInput.data(), (unsigned short)largeInput.size(), fetched.data(), fetchedSize, callGeneration));
+    EXPECT_EQ(callGeneration, 0);
+    std::vector<unsigned char> largeOutput(TestContractFunctionCache::maxOutputSize + 1, 1);
+    EXPECT_FALSE(cache->tryFetching(3, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+    cache->add(callGeneration, 3, 2, input, sizeof(input), largeOutput.data(), (unsigned short)largeOutput.size());
+    EXPECT_FALSE(cache->tryFetching(3, 2, input, sizeof(input), fetched.data(), fetchedSize, callGeneration));
+
+    cache->deinit();
+}
+
+TEST(TestCoreContractFunctionCache, ReplaceInFullSet)
+{
+    auto cache = std::make_unique<TestContractFunctionCache>();
+    cache->sets = nullptr;
+    EXPECT_TRUE(cache->init());
+
+    // Add more entries than fit into the cache
+    constexpr unsigned int count = TestContractFunctionCache::numberOfSets * TestContractFunctionCache::numberOfWays * 2;
+    unsigned short fetchedSize = 0;
+    unsigned long long callGeneration;
+    unsigned int fetched = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        EXPECT_FALSE(cache->tryFetching(0, 1, &i, sizeof(i), &fetched, fetchedSize, callGeneration));
+        cache->add(callGeneration, 0, 1, &i, sizeof(i), &i, sizeof(i));
+        cache->add(callGeneration, 0, 1, &i, sizeof(i), &i, sizeof(i)); // adding twice doesn't duplicate entry
+    }
+
+    // Latest entries are available and have correct output
+    unsigned int hits = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (cache->tryFetching(0, 1, &i, sizeof(i), &fetched, fetchedSize, callGeneration))
+        {
+            EXPECT_EQ(fetchedSize, sizeof(i));
+            EXPECT_EQ(fetched, i);
+            ++hits;
+        }
+    }
+    EXPECT_GT(hits, count / 4);
+    EXPECT_LE(hits, count / 2);
+
+    // Check that no set contains duplicates
+    for (unsigned int s = 0; s < TestContractFunctionCache::numberOfSets; ++s)
+    {
+        const TestContractFunctionCache::Set& set = cache->sets[s];
+        for (unsigned int i = 0; i < TestContractFunctionCache::numberOfWays; ++i)
+            for (unsigned int j = i + 1; j < TestContractFunctionCache::numberOfWays; ++j)
+                if (set.entries[i].generation && set.entries[j].generation)
+                    EXPECT_NE(*(unsigned int*)set.entries[i].input, *(unsigned int*)set.entries[j].input);
+    }
+
+    cache->deinit();
+}
@@ -0,0 +1,87 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/contract_core/contract_locals_stack_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+TEST(TestCoreContractLocalsStackPool, AffinityReservationAndGrowth)
+{
+    auto pool = std::make_unique<ContractLocalsStackPool<6, 4>>();
+    pool->init(3);
+    EXPECT_EQ(pool->activeStacks, 3);
+
+    // Slot reuses its last stack if it is free
+    int a = pool->acquire(0, 1);
+    EXPECT_TRUE(pool->isAcquired(a));
+    pool->release(a);
+    EXPECT_FALSE(pool->isAcquired(a));
+    int b = pool->acquire(0, 2);
+    pool->release(b);
+    EXPECT_EQ(pool->acquire(0, 1), a);
+    int c = pool->acquire(0, 3);
+    EXPECT_NE(c, a);
+
+    // Low priority acquisition keeps last free stack reserved and activates reserved stack instead
+    EXPECT_EQ(pool->activeStacks, 3);
+    int d = pool->tryAcquire(1, 2);
+    EXPECT_EQ(d, 3);
+    EXPECT_EQ(pool->activeStacks, 4);
+    EXPECT_EQ(__popcnt64(pool->freeStackFlags), 1);
+
+    // High priority acquisition takes last free stack, then activates remaining reserved stacks
+    int e = pool->tryAcquire(0, 0);
+    EXPECT_GE(e, 0);
+    EXPECT_LT(e, 3);
+    EXPECT_EQ(pool->freeStackFlags, 0);
+    EXPECT_EQ(pool->tryAcquire(0, 0), 4);
+    EXPECT_EQ(pool->tryAcquire(1, 0), 5);
+    EXPECT_EQ(pool->tryAcquire(0, 0), -1);
+    EXPECT_EQ(pool->activeStacks, 6);
+    for (int i = 0; i < 6; ++i)
+        EXPECT_TRUE(pool->isAcquired(i));
+
+    for (int i = 0; i < 6; ++i)
+        pool->release(i);
+    EXPECT_EQ(pool->freeStackFlags, 63);
+    EXPECT_EQ(pool->acquireCycles[0].count, 4);
+    EXPECT_EQ(pool->acquireCycles[1].count, 0);
+}
+
+TEST(TestCoreContractLocalsStackPool, ConcurrentAcquire)
+{
+    constexpr unsigned int numberOfStacks = 4;
+    constexpr unsigned int numberOfThreads = 8;
+    constexpr unsigned int iterations = 20000;
+    auto pool = std::make_unique<ContractLocalsStackPool<numberOfStacks, numberOfThreads>>();
+    pool->init(2);
+    std::atomic<int> users[numberOfStacks] = {};
+    std::atomic<bool> failed(false);
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numberOfThreads; ++t)
+    {
+        threads.emplace_back([&, t]()
+            {
+                for (unsigned int i = 0; i < iterations; ++i)
+                {
+                    const int stackIndex = pool->acquire(t & 1, t);
+                    if (stackIndex < 0 || stackIndex >= (int)numberOfStacks || users[stackIndex].fetch_add(1) != 0)
+                        failed = true;
+                    users[stackIndex].fetch_sub(1);
+                    pool->release(stackIndex);
+                }
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_FALSE(failed);
+    EXPECT_EQ(pool->freeStackFlags, (1LL << pool->activeStacks) - 1);
+    EXPECT_EQ(pool->acquireCycles[0].count + pool->acquireCycles[1].count, numberOfThreads * iterations);
+}
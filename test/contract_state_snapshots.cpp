@@ -0,0 +1,95 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/contract_core/contract_state_snapshots.h"
+
+#include <memory>
+#include <vector>
+
+
+TEST(TestCoreContractStateSnapshots, PublishAndRead)
+{
+    auto snapshots = std::make_unique<ContractStateSnapshots<3>>();
+    snapshots->reset();
+
+    // Size not multiple of page size to test partial last page
+    const unsigned long long size = 3 * ContractStateSnapshots<3>::pageSize + 13;
+    std::vector<unsigned char> state(size, 0);
+    EXPECT_TRUE(snapshots->registerContract(1, state.data(), size));
+    EXPECT_TRUE(snapshots->registerContract(2, nullptr, 0));
+
+    // No snapshot before first update -> readers use lock
+    int buffer = -1;
+    EXPECT_EQ(snapshots->acquire(0, buffer), nullptr);
+    EXPECT_EQ(snapshots->acquire(1, buffer), nullptr);
+    EXPECT_EQ(snapshots->acquire(2, buffer), nullptr);
+
+    state[5] = 1;
+    state[size - 1] = 2;
+    snapshots->update(10);
+    EXPECT_EQ(snapshots->acquire(2, buffer), nullptr);
+    const unsigned char* snapshot = snapshots->acquire(1, buffer);
+    ASSERT_NE(snapshot, nullptr);
+    EXPECT_EQ(snapshots->getTick(1, buffer), 10);
+    EXPECT_EQ(memcmp(snapshot, state.data(), size), 0);
+    const int firstBuffer = buffer;
+
+    // Changes of live state are invisible until update
+    state[5] = 3;
+    state[2 * ContractStateSnapshots<3>::pageSize] = 4;
+    EXPECT_EQ(snapshot[5], 1);
+    snapshots->markChanged(1);
+    snapshots->update(11);
+    EXPECT_EQ(snapshot[5], 1); // pinned old snapshot isn't changed
+
+    int newBuffer = -1;
+    const unsigned char* newSnapshot = snapshots->acquire(1, newBuffer);
+    ASSERT_NE(newSnapshot, nullptr);
+    EXPECT_NE(newBuffer, firstBuffer);
+    EXPECT_EQ(snapshots->getTick(1, newBuffer), 11);
+    EXPECT_EQ(memcmp(newSnapshot, state.data(), size), 0);
+    snapshots->release(1, newBuffer);
+
+    // Update is deferred while old buffer is pinned by reader
+    state[7] = 5;
+    snapshots->markChanged(1);
+    snapshots->update(12);
+    newSnapshot = snapshots->acquire(1, newBuffer);
+    EXPECT_EQ(snapshots->getTick(1, newBuffer), 11);
+    EXPECT_EQ(newSnapshot[7], 0);
+    snapshots->release(1, newBuffer);
+
+    // After the reader has finished, the pending update is done without marking again
+    snapshots->release(1, buffer);
+    snapshots->update(13);
+    newSnapshot = snapshots->acquire(1, newBuffer);
+    EXPECT_EQ(newBuffer, firstBuffer);
+    EXPECT_EQ(snapshots->getTick(1, newBuffer), 13);
+    EXPECT_EQ(memcmp(newSnapshot, state.data(), size), 0);
+    snapshots->release(1, newBuffer);
+
+    // Nothing changed -> no update
+    snapshots->update(14);
+    newSnapshot = snapshots->acquire(1, newBuffer);
+    EXPECT_EQ(snapshots->getTick(1, newBuffer), 13);
+    snapshots->release(1, newBuffer);
+
+    snapshots->deinit();
+    EXPECT_EQ(snapshots->acquire(1, buffer), nullptr);
+}
+
+TEST(TestCoreContractStateSnapshots, CopyChangedPages)
+{
+    const unsigned long long size = 5 * ContractStateSnapshots<1>::pageSize + 100;
+    std::vector<unsigned char> state(size), buffer(size, 0);
+    for (unsigned long long i = 0; i < size; ++i)
+        state[i] = (unsigned char)(i * 7);
+    ContractStateSnapshots<1>::copyChangedPages(buffer.data(), state.data(), size);
+    EXPECT_EQ(state, buffer);
+
+    state[size - 1]++;
+    state[ContractStateSnapshots<1>::pageSize + 1]++;
+    ContractStateSnapshots<1>::copyChangedPages(buffer.data(), state.data(), size);
+    EXPECT_EQ(state, buffer);
+}
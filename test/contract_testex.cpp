@@ -726,3 +726,27 @@ TEST(ContractTestEx, QueryBasicQpiFunctions)
     EXPECT_EQ(qpiReturned2.inputDataK12, digest2);
     EXPECT_FALSE(qpiReturned2.inputSignatureValid);
 }
+
+TEST(ContractTestEx, SystemProcedureLists)
+{
+    ContractTestingTestEx test;
+    EXPECT_EQ(contractSystemProcedureListsEpoch, 0xffffffff);
+
+    // QX implements END_TICK, TESTEXA implements BEGIN_TICK and END_TICK, TESTEXB implements neither
+    buildContractSystemProcedureLists(138);
+    EXPECT_EQ(contractSystemProcedureListsEpoch, 138);
+    EXPECT_EQ(contractSystemProcedureListSizes[BEGIN_TICK], 1);
+    EXPECT_EQ(contractSystemProcedureLists[BEGIN_TICK][0], TESTEXA_CONTRACT_INDEX);
+    EXPECT_EQ(contractSystemProcedureListSizes[END_TICK], 2);
+    EXPECT_EQ(contractSystemProcedureLists[END_TICK][0], QX_CONTRACT_INDEX);
+    EXPECT_EQ(contractSystemProcedureLists[END_TICK][1], TESTEXA_CONTRACT_INDEX);
+
+    // contracts that are not constructed yet or destructed already are skipped
+    buildContractSystemProcedureLists(100);
+    EXPECT_EQ(contractSystemProcedureListSizes[BEGIN_TICK], 0);
+    EXPECT_EQ(contractSystemProcedureListSizes[END_TICK], 1);
+    EXPECT_EQ(contractSystemProcedureLists[END_TICK][0], QX_CONTRACT_INDEX);
+    buildContractSystemProcedureLists(10000);
+    EXPECT_EQ(contractSystemProcedureListSizes[BEGIN_TICK], 0);
+    EXPECT_EQ(contractSystemProcedureListSizes[END_TICK], 0);
+}
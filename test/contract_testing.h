@@ -59,6 +59,7 @@ public:
         initSpectrum();
         memset(spectrum, 0, spectrumSizeInBytes);
         updateSpectrumInfo();
+        updateSpectrumFingerprints();
     }
 
     void initEmptyUniverse()
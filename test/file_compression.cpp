@@ -0,0 +1,158 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/platform/file_compression.h"
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+static void fillTestData(std::vector<unsigned char>& data, unsigned int seed)
+{
+    // mix of zero runs, repeated records, and random bytes
+    std::mt19937_64 gen64(seed);
+    unsigned long long pos = 0;
+    while (pos < data.size())
+    {
+        const unsigned long long length = std::min<unsigned long long>(1 + gen64() % 5000, data.size() - pos);
+        switch (gen64() % 4)
+        {
+        case 0:
+            memset(data.data() + pos, 0, length);
+            break;
+        case 1:
+            for (unsigned long long i = 0; i < length; ++i)
+                data[pos + i] = (unsigned char)gen64();
+            break;
+        default:
+        {
+            const unsigned char pattern[3] = { (unsigned char)gen64(), 0, (unsigned char)gen64() };
+            for (unsigned long long i = 0; i < length; ++i)
+                data[pos + i] = pattern[i % 3];
+            break;
+        }
+        }
+        pos += length;
+    }
+}
+
+TEST(TestCoreFileCompression, BlockRoundTrip)
+{
+    std::vector<unsigned char> compressed(compressedFileBlockSize);
+    std::vector<unsigned char> decompressed(compressedFileBlockSize);
+    std::vector<unsigned int> hashTable(1 << compressionHashBits);
+
+    for (unsigned int seed = 0; seed < 20; ++seed)
+    {
+        std::mt19937 gen32(seed);
+        const unsigned int size = (seed < 10) ? 1 + gen32() % 100 : 1 + gen32() % compressedFileBlockSize;
+        std::vector<unsigned char> data(size);
+        fillTestData(data, seed);
+
+        const unsigned int compressedSize = compressBlock(data.data(), size, compressed.data(), compressedFileBlockSize, hashTable.data());
+        ASSERT_GT(compressedSize, 0u);
+        EXPECT_TRUE(decompressBlock(compressed.data(), compressedSize, decompressed.data(), size));
+        EXPECT_EQ(memcmp(data.data(), decompressed.data(), size), 0);
+
+        // truncated or too small output is detected
+        EXPECT_FALSE(decompressBlock(compressed.data(), compressedSize - 1, decompressed.data(), size));
+        EXPECT_FALSE(decompressBlock(compressed.data(), compressedSize, decompressed.data(), size - 1));
+    }
+
+    // random data does not fit into smaller buffer
+    std::vector<unsigned char> data(compressedFileBlockSize);
+    std::mt19937_64 gen64(42);
+    for (auto& byte : data)
+        byte = (unsigned char)gen64();
+    EXPECT_EQ(compressBlock(data.data(), compressedFileBlockSize, compressed.data(), compressedFileBlockSize - 1, hashTable.data()), 0u);
+
+    // zero runs compress well
+    memset(data.data(), 0, data.size());
+    data[12345] = 1;
+    const unsigned int compressedSize = compressBlock(data.data(), compressedFileBlockSize, compressed.data(), compressedFileBlockSize, hashTable.data());
+    EXPECT_LT(compressedSize, 32u);
+    EXPECT_TRUE(decompressBlock(compressed.data(), compressedSize, decompressed.data(), compressedFileBlockSize));
+    EXPECT_EQ(memcmp(data.data(), decompressed.data(), compressedFileBlockSize), 0);
+}
+
+TEST(TestCoreFileCompression, SaveAndLoad)
+{
+    CHAR16 fileName[32];
+    setText(fileName, L"compressionTest.tmp");
+    const char* narrowFileName = "compressionTest.tmp";
+
+    // help with parallel jobs like the request processors
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> helpers;
+    for (int i = 0; i < 3; ++i)
+    {
+        helpers.emplace_back([&stop]()
+            {
+                while (!stop)
+                    tryHelpWithParallelJob();
+            });
+    }
+
+    // more than one batch, last block incomplete, including zero and incompressible blocks
+    const unsigned long long size = (compressedFileBatchBlocks + 3ULL) * compressedFileBlockSize + 12345;
+    std::vector<unsigned char> data(size);
+    fillTestData(data, 7);
+    memset(data.data() + 5ULL * compressedFileBlockSize, 0, 3ULL * compressedFileBlockSize);
+    std::mt19937_64 gen64(123);
+    for (unsigned long long i = 0; i < compressedFileBlockSize; ++i)
+        data[10ULL * compressedFileBlockSize + i] = (unsigned char)gen64();
+
+    unsigned long long storedSize = 0;
+    EXPECT_EQ(saveCompressed(fileName, size, data.data(), nullptr, &storedSize, 7), (long long)size);
+    EXPECT_LT(storedSize, size);
+    EXPECT_GT(storedSize, compressedFileBlockSize);
+
+    std::vector<unsigned char> loaded(size, 0xff);
+    unsigned long long loadedStoredSize = 0;
+    unsigned int contentVersion = 0;
+    EXPECT_EQ(loadCompressed(fileName, size, loaded.data(), nullptr, &loadedStoredSize, &contentVersion), (long long)size);
+    EXPECT_EQ(loadedStoredSize, storedSize);
+    EXPECT_EQ(contentVersion, 7);
+    EXPECT_TRUE(data == loaded);
+
+    // wrong size is rejected
+    EXPECT_EQ(loadCompressed(fileName, size - 1, loaded.data()), -1);
+
+    // invalid block header and truncated file are rejected
+    FILE* file = fopen(narrowFileName, "r+b");
+    ASSERT_TRUE(file != nullptr);
+    fseek(file, sizeof(CompressedFileHeader) + 3, SEEK_SET);
+    fputc(0xff, file);
+    fclose(file);
+    EXPECT_EQ(loadCompressed(fileName, size, loaded.data()), -1);
+    EXPECT_EQ(saveCompressed(fileName, size, data.data()), (long long)size);
+    std::vector<unsigned char> fileData(storedSize - 1);
+    EXPECT_EQ(load(fileName, fileData.size(), fileData.data()), (long long)fileData.size());
+    EXPECT_EQ(save(fileName, fileData.size(), fileData.data()), (long long)fileData.size());
+    EXPECT_EQ(loadCompressed(fileName, size, loaded.data()), -1);
+
+    // uncompressed files (legacy format and small files) are loaded
+    EXPECT_EQ(save(fileName, size, data.data()), (long long)size);
+    memset(loaded.data(), 0, size);
+    EXPECT_EQ(loadCompressed(fileName, size, loaded.data(), nullptr, &loadedStoredSize, &contentVersion), (long long)size);
+    EXPECT_EQ(loadedStoredSize, size);
+    EXPECT_EQ(contentVersion, 0);
+    EXPECT_TRUE(data == loaded);
+    for (unsigned long long smallSize : { 1ULL, 24ULL, compressedFileMinSize - 1 })
+    {
+        EXPECT_EQ(saveCompressed(fileName, smallSize, data.data(), nullptr, &storedSize), (long long)smallSize);
+        EXPECT_EQ(storedSize, smallSize);
+        memset(loaded.data(), 0, smallSize);
+        EXPECT_EQ(loadCompressed(fileName, smallSize, loaded.data()), (long long)smallSize);
+        EXPECT_EQ(memcmp(data.data(), loaded.data(), smallSize), 0);
+    }
+
+    stop = true;
+    for (auto& helper : helpers)
+        helper.join();
+    remove(narrowFileName);
+}
@@ -8,6 +8,9 @@
 #include <mutex>
 #include <fstream>
 #include <chrono>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "../src/platform/file_io.h"
 
@@ -616,3 +619,92 @@ TEST(TestAsyncFileIO, AsyncLoadLargeFile)
     }
     EXPECT_EQ(testPass, THREAD_COUNT);
 }
+
+TEST(TestAsyncFileIO, ParallelWorkersCoalescingAndErrors)
+{
+    static constexpr int fileCount = 32;
+    static constexpr unsigned long long fileSize = 256 * 1024;
+    std::vector<std::vector<unsigned char>> data(fileCount, std::vector<unsigned char>(fileSize));
+    for (int i = 0; i < fileCount; i++)
+        for (unsigned long long j = 0; j < fileSize; j++)
+            data[i][j] = (unsigned char)(random(256) + i);
+
+    AsyncFileIOStats statsBefore, statsAfter;
+    gAsyncFileIO->getStats(statsBefore);
+
+    // Several I/O workers process the queues concurrently
+    std::atomic<bool> stopWorkers = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 3; i++)
+    {
+        workers.emplace_back([&stopWorkers]()
+            {
+                while (!stopWorkers)
+                    flushAsyncFileIOBuffer();
+            });
+    }
+    std::vector<std::thread> writers;
+    std::atomic<int> failures = 0;
+    for (int t = 0; t < 4; t++)
+    {
+        writers.emplace_back([t, &data, &failures]()
+            {
+                for (int i = t; i < fileCount; i += 4)
+                {
+                    CHAR16 fileName[32];
+                    setText(fileName, L"tmp_parallel_");
+                    appendNumber(fileName, i, false);
+                    if (asyncSave(fileName, fileSize, data[i].data(), NULL, true) != fileSize)
+                        failures++;
+                }
+            });
+    }
+    for (auto& writer : writers)
+        writer.join();
+    stopWorkers = true;
+    for (auto& worker : workers)
+        worker.join();
+    EXPECT_EQ(failures, 0);
+
+    std::vector<unsigned char> loaded(fileSize);
+    for (int i = 0; i < fileCount; i++)
+    {
+        CHAR16 fileName[32];
+        setText(fileName, L"tmp_parallel_");
+        appendNumber(fileName, i, false);
+        EXPECT_EQ(loadFile(fileName, fileSize, (char*)loaded.data()), fileSize);
+        EXPECT_TRUE(loaded == data[i]);
+        EXPECT_EQ(remove(("tmp_parallel_" + std::to_string(i)).c_str()), 0);
+    }
+
+    // Queued writes of the same file are coalesced, both requests succeed and the newest data is written
+    CHAR16 fileName[32];
+    setText(fileName, L"tmp_coalesced");
+    FileItem* olderItem = gAsyncFileIO->beginBlockingSave(fileName, fileSize, data[0].data());
+    FileItem* newerItem = gAsyncFileIO->beginBlockingSave(fileName, fileSize, data[1].data());
+    ASSERT_TRUE(olderItem != nullptr);
+    ASSERT_TRUE(newerItem != nullptr);
+    flushAsyncFileIOBuffer();
+    EXPECT_EQ(gAsyncFileIO->waitFor(olderItem), fileSize);
+    EXPECT_EQ(gAsyncFileIO->waitFor(newerItem), fileSize);
+    EXPECT_EQ(loadFile(fileName, fileSize, (char*)loaded.data()), fileSize);
+    EXPECT_TRUE(loaded == data[1]);
+    remove("tmp_coalesced");
+
+    // Errors are reported to the caller
+    setText(fileName, L"tmp_missing_dir/file");
+    FileItem* saveItem = gAsyncFileIO->beginBlockingSave(fileName, fileSize, data[0].data());
+    setText(fileName, L"tmp_missing_file");
+    FileItem* loadItem = gAsyncFileIO->beginLoad(fileName, fileSize, loaded.data());
+    ASSERT_TRUE(saveItem != nullptr);
+    ASSERT_TRUE(loadItem != nullptr);
+    flushAsyncFileIOBuffer();
+    EXPECT_EQ(gAsyncFileIO->waitFor(saveItem), -1);
+    EXPECT_EQ(gAsyncFileIO->waitFor(loadItem), -1);
+
+    gAsyncFileIO->getStats(statsAfter);
+    EXPECT_EQ(statsAfter.filesWritten - statsBefore.filesWritten, fileCount + 1);
+    EXPECT_EQ(statsAfter.bytesWritten - statsBefore.bytesWritten, (fileCount + 1) * fileSize);
+    EXPECT_EQ(statsAfter.coalescedWrites - statsBefore.coalescedWrites, 1);
+    EXPECT_EQ(statsAfter.failedOperations - statsBefore.failedOperations, 2);
+}
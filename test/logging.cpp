@@ -0,0 +1,436 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+// test log archive with small logging buffer
+#include "../src/private_settings.h"
+#undef LOG_ARCHIVE
+#define LOG_ARCHIVE 1
+#define LOG_ARCHIVE_DIRECTORY NULL
+#define LOG_BUFFER_SIZE (64 * 1024 * 1024ULL)
+
+// test entity log index with small capacity
+#undef LOG_QU_TRANSFERS
+#undef LOG_ASSET_OWNERSHIP_CHANGES
+#undef LOG_ASSET_POSSESSION_CHANGES
+#undef LOG_ENTITY_INDEX
+#define LOG_QU_TRANSFERS 1
+#define LOG_ASSET_OWNERSHIP_CHANGES 1
+#define LOG_ASSET_POSSESSION_CHANGES 1
+#define LOG_ENTITY_INDEX 1
+#define LOG_ENTITY_INDEX_CAPACITY 256
+#define LOG_ENTITY_INDEX_CHUNKS 128
+
+#include "logging_test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+struct TestLogInfo
+{
+    unsigned long long virtualStart; // start index + number of passes through round buffer * LOG_BUFFER_SIZE
+    unsigned int messageSize;
+};
+
+static void fillTestMessage(std::vector<unsigned char>& message, unsigned long long logId, unsigned int messageSize)
+{
+    message.resize(messageSize);
+    for (unsigned int i = 0; i < messageSize; ++i)
+        message[i] = (unsigned char)(logId * 31 + i);
+}
+
+static void checkLogs(const std::vector<TestLogInfo>& logs, unsigned long long virtualTail)
+{
+    std::vector<unsigned char> expectedMessage;
+    for (unsigned long long logId = 0; logId < logs.size(); ++logId)
+    {
+        const TestLogInfo& info = logs[logId];
+        const bool overwritten = virtualTail > info.virtualStart + LOG_BUFFER_SIZE;
+        const bool farFromOverwriting = virtualTail + LOG_BUFFER_SEGMENT_SIZE <= info.virtualStart + LOG_BUFFER_SIZE;
+        qLogger::BlobInfo blob = logger.logBuf.getBlobInfo(logId);
+        if (blob.startIndex < 0)
+        {
+            // log is only rejected if the segment containing its start is being overwritten
+            EXPECT_FALSE(farFromOverwriting);
+            EXPECT_EQ(logger.logBuf.getIndex(logId), -1);
+            continue;
+        }
+
+        // log is never accepted if overwritten
+        EXPECT_FALSE(overwritten);
+        EXPECT_EQ(blob.startIndex, info.virtualStart % LOG_BUFFER_SIZE);
+        EXPECT_EQ(blob.length, LOG_HEADER_SIZE + info.messageSize);
+        EXPECT_EQ(logger.logBuf.getIndex(logId), blob.startIndex);
+        const char* ptr = logger.logBuffer + blob.startIndex;
+        EXPECT_EQ(qLogger::getLogId(ptr), logId);
+        EXPECT_EQ(qLogger::getLogSize(ptr), info.messageSize);
+        EXPECT_TRUE(qLogger::verifyLogDigest(ptr));
+        fillTestMessage(expectedMessage, logId, info.messageSize);
+        EXPECT_EQ(memcmp(ptr + LOG_HEADER_SIZE, expectedMessage.data(), info.messageSize), 0);
+    }
+}
+
+TEST(TestCoreLogging, OverwritingInRoundBuffer)
+{
+    LoggingTest test;
+    std::mt19937_64 gen64(42);
+    std::vector<TestLogInfo> logs;
+    std::vector<unsigned char> message;
+    unsigned long long passOffset = 0;
+
+    // not logged yet
+    EXPECT_EQ(logger.logBuf.getBlobInfo(0).startIndex, -1);
+    EXPECT_EQ(logger.logBuf.getIndex(0), -1);
+
+    // write more than 3 times through the round buffer
+    while (passOffset < 3 * LOG_BUFFER_SIZE)
+    {
+        const unsigned long long logId = logger.logId;
+        const unsigned int messageSize = 1 + gen64() % 200000;
+        fillTestMessage(message, logId, messageSize);
+        const unsigned long long oldTail = logger.logBufferTail;
+        qLogger::logMessage(messageSize, CUSTOM_MESSAGE, message.data());
+        if (logger.logBufferTail < oldTail)
+            passOffset += LOG_BUFFER_SIZE;
+
+        // new log is always valid
+        qLogger::BlobInfo blob = logger.logBuf.getBlobInfo(logId);
+        ASSERT_EQ(blob.length, LOG_HEADER_SIZE + messageSize);
+        ASSERT_EQ(blob.startIndex + blob.length, logger.logBufferTail);
+        logs.push_back({ passOffset + blob.startIndex, messageSize });
+
+        // logs that will be written in the future are invalid
+        EXPECT_EQ(logger.logBuf.getBlobInfo(logId + 1).startIndex, -1);
+
+        if (logs.size() % 3000 == 0)
+            checkLogs(logs, passOffset + logger.logBufferTail);
+    }
+    checkLogs(logs, passOffset + logger.logBufferTail);
+
+    // reset invalidates all logs
+    qLogger::reset(0, 0);
+    EXPECT_EQ(logger.logBuf.getBlobInfo(0).startIndex, -1);
+    EXPECT_EQ(logger.logBuf.getBlobInfo(logs.size() - 1).startIndex, -1);
+}
+
+TEST(TestCoreLogging, ArchiveOverwrittenLogs)
+{
+    initFilesystem();
+    registerAsynFileIO(NULL);
+    std::atomic<bool> stopFileIO = false;
+    std::thread fileIOThread([&stopFileIO]()
+        {
+            while (!stopFileIO)
+                flushAsyncFileIOBuffer();
+        });
+
+    LoggingTest test;
+    system.epoch = 123;
+    qLogger::reset(0, 0);
+    std::mt19937_64 gen64(123);
+    std::vector<unsigned int> messageSizes;
+    std::vector<unsigned char> message;
+
+    // write more than 2 times through the round buffer, saving segments before they are overwritten
+    unsigned long long bytesLogged = 0;
+    while (bytesLogged < 5 * LOG_BUFFER_SIZE / 2)
+    {
+        const unsigned int messageSize = 1 + gen64() % 100000;
+        fillTestMessage(message, logger.logId, messageSize);
+        qLogger::logMessage(messageSize, CUSTOM_MESSAGE, message.data());
+        messageSizes.push_back(messageSize);
+        bytesLogged += LOG_HEADER_SIZE + messageSize;
+    }
+    EXPECT_EQ(logger.logBuf.getIndex(0), -1);
+    qLogger::archive.flush();
+    const unsigned int numberOfSegments = logger.numberOfArchiveSegments;
+    EXPECT_GT(numberOfSegments, 2 * LOG_BUFFER_SIZE / LOG_ARCHIVE_SEGMENT_SIZE);
+
+    // all logs can be read from archive in chunks of maximum size
+    constexpr long long maxSize = 1024 * 1024;
+    std::vector<unsigned char> expectedMessage;
+    for (unsigned long long fromId = 0; fromId < messageSizes.size(); )
+    {
+        unsigned long long toId = messageSizes.size() + 10;
+        long long size = -1;
+        unsigned int readBufferIndex;
+        const char* logs = qLogger::archive.lockLogs(fromId, toId, maxSize, size, readBufferIndex);
+        ASSERT_TRUE(logs != nullptr);
+        EXPECT_GE(toId, fromId);
+        EXPECT_LE(size, maxSize);
+        long long offset = 0;
+        for (unsigned long long logId = fromId; logId <= toId; ++logId)
+        {
+            const char* ptr = logs + offset;
+            EXPECT_EQ(qLogger::getLogId(ptr), logId);
+            EXPECT_EQ(qLogger::getLogSize(ptr), messageSizes[logId]);
+            EXPECT_TRUE(qLogger::verifyLogDigest(ptr));
+            fillTestMessage(expectedMessage, logId, messageSizes[logId]);
+            EXPECT_EQ(memcmp(ptr + LOG_HEADER_SIZE, expectedMessage.data(), messageSizes[logId]), 0);
+            offset += LOG_HEADER_SIZE + messageSizes[logId];
+        }
+        EXPECT_EQ(offset, size);
+        qLogger::archive.unlockLogs(readBufferIndex);
+        fromId = toId + 1;
+    }
+
+    // logs not written yet and invalid ranges
+    unsigned long long toId = messageSizes.size() + 10;
+    long long size;
+    unsigned int readBufferIndex;
+    EXPECT_TRUE(qLogger::archive.lockLogs(messageSizes.size(), toId, maxSize, size, readBufferIndex) == nullptr);
+    toId = 4;
+    EXPECT_TRUE(qLogger::archive.lockLogs(5, toId, maxSize, size, readBufferIndex) == nullptr);
+
+    // buffers in use are neither replaced nor shared with other segments
+    static_assert(qLogger::numberOfArchiveReadBuffers == 2);
+    unsigned int readBufferIndices[3];
+    const char* segmentLogs[3];
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        toId = logger.archiveSegments[i].firstLogId;
+        segmentLogs[i] = qLogger::archive.lockLogs(logger.archiveSegments[i].firstLogId, toId, maxSize, size, readBufferIndices[i]);
+    }
+    ASSERT_TRUE(segmentLogs[0] != nullptr && segmentLogs[1] != nullptr);
+    EXPECT_NE(readBufferIndices[0], readBufferIndices[1]);
+    EXPECT_TRUE(segmentLogs[2] == nullptr);
+    toId = logger.archiveSegments[0].firstLogId;
+    EXPECT_EQ(qLogger::archive.lockLogs(logger.archiveSegments[0].firstLogId, toId, maxSize, size, readBufferIndex), segmentLogs[0]);
+    EXPECT_EQ(readBufferIndex, readBufferIndices[0]);
+    qLogger::archive.unlockLogs(readBufferIndex);
+    qLogger::archive.unlockLogs(readBufferIndices[0]);
+    toId = logger.archiveSegments[2].firstLogId;
+    segmentLogs[2] = qLogger::archive.lockLogs(logger.archiveSegments[2].firstLogId, toId, maxSize, size, readBufferIndices[2]);
+    ASSERT_TRUE(segmentLogs[2] != nullptr);
+    EXPECT_EQ(readBufferIndices[2], readBufferIndices[0]);
+    EXPECT_EQ(qLogger::getLogId(segmentLogs[2]), logger.archiveSegments[2].firstLogId);
+    EXPECT_EQ(qLogger::getLogId(segmentLogs[1]), logger.archiveSegments[1].firstLogId);
+    qLogger::archive.unlockLogs(readBufferIndices[1]);
+    qLogger::archive.unlockLogs(readBufferIndices[2]);
+
+    // archive of previous epoch is not used after reset
+    system.epoch = 124;
+    qLogger::reset(0, 0);
+    toId = 10;
+    EXPECT_TRUE(qLogger::archive.lockLogs(0, toId, maxSize, size, readBufferIndex) == nullptr);
+
+    stopFileIO = true;
+    fileIOThread.join();
+    deInitFileSystem();
+    for (unsigned int i = 0; i < numberOfSegments; ++i)
+    {
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "logArchive%06u.123", i);
+        remove(fileName);
+    }
+}
+
+static void expectSubscriptionRanges(unsigned int slot, const std::vector<std::pair<unsigned long long, unsigned long long>>& expectedRanges)
+{
+    const qLogger::LogSubscription& subscription = logger.logSubscriptions[slot];
+    ASSERT_EQ(subscription.numberOfRanges, expectedRanges.size());
+    const qLogger::LogIdRange* ranges = logger.logSubscriptionRanges + slot * LOG_SUBSCRIPTION_MAX_RANGES;
+    for (unsigned int i = 0; i < expectedRanges.size(); ++i)
+    {
+        EXPECT_EQ(ranges[i].fromLogId, expectedRanges[i].first);
+        EXPECT_EQ(ranges[i].toLogId, expectedRanges[i].second);
+    }
+}
+
+static void logTestTransfer(const m256i& source, const m256i& destination)
+{
+    QuTransfer transfer{ source, destination, 1000 };
+    qLogger::logMessage(offsetof(QuTransfer, _terminator), QU_TRANSFER, &transfer);
+}
+
+static void logTestContractMessage(unsigned int contractIndex)
+{
+    DummyContractInfoMessage contractMessage{ contractIndex, 42 };
+    qLogger::logMessage(offsetof(DummyContractInfoMessage, _terminator), CONTRACT_INFORMATION_MESSAGE, &contractMessage);
+}
+
+TEST(TestCoreLogging, SubscriptionFilters)
+{
+    LoggingTest test;
+    const m256i X(1, 2, 3, 4), Y(5, 6, 7, 8), Z(9, 10, 11, 12);
+    Peer* peers[LOG_MAX_SUBSCRIPTIONS + 1];
+    for (unsigned int i = 0; i <= LOG_MAX_SUBSCRIPTIONS; ++i)
+        peers[i] = reinterpret_cast<Peer*>(0x1000 + i * 0x100);
+    void* connection = reinterpret_cast<void*>(0x42);
+
+    // subscriptions: all logs, transfers of X, messages of contract 5, dust burnings of Y
+    EXPECT_EQ(qLogger::subscribeLogs(peers[0], connection, 1, m256i::zero(), ~0ULL, 0), 0);
+    EXPECT_EQ(qLogger::subscribeLogs(peers[1], connection, 2, X, qLogger::getLogTypeFlag(QU_TRANSFER), 0), 0);
+    EXPECT_EQ(qLogger::subscribeLogs(peers[2], connection, 3, m256i::zero(), qLogger::getLogTypeFlag(CONTRACT_INFORMATION_MESSAGE), 5), 0);
+    EXPECT_EQ(qLogger::subscribeLogs(peers[3], connection, 4, Y, qLogger::getLogTypeFlag(DUST_BURNING) | qLogger::getLogTypeFlag(QU_TRANSFER), 0), 0);
+    EXPECT_EQ(logger.numberOfLogSubscriptions, 4);
+
+    logTestTransfer(X, Z); // 0
+    logTestTransfer(Z, Y); // 1
+    logTestContractMessage(5); // 2
+    logTestContractMessage(6); // 3
+    logTestTransfer(Z, X); // 4
+    {
+        // 5: dust burning with Y as second entity (not aligned in message)
+        unsigned char dustBurningBuffer[2 + 3 * sizeof(DustBurning::Entity)];
+        DustBurning* dustBurning = reinterpret_cast<DustBurning*>(dustBurningBuffer);
+        dustBurning->numberOfBurns = 3;
+        dustBurning->entity(0).publicKey = Z;
+        dustBurning->entity(1).publicKey = Y;
+        dustBurning->entity(2).publicKey = X;
+        qLogger::logMessage(dustBurning->messageSize(), DUST_BURNING, dustBurning);
+    }
+    DummyCustomMessage customMessage{ 123 };
+    qLogger::logMessage(offsetof(DummyCustomMessage, _terminator), CUSTOM_MESSAGE, &customMessage); // 6
+
+    expectSubscriptionRanges(0, { {0, 6} });
+    expectSubscriptionRanges(1, { {0, 0}, {4, 4} });
+    expectSubscriptionRanges(2, { {2, 2} });
+    expectSubscriptionRanges(3, { {1, 1}, {5, 5} });
+
+    // new subscription of same connection replaces filter, other connection of same peer gets new slot
+    EXPECT_EQ(qLogger::subscribeLogs(peers[1], connection, 5, m256i::zero(), qLogger::getLogTypeFlag(CUSTOM_MESSAGE), 0), 7);
+    EXPECT_EQ(logger.logSubscriptions[1].dejavu, 5);
+    EXPECT_EQ(qLogger::subscribeLogs(peers[3], nullptr, 6, Z, qLogger::getLogTypeFlag(QU_TRANSFER), 0), 7);
+    EXPECT_EQ(logger.numberOfLogSubscriptions, 5);
+    EXPECT_TRUE(logger.logSubscriptions[4].peer == peers[3]);
+
+    // unsubscribe
+    EXPECT_EQ(qLogger::subscribeLogs(peers[2], connection, 3, m256i::zero(), 0, 0), -1);
+    EXPECT_EQ(logger.numberOfLogSubscriptions, 4);
+    EXPECT_TRUE(logger.logSubscriptions[2].peer == nullptr);
+    EXPECT_EQ(qLogger::subscribeLogs(peers[2], connection, 3, m256i::zero(), 0, 0), -1);
+    EXPECT_EQ(logger.numberOfLogSubscriptions, 4);
+
+    // no free slot left
+    for (unsigned int i = 4; i < LOG_MAX_SUBSCRIPTIONS; ++i)
+        EXPECT_EQ(qLogger::subscribeLogs(peers[i], connection, 7, m256i::zero(), 1, 0), 7);
+    EXPECT_EQ(logger.numberOfLogSubscriptions, LOG_MAX_SUBSCRIPTIONS);
+    EXPECT_EQ(qLogger::subscribeLogs(peers[LOG_MAX_SUBSCRIPTIONS], connection, 7, m256i::zero(), 1, 0), -1);
+
+    // if number of ranges is exceeded, last range is extended with non-matching logs
+    qLogger::reset(0, 0);
+    expectSubscriptionRanges(0, {});
+    for (unsigned int i = 0; i < LOG_SUBSCRIPTION_MAX_RANGES + 10; ++i)
+    {
+        logTestTransfer(Z, Y);
+        logTestTransfer(Z, X);
+    }
+    expectSubscriptionRanges(1, {});
+    EXPECT_EQ(logger.logSubscriptions[3].numberOfRanges, LOG_SUBSCRIPTION_MAX_RANGES);
+    const qLogger::LogIdRange* ranges = logger.logSubscriptionRanges + 3 * LOG_SUBSCRIPTION_MAX_RANGES;
+    EXPECT_EQ(ranges[0].fromLogId, 0);
+    EXPECT_EQ(ranges[0].toLogId, 0);
+    EXPECT_EQ(ranges[LOG_SUBSCRIPTION_MAX_RANGES - 2].fromLogId, 2 * (LOG_SUBSCRIPTION_MAX_RANGES - 2));
+    EXPECT_EQ(ranges[LOG_SUBSCRIPTION_MAX_RANGES - 1].fromLogId, 2 * (LOG_SUBSCRIPTION_MAX_RANGES - 1));
+    EXPECT_EQ(ranges[LOG_SUBSCRIPTION_MAX_RANGES - 1].toLogId, 2 * (LOG_SUBSCRIPTION_MAX_RANGES + 9));
+    expectSubscriptionRanges(0, { {0, 2 * (LOG_SUBSCRIPTION_MAX_RANGES + 10) - 1} });
+}
+
+static std::vector<unsigned long long> getEntityLogIds(const m256i& publicKey, unsigned long long fromLogId, unsigned int maxLogIds, bool& moreLogIds)
+{
+    std::vector<unsigned long long> logIds(maxLogIds);
+    logIds.resize(qLogger::entityIndex.getLogIds(publicKey, fromLogId, logIds.data(), maxLogIds, moreLogIds));
+    return logIds;
+}
+
+TEST(TestCoreLogging, EntityLogIndex)
+{
+    LoggingTest test;
+    qLogger::reset(0, 0);
+    const m256i X(1, 2, 3, 4), Y(5, 6, 7, 8), Z(9, 10, 11, 12);
+    bool moreLogIds;
+
+    logger.logQuTransfer(QuTransfer{ X, Y, 1000 }); // 0
+    logTestContractMessage(5); // 1
+    logger.logAssetOwnershipChange(AssetOwnershipChange{ Y, Z, X, 10 }); // 2
+    logger.logAssetPossessionChange(AssetPossessionChange{ Y, Z, X, 10 }); // 3
+    logger.logQuTransfer(QuTransfer{ Z, Z, 1000 }); // 4
+    logger.logQuTransfer(QuTransfer{ m256i::zero(), X, 1000 }); // 5
+
+    // issuer isn't indexed, source and destination are only added once
+    EXPECT_EQ(getEntityLogIds(X, 0, 100, moreLogIds), std::vector<unsigned long long>({ 0, 5 }));
+    EXPECT_FALSE(moreLogIds);
+    EXPECT_EQ(getEntityLogIds(Y, 0, 100, moreLogIds), std::vector<unsigned long long>({ 0, 2, 3 }));
+    EXPECT_EQ(getEntityLogIds(Z, 0, 100, moreLogIds), std::vector<unsigned long long>({ 2, 3, 4 }));
+    EXPECT_TRUE(getEntityLogIds(m256i::zero(), 0, 100, moreLogIds).empty());
+    EXPECT_TRUE(getEntityLogIds(m256i(1, 1, 1, 1), 0, 100, moreLogIds).empty());
+
+    // paging through list spanning several chunks
+    std::vector<unsigned long long> expectedLogIds = { 0, 5 };
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+        expectedLogIds.push_back(qLogger::logId);
+        logger.logQuTransfer(QuTransfer{ X, m256i(i + 1, 0, 0, 0), 1 });
+    }
+    std::vector<unsigned long long> logIds;
+    unsigned long long fromLogId = 0;
+    do
+    {
+        std::vector<unsigned long long> page = getEntityLogIds(X, fromLogId, 7, moreLogIds);
+        EXPECT_TRUE(page.size() == 7 || !moreLogIds);
+        logIds.insert(logIds.end(), page.begin(), page.end());
+        fromLogId = page.empty() ? fromLogId : page.back() + 1;
+    } while (moreLogIds);
+    EXPECT_EQ(logIds, expectedLogIds);
+    EXPECT_FALSE(logger.entityLogIndexIncomplete);
+
+    // logs that don't fit into the arena aren't indexed and mark index incomplete
+    EXPECT_EQ(logger.numberOfIndexedEntities, 3 + 100);
+    for (unsigned int i = 0; i < LOG_ENTITY_INDEX_CHUNKS; ++i)
+        logger.logQuTransfer(QuTransfer{ Y, m256i(0, i + 1, 0, 0), 1 });
+    EXPECT_TRUE(logger.entityLogIndexIncomplete);
+    EXPECT_EQ(logger.numberOfEntityLogIdChunks, LOG_ENTITY_INDEX_CHUNKS);
+    EXPECT_TRUE(getEntityLogIds(m256i(0, LOG_ENTITY_INDEX_CHUNKS, 0, 0), 0, 100, moreLogIds).empty());
+    EXPECT_LT(getEntityLogIds(Y, 0, 1000, moreLogIds).size(), 3 + LOG_ENTITY_INDEX_CHUNKS);
+
+    // reset clears index
+    qLogger::reset(0, 0);
+    EXPECT_FALSE(logger.entityLogIndexIncomplete);
+    EXPECT_TRUE(getEntityLogIds(X, 0, 100, moreLogIds).empty());
+}
+
+TEST(TestCoreLogging, EntityLogIndexLookup)
+{
+    LoggingTest test;
+    qLogger::reset(0, 0);
+    const m256i X(1, 2, 3, 4);
+    std::mt19937_64 gen64(42);
+    bool moreLogIds;
+
+    // list of many chunks with other logs in between
+    std::vector<unsigned long long> expectedLogIds;
+    for (unsigned int i = 0; i < 100 * qLogger::EntityLogIdChunk::capacity; ++i)
+    {
+        if (gen64() % 3 == 0)
+            logTestContractMessage(5);
+        expectedLogIds.push_back(qLogger::logId);
+        logger.logQuTransfer(QuTransfer{ X, X, 1 });
+    }
+    EXPECT_FALSE(logger.entityLogIndexIncomplete);
+    EXPECT_EQ(logger.numberOfEntityLogIdChunks, 101);
+
+    // jump links lead to earlier chunks of the list
+    for (unsigned int chunkIndex = 1; chunkIndex < logger.numberOfEntityLogIdChunks; ++chunkIndex)
+    {
+        const qLogger::EntityLogIdChunk& chunk = logger.entityLogIdChunks[chunkIndex];
+        EXPECT_EQ(chunk.position, chunkIndex - 1);
+        const qLogger::EntityLogIdChunk& jump = logger.entityLogIdChunks[chunk.jump];
+        EXPECT_LE(jump.position, chunk.position);
+        EXPECT_TRUE(chunk.position == 0 || jump.position < chunk.position);
+    }
+
+    // any start ID finds the following IDs
+    for (unsigned long long fromLogId = 0; fromLogId <= qLogger::logId; ++fromLogId)
+    {
+        const auto it = std::lower_bound(expectedLogIds.begin(), expectedLogIds.end(), fromLogId);
+        const std::vector<unsigned long long> expectedPage(it, it + std::min<long long>(3, expectedLogIds.end() - it));
+        EXPECT_EQ(getEntityLogIds(X, fromLogId, 3, moreLogIds), expectedPage);
+        EXPECT_EQ(moreLogIds, expectedLogIds.end() - it > 3);
+    }
+}
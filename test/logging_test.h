@@ -13,7 +13,9 @@
 #define LOG_SPECTRUM_STATS 1
 
 // reduced size of logging buffer (512 MB instead of 8 GB)
+#ifndef LOG_BUFFER_SIZE
 #define LOG_BUFFER_SIZE (2*268435456ULL)
+#endif
 
 // also reduce size of logging tx index by reducing maximum number of ticks per epoch
 #include "public_settings.h"
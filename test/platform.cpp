@@ -4,6 +4,11 @@
 #include "../src/platform/read_write_lock.h"
 #include "../src/platform/stack_size_tracker.h"
 #include "../src/platform/custom_stack.h"
+#include "../src/platform/parallel_job.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
 
 TEST(TestCoreReadWriteLock, SimpleSingleThread)
 {
@@ -165,3 +170,42 @@ TEST(TestCoreCustomStack, SimpleTest)
     auto size4 = s.maxStackUsed();
     EXPECT_GT(size4, size3);
 }
+
+
+static void parallelJobTestFunction(void* context, unsigned int partIndex)
+{
+    std::atomic<unsigned int>* partCounts = (std::atomic<unsigned int>*)context;
+    partCounts[partIndex]++;
+}
+
+TEST(TestCoreParallelJob, AllPartsProcessedOnce)
+{
+    constexpr unsigned int numberOfParts = 1000;
+    for (unsigned int numberOfHelpers = 0; numberOfHelpers < 4; ++numberOfHelpers)
+    {
+        std::atomic<bool> stopHelpers = false;
+        std::vector<std::thread> helpers;
+        for (unsigned int i = 0; i < numberOfHelpers; ++i)
+        {
+            helpers.emplace_back([&stopHelpers]()
+                {
+                    while (!stopHelpers)
+                        tryHelpWithParallelJob();
+                });
+        }
+
+        for (int rep = 0; rep < 10; ++rep)
+        {
+            std::vector<std::atomic<unsigned int>> partCounts(numberOfParts);
+            runParallelJob(parallelJobTestFunction, partCounts.data(), numberOfParts);
+            for (unsigned int i = 0; i < numberOfParts; ++i)
+                EXPECT_EQ(partCounts[i], 1);
+            EXPECT_EQ(currentParallelJob, nullptr);
+        }
+
+        stopHelpers = true;
+        for (auto& helper : helpers)
+            helper.join();
+        EXPECT_EQ(parallelJobHelpers, 0);
+    }
+}
@@ -24,6 +24,7 @@ typedef void (*USER_PROCEDURE)(const QPI::QpiContextProcedureCall&, void* state,
 #include <map>
 #include <random>
 #include <chrono>
+#include <memory>
 
 template <typename T, unsigned long long capacity>
 void checkPriorityQueue(const QPI::Collection<T, capacity>& coll, const QPI::id& pov, bool print = false)
@@ -105,6 +106,54 @@ bool isCompletelySame(const QPI::Collection<T, capacity>& coll1, const QPI::Coll
     return memcmp(&coll1, &coll2, sizeof(coll1)) == 0;
 }
 
+// Mirror of memory layout of QPI::Collection, for checking internals
+template <typename T, unsigned long long capacity>
+struct CollectionLayout
+{
+    unsigned char povs[64 * capacity];
+    QPI::uint64 povOccupationFlags[(capacity * 2 + 63) / 64];
+    struct
+    {
+        QPI::sint64 priority, bstParentIndex, bstLeftIndex, bstRightIndex;
+    } elementNodes[capacity];
+    struct
+    {
+        QPI::uint32 povIndex, bstHeight;
+    } elementInfos[capacity];
+    T elementValues[capacity];
+    QPI::uint64 population, markRemovalCounter;
+};
+
+// Check that tree of each pov is a valid AVL tree (links consistent, heights correct, balanced)
+template <typename T, unsigned long long capacity>
+void checkCollectionBstBalanced(const QPI::Collection<T, capacity>& coll)
+{
+    static_assert(sizeof(CollectionLayout<T, capacity>) == sizeof(coll));
+    const auto& layout = reinterpret_cast<const CollectionLayout<T, capacity>&>(coll);
+    auto height = [&layout](QPI::sint64 idx) -> QPI::sint64
+        {
+            return (idx == QPI::NULL_INDEX) ? 0 : layout.elementInfos[idx].bstHeight;
+        };
+    for (QPI::uint64 i = 0; i < layout.population; ++i)
+    {
+        const auto& node = layout.elementNodes[i];
+        if (node.bstLeftIndex != QPI::NULL_INDEX)
+        {
+            EXPECT_EQ(layout.elementNodes[node.bstLeftIndex].bstParentIndex, i);
+            EXPECT_GE(layout.elementNodes[node.bstLeftIndex].priority, node.priority);
+        }
+        if (node.bstRightIndex != QPI::NULL_INDEX)
+        {
+            EXPECT_EQ(layout.elementNodes[node.bstRightIndex].bstParentIndex, i);
+            EXPECT_LE(layout.elementNodes[node.bstRightIndex].priority, node.priority);
+        }
+        const QPI::sint64 leftHeight = height(node.bstLeftIndex);
+        const QPI::sint64 rightHeight = height(node.bstRightIndex);
+        EXPECT_EQ(height(i), 1 + std::max(leftHeight, rightHeight));
+        EXPECT_LE(std::abs(leftHeight - rightHeight), 1);
+    }
+}
+
 template <typename T, unsigned long long capacity>
 bool haveSameContent(const QPI::Collection<T, capacity>& coll1, const QPI::Collection<T, capacity>& coll2, bool verbose = true)
 {
@@ -185,6 +234,7 @@ void cleanupCollection(QPI::Collection<T, capacity>& coll)
     // run faster cleanup and check result
     origColl.cleanup();
     EXPECT_TRUE(haveSameContent(origColl, coll));
+    checkCollectionBstBalanced(origColl);
 }
 
 
@@ -1331,6 +1381,92 @@ TEST(TestCoreQPI, CollectionCleanupWithPovCollisions)
 }
 
 
+struct TestCollectionOrder
+{
+    QPI::id issuer;
+    QPI::uint64 assetName;
+    QPI::sint64 numberOfShares;
+
+    bool operator!=(const TestCollectionOrder& other) const
+    {
+        return memcmp(this, &other, sizeof(*this)) != 0;
+    }
+};
+
+// Rewrite element arrays of collection in the former element layout (array of structs), which is used in state files
+// saved before the struct-of-arrays layout was introduced
+template <typename T, unsigned long long capacity>
+void convertCollectionToElementArrayLayout(QPI::Collection<T, capacity>& coll)
+{
+    struct FormerElement
+    {
+        T value;
+        QPI::sint64 priority, povIndex, bstParentIndex, bstLeftIndex, bstRightIndex;
+    };
+    auto& layout = reinterpret_cast<CollectionLayout<T, capacity>&>(coll);
+    static_assert(sizeof(layout.elementNodes) + sizeof(layout.elementInfos) + sizeof(layout.elementValues) == sizeof(FormerElement) * capacity);
+
+    std::vector<FormerElement> formerElements(capacity);
+    for (unsigned long long i = 0; i < capacity; ++i)
+    {
+        formerElements[i].value = layout.elementValues[i];
+        formerElements[i].priority = layout.elementNodes[i].priority;
+        formerElements[i].povIndex = layout.elementInfos[i].povIndex;
+        formerElements[i].bstParentIndex = layout.elementNodes[i].bstParentIndex;
+        formerElements[i].bstLeftIndex = layout.elementNodes[i].bstLeftIndex;
+        formerElements[i].bstRightIndex = layout.elementNodes[i].bstRightIndex;
+    }
+    memcpy(layout.elementNodes, formerElements.data(), sizeof(FormerElement) * capacity);
+}
+
+template <typename T, unsigned long long capacity>
+void testCollectionMigrateFromElementArrayLayout(int povs, int seed)
+{
+    std::mt19937_64 gen64(seed);
+    auto coll = std::make_unique<QPI::Collection<T, capacity>>();
+    coll->reset();
+    for (unsigned long long i = 0; i < capacity * 3 / 4; ++i)
+    {
+        T value;
+        memset(&value, 0, sizeof(value));
+        *reinterpret_cast<QPI::uint64*>(&value) = gen64();
+        coll->add(QPI::id(gen64() % povs, 1, 2, 3), value, gen64() % 1000);
+        if (gen64() % 4 == 0)
+            coll->remove(gen64() % coll->population());
+    }
+
+    auto migratedColl = std::make_unique<QPI::Collection<T, capacity>>();
+    memcpy(migratedColl.get(), coll.get(), sizeof(*coll));
+    convertCollectionToElementArrayLayout(*migratedColl);
+    EXPECT_FALSE(isCompletelySame(*coll, *migratedColl));
+
+    // trees are rebuilt, so element links may differ but content and order are the same
+    EXPECT_TRUE(QPI::migrateCollectionFromElementArrayLayout(*migratedColl));
+    EXPECT_TRUE(haveSameContent(*coll, *migratedColl));
+    checkCollectionBstBalanced(*migratedColl);
+}
+
+TEST(TestCoreQPI, CollectionMigrateFromElementArrayLayout)
+{
+    __scratchpadBuffer = new char[10 * 1024 * 1024];
+    testCollectionMigrateFromElementArrayLayout<QPI::uint64, 1024>(10, 42);
+    testCollectionMigrateFromElementArrayLayout<QPI::uint64, 16>(3, 43);
+    testCollectionMigrateFromElementArrayLayout<TestCollectionOrder, 512>(30, 44);
+
+    // empty collection stays empty
+    auto coll = std::make_unique<QPI::Collection<TestCollectionOrder, 64>>();
+    coll->reset();
+    auto emptyColl = std::make_unique<QPI::Collection<TestCollectionOrder, 64>>();
+    emptyColl->reset();
+    EXPECT_TRUE(QPI::migrateCollectionFromElementArrayLayout(*coll));
+    EXPECT_TRUE(isCompletelySame(*coll, *emptyColl));
+    delete[] __scratchpadBuffer;
+    __scratchpadBuffer = nullptr;
+
+    // fails without scratchpad
+    EXPECT_FALSE(QPI::migrateCollectionFromElementArrayLayout(*coll));
+}
+
 template<typename T>
 T genNumber(
     const T* genBuffer,
@@ -1490,3 +1626,102 @@ TEST(TestCoreQPI, CollectionPerformance)
         std::cout << "* [CollectionPerformance] Total:\t\t" << total << " ms\n";
     }
 }
+
+// Order book workload similar to Qx: large collection with values of the size of Qx orders, where each operation
+// inserts an order with random price and removes an order matching a random price limit (or the head)
+template <unsigned long long capacity>
+QPI::uint64 testCollectionOrderBookPerformance(const QPI::uint64 povs, const QPI::uint64 operations)
+{
+    std::mt19937_64 gen64(12345);
+    auto coll = std::make_unique<QPI::Collection<TestCollectionOrder, capacity>>();
+    coll->reset();
+    TestCollectionOrder order;
+    memset(&order, 0, sizeof(order));
+    for (unsigned long long i = 0; i < capacity / 2; ++i)
+    {
+        order.numberOfShares = i;
+        coll->add(QPI::id(gen64() % povs, 0, 0, 0), order, gen64() % 1000000);
+    }
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    for (unsigned long long i = 0; i < operations; ++i)
+    {
+        const QPI::id pov(gen64() % povs, 0, 0, 0);
+        order.numberOfShares = i;
+        coll->add(pov, order, gen64() % 1000000);
+        QPI::sint64 elementIndex = coll->headIndex(pov, gen64() % 1000000);
+        if (elementIndex == QPI::NULL_INDEX)
+            elementIndex = coll->headIndex(pov);
+        coll->remove(elementIndex);
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    EXPECT_EQ(coll->population(), capacity / 2);
+
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+}
+
+TEST(TestCoreQPI, CollectionOrderBookPerformance)
+{
+    __scratchpadBuffer = new char[16 * 1024 * 1024];
+    QPI::uint64 ms1 = testCollectionOrderBookPerformance<262144>(16, 1000000);
+    QPI::uint64 ms2 = testCollectionOrderBookPerformance<262144>(1024, 1000000);
+    delete[] __scratchpadBuffer;
+    __scratchpadBuffer = nullptr;
+
+    std::cout << "- [CollectionOrderBookPerformance] Collection<262144>(16 povs, 1M add+remove):\t" << ms1 << " ms\n";
+    std::cout << "- [CollectionOrderBookPerformance] Collection<262144>(1024 povs, 1M add+remove):\t" << ms2 << " ms\n";
+}
+
+// Latency of add and remove with adversarial insertion order (monotonic priorities, such as increasing Qx bid prices)
+// in one large priority queue. Returns total duration in ms and maximum duration of a single add and remove in us.
+template <unsigned long long capacity>
+QPI::uint64 testCollectionMonotonicPriorityLatency(bool increasing, QPI::uint64& maxAddUs, QPI::uint64& maxRemoveUs)
+{
+    std::mt19937_64 gen64(4242);
+    auto coll = std::make_unique<QPI::Collection<TestCollectionOrder, capacity>>();
+    coll->reset();
+    TestCollectionOrder order;
+    memset(&order, 0, sizeof(order));
+    const QPI::id pov(1, 2, 3, 4);
+    std::chrono::high_resolution_clock::duration maxAdd(0), maxRemove(0);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (unsigned long long i = 0; i < capacity; ++i)
+    {
+        order.numberOfShares = i;
+        auto opStart = std::chrono::high_resolution_clock::now();
+        coll->add(pov, order, increasing ? i : capacity - i);
+        maxAdd = std::max(maxAdd, std::chrono::high_resolution_clock::now() - opStart);
+    }
+    for (unsigned long long i = 0; i < capacity / 2; ++i)
+    {
+        const QPI::sint64 elementIndex = (i & 1) ? coll->headIndex(pov) : (gen64() % coll->population());
+        auto opStart = std::chrono::high_resolution_clock::now();
+        coll->remove(elementIndex);
+        maxRemove = std::max(maxRemove, std::chrono::high_resolution_clock::now() - opStart);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    EXPECT_EQ(coll->population(pov), capacity / 2);
+    checkCollectionBstBalanced(*coll);
+
+    maxAddUs = std::chrono::duration_cast<std::chrono::microseconds>(maxAdd).count();
+    maxRemoveUs = std::chrono::duration_cast<std::chrono::microseconds>(maxRemove).count();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+}
+
+TEST(TestCoreQPI, CollectionMonotonicPriorityLatency)
+{
+    __scratchpadBuffer = new char[16 * 1024 * 1024];
+    for (bool increasing : { true, false })
+    {
+        QPI::uint64 maxAddUs, maxRemoveUs;
+        QPI::uint64 ms = testCollectionMonotonicPriorityLatency<262144>(increasing, maxAddUs, maxRemoveUs);
+        std::cout << "- [CollectionMonotonicPriorityLatency] Collection<262144>(" << (increasing ? "increasing" : "decreasing")
+            << ", 262144 add + 131072 remove):\t" << ms << " ms, max add " << maxAddUs << " us, max remove " << maxRemoveUs << " us\n";
+    }
+    delete[] __scratchpadBuffer;
+    __scratchpadBuffer = nullptr;
+}
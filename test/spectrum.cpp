@@ -7,8 +7,11 @@
 #include "logging_test.h"
 #include "spectrum/spectrum.h"
 
+#include <atomic>
 #include <chrono>
 #include <random>
+#include <thread>
+#include <vector>
 
 static bool transfer(const m256i& src, const m256i& dst, long long amount)
 {
@@ -78,12 +81,36 @@ static SpectrumInfo checkAndGetInfo()
     EXPECT_LE((unsigned long long)si.totalAmount, MAX_SUPPLY);
     EXPECT_EQ(si.totalAmount, spectrumInfo.totalAmount);
     EXPECT_EQ(si.numberOfEntities, spectrumInfo.numberOfEntities);
+
+    // Continuously updated entity category populations match counting from scratch
+    SpectrumInfo si2;
+    unsigned int categoryPopulations[entityCategoryCount];
+    updateSpectrumInfo(si2, categoryPopulations);
+    EXPECT_EQ(si2.totalAmount, si.totalAmount);
+    EXPECT_EQ(si2.numberOfEntities, si.numberOfEntities);
+    for (int i = 0; i < entityCategoryCount; ++i)
+        EXPECT_EQ(categoryPopulations[i], entityCategoryPopulations[i]);
+
+#if USE_SPECTRUM_FINGERPRINTS
+    // Fingerprints match public keys, including the padding at the end
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        unsigned char expectedFingerprint = isZero(spectrum[i].publicKey) ? 0 : spectrumFingerprint(spectrum[i].publicKey);
+        if (spectrumFingerprints[i] != expectedFingerprint)
+        {
+            ADD_FAILURE() << "Wrong fingerprint in slot " << i;
+            break;
+        }
+    }
+    EXPECT_EQ(memcmp(spectrumFingerprints + SPECTRUM_CAPACITY, spectrumFingerprints, spectrumFingerprintsPadding), 0);
+#endif
+
     return si;
 }
 
-static void updateAndPrintEntityCategoryPopulations()
+static void analyzeAndPrintEntityCategoryPopulations()
 {
-    updateAndAnalzeEntityCategoryPopulations();
+    analyzeEntityCategoryPopulations();
 
     // Compute number of entities with 0 balance
     unsigned int sumEntityCategoryPopulations = 0;
@@ -148,6 +175,7 @@ struct SpectrumTest : public LoggingTest
     {
         memset(spectrum, 0, spectrumSizeInBytes);
         updateSpectrumInfo();
+        updateSpectrumFingerprints();
     }
 
     void beforeAntiDust()
@@ -159,7 +187,7 @@ struct SpectrumTest : public LoggingTest
 #if PRINT_TEST_INFO
         std::cout << "Entity balance distribution before anti-dust:" << std::endl;
 #endif
-        updateAndPrintEntityCategoryPopulations();
+        analyzeAndPrintEntityCategoryPopulations();
 
         // Start measuring run-time
         beforeAntiDustTimestamp = std::chrono::high_resolution_clock::now();
@@ -181,7 +209,7 @@ struct SpectrumTest : public LoggingTest
 #if PRINT_TEST_INFO
         std::cout << "Entity balance distribution after anti-dust:" << std::endl;
 #endif
-        updateAndPrintEntityCategoryPopulations();
+        analyzeAndPrintEntityCategoryPopulations();
 
         // Anti-dust always cleans up to at least half of the spectrum
         EXPECT_LE(spectrumInfo.numberOfEntities, (SPECTRUM_CAPACITY / 2));
@@ -230,7 +258,7 @@ TEST(TestCoreSpectrum, AntiDustFile)
     if (loadSpectrum(L"spectrum.000"))
     {
         std::cout << "Spectrum file state before dust attack:" << std::endl;
-        updateAndPrintEntityCategoryPopulations();
+        analyzeAndPrintEntityCategoryPopulations();
 
         SpectrumInfo si1 = checkAndGetInfo();
         test.dust_attack(1, 10, 3);
@@ -397,3 +425,232 @@ TEST(TestCoreSpectrum, AntiDustEdgeCaseHugeBinZeroBalance)
     test.afterAntiDust();
 }
 
+// Reference implementation of spectrum reorganization: reinsert all entities with balance into an empty hash map
+static void reorganizeSpectrumReference(const ::Entity* oldSpectrum, ::Entity* newSpectrum)
+{
+    memset(newSpectrum, 0, spectrumSizeInBytes);
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        if (oldSpectrum[i].incomingAmount - oldSpectrum[i].outgoingAmount)
+        {
+            unsigned int index = oldSpectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+            while (!isZero(newSpectrum[index].publicKey))
+                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+            newSpectrum[index] = oldSpectrum[i];
+        }
+    }
+}
+
+// Reference implementation of computing the spectrum digest tree on one core
+static void computeSpectrumDigestsReference(const ::Entity* spectrum, m256i* digests)
+{
+    unsigned int digestIndex;
+    for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
+        KangarooTwelve64To32(&spectrum[digestIndex], &digests[digestIndex]);
+    unsigned int previousLevelBeginning = 0;
+    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
+    while (numberOfLeafs > 1)
+    {
+        for (unsigned int i = 0; i < numberOfLeafs; i += 2)
+            KangarooTwelve64To32(&digests[previousLevelBeginning + i], &digests[digestIndex++]);
+        previousLevelBeginning += numberOfLeafs;
+        numberOfLeafs >>= 1;
+    }
+}
+
+static void testReorganizeSpectrum(unsigned int numberOfHelpers)
+{
+    SpectrumTest test;
+
+    // Fill spectrum with entities, including long clusters, a cluster wrapping around the end of the hash map,
+    // and entities with zero balance
+    for (unsigned long long i = 0; i < SPECTRUM_CAPACITY / 2; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), test.rnd64() % 1000 + 1);
+    for (unsigned long long i = 0; i < 2000; ++i)
+    {
+        unsigned long long home = (i % 5 == 0) ? (SPECTRUM_CAPACITY - 1 - (i % 20)) : (i * 7919) % SPECTRUM_CAPACITY;
+        increaseEnergy(m256i(home | (test.rnd64() << 32), test.rnd64(), i, 1), 100);
+    }
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; ++i)
+    {
+        if (!isZero(spectrum[i].publicKey) && (test.rnd64() & 1))
+            decreaseEnergy(i, energy(i));
+    }
+    ASSERT_FALSE(isZero(spectrum[SPECTRUM_CAPACITY - 1].publicKey));
+    ASSERT_FALSE(isZero(spectrum[0].publicKey));
+
+    std::vector<::Entity> oldSpectrum(spectrum, spectrum + SPECTRUM_CAPACITY);
+    const SpectrumInfo oldSpectrumInfo = spectrumInfo;
+
+    // Reorganize with helper threads
+    std::atomic<bool> stopHelpers = false;
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 0; i < numberOfHelpers; ++i)
+    {
+        helpers.emplace_back([&stopHelpers]()
+            {
+                while (!stopHelpers)
+                    tryHelpWithParallelJob();
+            });
+    }
+    reorganizeSpectrum();
+    stopHelpers = true;
+    for (auto& helper : helpers)
+        helper.join();
+
+    // Check that info is up to date
+    SpectrumInfo si = checkAndGetInfo();
+    EXPECT_LT(si.numberOfEntities, oldSpectrumInfo.numberOfEntities);
+    EXPECT_EQ(si.totalAmount, oldSpectrumInfo.totalAmount);
+
+    // Compare hash map and digests with sequential reference implementation (using reorgBuffer for the reference)
+    reorganizeSpectrumReference(oldSpectrum.data(), (::Entity*)reorgBuffer);
+    EXPECT_EQ(memcmp(spectrum, reorgBuffer, spectrumSizeInBytes), 0);
+    computeSpectrumDigestsReference(spectrum, (m256i*)reorgBuffer);
+    EXPECT_EQ(memcmp(spectrumDigests, reorgBuffer, spectrumDigestsSizeInByte), 0);
+}
+
+TEST(TestCoreSpectrum, ReorganizeSingleThread)
+{
+    testReorganizeSpectrum(0);
+}
+
+TEST(TestCoreSpectrum, ReorganizeMultiThread)
+{
+    testReorganizeSpectrum(3);
+}
+
+static void testSparseSpectrumFile(unsigned int numberOfHelpers)
+{
+    SpectrumTest test;
+    CHAR16 fileName[32];
+    setText(fileName, L"spectrumSparseTest.tmp");
+    frequency = 1000000000; // for timing in log messages
+    const char* narrowFileName = "spectrumSparseTest.tmp";
+
+    std::atomic<bool> stopHelpers = false;
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 0; i < numberOfHelpers; ++i)
+    {
+        helpers.emplace_back([&stopHelpers]()
+            {
+                while (!stopHelpers)
+                    tryHelpWithParallelJob();
+            });
+    }
+
+    // Sparse spectrum including first and last slot
+    for (unsigned long long i = 0; i < SPECTRUM_CAPACITY / 16; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), test.rnd64() % 1000 + 1);
+    increaseEnergy(m256i(0, 1, 2, 3), 10);
+    increaseEnergy(m256i(SPECTRUM_CAPACITY - 1, 1, 2, 3), 10);
+    ASSERT_FALSE(isZero(spectrum[0].publicKey));
+    ASSERT_FALSE(isZero(spectrum[SPECTRUM_CAPACITY - 1].publicKey));
+    const SpectrumInfo oldSpectrumInfo = checkAndGetInfo();
+    std::vector<::Entity> oldSpectrum(spectrum, spectrum + SPECTRUM_CAPACITY);
+    std::vector<m256i> referenceDigests(SPECTRUM_CAPACITY * 2 - 1);
+    computeSpectrumDigestsReference(spectrum, referenceDigests.data());
+
+    // Only non-empty entities are stored
+    EXPECT_TRUE(saveSpectrum(fileName));
+    FILE* file = fopen(narrowFileName, "rb");
+    ASSERT_TRUE(file != nullptr);
+    fseek(file, 0, SEEK_END);
+    const long fileSize = ftell(file);
+    fclose(file);
+    EXPECT_EQ((unsigned long long)fileSize, sizeof(SparseStateFileHeader) + oldSpectrumInfo.numberOfEntities * (4 + sizeof(::Entity)));
+
+    // Loading restores entities, info, and all digests
+    memset(spectrum, 0xff, spectrumSizeInBytes);
+    memset(spectrumDigests, 0xff, spectrumDigestsSizeInByte);
+    EXPECT_TRUE(loadSpectrum(fileName));
+    EXPECT_EQ(memcmp(spectrum, oldSpectrum.data(), spectrumSizeInBytes), 0);
+    EXPECT_EQ(memcmp(spectrumDigests, referenceDigests.data(), spectrumDigestsSizeInByte), 0);
+    SpectrumInfo si = checkAndGetInfo();
+    EXPECT_EQ(si.numberOfEntities, oldSpectrumInfo.numberOfEntities);
+    EXPECT_EQ(si.totalAmount, oldSpectrumInfo.totalAmount);
+
+    // Modified entity is detected by digest check, invalid index by index check
+    file = fopen(narrowFileName, "r+b");
+    ASSERT_TRUE(file != nullptr);
+    fseek(file, sizeof(SparseStateFileHeader) + 100 * (4 + sizeof(::Entity)) + 40, SEEK_SET);
+    fputc(0x77, file);
+    fclose(file);
+    EXPECT_FALSE(loadSpectrum(fileName));
+    EXPECT_TRUE(saveSpectrum(fileName));
+    file = fopen(narrowFileName, "r+b");
+    ASSERT_TRUE(file != nullptr);
+    fseek(file, sizeof(SparseStateFileHeader) + 200 * (4 + sizeof(::Entity)), SEEK_SET);
+    fputc(0, file);
+    fputc(0, file);
+    fputc(0, file);
+    fclose(file);
+    EXPECT_FALSE(loadSpectrum(fileName));
+
+    // Files of full spectrum are still supported
+    memcpy(spectrum, oldSpectrum.data(), spectrumSizeInBytes);
+    EXPECT_EQ(saveCompressed(fileName, spectrumSizeInBytes, (unsigned char*)spectrum), (long long)spectrumSizeInBytes);
+    memset(spectrum, 0xff, spectrumSizeInBytes);
+    memset(spectrumDigests, 0xff, spectrumDigestsSizeInByte);
+    EXPECT_TRUE(loadSpectrum(fileName));
+    EXPECT_EQ(memcmp(spectrum, oldSpectrum.data(), spectrumSizeInBytes), 0);
+    EXPECT_EQ(memcmp(spectrumDigests, referenceDigests.data(), spectrumDigestsSizeInByte), 0);
+
+    stopHelpers = true;
+    for (auto& helper : helpers)
+        helper.join();
+    remove(narrowFileName);
+}
+
+TEST(TestCoreSpectrum, SparseFileSingleThread)
+{
+    testSparseSpectrumFile(0);
+}
+
+TEST(TestCoreSpectrum, SparseFileMultiThread)
+{
+    testSparseSpectrumFile(3);
+}
+
+TEST(TestCoreSpectrum, LookupCollidingEntities)
+{
+    SpectrumTest test;
+
+    // Entities with same home slot near the end of the hash map (cluster wraps around) and partly same fingerprint
+    std::vector<m256i> publicKeys;
+    for (unsigned long long i = 0; i < 150; ++i)
+    {
+        const unsigned long long home = SPECTRUM_CAPACITY - 1 - (i % 3);
+        const unsigned long long fingerprintByte = (i % 2) ? 0 : i;
+        publicKeys.push_back(m256i(home | (test.rnd64() << 32), fingerprintByte | (test.rnd64() << 8), i, 2));
+        increaseEnergy(publicKeys.back(), i + 1);
+    }
+    for (unsigned long long i = 0; i < publicKeys.size(); ++i)
+    {
+        const int index = spectrumIndex(publicKeys[i]);
+        ASSERT_GE(index, 0);
+        EXPECT_EQ(spectrum[index].publicKey, publicKeys[i]);
+        EXPECT_EQ(energy(index), i + 1);
+    }
+    EXPECT_EQ(spectrumIndex(m256i(SPECTRUM_CAPACITY - 1, 0, 0, 3)), -1);
+    EXPECT_EQ(spectrumIndex(m256i(5, 0, 0, 3)), -1);
+    EXPECT_EQ(spectrumIndex(m256i::zero()), -1);
+
+    // Increasing balance of existing entity does not insert it again
+    increaseEnergy(publicKeys[100], 1000);
+    EXPECT_EQ(energy(spectrumIndex(publicKeys[100])), 1101);
+    EXPECT_EQ(checkAndGetInfo().numberOfEntities, publicKeys.size());
+
+    // Remove every third entity and check lookup after reorganization
+    for (unsigned long long i = 0; i < publicKeys.size(); i += 3)
+        decreaseEnergy(spectrumIndex(publicKeys[i]), energy(spectrumIndex(publicKeys[i])));
+    reorganizeSpectrum();
+    checkAndGetInfo();
+    for (unsigned long long i = 0; i < publicKeys.size(); ++i)
+    {
+        if (i % 3 == 0)
+            EXPECT_EQ(spectrumIndex(publicKeys[i]), -1);
+        else
+            EXPECT_GE(spectrumIndex(publicKeys[i]), 0);
+    }
+}
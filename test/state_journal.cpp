@@ -0,0 +1,354 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+// workaround for name clash with stdlib
+#define system qubicSystemStruct
+
+#include "spectrum/spectrum.h"
+#include "../src/ticking/state_journal.h"
+
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+
+typedef StateJournal<3> TestStateJournal;
+
+static constexpr unsigned int testRecordSize = 48;
+static constexpr unsigned int testNumberOfRecords = 1000;
+
+static std::string journalFileName(unsigned int fileIndex)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "snapshotStateJournal.%03u", fileIndex);
+    return name;
+}
+
+static void removeJournalFiles()
+{
+    for (unsigned int i = 0; i < 4; ++i)
+        remove(journalFileName(i).c_str());
+}
+
+struct TestJournalState
+{
+    std::vector<unsigned char> records = std::vector<unsigned char>(testNumberOfRecords * testRecordSize);
+    std::vector<unsigned char> pages = std::vector<unsigned char>(20 * TestStateJournal::pageSize);
+    std::vector<unsigned char> small = std::vector<unsigned char>(5000);
+
+    void registerRegions(TestStateJournal& journal, unsigned long long* changeFlags)
+    {
+        EXPECT_TRUE(journal.registerRegion(0, records.data(), records.size(), false, changeFlags, 0, testRecordSize));
+        EXPECT_TRUE(journal.registerRegion(1, pages.data(), pages.size(), true));
+        EXPECT_TRUE(journal.registerRegion(2, small.data(), small.size(), true));
+    }
+
+    // Copy content without changing the registered buffers
+    void assign(const TestJournalState& other)
+    {
+        memcpy(records.data(), other.records.data(), records.size());
+        memcpy(pages.data(), other.pages.data(), pages.size());
+        memcpy(small.data(), other.small.data(), small.size());
+    }
+
+    bool operator==(const TestJournalState& other) const
+    {
+        return records == other.records && pages == other.pages && small == other.small;
+    }
+};
+
+// Change some records and bytes of the state and add the changes to the current frame
+static void processTestTick(TestStateJournal& journal, TestJournalState& state, std::mt19937_64& gen64, std::set<unsigned int>& changedRecords)
+{
+    for (int i = 0; i < 5; ++i)
+    {
+        const unsigned int recordIndex = gen64() % testNumberOfRecords;
+        for (unsigned int j = 0; j < testRecordSize; ++j)
+            state.records[recordIndex * testRecordSize + j] = (unsigned char)gen64();
+        journal.addRecord(0, recordIndex * testRecordSize, &state.records[recordIndex * testRecordSize], testRecordSize);
+        changedRecords.insert(recordIndex);
+    }
+    for (int i = 0; i < 3; ++i)
+        state.pages[gen64() % state.pages.size()] ^= 1 + gen64() % 255;
+    state.small[state.small.size() - 1 - gen64() % 100] ^= 1 + gen64() % 255;
+    journal.addChangedPages(1);
+    journal.addChangedPages(2);
+}
+
+TEST(TestCoreStateJournal, JournalAndReplay)
+{
+    frequency = 1000000000; // for timing in log messages
+    removeJournalFiles();
+
+    auto journal = std::make_unique<TestStateJournal>();
+    ASSERT_TRUE(journal->init(1 << 20, 1 << 20, 0));
+    std::vector<unsigned long long> changeFlags((testNumberOfRecords + 63) / 64);
+    TestJournalState state;
+    state.registerRegions(*journal, changeFlags.data());
+
+    std::mt19937_64 gen64(42);
+    for (auto& byte : state.records)
+        byte = (unsigned char)gen64();
+    for (auto& byte : state.pages)
+        byte = (unsigned char)gen64();
+    TestJournalState snapshot;
+    snapshot.assign(state);
+
+    // Journal ticks after the snapshot, writing groups of frames
+    std::set<unsigned int> changedRecords;
+    EXPECT_TRUE(journal->start(123, 1000, nullptr));
+    EXPECT_TRUE(journal->isActive());
+    for (unsigned int tick = 1000; tick < 1020; ++tick)
+    {
+        journal->beginFrame(tick);
+        EXPECT_TRUE(journal->isFrameOpen());
+        processTestTick(*journal, state, gen64, changedRecords);
+        journal->commitFrame();
+        if (tick % 5 == 0)
+            journal->writeCommittedFrames();
+    }
+    journal->stop();
+    EXPECT_FALSE(journal->isActive());
+    const unsigned long long firstJournalId = journal->journalId();
+
+    // Recover from snapshot and journal
+    TestJournalState expected;
+    expected.assign(state);
+    state.assign(snapshot);
+    unsigned int tick = 1000, fileIndex = 99;
+    unsigned long long previousJournalId = 0;
+    EXPECT_EQ(journal->replay(123, tick, nullptr, fileIndex, previousJournalId), 20);
+    EXPECT_EQ(tick, 1020);
+    EXPECT_EQ(fileIndex, 1);
+    EXPECT_EQ(previousJournalId, firstJournalId);
+    EXPECT_TRUE(state == expected);
+    for (unsigned int i = 0; i < testNumberOfRecords; ++i)
+        EXPECT_EQ((changeFlags[i >> 6] >> (i & 63)) & 1, changedRecords.count(i));
+
+    // Continue chain in second file, crash while writing last frame
+    EXPECT_TRUE(journal->start(123, tick, nullptr, fileIndex, previousJournalId));
+    EXPECT_EQ(journal->fileIndex(), 1);
+    for (; tick < 1025; ++tick)
+    {
+        if (tick == 1024)
+            expected.assign(state);
+        journal->beginFrame(tick);
+        processTestTick(*journal, state, gen64, changedRecords);
+        journal->commitFrame();
+    }
+    journal->stop();
+    {
+        const std::string fileName = journalFileName(1);
+        FILE* file = fopen(fileName.c_str(), "rb");
+        ASSERT_TRUE(file != nullptr);
+        std::vector<unsigned char> data(1 << 20);
+        data.resize(fread(data.data(), 1, data.size(), file));
+        fclose(file);
+        file = fopen(fileName.c_str(), "wb");
+        ASSERT_TRUE(file != nullptr);
+        fwrite(data.data(), 1, data.size() - 10, file);
+        fclose(file);
+    }
+    state.assign(snapshot);
+    tick = 1000;
+    EXPECT_EQ(journal->replay(123, tick, nullptr, fileIndex, previousJournalId), 24);
+    EXPECT_EQ(tick, 1024);
+    EXPECT_EQ(fileIndex, 2);
+    EXPECT_TRUE(state == expected);
+
+    // Journal of other epoch or snapshot is ignored
+    tick = 1000;
+    EXPECT_EQ(journal->replay(124, tick, nullptr, fileIndex, previousJournalId), 0);
+    EXPECT_EQ(tick, 1000);
+    EXPECT_EQ(fileIndex, 0);
+    EXPECT_EQ(previousJournalId, 0);
+    tick = 999;
+    EXPECT_EQ(journal->replay(123, tick, nullptr, fileIndex, previousJournalId), 0);
+    EXPECT_EQ(fileIndex, 0);
+
+    // New snapshot starts new chain, second file of old chain is ignored
+    EXPECT_TRUE(journal->start(123, 1024, nullptr));
+    journal->beginFrame(1024);
+    processTestTick(*journal, state, gen64, changedRecords);
+    journal->commitFrame();
+    journal->stop();
+    tick = 1024;
+    EXPECT_EQ(journal->replay(123, tick, nullptr, fileIndex, previousJournalId), 1);
+    EXPECT_EQ(tick, 1025);
+    EXPECT_EQ(fileIndex, 1);
+
+    journal->deinit();
+    removeJournalFiles();
+}
+
+TEST(TestCoreStateJournal, SuspendWhenFull)
+{
+    frequency = 1000000000; // for timing in log messages
+    removeJournalFiles();
+
+    // Long commit period, so frames are only written when ring buffer is a quarter full or journal is suspended
+    auto journal = std::make_unique<TestStateJournal>();
+    ASSERT_TRUE(journal->init(8192, 1 << 15, 1000000));
+    std::vector<unsigned char> data(16 * TestStateJournal::pageSize);
+    EXPECT_TRUE(journal->registerRegion(0, data.data(), data.size(), true));
+
+    // Frames wrap around in the ring buffer if it is written regularly
+    EXPECT_TRUE(journal->start(7, 0, nullptr));
+    for (unsigned int tick = 0; tick < 20; ++tick)
+    {
+        journal->beginFrame(tick);
+        data[tick] = (unsigned char)tick;
+        journal->addRecord(0, 0, data.data(), 5000 + tick);
+        journal->commitFrame();
+        journal->writeCommittedFrames();
+    }
+    EXPECT_TRUE(journal->isActive());
+    journal->stop();
+    const std::vector<unsigned char> expected = data;
+    memset(data.data(), 0, data.size());
+    unsigned int replayTick = 0, fileIndex;
+    unsigned long long previousJournalId;
+    EXPECT_EQ(journal->replay(7, replayTick, nullptr, fileIndex, previousJournalId), 20);
+    EXPECT_TRUE(data == expected);
+
+    // Frames that don't fit into the ring buffer suspend journaling, frames committed before are kept
+    EXPECT_TRUE(journal->start(7, 100, nullptr));
+    unsigned int tick = 100;
+    while (journal->isActive())
+    {
+        journal->beginFrame(tick);
+        journal->addRecord(0, 0, data.data(), 6000);
+        journal->commitFrame();
+        if (journal->isActive())
+            ++tick;
+    }
+    EXPECT_GT(tick, 100u + 2);
+    journal->writeCommittedFrames();
+    replayTick = 100;
+    EXPECT_EQ(journal->replay(7, replayTick, nullptr, fileIndex, previousJournalId), tick - 100);
+
+    // Tick without journal is not recorded
+    journal->beginFrame(tick);
+    EXPECT_FALSE(journal->isFrameOpen());
+
+    // Changes of one tick that exceed the frame buffer suspend journaling
+    EXPECT_TRUE(journal->start(7, 200, nullptr));
+    journal->beginFrame(200);
+    for (auto& byte : data)
+        ++byte;
+    journal->addChangedPages(0);
+    journal->commitFrame();
+    EXPECT_FALSE(journal->isActive());
+    journal->writeCommittedFrames();
+    replayTick = 200;
+    EXPECT_EQ(journal->replay(7, replayTick, nullptr, fileIndex, previousJournalId), 0);
+
+    // Explicit suspension discards the open frame
+    EXPECT_TRUE(journal->start(7, 300, nullptr));
+    journal->beginFrame(300);
+    journal->addRecord(0, 0, data.data(), 100);
+    journal->suspend(L"test");
+    journal->commitFrame();
+    journal->writeCommittedFrames();
+    replayTick = 300;
+    EXPECT_EQ(journal->replay(7, replayTick, nullptr, fileIndex, previousJournalId), 0);
+
+    journal->deinit();
+    removeJournalFiles();
+}
+
+// Reset spectrum to state before tick 1000: one rich entity and dust filling the hash map up to just below the
+// anti-dust limit (deterministic, so the state can be restored without keeping a copy)
+static void fillSpectrumWithDust(unsigned int antiDustLimit)
+{
+    memset(spectrum, 0, spectrumSizeInBytes);
+    updateSpectrumInfo();
+    updateSpectrumFingerprints();
+    std::mt19937_64 gen64(42);
+    system.tick = 999;
+    increaseEnergy(m256i(1, 2, 3, 4), 1000000000000LL);
+    while (spectrumInfo.numberOfEntities < antiDustLimit - 10)
+        increaseEnergy(m256i(gen64(), gen64(), gen64(), gen64()), 1 + gen64() % 10);
+}
+
+// Add spectrum slots changed in tick to the current frame, like processTick()
+static void journalChangedSpectrumSlots(StateJournal<1>& journal, unsigned int tick)
+{
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        if (spectrum[i].latestIncomingTransferTick == tick || spectrum[i].latestOutgoingTransferTick == tick)
+            journal.addRecord(0, i * sizeof(::Entity), &spectrum[i], sizeof(::Entity));
+    }
+}
+
+static m256i getSpectrumRootDigest()
+{
+    computeSpectrumDigests();
+    return spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+}
+
+TEST(TestCoreStateJournal, SuspendOnSpectrumReorganization)
+{
+    frequency = 1000000000; // for timing in log messages
+    removeJournalFiles();
+    ASSERT_TRUE(initSpectrum());
+    ASSERT_TRUE(initCommonBuffers());
+    const unsigned int antiDustLimit = (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4);
+    fillSpectrumWithDust(antiDustLimit);
+
+    auto journal = std::make_unique<StateJournal<1>>();
+    ASSERT_TRUE(journal->init(1 << 20, 1 << 20, 0));
+    EXPECT_TRUE(journal->registerRegion(0, spectrum, spectrumSizeInBytes, false));
+    journal->watchRewrites(0, &spectrumReorgCount, L"spectrum reorganized by anti-dust burning");
+    EXPECT_TRUE(journal->start(7, 1000, nullptr));
+
+    // Tick with a few transfers is journaled
+    std::mt19937_64 gen64(123);
+    const m256i richId(1, 2, 3, 4);
+    system.tick = 1000;
+    journal->beginFrame(system.tick);
+    for (int i = 0; i < 5; ++i)
+    {
+        EXPECT_TRUE(decreaseEnergy(spectrumIndex(richId), 1000));
+        increaseEnergy(m256i(gen64(), gen64(), gen64(), gen64()), 1000);
+    }
+    journalChangedSpectrumSlots(*journal, system.tick);
+    journal->commitFrame();
+    EXPECT_TRUE(journal->isActive());
+    const m256i liveDigest = getSpectrumRootDigest();
+    const SpectrumInfo liveInfo = spectrumInfo;
+
+    // Tick burning dust in the middle moves entities without updating their transfer ticks, so it suspends the
+    // journal instead of committing a frame that cannot restore the live spectrum
+    system.tick = 1001;
+    journal->beginFrame(system.tick);
+    const unsigned int reorgCount = spectrumReorgCount;
+    while (spectrumReorgCount == reorgCount)
+        increaseEnergy(m256i(gen64(), gen64(), gen64(), gen64()), 1);
+    EXPECT_LT(spectrumInfo.numberOfEntities, antiDustLimit);
+    journalChangedSpectrumSlots(*journal, system.tick);
+    journal->commitFrame();
+    EXPECT_FALSE(journal->isActive());
+    journal->writeCommittedFrames();
+
+    // Recovery replays the ticks before the burning, which match the live spectrum and digest after tick 1000
+    fillSpectrumWithDust(antiDustLimit);
+    unsigned int tick = 1000, fileIndex;
+    unsigned long long previousJournalId;
+    EXPECT_EQ(journal->replay(7, tick, nullptr, fileIndex, previousJournalId), 1);
+    EXPECT_EQ(tick, 1001);
+    updateSpectrumFingerprints();
+    updateSpectrumInfo();
+    EXPECT_EQ(spectrumInfo.numberOfEntities, liveInfo.numberOfEntities);
+    EXPECT_EQ(spectrumInfo.totalAmount, liveInfo.totalAmount);
+    EXPECT_TRUE(getSpectrumRootDigest() == liveDigest);
+
+    journal->deinit();
+    deinitCommonBuffers();
+    deinitSpectrum();
+    removeJournalFiles();
+}
@@ -0,0 +1,113 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/ticking/tick_profiler.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+
+TEST(TestCoreTickProfiler, HistogramBuckets)
+{
+    // Small values have own bucket
+    for (unsigned long long v = 0; v < CycleHistogram::subBucketCount; ++v)
+    {
+        EXPECT_EQ(CycleHistogram::bucketIndex(v), v);
+        EXPECT_EQ(CycleHistogram::bucketUpperBound((unsigned int)v), v);
+    }
+
+    // Buckets are consecutive, upper bound is in bucket and next value is in next bucket
+    unsigned int lastIndex = CycleHistogram::bucketIndex(CycleHistogram::subBucketCount - 1);
+    for (unsigned int i = lastIndex + 1; i < CycleHistogram::bucketCount; ++i)
+    {
+        const unsigned long long upperBound = CycleHistogram::bucketUpperBound(i);
+        EXPECT_EQ(CycleHistogram::bucketIndex(upperBound), i);
+        EXPECT_EQ(CycleHistogram::bucketIndex(CycleHistogram::bucketUpperBound(i - 1) + 1), i);
+    }
+    EXPECT_EQ(CycleHistogram::bucketUpperBound(CycleHistogram::bucketCount - 1), 0xffffffffffffffffULL);
+    EXPECT_EQ(CycleHistogram::bucketIndex(0xffffffffffffffffULL), CycleHistogram::bucketCount - 1);
+
+    // Relative error of bucket upper bound is small
+    std::mt19937_64 gen64(42);
+    for (int i = 0; i < 10000; ++i)
+    {
+        const unsigned long long value = gen64() >> (gen64() % 64);
+        const unsigned long long upperBound = CycleHistogram::bucketUpperBound(CycleHistogram::bucketIndex(value));
+        EXPECT_GE(upperBound, value);
+        EXPECT_LE(upperBound - value, value >> CycleHistogram::subBucketBits);
+    }
+}
+
+TEST(TestCoreTickProfiler, HistogramPercentiles)
+{
+    auto histogram = std::make_unique<CycleHistogram>();
+    histogram->reset();
+    EXPECT_EQ(histogram->percentile(500), 0);
+    EXPECT_EQ(histogram->percentile(990), 0);
+
+    std::mt19937_64 gen64(123);
+    std::vector<unsigned long long> values;
+    for (int i = 0; i < 10000; ++i)
+    {
+        values.push_back(gen64() % 100000000);
+        histogram->record(values.back());
+    }
+    std::sort(values.begin(), values.end());
+    EXPECT_EQ(histogram->count, values.size());
+    EXPECT_EQ(histogram->max, values.back());
+    EXPECT_EQ(histogram->percentile(1000), values.back());
+
+    for (unsigned int permille : { 1u, 100u, 500u, 900u, 990u, 999u })
+    {
+        const unsigned long long exact = values[(values.size() * permille + 999) / 1000 - 1];
+        const unsigned long long approx = histogram->percentile(permille);
+        EXPECT_GE(approx, exact);
+        EXPECT_LE(approx - exact, exact >> CycleHistogram::subBucketBits);
+    }
+}
+
+TEST(TestCoreTickProfiler, EpochProfiles)
+{
+    auto profiler = std::make_unique<TickProfiler>();
+    profiler->reset();
+    auto response = std::make_unique<SpecialCommandGetTickProfileResponse>();
+
+    for (unsigned short epoch = 100; epoch < 103; ++epoch)
+    {
+        for (int tick = 0; tick < epoch; ++tick)
+        {
+            profiler->beginTick(epoch);
+            profiler->endPhase(epoch, TICK_PROFILE_PHASE_BEGIN_TICK);
+            if (tick % 2)
+                profiler->endPhase(epoch, TICK_PROFILE_PHASE_TRANSACTIONS);
+            profiler->endTick(epoch);
+        }
+
+        // Current and previous epoch are available
+        profiler->getStats(epoch, *response);
+        EXPECT_EQ(response->epoch, epoch);
+        EXPECT_EQ(response->phases[TICK_PROFILE_PHASE_TOTAL].count, epoch);
+        EXPECT_EQ(response->phases[TICK_PROFILE_PHASE_BEGIN_TICK].count, epoch);
+        EXPECT_EQ(response->phases[TICK_PROFILE_PHASE_TRANSACTIONS].count, epoch / 2);
+        EXPECT_EQ(response->phases[TICK_PROFILE_PHASE_SOLUTIONS].count, 0);
+        EXPECT_LE(response->phases[TICK_PROFILE_PHASE_TOTAL].p50, response->phases[TICK_PROFILE_PHASE_TOTAL].p99);
+        EXPECT_LE(response->phases[TICK_PROFILE_PHASE_TOTAL].p99, response->phases[TICK_PROFILE_PHASE_TOTAL].max);
+
+        if (epoch > 100)
+        {
+            profiler->getStats(epoch - 1, *response);
+            EXPECT_EQ(response->epoch, epoch - 1);
+            EXPECT_EQ(response->phases[TICK_PROFILE_PHASE_TOTAL].count, epoch - 1);
+        }
+
+        // Older and future epochs are not
+        profiler->getStats(epoch - 2, *response);
+        EXPECT_EQ(response->epoch, 0);
+        EXPECT_EQ(response->phases[TICK_PROFILE_PHASE_TOTAL].count, 0);
+        profiler->getStats(epoch + 1, *response);
+        EXPECT_EQ(response->epoch, 0);
+    }
+}
@@ -7,9 +7,14 @@
 #define MAX_NUMBER_OF_TICKS_PER_EPOCH 50
 #undef TICKS_TO_KEEP_FROM_PRIOR_EPOCH
 #define TICKS_TO_KEEP_FROM_PRIOR_EPOCH 5
+#undef TICK_STORAGE_AUTOSAVE_MODE
+#define TICK_STORAGE_AUTOSAVE_MODE 1
 #include "../src/ticking/tick_storage.h"
 
 #include <random>
+#include <cstdio>
+#include <string>
+#include <vector>
 
 
 class TestTickStorage : public TickStorage
@@ -208,3 +213,120 @@ TEST(TestCoreTickStorage, EpochTransition) {
         ts.deinit();
     }
 }
+
+static std::string snapshotSegmentFileName(const char* prefix, unsigned short epoch, unsigned int segmentIndex)
+{
+    char name[64];
+    sprintf(name, "%s.%03u.%03u", prefix, (unsigned int)epoch, segmentIndex);
+    return name;
+}
+
+static void removeSnapshotFiles(unsigned short epoch)
+{
+    char name[64];
+    sprintf(name, "snapshotMetadata.%03u", (unsigned int)epoch);
+    remove(name);
+    for (unsigned int segmentIndex = 0; segmentIndex < 4; ++segmentIndex)
+    {
+        for (const char* prefix : { "snapshotTickdata", "snapshotTicks", "snapshotTickTransactionOffsets", "snapshotTickTransaction" })
+            remove(snapshotSegmentFileName(prefix, epoch, segmentIndex).c_str());
+    }
+}
+
+static bool fileExists(const std::string& name)
+{
+    FILE* file = fopen(name.c_str(), "rb");
+    if (!file)
+        return false;
+    fclose(file);
+    return true;
+}
+
+TEST(TestCoreTickStorage, SnapshotSegments) {
+    const unsigned short epoch = 123;
+    const unsigned int tick0 = 4567;
+    const unsigned short maxTransactions = NUMBER_OF_TRANSACTIONS_PER_TICK;
+    unsigned int seeds[MAX_NUMBER_OF_TICKS_PER_EPOCH];
+    std::mt19937 gen32(42);
+    for (int i = 0; i < MAX_NUMBER_OF_TICKS_PER_EPOCH; ++i)
+        seeds[i] = gen32();
+    removeSnapshotFiles(epoch);
+
+    ts.init();
+    ts.beginEpoch(tick0);
+    ts.initMetaData(epoch);
+
+    // first save writes segment 0 with all ticks before the current tick
+    for (int i = 0; i < 20; ++i)
+        addTick(tick0 + i, seeds[i], maxTransactions);
+    EXPECT_EQ(ts.trySaveToFile(epoch, tick0 + 20), 0);
+    EXPECT_TRUE(fileExists(snapshotSegmentFileName("snapshotTicks", epoch, 0)));
+    EXPECT_FALSE(fileExists(snapshotSegmentFileName("snapshotTicks", epoch, 1)));
+
+    // next save only appends new ticks as segment 1 (ticks added while the segment is written in the background
+    // are not part of it)
+    for (int i = 20; i < 35; ++i)
+        addTick(tick0 + i, seeds[i], maxTransactions);
+    EXPECT_EQ(ts.beginSaveToFile(epoch, tick0 + 35), 0);
+    for (int i = 35; i < 46; ++i)
+        addTick(tick0 + i, seeds[i], maxTransactions);
+    EXPECT_EQ(ts.finishSaveToFile(), 0);
+    EXPECT_TRUE(fileExists(snapshotSegmentFileName("snapshotTicks", epoch, 1)));
+
+    // saving after invalidation without new ticks only restores the meta data
+    EXPECT_TRUE(ts.saveInvalidateData(epoch));
+    EXPECT_EQ(ts.trySaveToFile(epoch, tick0 + 35), 0);
+    EXPECT_FALSE(fileExists(snapshotSegmentFileName("snapshotTicks", epoch, 2)));
+
+    // saving after invalidation continues with next segment
+    EXPECT_TRUE(ts.saveInvalidateData(epoch));
+    EXPECT_EQ(ts.trySaveToFile(epoch, tick0 + 45), 0);
+    EXPECT_TRUE(fileExists(snapshotSegmentFileName("snapshotTicks", epoch, 2)));
+    ts.deinit();
+
+    // load replays all segments
+    ts.init();
+    ts.beginEpoch(tick0);
+    EXPECT_EQ(ts.tryLoadFromFile(epoch, nullptr), 0);
+    EXPECT_EQ(ts.getPreloadTick(), tick0 + 44);
+    ts.checkStateConsistencyWithAssert();
+    for (int i = 0; i < 45; ++i)
+        checkTick(tick0 + i, seeds[i], maxTransactions);
+
+    // current tick at time of saving is not part of the snapshot
+    EXPECT_EQ((int)ts.tickData.getByTickInCurrentEpoch(tick0 + 45).epoch, 0);
+    EXPECT_EQ((int)ts.ticks.getByTickInCurrentEpoch(tick0 + 45)[0].epoch, 0);
+    ts.deinit();
+
+    // corrupted segment is detected (rewrite segment file uncompressed with one byte changed)
+    const std::string segmentFileNameNarrow = snapshotSegmentFileName("snapshotTicks", epoch, 1);
+    CHAR16 segmentFileName[64];
+    for (unsigned int i = 0; i <= segmentFileNameNarrow.size(); ++i)
+        segmentFileName[i] = segmentFileNameNarrow.c_str()[i];
+    std::vector<unsigned char> segmentData(15ULL * NUMBER_OF_COMPUTORS * sizeof(Tick));
+    EXPECT_EQ(loadCompressed(segmentFileName, segmentData.size(), segmentData.data()), (long long)segmentData.size());
+    segmentData[100] ^= 0xff;
+    EXPECT_EQ(save(segmentFileName, segmentData.size(), segmentData.data()), (long long)segmentData.size());
+    ts.init();
+    ts.beginEpoch(tick0);
+    EXPECT_EQ(ts.tryLoadFromFile(epoch, nullptr), 4);
+    ts.deinit();
+    segmentData[100] ^= 0xff;
+    EXPECT_EQ(save(segmentFileName, segmentData.size(), segmentData.data()), (long long)segmentData.size());
+
+    // missing segment is detected
+    remove(snapshotSegmentFileName("snapshotTickdata", epoch, 2).c_str());
+    ts.init();
+    ts.beginEpoch(tick0);
+    EXPECT_EQ(ts.tryLoadFromFile(epoch, nullptr), 3);
+    ts.deinit();
+
+    // invalidated snapshot is not loaded
+    EXPECT_TRUE(ts.saveInvalidateData(epoch));
+    ts.init();
+    ts.beginEpoch(tick0);
+    EXPECT_EQ(ts.tryLoadFromFile(epoch, nullptr), 1);
+    ts.deinit();
+
+    removeSnapshotFiles(epoch);
+}